@@ -0,0 +1,218 @@
+/*
+ * Particle attribute buffers implementation. See attribute_buffers.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <GLXW/glxw.h>
+
+#include "attribute_buffers.h"
+#include "programs.h"
+
+#include "shaders/attributes_vs.glsl"
+
+static unsigned int attribute_gl_format(int format) {
+	switch (format) {
+		case ATTRIBUTE_FORMAT_R32F: return GL_R32F;
+		case ATTRIBUTE_FORMAT_R32UI: return GL_R32UI;
+		case ATTRIBUTE_FORMAT_RG32UI: return GL_RG32UI;
+		default: return GL_RGBA32F;
+	}
+}
+
+template <class layout>
+attribute_buffers<layout>::attribute_buffers(void) {
+	initialized = false;
+	particle_capacity = 0;
+
+	memset(buffers, 0, sizeof buffers);
+	memset(textures, 0, sizeof textures);
+	memset(current, 0, sizeof current);
+
+	update_program = 0;
+	update_age_step_loc = -1;
+
+	layout::plan(0, &streams_plan);
+}
+
+template <class layout>
+attribute_buffers<layout>::~attribute_buffers(void) {
+	shutdown();
+}
+
+template <class layout>
+bool attribute_buffers<layout>::initialize(unsigned int set, unsigned int capacity, const particle_attributes* initial) {
+	layout::plan(set, &streams_plan);
+	particle_capacity = capacity;
+
+	/* Encoded on the CPU with the same codec the shaders use, one staging area per stream. */
+	std::vector<unsigned char> staging[ATTRIBUTES];
+	unsigned char* streams[ATTRIBUTES] = {NULL};
+
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		staging[s].resize((size_t) capacity * streams_plan.streams[s].bytes);
+		streams[s] = staging[s].data();
+	}
+
+	particle_attributes defaults;
+	attributes_defaults(&defaults);
+
+	for (unsigned int i = 0; i < capacity && streams_plan.stream_count; i++) {
+		layout::store(&streams_plan, streams, i, initial ? &initial[i] : &defaults);
+	}
+
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		const attribute_stream* stream = &streams_plan.streams[s];
+		int copies = stream->written ? 2 : 1;
+
+		glGenBuffers(copies, buffers[s]);
+		glGenTextures(copies, textures[s]);
+
+		for (int c = 0; c < copies; c++) {
+			glBindBuffer(GL_ARRAY_BUFFER, buffers[s][c]);
+			glBufferData(GL_ARRAY_BUFFER, staging[s].size(), staging[s].data(), stream->written ? GL_DYNAMIC_COPY : GL_STATIC_DRAW);
+
+			glBindTexture(GL_TEXTURE_BUFFER, textures[s][c]);
+			glTexBuffer(GL_TEXTURE_BUFFER, attribute_gl_format(stream->format), buffers[s][c]);
+		}
+
+		current[s] = 0;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	initialized = true;
+
+	if (streams_plan.varying_count) {
+		std::string source = streams_plan.load_glsl + streams_plan.store_glsl;
+
+		update_program = start_program_feedback(NULL, SHADER_ATTRIBUTES_VS, NULL, NULL, streams_plan.varyings, streams_plan.varying_count,
+			streams_plan.separate, source.c_str());
+
+		if (!finish_program("attributes", update_program)) {
+			update_program = 0;
+			return false;
+		}
+
+		update_age_step_loc = glGetUniformLocation(update_program, "attribute_age_step");
+	}
+
+	if (glGetError() != GL_NO_ERROR) {
+		printf("[attribute_buffers] GL error while creating %s streams for %u particles\n", layout::name(), capacity);
+		return false;
+	}
+
+	printf("[attribute_buffers] %s : %d streams, %u bytes per particle, %u moved per particle by the update\n", layout::name(), streams_plan.stream_count,
+		streams_plan.bytes, streams_plan.update_bytes);
+
+	return true;
+}
+
+template <class layout>
+void attribute_buffers<layout>::shutdown(void) {
+	if (!initialized) {
+		return;
+	}
+
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		int copies = streams_plan.streams[s].written ? 2 : 1;
+
+		glDeleteBuffers(copies, buffers[s]);
+		glDeleteTextures(copies, textures[s]);
+	}
+
+	if (update_program) {
+		glDeleteProgram(update_program);
+		update_program = 0;
+	}
+
+	memset(buffers, 0, sizeof buffers);
+	memset(textures, 0, sizeof textures);
+	initialized = false;
+}
+
+template <class layout>
+void attribute_buffers<layout>::update(unsigned int count, float age_step, int first_unit) {
+	if (!update_program || !count) {
+		return;
+	}
+
+	count = count < particle_capacity ? count : particle_capacity;
+
+	glUseProgram(update_program);
+	glUniform1f(update_age_step_loc, age_step);
+	set_uniforms(update_program, first_unit);
+	bind(first_unit);
+
+	/* The written streams in the order of their varyings, each into the copy it isn't being read from. */
+	int binding = 0;
+
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		const attribute_stream* stream = &streams_plan.streams[s];
+
+		if (!stream->written) {
+			continue;
+		}
+
+		unsigned int target = buffers[s][1 - current[s]];
+
+		/* Particles past count aren't aged, but must come along to the other copy. */
+		if (count < particle_capacity) {
+			glBindBuffer(GL_COPY_READ_BUFFER, buffers[s][current[s]]);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t) count * stream->bytes, (size_t) count * stream->bytes,
+				(size_t) (particle_capacity - count) * stream->bytes);
+		}
+
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, binding++, target, 0, (size_t) count * stream->bytes);
+	}
+
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	glEndTransformFeedback();
+
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		if (streams_plan.streams[s].written) {
+			current[s] = 1 - current[s];
+		}
+	}
+
+	bind(first_unit); // The new copies, for whatever draws next.
+	glActiveTexture(GL_TEXTURE0);
+}
+
+template <class layout>
+void attribute_buffers<layout>::bind(int first_unit) const {
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		glActiveTexture(GL_TEXTURE0 + first_unit + s);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[s][current[s]]);
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+template <class layout>
+void attribute_buffers<layout>::set_uniforms(unsigned int program, int first_unit) const {
+	char name[32];
+
+	for (int s = 0; s < streams_plan.stream_count; s++) {
+		snprintf(name, sizeof name, "attribute_stream_%d", s);
+		glUniform1i(glGetUniformLocation(program, name), first_unit + s);
+	}
+}
+
+template <class layout>
+const attribute_plan* attribute_buffers<layout>::plan(void) const {
+	return &streams_plan;
+}
+
+template class attribute_buffers<attribute_layout_aos>;
+template class attribute_buffers<attribute_layout_soa>;
+template class attribute_buffers<attribute_layout_packed>;
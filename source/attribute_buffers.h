@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * GL side of the particle attributes (see attributes.h) : a buffer and texture buffer per stream of the layout's plan, and the transform
+ *	feedback pass that ages them. The layout is a template parameter, so a build only carries the one it picked, and is explicitly
+ *	instantiated for the three in attribute_buffers.cpp.
+ *
+ * Streams are indexed by particle like the state, so anything that reorders particles (sleeping, the CPU engine's neighbor sort) would
+ *	leave them behind. Written streams are double buffered and swap on every update(), the others are uploaded once and only read.
+ */
+
+#include "attributes.h"
+
+template <class layout>
+class attribute_buffers {
+public:
+	attribute_buffers(void);
+	~attribute_buffers(void); // Calls shutdown(), the context must still be current if it was initialized.
+
+	attribute_buffers(const attribute_buffers&) = delete; // Owns GL objects.
+	attribute_buffers& operator=(const attribute_buffers&) = delete;
+
+	/* initial is capacity particles, NULL starts them all at the defaults. Builds the update program too, when the set has an age. */
+	bool initialize(unsigned int set, unsigned int capacity, const particle_attributes* initial);
+	void shutdown(void);
+
+	/* Ages the first count particles by age_step. Binds the streams on first_unit and up on the way. */
+	void update(unsigned int count, float age_step, int first_unit);
+
+	/* Stream n goes on texture unit first_unit + n, set_uniforms() points a program's attribute_stream_<n> samplers there. */
+	void bind(int first_unit) const;
+	void set_uniforms(unsigned int program, int first_unit) const;
+
+	const attribute_plan* plan(void) const;
+
+private:
+	bool initialized;
+	attribute_plan streams_plan;
+	unsigned int particle_capacity;
+
+	unsigned int buffers[ATTRIBUTES][2];
+	unsigned int textures[ATTRIBUTES][2];
+	int current[ATTRIBUTES];
+
+	unsigned int update_program;
+	int update_age_step_loc;
+};
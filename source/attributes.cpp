@@ -0,0 +1,457 @@
+/*
+ * Particle attribute layouts implementation. See attributes.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "attributes.h"
+
+static const char* attribute_names[ATTRIBUTES] = {"color", "size", "age", "sprite"};
+static const char* attribute_defines[ATTRIBUTES] = {"ATTRIBUTE_COLOR", "ATTRIBUTE_SIZE", "ATTRIBUTE_AGE", "ATTRIBUTE_SPRITE"};
+
+const char* attributes_name(int attribute) {
+	return attribute >= 0 && attribute < ATTRIBUTES ? attribute_names[attribute] : "unknown";
+}
+
+void attributes_defaults(particle_attributes* attributes) {
+	for (int i = 0; i < 4; i++) {
+		attributes->color[i] = 1.0f;
+	}
+
+	attributes->size = 1.0f;
+	attributes->age = 0.0f;
+	attributes->sprite = -1.0f;
+}
+
+void attributes_generate(particle_attributes* attributes, unsigned int count, unsigned int seed, int sprites) {
+	unsigned int state = seed * 747796405u + 2891336453u;
+
+	for (unsigned int i = 0; i < count; i++) {
+		float random[3];
+
+		for (int r = 0; r < 3; r++) {
+			state = state * 1664525u + 1013904223u;
+			random[r] = (float) (state >> 8) / 16777216.0f;
+		}
+
+		/* Hues around the wheel, full saturation. */
+		float hue = random[0] * 6.0f;
+
+		attributes[i].color[0] = fminf(fmaxf(fabsf(hue - 3.0f) - 1.0f, 0.0f), 1.0f);
+		attributes[i].color[1] = fminf(fmaxf(2.0f - fabsf(hue - 2.0f), 0.0f), 1.0f);
+		attributes[i].color[2] = fminf(fmaxf(2.0f - fabsf(hue - 4.0f), 0.0f), 1.0f);
+		attributes[i].color[3] = 1.0f;
+		attributes[i].size = 0.5f + random[1];
+		attributes[i].age = 0.0f;
+		attributes[i].sprite = (float) ((unsigned int) (random[2] * (float) sprites) % (unsigned int) (sprites > 0 ? sprites : 1));
+	}
+}
+
+static void attributes_common_glsl(unsigned int set, std::string* glsl) {
+	/* Every layout reads into the same struct, with the defaults for what the set leaves out. */
+	for (int attribute = 0; attribute < ATTRIBUTES; attribute++) {
+		if (set & (1u << attribute)) {
+			*glsl += "#define ";
+			*glsl += attribute_defines[attribute];
+			*glsl += "\n";
+		}
+	}
+
+	*glsl += "struct particle_attributes { vec4 color; float size; float age; float sprite; };\n";
+
+	/* Only the packed layout quantizes sizes into range, the render pass clamps the others so the cull margin stays a bound. */
+	char line[64];
+	snprintf(line, sizeof line, "const float attribute_size_max = %.9f;\n", ATTRIBUTE_SIZE_MAX);
+	*glsl += line;
+}
+
+static void attributes_begin_plan(unsigned int set, attribute_plan* plan) {
+	plan->set = set & ATTRIBUTE_ALL_BITS;
+	plan->stream_count = 0;
+	plan->separate = false;
+	plan->varying_count = 0;
+	plan->load_glsl.clear();
+	plan->store_glsl.clear();
+	plan->bytes = 0;
+	plan->update_bytes = 0;
+
+	for (int attribute = 0; attribute < ATTRIBUTES; attribute++) {
+		plan->offsets[attribute] = -1;
+	}
+
+	attributes_common_glsl(plan->set, &plan->load_glsl);
+	plan->load_glsl += "particle_attributes load_attributes(int index) {\n";
+	plan->load_glsl += "\tparticle_attributes attributes = particle_attributes(vec4(1.0f), 1.0f, 0.0f, -1.0f);\n";
+}
+
+static void attributes_end_plan(attribute_plan* plan) {
+	plan->load_glsl += "\treturn attributes;\n}\n";
+
+	for (int i = 0; i < plan->stream_count; i++) {
+		plan->bytes += plan->streams[i].bytes;
+		plan->update_bytes += plan->streams[i].written ? plan->streams[i].bytes * 2 : 0;
+	}
+
+	if (plan->varying_count) {
+		plan->store_glsl += "}\n";
+	}
+}
+
+static void attributes_add_stream(attribute_plan* plan, int format, unsigned int bytes, bool written) {
+	attribute_stream* stream = &plan->streams[plan->stream_count];
+
+	stream->format = format;
+	stream->bytes = bytes;
+	stream->written = written;
+
+	char line[80];
+	snprintf(line, sizeof line, "uniform %s attribute_stream_%d;\n", format >= ATTRIBUTE_FORMAT_R32UI ? "usamplerBuffer" : "samplerBuffer", plan->stream_count);
+
+	plan->load_glsl.insert(plan->load_glsl.find("particle_attributes load_attributes"), line);
+	plan->stream_count++;
+}
+
+/* Interleaved : [colour texel] [size, age, sprite, 0] per particle. */
+
+static bool attributes_aos_scalars(unsigned int set) {
+	return (set & (ATTRIBUTE_SIZE_BIT | ATTRIBUTE_AGE_BIT | ATTRIBUTE_SPRITE_BIT)) != 0;
+}
+
+const char* attribute_layout_aos::name(void) {
+	return "aos";
+}
+
+void attribute_layout_aos::plan(unsigned int set, attribute_plan* plan) {
+	attributes_begin_plan(set, plan);
+	set = plan->set;
+
+	bool color = (set & ATTRIBUTE_COLOR_BIT) != 0;
+	bool scalars = attributes_aos_scalars(set);
+	bool aging = (set & ATTRIBUTE_AGE_BIT) != 0;
+	int texels = (color ? 1 : 0) + (scalars ? 1 : 0);
+
+	if (!texels) {
+		attributes_end_plan(plan);
+		return;
+	}
+
+	attributes_add_stream(plan, ATTRIBUTE_FORMAT_RGBA32F, texels * 16, aging);
+
+	char line[128];
+
+	if (color) {
+		snprintf(line, sizeof line, "\tattributes.color = texelFetch(attribute_stream_0, index * %d);\n", texels);
+		plan->load_glsl += line;
+	}
+
+	if (scalars) {
+		snprintf(line, sizeof line, "\tvec4 scalars = texelFetch(attribute_stream_0, index * %d + %d);\n", texels, color ? 1 : 0);
+		plan->load_glsl += line;
+
+		if (set & ATTRIBUTE_SIZE_BIT) plan->load_glsl += "\tattributes.size = scalars.x;\n";
+		if (set & ATTRIBUTE_AGE_BIT) plan->load_glsl += "\tattributes.age = scalars.y;\n";
+		if (set & ATTRIBUTE_SPRITE_BIT) plan->load_glsl += "\tattributes.sprite = scalars.z;\n";
+	}
+
+	/* The update rewrites whole records, the texels interleave in the order of the varyings. */
+	if (aging) {
+		if (color) {
+			plan->varyings[plan->varying_count++] = "out_attribute_color";
+			plan->store_glsl += "out vec4 out_attribute_color;\n";
+		}
+
+		plan->varyings[plan->varying_count++] = "out_attribute_scalars";
+		plan->store_glsl += "out vec4 out_attribute_scalars;\n";
+		plan->store_glsl += "void store_attributes(particle_attributes attributes) {\n";
+
+		if (color) {
+			plan->store_glsl += "\tout_attribute_color = attributes.color;\n";
+		}
+
+		plan->store_glsl += "\tout_attribute_scalars = vec4(attributes.size, attributes.age, attributes.sprite, 0.0f);\n";
+	}
+
+	attributes_end_plan(plan);
+}
+
+void attribute_layout_aos::store(const attribute_plan* plan, unsigned char* const* streams, unsigned int index, const particle_attributes* attributes) {
+	if (!plan->stream_count) {
+		return;
+	}
+
+	float* record = (float*) (streams[0] + (size_t) index * plan->streams[0].bytes);
+
+	if (plan->set & ATTRIBUTE_COLOR_BIT) {
+		memcpy(record, attributes->color, sizeof(float) * 4);
+		record += 4;
+	}
+
+	if (attributes_aos_scalars(plan->set)) {
+		record[0] = attributes->size;
+		record[1] = attributes->age;
+		record[2] = attributes->sprite;
+		record[3] = 0.0f;
+	}
+}
+
+void attribute_layout_aos::load(const attribute_plan* plan, const unsigned char* const* streams, unsigned int index, particle_attributes* attributes) {
+	attributes_defaults(attributes);
+
+	if (!plan->stream_count) {
+		return;
+	}
+
+	const float* record = (const float*) (streams[0] + (size_t) index * plan->streams[0].bytes);
+
+	if (plan->set & ATTRIBUTE_COLOR_BIT) {
+		memcpy(attributes->color, record, sizeof(float) * 4);
+		record += 4;
+	}
+
+	if (plan->set & ATTRIBUTE_SIZE_BIT) attributes->size = record[0];
+	if (plan->set & ATTRIBUTE_AGE_BIT) attributes->age = record[1];
+	if (plan->set & ATTRIBUTE_SPRITE_BIT) attributes->sprite = record[2];
+}
+
+/* Split : a stream per attribute in the set, in enum order. */
+
+const char* attribute_layout_soa::name(void) {
+	return "soa";
+}
+
+void attribute_layout_soa::plan(unsigned int set, attribute_plan* plan) {
+	attributes_begin_plan(set, plan);
+	set = plan->set;
+
+	char line[128];
+
+	for (int attribute = 0; attribute < ATTRIBUTES; attribute++) {
+		if (!(set & (1u << attribute))) {
+			continue;
+		}
+
+		int stream = plan->stream_count;
+		bool color = attribute == ATTRIBUTE_COLOR;
+
+		attributes_add_stream(plan, color ? ATTRIBUTE_FORMAT_RGBA32F : ATTRIBUTE_FORMAT_R32F, color ? 16 : 4, attribute == ATTRIBUTE_AGE);
+
+		snprintf(line, sizeof line, "\tattributes.%s = texelFetch(attribute_stream_%d, index)%s;\n", attribute_names[attribute], stream, color ? "" : ".x");
+		plan->load_glsl += line;
+	}
+
+	/* Only the age stream is written, the others aren't even read by the update. */
+	if (set & ATTRIBUTE_AGE_BIT) {
+		plan->separate = true;
+		plan->varyings[plan->varying_count++] = "out_attribute_age";
+		plan->store_glsl += "out float out_attribute_age;\n";
+		plan->store_glsl += "void store_attributes(particle_attributes attributes) {\n";
+		plan->store_glsl += "\tout_attribute_age = attributes.age;\n";
+	}
+
+	attributes_end_plan(plan);
+}
+
+void attribute_layout_soa::store(const attribute_plan* plan, unsigned char* const* streams, unsigned int index, const particle_attributes* attributes) {
+	int stream = 0;
+
+	if (plan->set & ATTRIBUTE_COLOR_BIT) memcpy(streams[stream++] + (size_t) index * 16, attributes->color, 16);
+	if (plan->set & ATTRIBUTE_SIZE_BIT) memcpy(streams[stream++] + (size_t) index * 4, &attributes->size, 4);
+	if (plan->set & ATTRIBUTE_AGE_BIT) memcpy(streams[stream++] + (size_t) index * 4, &attributes->age, 4);
+	if (plan->set & ATTRIBUTE_SPRITE_BIT) memcpy(streams[stream++] + (size_t) index * 4, &attributes->sprite, 4);
+}
+
+void attribute_layout_soa::load(const attribute_plan* plan, const unsigned char* const* streams, unsigned int index, particle_attributes* attributes) {
+	attributes_defaults(attributes);
+
+	int stream = 0;
+
+	if (plan->set & ATTRIBUTE_COLOR_BIT) memcpy(attributes->color, streams[stream++] + (size_t) index * 16, 16);
+	if (plan->set & ATTRIBUTE_SIZE_BIT) memcpy(&attributes->size, streams[stream++] + (size_t) index * 4, 4);
+	if (plan->set & ATTRIBUTE_AGE_BIT) memcpy(&attributes->age, streams[stream++] + (size_t) index * 4, 4);
+	if (plan->set & ATTRIBUTE_SPRITE_BIT) memcpy(&attributes->sprite, streams[stream++] + (size_t) index * 4, 4);
+}
+
+/* Packed : bit fields in one or two uints. A field never straddles two words, so the colour always takes a word of its own. */
+
+static const unsigned int attribute_packed_bits[ATTRIBUTES] = {32, 12, 12, 8};
+
+struct attribute_packing {
+	int words;
+	int word[ATTRIBUTES];
+	int shift[ATTRIBUTES];
+};
+
+static void attributes_packing(unsigned int set, attribute_packing* packing) {
+	int word = 0;
+	unsigned int used = 0;
+
+	packing->words = 0;
+
+	for (int attribute = 0; attribute < ATTRIBUTES; attribute++) {
+		if (!(set & (1u << attribute))) {
+			continue;
+		}
+
+		if (used + attribute_packed_bits[attribute] > 32) {
+			word++;
+			used = 0;
+		}
+
+		packing->word[attribute] = word;
+		packing->shift[attribute] = (int) used;
+		packing->words = word + 1;
+		used += attribute_packed_bits[attribute];
+	}
+}
+
+static inline unsigned int attributes_quantize(float value, float scale, unsigned int max) {
+	float scaled = value * scale + 0.5f;
+	return scaled <= 0.0f ? 0u : (scaled >= (float) max ? max : (unsigned int) scaled);
+}
+
+const char* attribute_layout_packed::name(void) {
+	return "packed";
+}
+
+void attribute_layout_packed::plan(unsigned int set, attribute_plan* plan) {
+	attributes_begin_plan(set, plan);
+	set = plan->set;
+
+	attribute_packing packing;
+	attributes_packing(set, &packing);
+
+	if (!packing.words) {
+		attributes_end_plan(plan);
+		return;
+	}
+
+	for (int attribute = 0; attribute < ATTRIBUTES; attribute++) {
+		plan->offsets[attribute] = (set & (1u << attribute)) ? packing.word[attribute] * 32 + packing.shift[attribute] : -1;
+	}
+
+	attributes_add_stream(plan, packing.words == 1 ? ATTRIBUTE_FORMAT_R32UI : ATTRIBUTE_FORMAT_RG32UI, packing.words * 4, (set & ATTRIBUTE_AGE_BIT) != 0);
+
+	char line[192];
+	const char* components = "xy";
+
+	plan->load_glsl += "\tuvec4 word = texelFetch(attribute_stream_0, index);\n";
+
+	if (set & ATTRIBUTE_COLOR_BIT) {
+		snprintf(line, sizeof line, "\tattributes.color = vec4((uvec4(word.%c) >> uvec4(0u, 8u, 16u, 24u)) & 255u) / 255.0f;\n",
+			components[packing.word[ATTRIBUTE_COLOR]]);
+		plan->load_glsl += line;
+	}
+
+	if (set & ATTRIBUTE_SIZE_BIT) {
+		snprintf(line, sizeof line, "\tattributes.size = float((word.%c >> %du) & 4095u) * %.9ff;\n", components[packing.word[ATTRIBUTE_SIZE]],
+			packing.shift[ATTRIBUTE_SIZE], ATTRIBUTE_SIZE_MAX / 4095.0f);
+		plan->load_glsl += line;
+	}
+
+	if (set & ATTRIBUTE_AGE_BIT) {
+		snprintf(line, sizeof line, "\tattributes.age = float((word.%c >> %du) & 4095u);\n", components[packing.word[ATTRIBUTE_AGE]], packing.shift[ATTRIBUTE_AGE]);
+		plan->load_glsl += line;
+	}
+
+	if (set & ATTRIBUTE_SPRITE_BIT) {
+		snprintf(line, sizeof line, "\tattributes.sprite = float((word.%c >> %du) & 255u);\n", components[packing.word[ATTRIBUTE_SPRITE]], packing.shift[ATTRIBUTE_SPRITE]);
+		plan->load_glsl += line;
+	}
+
+	/* The whole record is rewritten, integer outputs have to be flat. */
+	if (set & ATTRIBUTE_AGE_BIT) {
+		plan->varyings[plan->varying_count++] = "out_attribute_packed";
+		plan->store_glsl += packing.words == 1 ? "flat out uint out_attribute_packed;\n" : "flat out uvec2 out_attribute_packed;\n";
+		plan->store_glsl += "void store_attributes(particle_attributes attributes) {\n";
+		plan->store_glsl += "\tuvec2 word = uvec2(0u);\n";
+
+		if (set & ATTRIBUTE_COLOR_BIT) {
+			snprintf(line, sizeof line, "\tuvec4 color = uvec4(clamp(attributes.color, 0.0f, 1.0f) * 255.0f + 0.5f);\n"
+				"\tword.%c |= color.x | (color.y << 8u) | (color.z << 16u) | (color.w << 24u);\n", components[packing.word[ATTRIBUTE_COLOR]]);
+			plan->store_glsl += line;
+		}
+
+		if (set & ATTRIBUTE_SIZE_BIT) {
+			snprintf(line, sizeof line, "\tword.%c |= uint(clamp(attributes.size * %.9ff + 0.5f, 0.0f, 4095.0f)) << %du;\n",
+				components[packing.word[ATTRIBUTE_SIZE]], 4095.0f / ATTRIBUTE_SIZE_MAX, packing.shift[ATTRIBUTE_SIZE]);
+			plan->store_glsl += line;
+		}
+
+		snprintf(line, sizeof line, "\tword.%c |= uint(clamp(attributes.age + 0.5f, 0.0f, 4095.0f)) << %du;\n", components[packing.word[ATTRIBUTE_AGE]],
+			packing.shift[ATTRIBUTE_AGE]);
+		plan->store_glsl += line;
+
+		if (set & ATTRIBUTE_SPRITE_BIT) {
+			snprintf(line, sizeof line, "\tword.%c |= (uint(attributes.sprite) & 255u) << %du;\n", components[packing.word[ATTRIBUTE_SPRITE]],
+				packing.shift[ATTRIBUTE_SPRITE]);
+			plan->store_glsl += line;
+		}
+
+		plan->store_glsl += packing.words == 1 ? "\tout_attribute_packed = word.x;\n" : "\tout_attribute_packed = word;\n";
+	}
+
+	attributes_end_plan(plan);
+}
+
+void attribute_layout_packed::store(const attribute_plan* plan, unsigned char* const* streams, unsigned int index, const particle_attributes* attributes) {
+	if (!plan->stream_count) {
+		return;
+	}
+
+	/* Offsets are bit positions, word * 32 + shift. */
+	const int* offsets = plan->offsets;
+	unsigned int word[2] = {0u, 0u};
+
+	if (offsets[ATTRIBUTE_COLOR] >= 0) {
+		for (int c = 0; c < 4; c++) {
+			word[offsets[ATTRIBUTE_COLOR] / 32] |= attributes_quantize(attributes->color[c], 255.0f, 255u) << (c * 8);
+		}
+	}
+
+	if (offsets[ATTRIBUTE_SIZE] >= 0) {
+		word[offsets[ATTRIBUTE_SIZE] / 32] |= attributes_quantize(attributes->size, 4095.0f / ATTRIBUTE_SIZE_MAX, 4095u) << (offsets[ATTRIBUTE_SIZE] % 32);
+	}
+
+	if (offsets[ATTRIBUTE_AGE] >= 0) {
+		word[offsets[ATTRIBUTE_AGE] / 32] |= attributes_quantize(attributes->age, 1.0f, 4095u) << (offsets[ATTRIBUTE_AGE] % 32);
+	}
+
+	if (offsets[ATTRIBUTE_SPRITE] >= 0) {
+		word[offsets[ATTRIBUTE_SPRITE] / 32] |= ((unsigned int) attributes->sprite & 255u) << (offsets[ATTRIBUTE_SPRITE] % 32);
+	}
+
+	memcpy(streams[0] + (size_t) index * plan->streams[0].bytes, word, plan->streams[0].bytes);
+}
+
+void attribute_layout_packed::load(const attribute_plan* plan, const unsigned char* const* streams, unsigned int index, particle_attributes* attributes) {
+	attributes_defaults(attributes);
+
+	if (!plan->stream_count) {
+		return;
+	}
+
+	const int* offsets = plan->offsets;
+	unsigned int word[2] = {0u, 0u};
+
+	memcpy(word, streams[0] + (size_t) index * plan->streams[0].bytes, plan->streams[0].bytes);
+
+	if (offsets[ATTRIBUTE_COLOR] >= 0) {
+		for (int c = 0; c < 4; c++) {
+			attributes->color[c] = (float) ((word[offsets[ATTRIBUTE_COLOR] / 32] >> (c * 8)) & 255u) / 255.0f;
+		}
+	}
+
+	if (offsets[ATTRIBUTE_SIZE] >= 0) {
+		attributes->size = (float) ((word[offsets[ATTRIBUTE_SIZE] / 32] >> (offsets[ATTRIBUTE_SIZE] % 32)) & 4095u) * (ATTRIBUTE_SIZE_MAX / 4095.0f);
+	}
+
+	if (offsets[ATTRIBUTE_AGE] >= 0) {
+		attributes->age = (float) ((word[offsets[ATTRIBUTE_AGE] / 32] >> (offsets[ATTRIBUTE_AGE] % 32)) & 4095u);
+	}
+
+	if (offsets[ATTRIBUTE_SPRITE] >= 0) {
+		attributes->sprite = (float) ((word[offsets[ATTRIBUTE_SPRITE] / 32] >> (offsets[ATTRIBUTE_SPRITE] % 32)) & 255u);
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+ * Per-particle attributes past the (x, y, vx, vy) state : colour, size, age and sprite. Builds without GL, see attribute_buffers.h for the
+ *	buffers themselves.
+ * A set is a mask of ATTRIBUTE_*_BIT, and only what is in it gets stored, updated and read. A layout policy turns a set into an
+ *	attribute_plan : the streams (one buffer and texture buffer each) with their formats, the transform feedback varyings that write them,
+ *	and the GLSL that reads and writes them. Shaders see a particle_attributes struct either way, with defaults for what the set leaves out,
+ *	and an ATTRIBUTE_<NAME> define for what it has.
+ *
+ *	attribute_layout_aos : one stream of vec4 texels, the colour in one and the scalars in the next. Every pass moves whole records.
+ *	attribute_layout_soa : one stream per attribute, RGBA32F for the colour and R32F for the scalars. Passes only touch what they use.
+ *	attribute_layout_packed : one stream of one or two uints, colour as RGBA8, size and age in 12 bits, sprite in 8. Smallest, but
+ *		quantized : sizes go up to ATTRIBUTE_SIZE_MAX, and ages stop counting at ATTRIBUTE_PACKED_AGE_MAX steps.
+ *
+ * Age is the only attribute that changes, so only the streams holding it are written by the update pass (and double buffered).
+ *	The codecs here are the same packing the GLSL does, for initial uploads and for the CPU benchmark.
+ */
+
+#include <string>
+
+enum {
+	ATTRIBUTE_COLOR = 0,
+	ATTRIBUTE_SIZE,
+	ATTRIBUTE_AGE,
+	ATTRIBUTE_SPRITE,
+	ATTRIBUTES
+};
+
+#define ATTRIBUTE_COLOR_BIT (1u << ATTRIBUTE_COLOR)
+#define ATTRIBUTE_SIZE_BIT (1u << ATTRIBUTE_SIZE)
+#define ATTRIBUTE_AGE_BIT (1u << ATTRIBUTE_AGE)
+#define ATTRIBUTE_SPRITE_BIT (1u << ATTRIBUTE_SPRITE)
+#define ATTRIBUTE_ALL_BITS ((1u << ATTRIBUTES) - 1)
+
+#define ATTRIBUTE_SIZE_MAX 4.0f // Size is a factor on the sprite size.
+#define ATTRIBUTE_PACKED_AGE_MAX 4095.0f
+
+enum {
+	ATTRIBUTE_FORMAT_RGBA32F = 0,
+	ATTRIBUTE_FORMAT_R32F,
+	ATTRIBUTE_FORMAT_R32UI,
+	ATTRIBUTE_FORMAT_RG32UI
+};
+
+struct particle_attributes {
+	float color[4];
+	float size;
+	float age; // Steps.
+	float sprite; // Atlas cell, see sprites.h.
+};
+
+struct attribute_stream {
+	int format; // ATTRIBUTE_FORMAT_*.
+	unsigned int bytes; // Per particle.
+	bool written; // By the update pass, so it is double buffered.
+};
+
+struct attribute_plan {
+	unsigned int set;
+	int stream_count;
+	attribute_stream streams[ATTRIBUTES];
+
+	bool separate; // GL_SEPARATE_ATTRIBS, one varying per written stream. Otherwise interleaved into the only written stream.
+	int varying_count;
+	const char* varyings[ATTRIBUTES];
+
+	int offsets[ATTRIBUTES]; // Where each attribute sits, in whatever units the layout uses.
+
+	std::string load_glsl; // Samplers attribute_stream_<n>, the struct, and particle_attributes load_attributes(int index).
+	std::string store_glsl; // The varyings, and void store_attributes(particle_attributes attributes).
+
+	unsigned int bytes; // Per particle, every stream.
+	unsigned int update_bytes; // Read and written per particle by the update pass.
+};
+
+struct attribute_layout_aos {
+	static const char* name(void);
+	static void plan(unsigned int set, attribute_plan* plan);
+	static void store(const attribute_plan* plan, unsigned char* const* streams, unsigned int index, const particle_attributes* attributes);
+	static void load(const attribute_plan* plan, const unsigned char* const* streams, unsigned int index, particle_attributes* attributes);
+};
+
+struct attribute_layout_soa {
+	static const char* name(void);
+	static void plan(unsigned int set, attribute_plan* plan);
+	static void store(const attribute_plan* plan, unsigned char* const* streams, unsigned int index, const particle_attributes* attributes);
+	static void load(const attribute_plan* plan, const unsigned char* const* streams, unsigned int index, particle_attributes* attributes);
+};
+
+struct attribute_layout_packed {
+	static const char* name(void);
+	static void plan(unsigned int set, attribute_plan* plan);
+	static void store(const attribute_plan* plan, unsigned char* const* streams, unsigned int index, const particle_attributes* attributes);
+	static void load(const attribute_plan* plan, const unsigned char* const* streams, unsigned int index, particle_attributes* attributes);
+};
+
+void attributes_defaults(particle_attributes* attributes); // What shaders see for attributes the set leaves out, sprite -1 meaning by index.
+void attributes_generate(particle_attributes* attributes, unsigned int count, unsigned int seed, int sprites); // A spread of colours, sizes and sprites, age 0.
+const char* attributes_name(int attribute);
@@ -0,0 +1,402 @@
+/*
+ * CPU engine throughput benchmark. Builds without GL, see 'make bench'.
+ *
+ * Particles are spread uniformly inside the default camera bounds, and the neighbor radius shrinks with the particle count so every run sees
+ *	the same average number of neighbors (about as many as PARTICLE_COUNT particles at NEIGHBOR_RADIUS see in the real program).
+ *	That way the numbers show how the grid scales with n rather than how the pair count grows with density.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+#include "cpu_engine.h"
+#include "bh_tree.h"
+#include "forces.h"
+#include "variants.h"
+#include "attributes.h"
+
+#define BENCH_REFERENCE_COUNT 175000.0f
+#define BENCH_REFERENCE_RADIUS 0.004f
+#define BENCH_STRENGTH 0.00002f
+
+/* Barnes-Hut traversal is timed over at most this many particles, and checked against the direct sum at BENCH_NBODY_SAMPLES of them. */
+#define BENCH_NBODY_TRAVERSALS 200000
+#define BENCH_NBODY_SAMPLES 64
+#define BENCH_NBODY_THETA 0.5f
+#define BENCH_NBODY_SOFTENING 0.01f
+
+/* Sleeping is timed after BENCH_SLEEP_SETTLE steps without attractors, once most particles have come to rest on the floor. */
+#define BENCH_SLEEP_SETTLE 600
+#define BENCH_SLEEP_STEPS 60
+
+/* Integrators run BENCH_INTEGRATOR_TIME steps worth of simulated time at a few step lengths, and are compared against Verlet at
+ *	BENCH_INTEGRATOR_REFERENCE_DT. The bounds are pushed far out so nothing bounces, bounces would dominate the error. */
+#define BENCH_INTEGRATOR_COUNT 20000
+#define BENCH_INTEGRATOR_TIME 240.0f
+#define BENCH_INTEGRATOR_REFERENCE_DT (1.0f / 16.0f)
+#define BENCH_INTEGRATOR_TOLERANCE 0.0002f
+#define BENCH_INTEGRATOR_MAX_SUBSTEPS 8
+#define BENCH_GRAVITATION 0.0001f // The engine's gravity, which also scales attractor strengths.
+
+/* Attribute layouts are compared over the same sets of BENCH_ATTRIBUTE_COUNT particles, through the same codecs the GPU side uploads
+ *	with. The CPU ages by whole loads and stores, the GPU update only moves the written streams : that traffic is the update column. */
+#define BENCH_ATTRIBUTE_COUNT 1000000
+#define BENCH_ATTRIBUTE_PASSES 10
+
+static volatile float bench_sink; // Keeps timed loops from being optimized away.
+
+/* Each round reseeds the particles and times BENCH_STEPS steps, short enough that gravity and the attractor don't pile everything up.
+ *	Small counts run more rounds, until roughly BENCH_WORK particle steps have been timed, and every count runs at least BENCH_MIN_ROUNDS.
+ *	The step time is the median round and the spread is the interquartile range of the rounds, so a few descheduled rounds don't move either. */
+#define BENCH_STEPS 10
+#define BENCH_WORK 30000000.0
+#define BENCH_MIN_ROUNDS 5
+
+static void bench_seed(unsigned int count, const float* camera_bounds, int round) {
+	float* particles = cpu_engine_particles();
+	srand(1 + round);
+
+	for (unsigned int i = 0; i < count; i++) {
+		particles[i * 4] = camera_bounds[0] + (camera_bounds[1] - camera_bounds[0]) * ((float) rand() / (float) RAND_MAX);
+		particles[i * 4 + 1] = camera_bounds[2] + (camera_bounds[3] - camera_bounds[2]) * ((float) rand() / (float) RAND_MAX);
+		particles[i * 4 + 2] = particles[i * 4 + 3] = 0.0f;
+	}
+}
+
+static void bench_run(unsigned int count, bool neighbors) {
+	float ratio = 1366.0f / 768.0f;
+	float camera_bounds[4] = {-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f};
+	float radius = BENCH_REFERENCE_RADIUS * sqrtf(BENCH_REFERENCE_COUNT / (float) count);
+
+	if (!cpu_engine_initialize(count, camera_bounds)) {
+		printf("[bench] failed to initialize %u particles\n", count);
+		return;
+	}
+
+	cpu_engine_set_neighbors(neighbors, radius, BENCH_STRENGTH);
+
+	forces_clear_attractors();
+	forces_add_attractor(0.1f, 0.1f, 1.0f, 0.01f); // Like holding the mouse down.
+
+	int rounds = (int) (BENCH_WORK / ((double) count * BENCH_STEPS));
+
+	if (rounds < BENCH_MIN_ROUNDS) {
+		rounds = BENCH_MIN_ROUNDS;
+	}
+
+	float grid_ms = 0.0f, neighbor_ms = 0.0f, advance_ms = 0.0f;
+	std::vector<double> round_ms(rounds);
+
+	for (int round = 0; round < rounds; round++) {
+		bench_seed(count, camera_bounds, round);
+
+		cpu_engine_step(count); // Warm up, faults in all the grid storage on the first round.
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < BENCH_STEPS; i++) {
+			cpu_engine_step(count);
+
+			const cpu_engine_timings* timings = cpu_engine_last_timings();
+
+			grid_ms += timings->grid_ms;
+			neighbor_ms += timings->neighbor_ms;
+			advance_ms += timings->advance_ms;
+		}
+
+		round_ms[round] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / BENCH_STEPS;
+	}
+
+	int steps = rounds * BENCH_STEPS;
+
+	/* The interquartile range as a share of the median. The stage columns stay means, they only say where the time goes. */
+	std::sort(round_ms.begin(), round_ms.end());
+	double step_ms = rounds % 2 ? round_ms[rounds / 2] : (round_ms[rounds / 2 - 1] + round_ms[rounds / 2]) / 2.0;
+	double spread = (round_ms[rounds * 3 / 4] - round_ms[rounds / 4]) / step_ms * 100.0;
+
+	printf("%10u  %-9s  %9.2f  %7.1f%%  %8.2f  %8.2f  %8.2f  %10.1f\n", count, neighbors ? "on" : "off", step_ms, spread,
+		grid_ms / steps, neighbor_ms / steps, advance_ms / steps, count / step_ms / 1000.0);
+
+	cpu_engine_shutdown();
+}
+
+static void bench_nbody(unsigned int count) {
+	float ratio = 1366.0f / 768.0f;
+	float camera_bounds[4] = {-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f};
+
+	cpu_engine_initialize(count, camera_bounds);
+	bench_seed(count, camera_bounds, 0);
+
+	const float* particles = cpu_engine_particles();
+
+	bh_tree_build(particles, count, 4); // Warm up.
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bh_tree_build(particles, count, 4);
+	double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned int traversals = count < BENCH_NBODY_TRAVERSALS ? count : BENCH_NBODY_TRAVERSALS;
+	start = std::chrono::steady_clock::now();
+
+	parallel_for(traversals, [&](unsigned int begin, unsigned int end, int chunk) {
+		float local = 0.0f;
+
+		for (unsigned int i = begin; i < end; i++) {
+			const float* p = particles + (size_t) ((unsigned long long) i * count / traversals) * 4;
+			float force[2];
+
+			bh_tree_force(p[0], p[1], BENCH_NBODY_THETA, BENCH_NBODY_SOFTENING, force);
+			local += force[0];
+		}
+
+		bench_sink = local;
+	});
+
+	double traverse_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / traversals;
+
+	float mean_error = 0.0f, max_error = 0.0f;
+	bh_tree_validate(particles, count, 4, BENCH_NBODY_THETA, BENCH_NBODY_SOFTENING, BENCH_NBODY_SAMPLES, &mean_error, &max_error);
+
+	printf("%10u  %8u  %9.2f  %11.3f  %12.1f  %10.5f  %10.5f\n", count, bh_tree_node_count(), build_ms, traverse_us,
+		traverse_us * count / 1000.0, mean_error, max_error);
+
+	cpu_engine_shutdown();
+}
+
+static void bench_sleep(unsigned int count, bool sleep) {
+	float ratio = 1366.0f / 768.0f;
+	float camera_bounds[4] = {-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f};
+
+	cpu_engine_initialize(count, camera_bounds);
+	cpu_engine_set_neighbors(false, 0.0f, 0.0f); // Settled particles pile up on the floor, which the neighbor grid doesn't enjoy.
+	cpu_engine_set_sleep(sleep, 0.0003f, 0.00005f, 30);
+	bench_seed(count, camera_bounds, 0);
+
+	forces_clear_attractors();
+
+	for (int i = 0; i < BENCH_SLEEP_SETTLE; i++) {
+		cpu_engine_step(count);
+	}
+
+	float advance_ms = 0.0f;
+
+	for (int i = 0; i < BENCH_SLEEP_STEPS; i++) {
+		cpu_engine_step(count);
+		advance_ms += cpu_engine_last_timings()->advance_ms;
+	}
+
+	printf("%10u  %-5s  %8.1f%%  %10.3f\n", count, sleep ? "on" : "off", cpu_engine_active_fraction() * 100.0f, advance_ms / BENCH_SLEEP_STEPS);
+
+	cpu_engine_shutdown();
+}
+
+static double bench_energy(const float* particles, unsigned int count) {
+	/* Mean kinetic plus potential energy. The attractor's pull has magnitude k / (r^2 + softening), whose potential has a closed form. */
+	const forces_attractor* attractor = forces_attractors();
+	double k = attractor->strength * BENCH_GRAVITATION;
+	double root = sqrt((double) attractor->softening);
+	double energy = 0.0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const float* p = particles + (size_t) i * 4;
+		double dx = p[0] - attractor->position[0], dy = p[1] - attractor->position[1];
+
+		energy += 0.5 * ((double) p[2] * p[2] + (double) p[3] * p[3]) + BENCH_GRAVITATION * p[1];
+		energy -= k / root * (M_PI / 2.0 - atan(sqrt(dx * dx + dy * dy) / root));
+	}
+
+	return energy / count;
+}
+
+static double bench_integrate(int integrator, float dt, const float* view_bounds, std::vector<float>* result) {
+	/* Returns the milliseconds it took, per step of simulated time. */
+	cpu_engine_set_integrator(integrator, dt, BENCH_INTEGRATOR_TOLERANCE, BENCH_INTEGRATOR_MAX_SUBSTEPS);
+	bench_seed(BENCH_INTEGRATOR_COUNT, view_bounds, 0);
+
+	int steps = (int) lroundf(BENCH_INTEGRATOR_TIME / dt);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < steps; i++) {
+		cpu_engine_step(BENCH_INTEGRATOR_COUNT);
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	const float* particles = cpu_engine_particles();
+
+	result->assign(particles, particles + (size_t) BENCH_INTEGRATOR_COUNT * 4);
+	return ms / BENCH_INTEGRATOR_TIME;
+}
+
+static void bench_integrators(void) {
+	float ratio = 1366.0f / 768.0f;
+	float view_bounds[4] = {-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f};
+	float far_bounds[4] = {-100.0f, 100.0f, -100.0f, 100.0f};
+
+	cpu_engine_initialize(BENCH_INTEGRATOR_COUNT, far_bounds);
+	cpu_engine_set_neighbors(false, 0.0f, 0.0f); // Neighbors would reorder the particles, and they are compared index by index.
+	cpu_engine_set_sleep(false, 0.0f, 0.0f, 1);
+
+	forces_clear_attractors();
+	forces_add_attractor(0.1f, 0.1f, 1.0f, 0.01f);
+
+	std::vector<float> reference, result;
+	bench_integrate(INTEGRATOR_VERLET, BENCH_INTEGRATOR_REFERENCE_DT, view_bounds, &reference);
+	double reference_energy = bench_energy(reference.data(), BENCH_INTEGRATOR_COUNT);
+
+	const float dts[] = {1.0f, 2.0f, 4.0f};
+
+	for (int integrator = 0; integrator < INTEGRATORS; integrator++) {
+		for (int d = 0; d < 3; d++) {
+			double ms = bench_integrate(integrator, dts[d], view_bounds, &result);
+			double error_sum = 0.0, error_max = 0.0;
+
+			for (unsigned int i = 0; i < BENCH_INTEGRATOR_COUNT; i++) {
+				double dx = result[i * 4] - reference[i * 4], dy = result[i * 4 + 1] - reference[i * 4 + 1];
+				double error_sq = dx * dx + dy * dy;
+
+				error_sum += error_sq;
+				error_max = error_sq > error_max ? error_sq : error_max;
+			}
+
+			double energy_error = bench_energy(result.data(), BENCH_INTEGRATOR_COUNT) - reference_energy;
+
+			printf("%-10s  %5.1f  %8.3f  %10.6f  %10.6f  %12.3e  %12.4f\n", variants_integrator_name(integrator), dts[d], 1.0f / dts[d],
+				sqrt(error_sum / BENCH_INTEGRATOR_COUNT), sqrt(error_max), energy_error, ms);
+		}
+	}
+
+	cpu_engine_set_integrator(INTEGRATOR_EULER, 1.0f, BENCH_INTEGRATOR_TOLERANCE, BENCH_INTEGRATOR_MAX_SUBSTEPS);
+	cpu_engine_shutdown();
+}
+
+template <class layout>
+static void bench_layout(unsigned int set, const particle_attributes* initial) {
+	attribute_plan plan;
+	layout::plan(set, &plan);
+
+	std::vector<unsigned char> storage[ATTRIBUTES];
+	unsigned char* streams[ATTRIBUTES] = {NULL};
+
+	for (int s = 0; s < plan.stream_count; s++) {
+		storage[s].resize((size_t) BENCH_ATTRIBUTE_COUNT * plan.streams[s].bytes);
+		streams[s] = storage[s].data();
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (unsigned int i = 0; i < BENCH_ATTRIBUTE_COUNT; i++) {
+		layout::store(&plan, streams, i, &initial[i]);
+	}
+
+	double store_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	/* What the render pass does per particle : read everything. */
+	float sum = 0.0f;
+	start = std::chrono::steady_clock::now();
+
+	for (int pass = 0; pass < BENCH_ATTRIBUTE_PASSES; pass++) {
+		for (unsigned int i = 0; i < BENCH_ATTRIBUTE_COUNT; i++) {
+			particle_attributes attributes;
+			layout::load(&plan, streams, i, &attributes);
+
+			sum += attributes.color[0] + attributes.size + attributes.age + attributes.sprite;
+		}
+	}
+
+	double read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / BENCH_ATTRIBUTE_PASSES;
+
+	/* And what the update does : age by a step. */
+	start = std::chrono::steady_clock::now();
+
+	for (int pass = 0; pass < BENCH_ATTRIBUTE_PASSES; pass++) {
+		for (unsigned int i = 0; i < BENCH_ATTRIBUTE_COUNT; i++) {
+			particle_attributes attributes;
+			layout::load(&plan, streams, i, &attributes);
+
+			attributes.age += 1.0f;
+			layout::store(&plan, streams, i, &attributes);
+		}
+	}
+
+	double age_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / BENCH_ATTRIBUTE_PASSES;
+
+	particle_attributes last;
+	layout::load(&plan, streams, BENCH_ATTRIBUTE_COUNT - 1, &last);
+	bench_sink = sum + last.age;
+
+	char names[64] = "";
+
+	for (int attribute = 0; attribute < ATTRIBUTES; attribute++) {
+		if (set & (1u << attribute)) {
+			snprintf(names + strlen(names), sizeof names - strlen(names), "%s%s", names[0] ? "," : "", attributes_name(attribute));
+		}
+	}
+
+	printf("%-22s  %-7s  %7d  %9u  %9u  %9.3f  %9.3f  %9.3f  %8.0f\n", names, layout::name(), plan.stream_count, plan.bytes, plan.update_bytes,
+		store_ms, read_ms, age_ms, last.age);
+}
+
+static void bench_layouts(void) {
+	std::vector<particle_attributes> initial(BENCH_ATTRIBUTE_COUNT);
+	attributes_generate(initial.data(), BENCH_ATTRIBUTE_COUNT, 1, 64);
+
+	const unsigned int sets[] = {ATTRIBUTE_ALL_BITS, ATTRIBUTE_SIZE_BIT | ATTRIBUTE_AGE_BIT, ATTRIBUTE_COLOR_BIT | ATTRIBUTE_SPRITE_BIT};
+
+	for (int i = 0; i < 3; i++) {
+		bench_layout<attribute_layout_aos>(sets[i], initial.data());
+		bench_layout<attribute_layout_soa>(sets[i], initial.data());
+		bench_layout<attribute_layout_packed>(sets[i], initial.data());
+	}
+}
+
+int main(int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : 0;
+
+	parallel_initialize(threads);
+
+	printf("%10s  %-9s  %9s  %8s  %8s  %8s  %8s  %10s\n", "particles", "neighbors", "step ms", "spread", "grid", "forces", "advance",
+		"Mparticle/s");
+
+	const unsigned int counts[] = {100000, 1000000, 10000000};
+
+	for (int i = 0; i < 3; i++) {
+		bench_run(counts[i], false);
+		bench_run(counts[i], true);
+	}
+
+	printf("\nBarnes-Hut, theta %.2f\n", BENCH_NBODY_THETA);
+	printf("%10s  %8s  %9s  %11s  %12s  %10s  %10s\n", "particles", "nodes", "build ms", "us/particle", "all ms (est)", "mean error", "max error");
+
+	for (int i = 0; i < 3; i++) {
+		bench_nbody(counts[i]);
+	}
+
+	printf("\nSleeping, after %d settling steps\n", BENCH_SLEEP_SETTLE);
+	printf("%10s  %-5s  %9s  %10s\n", "particles", "sleep", "awake", "advance ms");
+
+	for (int i = 0; i < 2; i++) {
+		bench_sleep(counts[i], false);
+		bench_sleep(counts[i], true);
+	}
+
+	printf("\nIntegrators, %u particles over %.0f steps against Verlet at dt %.4f\n", BENCH_INTEGRATOR_COUNT, BENCH_INTEGRATOR_TIME,
+		BENCH_INTEGRATOR_REFERENCE_DT);
+	printf("%-10s  %5s  %8s  %10s  %10s  %12s  %12s\n", "integrator", "dt", "passes", "rms error", "max error", "energy error", "ms per step");
+
+	bench_integrators();
+
+	printf("\nAttribute layouts, %u particles, bytes per particle and CPU ms per pass over all of them\n", BENCH_ATTRIBUTE_COUNT);
+	printf("%-22s  %-7s  %7s  %9s  %9s  %9s  %9s  %9s  %8s\n", "set", "layout", "streams", "bytes", "update", "store ms", "read ms", "age ms",
+		"last age");
+
+	bench_layouts();
+
+	parallel_shutdown();
+	return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * Barnes-Hut quadtree implementation. See bh_tree.h.
+ */
+
+#include <cstdio>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+#include "bh_tree.h"
+
+/* Leaves hold up to this many points. Bigger leaves mean fewer nodes to build and upload, at the cost of more direct sums when opened. */
+#define BH_LEAF_SIZE 8
+
+/* Morton codes carry 16 bits per axis, which is as deep as the tree can get. */
+#define BH_MAX_LEVEL 16
+
+/* Subtrees rooted at this level (up to 4^level of them) are built in parallel. */
+#define BH_SPLIT_LEVEL 3
+
+static std::vector<bh_node> bh_nodes;
+static std::vector<float> bh_points;
+
+static std::vector<unsigned int> bh_codes;
+static std::vector<unsigned int> bh_indices;
+static std::vector<unsigned int> bh_scratch_codes;
+static std::vector<unsigned int> bh_scratch_indices;
+static std::vector<unsigned int> bh_histogram;
+
+static float bh_root[3]; // Lower left corner and edge length of the root square.
+
+static unsigned int bh_spread(unsigned int v) {
+	/* Spreads the low 16 bits of v out to the even bits. */
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static void bh_compute_bounds(const float* particles, unsigned int count, unsigned int stride) {
+	int threads = parallel_thread_count();
+	std::vector<float> extents((size_t) threads * 4);
+
+	for (int t = 0; t < threads; t++) {
+		extents[t * 4] = extents[t * 4 + 1] = FLT_MAX;
+		extents[t * 4 + 2] = extents[t * 4 + 3] = -FLT_MAX;
+	}
+
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		float* e = extents.data() + chunk * 4;
+
+		for (unsigned int i = begin; i < end; i++) {
+			const float* p = particles + (size_t) i * stride;
+
+			e[0] = std::min(e[0], p[0]);
+			e[1] = std::min(e[1], p[1]);
+			e[2] = std::max(e[2], p[0]);
+			e[3] = std::max(e[3], p[1]);
+		}
+	});
+
+	for (int t = 1; t < threads; t++) {
+		extents[0] = std::min(extents[0], extents[t * 4]);
+		extents[1] = std::min(extents[1], extents[t * 4 + 1]);
+		extents[2] = std::max(extents[2], extents[t * 4 + 2]);
+		extents[3] = std::max(extents[3], extents[t * 4 + 3]);
+	}
+
+	/* Pad a little so the largest coordinate still maps below 1 << 16. */
+	float size = std::max(extents[2] - extents[0], extents[3] - extents[1]) * 1.001f + 1e-6f;
+
+	bh_root[0] = extents[0];
+	bh_root[1] = extents[1];
+	bh_root[2] = size;
+}
+
+static void bh_sort(unsigned int count) {
+	/* LSD radix sort of (code, index) pairs, 8 bits per pass, same per-thread histogram scheme as the neighbor grid. */
+	int threads = parallel_thread_count();
+
+	bh_scratch_codes.resize(count);
+	bh_scratch_indices.resize(count);
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		bh_histogram.assign((size_t) threads * 256, 0);
+
+		parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+			unsigned int* histogram = bh_histogram.data() + chunk * 256;
+
+			for (unsigned int i = begin; i < end; i++) {
+				histogram[(bh_codes[i] >> shift) & 0xFF]++;
+			}
+		});
+
+		unsigned int offset = 0;
+
+		for (int digit = 0; digit < 256; digit++) {
+			for (int t = 0; t < threads; t++) {
+				unsigned int n = bh_histogram[t * 256 + digit];
+
+				bh_histogram[t * 256 + digit] = offset;
+				offset += n;
+			}
+		}
+
+		parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+			unsigned int* cursor = bh_histogram.data() + chunk * 256;
+
+			for (unsigned int i = begin; i < end; i++) {
+				unsigned int slot = cursor[(bh_codes[i] >> shift) & 0xFF]++;
+
+				bh_scratch_codes[slot] = bh_codes[i];
+				bh_scratch_indices[slot] = bh_indices[i];
+			}
+		});
+
+		bh_codes.swap(bh_scratch_codes);
+		bh_indices.swap(bh_scratch_indices);
+	}
+}
+
+static unsigned int bh_quadrant_end(unsigned int begin, unsigned int end, int level, unsigned int quadrant) {
+	/* Codes are sorted, so within a node the two bits for the next level never decrease. */
+	int shift = 30 - 2 * level;
+
+	return (unsigned int) (std::upper_bound(bh_codes.begin() + begin, bh_codes.begin() + end, quadrant, [shift](unsigned int q, unsigned int code) {
+		return q < ((code >> shift) & 3);
+	}) - bh_codes.begin());
+}
+
+static void bh_make_leaf(bh_node& node, unsigned int begin, unsigned int end) {
+	double x = 0.0, y = 0.0;
+
+	for (unsigned int i = begin; i < end; i++) {
+		x += bh_points[(size_t) i * 2];
+		y += bh_points[(size_t) i * 2 + 1];
+	}
+
+	node.mass = (float) (end - begin);
+	node.com[0] = (float) (x / (end - begin));
+	node.com[1] = (float) (y / (end - begin));
+	node.subtree = 1;
+	node.leaf_first = begin;
+	node.leaf_count = end - begin;
+}
+
+static void bh_finish_internal(std::vector<bh_node>& out, unsigned int index, const unsigned int* children, int child_count) {
+	double x = 0.0, y = 0.0, mass = 0.0;
+
+	for (int c = 0; c < child_count; c++) {
+		const bh_node& child = out[children[c]];
+
+		x += (double) child.com[0] * child.mass;
+		y += (double) child.com[1] * child.mass;
+		mass += child.mass;
+	}
+
+	bh_node& node = out[index];
+
+	node.mass = (float) mass;
+	node.com[0] = (float) (x / mass);
+	node.com[1] = (float) (y / mass);
+	node.subtree = (unsigned int) out.size() - index;
+	node.leaf_first = 0;
+	node.leaf_count = 0;
+}
+
+static void bh_build_range(std::vector<bh_node>& out, unsigned int begin, unsigned int end, int level) {
+	unsigned int index = (unsigned int) out.size();
+
+	bh_node node;
+	node.size = bh_root[2] / (float) (1 << level);
+	out.push_back(node);
+
+	if (end - begin <= BH_LEAF_SIZE || level == BH_MAX_LEVEL) {
+		bh_make_leaf(out[index], begin, end);
+		return;
+	}
+
+	unsigned int children[4];
+	int child_count = 0;
+
+	for (unsigned int quadrant = 0; quadrant < 4 && begin < end; quadrant++) {
+		unsigned int split = bh_quadrant_end(begin, end, level, quadrant);
+
+		if (split > begin) {
+			children[child_count++] = (unsigned int) out.size();
+			bh_build_range(out, begin, split, level + 1);
+		}
+
+		begin = split;
+	}
+
+	bh_finish_internal(out, index, children, child_count);
+}
+
+static void bh_assemble(std::vector<std::vector<bh_node> >& tasks, unsigned int begin, unsigned int end, int level, unsigned int prefix) {
+	/* Emits the top of the tree serially, splicing in the subtrees that were built in parallel. */
+	if (level == BH_SPLIT_LEVEL) {
+		bh_nodes.insert(bh_nodes.end(), tasks[prefix].begin(), tasks[prefix].end());
+		return;
+	}
+
+	if (end - begin <= BH_LEAF_SIZE) {
+		bh_build_range(bh_nodes, begin, end, level);
+		return;
+	}
+
+	unsigned int index = (unsigned int) bh_nodes.size();
+
+	bh_node node;
+	node.size = bh_root[2] / (float) (1 << level);
+	bh_nodes.push_back(node);
+
+	unsigned int children[4];
+	int child_count = 0;
+
+	for (unsigned int quadrant = 0; quadrant < 4 && begin < end; quadrant++) {
+		unsigned int split = bh_quadrant_end(begin, end, level, quadrant);
+
+		if (split > begin) {
+			children[child_count++] = (unsigned int) bh_nodes.size();
+			bh_assemble(tasks, begin, split, level + 1, prefix * 4 + quadrant);
+		}
+
+		begin = split;
+	}
+
+	bh_finish_internal(bh_nodes, index, children, child_count);
+}
+
+bool bh_tree_build(const float* particles, unsigned int count, unsigned int stride) {
+	bh_nodes.clear();
+
+	if (!count) {
+		return false;
+	}
+
+	bh_compute_bounds(particles, count, stride);
+
+	bh_codes.resize(count);
+	bh_indices.resize(count);
+	bh_points.resize((size_t) count * 2);
+
+	float scale = 65536.0f / bh_root[2];
+
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int i = begin; i < end; i++) {
+			const float* p = particles + (size_t) i * stride;
+
+			unsigned int x = (unsigned int) std::min((p[0] - bh_root[0]) * scale, 65535.0f);
+			unsigned int y = (unsigned int) std::min((p[1] - bh_root[1]) * scale, 65535.0f);
+
+			bh_codes[i] = bh_spread(x) | (bh_spread(y) << 1);
+			bh_indices[i] = i;
+		}
+	});
+
+	bh_sort(count);
+
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int i = begin; i < end; i++) {
+			const float* p = particles + (size_t) bh_indices[i] * stride;
+
+			bh_points[(size_t) i * 2] = p[0];
+			bh_points[(size_t) i * 2 + 1] = p[1];
+		}
+	});
+
+	/* The subtree at top-level prefix p covers codes [p << shift, (p + 1) << shift). */
+	const unsigned int task_count = 1 << (2 * BH_SPLIT_LEVEL);
+	const int task_shift = 32 - 2 * BH_SPLIT_LEVEL;
+
+	std::vector<unsigned int> task_begin(task_count + 1);
+
+	for (unsigned int t = 0; t < task_count; t++) {
+		task_begin[t] = (unsigned int) (std::lower_bound(bh_codes.begin(), bh_codes.end(), t << task_shift) - bh_codes.begin());
+	}
+
+	task_begin[task_count] = count;
+
+	std::vector<std::vector<bh_node> > tasks(task_count);
+
+	parallel_for(task_count, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int t = begin; t < end; t++) {
+			if (task_begin[t] < task_begin[t + 1]) {
+				bh_build_range(tasks[t], task_begin[t], task_begin[t + 1], BH_SPLIT_LEVEL);
+			}
+		}
+	});
+
+	bh_assemble(tasks, 0, count, 0, 0);
+	return true;
+}
+
+unsigned int bh_tree_node_count(void) {
+	return (unsigned int) bh_nodes.size();
+}
+
+const bh_node* bh_tree_nodes(void) {
+	return bh_nodes.data();
+}
+
+const float* bh_tree_points(void) {
+	return bh_points.data();
+}
+
+void bh_tree_pack(float* texels) {
+	parallel_for((unsigned int) bh_nodes.size(), [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int i = begin; i < end; i++) {
+			const bh_node& node = bh_nodes[i];
+			float* t = texels + (size_t) i * 8;
+
+			t[0] = node.com[0];
+			t[1] = node.com[1];
+			t[2] = node.mass;
+			t[3] = node.size;
+			t[4] = (float) (i + node.subtree);
+			t[5] = (float) node.leaf_first;
+			t[6] = (float) node.leaf_count;
+			t[7] = 0.0f;
+		}
+	});
+}
+
+void bh_tree_force(float x, float y, float theta, float softening, float* force) {
+	float theta_sq = theta * theta;
+	float soft_sq = softening * softening;
+	float fx = 0.0f, fy = 0.0f;
+
+	unsigned int count = (unsigned int) bh_nodes.size();
+	unsigned int i = 0;
+
+	while (i < count) {
+		const bh_node& node = bh_nodes[i];
+
+		float dx = node.com[0] - x;
+		float dy = node.com[1] - y;
+		float dist_sq = dx * dx + dy * dy + soft_sq;
+
+		if (node.size * node.size < theta_sq * dist_sq) {
+			/* Far enough away to treat the whole node as one mass. */
+			float inv = 1.0f / sqrtf(dist_sq);
+			float weight = node.mass * inv * inv * inv;
+
+			fx += dx * weight;
+			fy += dy * weight;
+		} else if (node.leaf_count) {
+			for (unsigned int p = node.leaf_first; p < node.leaf_first + node.leaf_count; p++) {
+				float px = bh_points[(size_t) p * 2] - x;
+				float py = bh_points[(size_t) p * 2 + 1] - y;
+				float inv = 1.0f / sqrtf(px * px + py * py + soft_sq);
+				float weight = inv * inv * inv;
+
+				fx += px * weight;
+				fy += py * weight;
+			}
+		} else {
+			i++; // Open the node.
+			continue;
+		}
+
+		i += node.subtree;
+	}
+
+	force[0] = fx;
+	force[1] = fy;
+}
+
+void bh_direct_force(const float* particles, unsigned int count, unsigned int stride, float x, float y, float softening, float* force) {
+	float soft_sq = softening * softening;
+	double fx = 0.0, fy = 0.0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const float* p = particles + (size_t) i * stride;
+
+		float dx = p[0] - x;
+		float dy = p[1] - y;
+		float inv = 1.0f / sqrtf(dx * dx + dy * dy + soft_sq);
+		float weight = inv * inv * inv;
+
+		fx += dx * weight;
+		fy += dy * weight;
+	}
+
+	force[0] = (float) fx;
+	force[1] = (float) fy;
+}
+
+void bh_tree_validate(const float* particles, unsigned int count, unsigned int stride, float theta, float softening, unsigned int samples,
+	float* mean_error, float* max_error) {
+	if (samples > count) {
+		samples = count;
+	}
+
+	std::vector<float> errors(samples, 0.0f);
+
+	parallel_for(samples, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int s = begin; s < end; s++) {
+			const float* p = particles + (size_t) ((unsigned long long) s * count / samples) * stride;
+
+			float approx[2], exact[2];
+
+			bh_tree_force(p[0], p[1], theta, softening, approx);
+			bh_direct_force(particles, count, stride, p[0], p[1], softening, exact);
+
+			float magnitude = sqrtf(exact[0] * exact[0] + exact[1] * exact[1]);
+			float dx = approx[0] - exact[0], dy = approx[1] - exact[1];
+
+			errors[s] = magnitude > 0.0f ? sqrtf(dx * dx + dy * dy) / magnitude : 0.0f;
+		}
+	});
+
+	float sum = 0.0f, worst = 0.0f;
+
+	for (unsigned int s = 0; s < samples; s++) {
+		sum += errors[s];
+		worst = std::max(worst, errors[s]);
+	}
+
+	*mean_error = samples ? sum / samples : 0.0f;
+	*max_error = worst;
+}
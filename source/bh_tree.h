@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * Barnes-Hut quadtree for particle-particle gravity.
+ *
+ * The tree is built on the worker pool (see parallel.h) : Morton codes, a parallel radix sort, then one subtree per top-level quadrant
+ *	built independently and stitched together. Nodes are stored flat in depth-first order, and each node records the size of its subtree,
+ *	so a traversal can either step into a node (index + 1) or skip it (index + subtree) without a stack. That is what lets the advance
+ *	shader walk the tree out of a texture buffer.
+ *
+ * Every particle has unit mass, scale the gravitation constant by the particle count to taste.
+ */
+
+struct bh_node {
+	float com[2]; // Centre of mass.
+	float mass; // Number of particles below this node.
+	float size; // Edge length of the node's square.
+	unsigned int subtree; // Nodes in this subtree including this one.
+	unsigned int leaf_first; // First point of a leaf in bh_tree_points().
+	unsigned int leaf_count; // Points in a leaf, 0 for internal nodes.
+};
+
+/* Particles are read as (x, y) pairs every stride floats, so GPU-layout (x, y, vx, vy) state can be passed with a stride of 4. */
+bool bh_tree_build(const float* particles, unsigned int count, unsigned int stride);
+
+unsigned int bh_tree_node_count(void);
+const bh_node* bh_tree_nodes(void);
+const float* bh_tree_points(void); // (x, y) of every particle, in tree order.
+
+/* Two RGBA32F texels per node : (com.x, com.y, mass, size) and (next node, leaf_first, leaf_count, 0). */
+void bh_tree_pack(float* texels);
+
+/* Acceleration at (x, y) for unit gravitation, approximated through the tree with opening angle theta. */
+void bh_tree_force(float x, float y, float theta, float softening, float* force);
+
+/* Exact O(n) sum over every particle, the reference the tree is validated against. */
+void bh_direct_force(const float* particles, unsigned int count, unsigned int stride, float x, float y, float softening, float* force);
+
+/* Compares the tree against the direct sum at `samples` evenly spaced particles. Errors are relative to the direct force magnitude. */
+void bh_tree_validate(const float* particles, unsigned int count, unsigned int stride, float theta, float softening, unsigned int samples,
+	float* mean_error, float* max_error);
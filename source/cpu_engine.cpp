@@ -0,0 +1,664 @@
+/*
+ * CPU simulation engine implementation. See cpu_engine.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "parallel.h"
+#include "bh_tree.h"
+#include "forces.h"
+#include "variants.h"
+#include "cpu_engine.h"
+
+/* These must match the constants in SHADER_ADVANCE_VS. */
+#define CPU_BOUNCE_DECAY 1.5f
+#define CPU_GRAVITATION 0.0001f
+#define CPU_SPEED_DECAY 1.01f
+
+/* Must match the floor contact distance in SHADER_SLEEP_VS. */
+#define CPU_FLOOR_CONTACT 0.001f
+
+static std::vector<float> cpu_particles;
+static std::vector<float> cpu_forces; // Neighbor force per particle, applied during the advance like the GPU path does.
+static float cpu_camera_bounds[4] = {0.0f};
+
+static bool cpu_neighbor_enabled = false;
+static float cpu_neighbor_radius = 0.004f;
+static float cpu_neighbor_strength = 0.00002f;
+
+static bool cpu_bounds_wrap = false;
+
+static int cpu_integrator = INTEGRATOR_EULER;
+static float cpu_integrator_dt = 1.0f;
+static float cpu_integrator_tolerance = 0.0002f;
+static int cpu_integrator_max_substeps = 8;
+
+static bool cpu_nbody_enabled = false;
+static bool cpu_nbody_direct = false;
+static float cpu_nbody_theta = 0.5f;
+static float cpu_nbody_gravitation = 0.0f;
+static float cpu_nbody_softening = 0.01f;
+
+/* Uniform grid, rebuilt every step. */
+static int cpu_grid_width = 0;
+static int cpu_grid_height = 0;
+static std::vector<unsigned int> cpu_grid_cell; // Cell of each particle.
+static std::vector<unsigned int> cpu_grid_sorted_cell; // Cell of each particle after the sort.
+static std::vector<unsigned int> cpu_grid_histogram; // Per-thread cell counts, turned into per-thread write offsets.
+static std::vector<unsigned int> cpu_grid_start; // First particle of each cell, plus one past the end.
+static std::vector<float> cpu_grid_sorted; // Particles in cell order, swapped with cpu_particles once the sort is done.
+
+/* Halo : positions of particles owned elsewhere (see domain.h), in their own small grid with the same cells. They push ours in the
+ *	neighbor stage and are never advanced. */
+static std::vector<float> cpu_halo;
+static std::vector<float> cpu_halo_sorted;
+static std::vector<unsigned int> cpu_halo_start;
+
+/* Sleeping particles. cpu_sleep_awake is permuted along with the particles by the neighbor sort, cpu_sleep_active lists the awake ones. */
+static bool cpu_sleep_enabled = false;
+static float cpu_sleep_speed = 0.0f;
+static float cpu_sleep_force = 0.0f;
+static int cpu_sleep_interval = 30;
+static int cpu_sleep_counter = 0;
+static bool cpu_sleep_wake = false;
+static std::vector<unsigned char> cpu_sleep_awake;
+static std::vector<unsigned char> cpu_sleep_sorted;
+static std::vector<unsigned int> cpu_sleep_active;
+static std::vector<std::vector<unsigned int> > cpu_sleep_chunks;
+static unsigned int cpu_sleep_live = 0;
+
+static cpu_engine_timings cpu_timings;
+
+static float cpu_elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool cpu_engine_initialize(unsigned int count, const float* camera_bounds) {
+	cpu_particles.assign((size_t) count * 4, 0.0f);
+	cpu_forces.assign((size_t) count * 2, 0.0f);
+	cpu_sleep_awake.assign(count, 1);
+	cpu_sleep_active.clear();
+	cpu_sleep_live = 0;
+
+	memcpy(cpu_camera_bounds, camera_bounds, sizeof cpu_camera_bounds);
+	memset(&cpu_timings, 0, sizeof cpu_timings);
+
+	cpu_engine_set_neighbors(cpu_neighbor_enabled, cpu_neighbor_radius, cpu_neighbor_strength);
+
+	return true;
+}
+
+void cpu_engine_shutdown(void) {
+	std::vector<float>().swap(cpu_particles);
+	std::vector<float>().swap(cpu_forces);
+	std::vector<unsigned int>().swap(cpu_grid_cell);
+	std::vector<unsigned int>().swap(cpu_grid_sorted_cell);
+	std::vector<unsigned int>().swap(cpu_grid_histogram);
+	std::vector<unsigned int>().swap(cpu_grid_start);
+	std::vector<float>().swap(cpu_grid_sorted);
+	std::vector<float>().swap(cpu_halo);
+	std::vector<float>().swap(cpu_halo_sorted);
+	std::vector<unsigned int>().swap(cpu_halo_start);
+	std::vector<unsigned char>().swap(cpu_sleep_awake);
+	std::vector<unsigned char>().swap(cpu_sleep_sorted);
+	std::vector<unsigned int>().swap(cpu_sleep_active);
+}
+
+float* cpu_engine_particles(void) {
+	return cpu_particles.data();
+}
+
+unsigned int cpu_engine_count(void) {
+	return (unsigned int) (cpu_particles.size() / 4);
+}
+
+void cpu_engine_set_neighbors(bool enabled, float radius, float strength) {
+	cpu_neighbor_enabled = enabled;
+	cpu_neighbor_radius = radius;
+	cpu_neighbor_strength = strength;
+
+	/* Cells are one interaction radius wide, so every neighbor of a particle is in the 3x3 block around its cell. */
+	cpu_grid_width = (int) ceilf((cpu_camera_bounds[1] - cpu_camera_bounds[0]) / radius);
+	cpu_grid_height = (int) ceilf((cpu_camera_bounds[3] - cpu_camera_bounds[2]) / radius);
+
+	if (cpu_grid_width < 1) cpu_grid_width = 1;
+	if (cpu_grid_height < 1) cpu_grid_height = 1;
+
+	if (!enabled && !cpu_nbody_enabled) {
+		std::fill(cpu_forces.begin(), cpu_forces.end(), 0.0f);
+	}
+}
+
+void cpu_engine_set_nbody(bool enabled, float theta, float gravitation, float softening, bool direct) {
+	cpu_nbody_enabled = enabled;
+	cpu_nbody_theta = theta;
+	cpu_nbody_gravitation = gravitation;
+	cpu_nbody_softening = softening;
+	cpu_nbody_direct = direct;
+
+	if (!enabled && !cpu_neighbor_enabled) {
+		std::fill(cpu_forces.begin(), cpu_forces.end(), 0.0f);
+	}
+}
+
+void cpu_engine_set_sleep(bool enabled, float speed, float force, int interval) {
+	cpu_sleep_enabled = enabled;
+	cpu_sleep_speed = speed;
+	cpu_sleep_force = force;
+	cpu_sleep_interval = interval < 1 ? 1 : interval;
+	cpu_sleep_counter = 0;
+
+	std::fill(cpu_sleep_awake.begin(), cpu_sleep_awake.end(), 1);
+}
+
+void cpu_engine_set_bounds(bool wrap) {
+	cpu_bounds_wrap = wrap;
+}
+
+void cpu_engine_set_integrator(int integrator, float dt, float tolerance, int max_substeps) {
+	cpu_integrator = integrator >= 0 && integrator < INTEGRATORS ? integrator : INTEGRATOR_EULER;
+	cpu_integrator_dt = dt;
+	cpu_integrator_tolerance = tolerance;
+	cpu_integrator_max_substeps = max_substeps < 1 ? 1 : max_substeps;
+}
+
+void cpu_engine_set_halo(const float* positions, unsigned int count) {
+	cpu_halo.assign(positions, positions + (size_t) count * 2);
+}
+
+void cpu_engine_wake(void) {
+	cpu_sleep_wake = true;
+}
+
+float cpu_engine_active_fraction(void) {
+	if (!cpu_sleep_enabled || !cpu_sleep_live) {
+		return 1.0f;
+	}
+
+	return (float) cpu_sleep_active.size() / (float) cpu_sleep_live;
+}
+
+static void cpu_engine_build_grid(unsigned int count) {
+	unsigned int cells = (unsigned int) (cpu_grid_width * cpu_grid_height);
+	int threads = parallel_thread_count();
+
+	cpu_grid_cell.resize(count);
+	cpu_grid_sorted_cell.resize(count);
+	cpu_grid_sorted.resize(cpu_particles.size());
+	cpu_sleep_sorted.resize(cpu_sleep_awake.size());
+	cpu_grid_start.resize(cells + 1);
+	cpu_grid_histogram.assign((size_t) cells * threads, 0);
+
+	float inv_radius = 1.0f / cpu_neighbor_radius;
+
+	/* Pass 1 : cell of every particle and a private histogram per thread. */
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		unsigned int* histogram = cpu_grid_histogram.data() + (size_t) chunk * cells;
+
+		for (unsigned int i = begin; i < end; i++) {
+			const float* particle = cpu_particles.data() + (size_t) i * 4;
+
+			int cx = (int) floorf((particle[0] - cpu_camera_bounds[0]) * inv_radius);
+			int cy = (int) floorf((particle[1] - cpu_camera_bounds[2]) * inv_radius);
+
+			cx = cx < 0 ? 0 : (cx >= cpu_grid_width ? cpu_grid_width - 1 : cx);
+			cy = cy < 0 ? 0 : (cy >= cpu_grid_height ? cpu_grid_height - 1 : cy);
+
+			unsigned int cell = (unsigned int) (cy * cpu_grid_width + cx);
+
+			cpu_grid_cell[i] = cell;
+			histogram[cell]++;
+		}
+	});
+
+	/* Pass 2 : exclusive prefix sum over (cell, thread), so each thread gets its own write cursor inside every cell. */
+	unsigned int offset = 0;
+
+	for (unsigned int cell = 0; cell < cells; cell++) {
+		cpu_grid_start[cell] = offset;
+
+		for (int t = 0; t < threads; t++) {
+			unsigned int* slot = cpu_grid_histogram.data() + (size_t) t * cells + cell;
+			unsigned int n = *slot;
+
+			*slot = offset;
+			offset += n;
+		}
+	}
+
+	cpu_grid_start[cells] = offset;
+
+	/* Pass 3 : stable scatter of the particles themselves. parallel_for hands out the same chunks as in pass 1, so the cursors line up.
+	 *	Draw order doesn't matter with additive blending, so the sorted copy simply becomes the particle state. Since particles barely move
+	 *	between steps the previous order is almost sorted already, which keeps this scatter close to a linear copy. */
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		unsigned int* cursor = cpu_grid_histogram.data() + (size_t) chunk * cells;
+
+		for (unsigned int i = begin; i < end; i++) {
+			unsigned int cell = cpu_grid_cell[i];
+			unsigned int slot = cursor[cell]++;
+
+			memcpy(cpu_grid_sorted.data() + (size_t) slot * 4, cpu_particles.data() + (size_t) i * 4, sizeof(float) * 4);
+			cpu_grid_sorted_cell[slot] = cell;
+			cpu_sleep_sorted[slot] = cpu_sleep_awake[i];
+		}
+	});
+
+	/* Particles past count were not sorted, carry them over untouched. */
+	std::copy(cpu_particles.begin() + (size_t) count * 4, cpu_particles.end(), cpu_grid_sorted.begin() + (size_t) count * 4);
+	std::copy(cpu_sleep_awake.begin() + count, cpu_sleep_awake.end(), cpu_sleep_sorted.begin() + count);
+
+	cpu_particles.swap(cpu_grid_sorted);
+	cpu_sleep_awake.swap(cpu_sleep_sorted);
+}
+
+static void cpu_engine_build_halo_grid(void) {
+	/* A serial counting sort, the halo is a thin strip along the domain edges. Empty cells cost the prefix sum either way. */
+	unsigned int cells = (unsigned int) (cpu_grid_width * cpu_grid_height);
+	unsigned int count = (unsigned int) (cpu_halo.size() / 2);
+	float inv_radius = 1.0f / cpu_neighbor_radius;
+
+	std::vector<unsigned int> cell_of(count);
+	cpu_halo_start.assign(cells + 1, 0);
+	cpu_halo_sorted.resize(cpu_halo.size());
+
+	for (unsigned int i = 0; i < count; i++) {
+		int cx = (int) floorf((cpu_halo[i * 2] - cpu_camera_bounds[0]) * inv_radius);
+		int cy = (int) floorf((cpu_halo[i * 2 + 1] - cpu_camera_bounds[2]) * inv_radius);
+
+		cx = cx < 0 ? 0 : (cx >= cpu_grid_width ? cpu_grid_width - 1 : cx);
+		cy = cy < 0 ? 0 : (cy >= cpu_grid_height ? cpu_grid_height - 1 : cy);
+
+		cell_of[i] = (unsigned int) (cy * cpu_grid_width + cx);
+		cpu_halo_start[cell_of[i] + 1]++;
+	}
+
+	for (unsigned int cell = 0; cell < cells; cell++) {
+		cpu_halo_start[cell + 1] += cpu_halo_start[cell];
+	}
+
+	std::vector<unsigned int> cursor(cpu_halo_start.begin(), cpu_halo_start.end() - 1);
+
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int slot = cursor[cell_of[i]]++;
+
+		cpu_halo_sorted[slot * 2] = cpu_halo[i * 2];
+		cpu_halo_sorted[slot * 2 + 1] = cpu_halo[i * 2 + 1];
+	}
+}
+
+static inline void cpu_engine_repel(float px, float py, const float* others, unsigned int stride, unsigned int first, unsigned int last,
+	float radius, float strength, float* fx, float* fy) {
+	for (unsigned int other = first; other < last; other++) {
+		float dx = px - others[(size_t) other * stride];
+		float dy = py - others[(size_t) other * stride + 1];
+		float dist_sq = dx * dx + dy * dy;
+
+		if (dist_sq >= radius * radius || dist_sq < 1e-12f) {
+			continue; // Out of range, or ourselves (or an exact overlap with no direction to push in).
+		}
+
+		float dist = sqrtf(dist_sq);
+		float weight = strength * (1.0f - dist / radius) / dist;
+
+		*fx += dx * weight;
+		*fy += dy * weight;
+	}
+}
+
+static void cpu_engine_neighbor_forces(unsigned int count) {
+	float radius = cpu_neighbor_radius;
+	float strength = cpu_neighbor_strength;
+	bool halo = !cpu_halo.empty();
+
+	if (halo) {
+		cpu_engine_build_halo_grid();
+	}
+
+	/* Particles are in cell order now, so neighbors of consecutive particles are in the same few cells. */
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		const float* particles = cpu_particles.data();
+		const float* halo_particles = cpu_halo_sorted.data();
+
+		for (unsigned int i = begin; i < end; i++) {
+			unsigned int cell = cpu_grid_sorted_cell[i];
+
+			int cx = (int) (cell % cpu_grid_width);
+			int cy = (int) (cell / cpu_grid_width);
+
+			float px = particles[(size_t) i * 4];
+			float py = particles[(size_t) i * 4 + 1];
+			float fx = 0.0f, fy = 0.0f;
+
+			for (int ny = cy - 1; ny <= cy + 1; ny++) {
+				if (ny < 0 || ny >= cpu_grid_height) continue;
+
+				/* The three cells of a row are contiguous in sorted order. */
+				int first_x = cx > 0 ? cx - 1 : cx;
+				int last_x = cx < cpu_grid_width - 1 ? cx + 1 : cx;
+
+				unsigned int first = cpu_grid_start[ny * cpu_grid_width + first_x];
+				unsigned int last = cpu_grid_start[ny * cpu_grid_width + last_x + 1];
+
+				cpu_engine_repel(px, py, particles, 4, first, last, radius, strength, &fx, &fy);
+
+				if (halo) {
+					first = cpu_halo_start[ny * cpu_grid_width + first_x];
+					last = cpu_halo_start[ny * cpu_grid_width + last_x + 1];
+
+					cpu_engine_repel(px, py, halo_particles, 2, first, last, radius, strength, &fx, &fy);
+				}
+			}
+
+			cpu_forces[(size_t) i * 2] = fx;
+			cpu_forces[(size_t) i * 2 + 1] = fy;
+		}
+	});
+}
+
+static void cpu_engine_nbody_forces(unsigned int count, bool accumulate) {
+	const float* particles = cpu_particles.data();
+
+	if (!cpu_nbody_direct) {
+		bh_tree_build(particles, count, 4);
+	}
+
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int i = begin; i < end; i++) {
+			const float* p = particles + (size_t) i * 4;
+			float* f = cpu_forces.data() + (size_t) i * 2;
+			float acceleration[2];
+
+			if (cpu_nbody_direct) {
+				bh_direct_force(particles, count, 4, p[0], p[1], cpu_nbody_softening, acceleration);
+			} else {
+				bh_tree_force(p[0], p[1], cpu_nbody_theta, cpu_nbody_softening, acceleration);
+			}
+
+			if (!accumulate) {
+				f[0] = f[1] = 0.0f;
+			}
+
+			f[0] += acceleration[0] * cpu_nbody_gravitation;
+			f[1] += acceleration[1] * cpu_nbody_gravitation;
+		}
+	});
+}
+
+static inline void cpu_engine_external_force(const float* p, const forces_attractor* attractors, unsigned int attractor_count, bool field, float* force) {
+	/* Attractors and the field, summed before they touch the velocity, same order as the advance shader. */
+	float ax = 0.0f, ay = 0.0f;
+
+	for (unsigned int a = 0; a < attractor_count; a++) {
+		float dx = attractors[a].position[0] - p[0];
+		float dy = attractors[a].position[1] - p[1];
+		float dist_sq = dx * dx + dy * dy;
+
+		float pull = attractors[a].strength * CPU_GRAVITATION / (sqrtf(std::max(dist_sq, 1e-12f)) * (dist_sq + attractors[a].softening));
+
+		ax += dx * pull;
+		ay += dy * pull;
+	}
+
+	force[0] = ax;
+	force[1] = ay;
+
+	if (field) {
+		float push[2];
+		forces_sample_field(p[0], p[1], push);
+
+		force[2] = push[0];
+		force[3] = push[1];
+	} else {
+		force[2] = force[3] = 0.0f;
+	}
+}
+
+static void cpu_engine_update_sleep(unsigned int count, bool evaluate) {
+	/* With evaluate set every particle is re-judged, otherwise the active list is just rebuilt from the flags (after the neighbor sort moved them). */
+	const float* bounds = cpu_camera_bounds;
+	const forces_attractor* attractors = forces_attractors();
+	unsigned int attractor_count = forces_attractor_count();
+	bool field = forces_field() != NULL;
+
+	float speed_sq = cpu_sleep_speed * cpu_sleep_speed;
+	float force_sq = cpu_sleep_force * cpu_sleep_force;
+
+	cpu_sleep_chunks.resize(parallel_thread_count());
+
+	parallel_for(count, [&](unsigned int begin, unsigned int end, int chunk) {
+		std::vector<unsigned int>& active = cpu_sleep_chunks[chunk];
+		active.clear();
+
+		for (unsigned int i = begin; i < end; i++) {
+			float* p = cpu_particles.data() + (size_t) i * 4;
+
+			if (evaluate) {
+				float external[4];
+				cpu_engine_external_force(p, attractors, attractor_count, field, external);
+
+				float fx = external[0] + external[2] + cpu_forces[(size_t) i * 2];
+				float fy = external[1] + external[3] + cpu_forces[(size_t) i * 2 + 1];
+
+				/* Gravity counts unless the floor is holding the particle up. */
+				if (p[1] > bounds[2] + CPU_FLOOR_CONTACT) {
+					fy -= 0.0001f;
+				}
+
+				bool awake = p[2] * p[2] + p[3] * p[3] > speed_sq || fx * fx + fy * fy > force_sq;
+
+				if (!awake && cpu_sleep_awake[i]) {
+					p[2] = p[3] = 0.0f; // Falling asleep, come to a full stop.
+				}
+
+				cpu_sleep_awake[i] = awake;
+			}
+
+			if (cpu_sleep_awake[i]) {
+				active.push_back(i);
+			}
+		}
+	});
+
+	cpu_sleep_active.clear();
+
+	for (size_t c = 0; c < cpu_sleep_chunks.size(); c++) {
+		cpu_sleep_active.insert(cpu_sleep_active.end(), cpu_sleep_chunks[c].begin(), cpu_sleep_chunks[c].end());
+	}
+
+	cpu_sleep_live = count;
+}
+
+static inline float cpu_engine_wrap(float x, float low, float high) {
+	/* Same as the shader's mod(), the result is always inside [low, high). */
+	float span = high - low;
+	return low + (x - low) - floorf((x - low) / span) * span;
+}
+
+static inline void cpu_engine_position_force(const float* p, const forces_attractor* attractors, unsigned int attractor_count, bool field, float* force) {
+	/* What position_force() in the shader sums : everything Verlet has to evaluate again after moving. */
+	float external[4];
+	cpu_engine_external_force(p, attractors, attractor_count, field, external);
+
+	force[0] = external[0] + external[2];
+	force[1] = external[1] + external[3];
+}
+
+/* One advance kernel per combination of VARIANT_CPU_FEATURES and integrator, like the shader variants. The feature tests are on template
+ *	arguments so the compiler drops the dead stages and their loads from each instantiation. VARIANT_NEIGHBORS stands for the per-particle
+ *	force buffer here, which the n-body stage writes too. Like the shader, that force is held over the whole step. */
+template <unsigned int features, int integrator>
+static void cpu_engine_advance_variant(unsigned int count) {
+	const float* bounds = cpu_camera_bounds;
+	const forces_attractor* attractors = forces_attractors();
+	unsigned int attractor_count = (features & VARIANT_ATTRACTORS) ? forces_attractor_count() : 0;
+	const bool positional = (features & (VARIANT_ATTRACTORS | VARIANT_FIELD)) != 0;
+	const bool field = (features & VARIANT_FIELD) != 0;
+
+	float dt = cpu_integrator_dt;
+	float step_decay = dt == 1.0f ? CPU_SPEED_DECAY : powf(CPU_SPEED_DECAY, dt);
+	float tolerance = cpu_integrator_tolerance;
+	int max_substeps = cpu_integrator_max_substeps;
+
+	/* Sleeping particles are left out of the dispatch entirely, we walk the compacted list of awake ones instead. */
+	const unsigned int* active = cpu_sleep_enabled ? cpu_sleep_active.data() : NULL;
+	unsigned int dispatch = cpu_sleep_enabled ? (unsigned int) cpu_sleep_active.size() : count;
+
+	parallel_for(dispatch, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int k = begin; k < end; k++) {
+			unsigned int i = active ? active[k] : k;
+
+			float* p = cpu_particles.data() + (size_t) i * 4;
+
+			if (integrator == INTEGRATOR_EULER) {
+				p[3] -= CPU_GRAVITATION * dt;
+			}
+
+			if (features & VARIANT_BOUNDS_WRAP) {
+				p[0] = cpu_engine_wrap(p[0], bounds[0], bounds[1]);
+				p[1] = cpu_engine_wrap(p[1], bounds[2], bounds[3]);
+			} else {
+				if (p[0] <= bounds[0]) { p[0] = bounds[0]; p[2] = -p[2] / CPU_BOUNCE_DECAY; }
+				if (p[0] >= bounds[1]) { p[0] = bounds[1]; p[2] = -p[2] / CPU_BOUNCE_DECAY; }
+				if (p[1] <= bounds[2]) { p[1] = bounds[2]; p[3] = -p[3] / CPU_BOUNCE_DECAY; }
+				if (p[1] >= bounds[3]) { p[1] = bounds[3]; p[3] = -p[3] / CPU_BOUNCE_DECAY; }
+			}
+
+			float held[2] = {0.0f, 0.0f};
+
+			if (features & VARIANT_NEIGHBORS) {
+				held[0] = cpu_forces[(size_t) i * 2];
+				held[1] = cpu_forces[(size_t) i * 2 + 1];
+			}
+
+			float force[2] = {0.0f, 0.0f};
+
+			if (positional) {
+				cpu_engine_position_force(p, attractors, attractor_count, field, force);
+			}
+
+			if (integrator == INTEGRATOR_EULER) {
+				p[2] = (p[2] + (force[0] + held[0]) * dt) / step_decay;
+				p[3] = (p[3] + (force[1] + held[1]) * dt) / step_decay;
+
+				p[0] += p[2] * dt;
+				p[1] += p[3] * dt;
+				continue;
+			}
+
+			/* Velocity Verlet, see SHADER_ADVANCE_VS. Gravity joins the held force. */
+			held[1] -= CPU_GRAVITATION;
+
+			float ax = force[0] + held[0];
+			float ay = force[1] + held[1];
+			int substeps = 1;
+
+			if (integrator == INTEGRATOR_ADAPTIVE) {
+				float needed = ceilf(dt * sqrtf(sqrtf(ax * ax + ay * ay) / (2.0f * tolerance)));
+				substeps = needed < 1.0f ? 1 : (needed > (float) max_substeps ? max_substeps : (int) needed);
+			}
+
+			float h = dt / (float) substeps;
+
+			for (int substep = 0; substep < substeps; substep++) {
+				p[0] += p[2] * h + ax * (0.5f * h * h);
+				p[1] += p[3] * h + ay * (0.5f * h * h);
+
+				if (positional) {
+					cpu_engine_position_force(p, attractors, attractor_count, field, force);
+				}
+
+				float next_ax = force[0] + held[0];
+				float next_ay = force[1] + held[1];
+
+				p[2] += (ax + next_ax) * (0.5f * h);
+				p[3] += (ay + next_ay) * (0.5f * h);
+
+				ax = next_ax;
+				ay = next_ay;
+			}
+
+			p[2] /= step_decay;
+			p[3] /= step_decay;
+		}
+	});
+}
+
+/* The table is looked up once per step, not per particle : the particle loop is inside each instantiation, so the stages still inline. */
+typedef void (*cpu_advance_kernel)(unsigned int count);
+
+static_assert(VARIANT_CPU_FEATURES == 15, "cpu_advance_kernels is indexed by the low four feature bits");
+
+#define CPU_KERNELS_4(integrator, base) &cpu_engine_advance_variant<base, integrator>, &cpu_engine_advance_variant<base + 1, integrator>, \
+	&cpu_engine_advance_variant<base + 2, integrator>, &cpu_engine_advance_variant<base + 3, integrator>
+#define CPU_KERNELS_16(integrator) {CPU_KERNELS_4(integrator, 0), CPU_KERNELS_4(integrator, 4), CPU_KERNELS_4(integrator, 8), \
+	CPU_KERNELS_4(integrator, 12)}
+
+static const cpu_advance_kernel cpu_advance_kernels[INTEGRATORS][16] = {
+	CPU_KERNELS_16(INTEGRATOR_EULER),
+	CPU_KERNELS_16(INTEGRATOR_VERLET),
+	CPU_KERNELS_16(INTEGRATOR_ADAPTIVE)
+};
+
+static void cpu_engine_advance(unsigned int count) {
+	unsigned int features = 0;
+
+	if (forces_attractor_count()) features |= VARIANT_ATTRACTORS;
+	if (forces_field()) features |= VARIANT_FIELD;
+	if (cpu_neighbor_enabled || cpu_nbody_enabled) features |= VARIANT_NEIGHBORS;
+	if (cpu_bounds_wrap) features |= VARIANT_BOUNDS_WRAP;
+
+	cpu_advance_kernels[cpu_integrator][features](count);
+}
+
+void cpu_engine_step(unsigned int count) {
+	if (count > cpu_engine_count()) {
+		count = cpu_engine_count();
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (cpu_neighbor_enabled) {
+		cpu_engine_build_grid(count);
+		cpu_timings.grid_ms = cpu_elapsed_ms(start);
+
+		start = std::chrono::steady_clock::now();
+		cpu_engine_neighbor_forces(count);
+		cpu_timings.neighbor_ms = cpu_elapsed_ms(start);
+
+		start = std::chrono::steady_clock::now();
+	} else {
+		cpu_timings.grid_ms = cpu_timings.neighbor_ms = 0.0f;
+	}
+
+	if (cpu_nbody_enabled) {
+		cpu_engine_nbody_forces(count, cpu_neighbor_enabled);
+		cpu_timings.nbody_ms = cpu_elapsed_ms(start);
+
+		start = std::chrono::steady_clock::now();
+	} else {
+		cpu_timings.nbody_ms = 0.0f;
+	}
+
+	if (cpu_sleep_enabled) {
+		bool evaluate = cpu_sleep_wake || cpu_sleep_counter++ % cpu_sleep_interval == 0 || count != cpu_sleep_live;
+
+		if (evaluate || cpu_neighbor_enabled) {
+			cpu_engine_update_sleep(count, evaluate);
+		}
+
+		cpu_sleep_wake = false;
+	}
+
+	cpu_engine_advance(count);
+	cpu_timings.advance_ms = cpu_elapsed_ms(start);
+}
+
+const cpu_engine_timings* cpu_engine_last_timings(void) {
+	return &cpu_timings;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * CPU simulation engine.
+ * Mirrors SHADER_ADVANCE_VS on the worker pool (see parallel.h), using the same (x, y, vx, vy) layout as the GPU particle buffers so the
+ *	state can be uploaded as-is. Attractors and the force field come from forces.h, same as for the shader.
+ *
+ * The optional neighbor stage rebuilds a uniform grid every step with a parallel counting sort (per-thread cell histograms, a prefix sum
+ *	and a stable scatter), then applies short range repulsion between particles in adjacent cells. Cost stays O(n) for a fixed density.
+ *	This is exact pairwise repulsion, a different model from the shader's density gradient, so with neighbors on the two don't match.
+ *	The sort reorders the particle array itself, so with neighbors enabled particle indices are not stable between steps. A halo of
+ *	particles owned by another process (see domain.h) can be added, those push but are never advanced.
+ *
+ * The optional n-body stage adds mutual gravity through a Barnes-Hut tree (see bh_tree.h), or through an exact O(n^2) direct sum
+ *	when validating the tree.
+ *
+ * The advance itself is specialized on which stages are in use and on the integrator, see cpu_engine_advance_variant().
+ *
+ * With sleeping enabled, particles that are slow and feel (almost) no force are stopped and dropped from a compacted list of awake
+ *	particles, which is all the advance walks. Every interval steps, or after cpu_engine_wake(), every particle is judged again.
+ */
+
+struct cpu_engine_timings {
+	float grid_ms; // Counting sort.
+	float neighbor_ms; // Pairwise repulsion.
+	float nbody_ms; // Tree build and traversal.
+	float advance_ms; // Integration, bounds and attractor.
+};
+
+bool cpu_engine_initialize(unsigned int count, const float* camera_bounds);
+void cpu_engine_shutdown(void);
+
+float* cpu_engine_particles(void);
+unsigned int cpu_engine_count(void);
+
+void cpu_engine_set_neighbors(bool enabled, float radius, float strength);
+void cpu_engine_set_nbody(bool enabled, float theta, float gravitation, float softening, bool direct);
+void cpu_engine_set_sleep(bool enabled, float speed, float force, int interval);
+void cpu_engine_set_bounds(bool wrap); // Wrap around the camera bounds instead of bouncing off them.
+void cpu_engine_set_integrator(int integrator, float dt, float tolerance, int max_substeps); // INTEGRATOR_* from variants.h, see SHADER_ADVANCE_VS.
+void cpu_engine_set_halo(const float* positions, unsigned int count); // (x, y) of particles owned elsewhere, felt by the neighbor stage only.
+void cpu_engine_wake(void);
+float cpu_engine_active_fraction(void); // Awake share of the particles the last step covered.
+void cpu_engine_step(unsigned int count); // Advances the first count particles.
+
+const cpu_engine_timings* cpu_engine_last_timings(void);
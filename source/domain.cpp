@@ -0,0 +1,399 @@
+#include "domain.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DOMAIN_CONNECT_TIMEOUT_MS 10000
+#define DOMAIN_CONNECT_RETRY_MS 10
+
+enum {
+	DOMAIN_LEFT,
+	DOMAIN_RIGHT,
+	DOMAIN_SIDES
+};
+
+struct domain_peer {
+	int fd; // -1 at the edges of the bounds.
+	std::vector<unsigned char> out;
+	size_t sent;
+	std::vector<unsigned char> in;
+	size_t received;
+	size_t expected; // The header, then the whole message once the header says how long it is.
+};
+
+static domain_config domain_settings;
+static int domain_listener = -1;
+static char domain_listener_path[108];
+static domain_peer domain_peers[DOMAIN_SIDES];
+static std::vector<float> domain_halo;
+static domain_traffic domain_totals;
+
+static void domain_path(int rank, char* path, size_t size) {
+	snprintf(path, size, "/tmp/%s-%d.sock", domain_settings.name, rank);
+}
+
+static int domain_socket(int rank, bool listen_on) {
+	/* The listening or connecting end of the link between rank and rank + 1, listen_on is for rank itself. */
+	int fd;
+
+	if (domain_settings.port) {
+		sockaddr_in address;
+		memset(&address, 0, sizeof address);
+		address.sin_family = AF_INET;
+		address.sin_port = htons((uint16_t) (domain_settings.port + rank));
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0) {
+			return -1;
+		}
+
+		int one = 1;
+
+		if (listen_on) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+			if (bind(fd, (sockaddr*) &address, sizeof address) < 0 || listen(fd, 1) < 0) {
+				close(fd);
+				return -1;
+			}
+		} else {
+			if (connect(fd, (sockaddr*) &address, sizeof address) < 0) {
+				close(fd);
+				return -1;
+			}
+
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+		}
+	} else {
+		sockaddr_un address;
+		memset(&address, 0, sizeof address);
+		address.sun_family = AF_UNIX;
+		domain_path(rank, address.sun_path, sizeof address.sun_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (fd < 0) {
+			return -1;
+		}
+
+		if (listen_on) {
+			unlink(address.sun_path); // Left over from a run that didn't get to clean up.
+
+			if (bind(fd, (sockaddr*) &address, sizeof address) < 0 || listen(fd, 1) < 0) {
+				close(fd);
+				return -1;
+			}
+
+			strcpy(domain_listener_path, address.sun_path);
+		} else if (connect(fd, (sockaddr*) &address, sizeof address) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+bool domain_connect(const domain_config* config) {
+	domain_settings = *config;
+	memset(&domain_totals, 0, sizeof domain_totals);
+
+	for (int side = 0; side < DOMAIN_SIDES; side++) {
+		domain_peers[side].fd = -1;
+	}
+
+	int rank = config->rank;
+
+	/* Listen before connecting, so every rank can get its connect in whatever order the ranks came up : only the accept blocks. */
+	if (rank + 1 < config->ranks) {
+		domain_listener = domain_socket(rank, true);
+
+		if (domain_listener < 0) {
+			printf("[domain_connect] rank %d can't listen : %s\n", rank, strerror(errno));
+			return false;
+		}
+	}
+
+	if (rank > 0) {
+		int waited = 0;
+
+		while ((domain_peers[DOMAIN_LEFT].fd = domain_socket(rank - 1, false)) < 0) {
+			if (waited >= DOMAIN_CONNECT_TIMEOUT_MS) {
+				printf("[domain_connect] rank %d can't reach rank %d : %s\n", rank, rank - 1, strerror(errno));
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(DOMAIN_CONNECT_RETRY_MS));
+			waited += DOMAIN_CONNECT_RETRY_MS;
+		}
+	}
+
+	if (domain_listener >= 0) {
+		domain_peers[DOMAIN_RIGHT].fd = accept(domain_listener, NULL, NULL);
+
+		if (domain_peers[DOMAIN_RIGHT].fd < 0) {
+			printf("[domain_connect] rank %d accept failed : %s\n", rank, strerror(errno));
+			return false;
+		}
+
+		if (config->port) {
+			int one = 1;
+			setsockopt(domain_peers[DOMAIN_RIGHT].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+		}
+	}
+
+	/* Both directions of a link move at once in domain_exchange(), so a full socket buffer on one side can't stall the other. */
+	for (int side = 0; side < DOMAIN_SIDES; side++) {
+		if (domain_peers[side].fd >= 0) {
+			fcntl(domain_peers[side].fd, F_SETFL, fcntl(domain_peers[side].fd, F_GETFL) | O_NONBLOCK);
+		}
+	}
+
+	return true;
+}
+
+void domain_close(void) {
+	for (int side = 0; side < DOMAIN_SIDES; side++) {
+		if (domain_peers[side].fd >= 0) {
+			close(domain_peers[side].fd);
+			domain_peers[side].fd = -1;
+		}
+	}
+
+	if (domain_listener >= 0) {
+		close(domain_listener);
+		domain_listener = -1;
+
+		if (!domain_settings.port) {
+			unlink(domain_listener_path);
+		}
+	}
+
+	std::vector<float>().swap(domain_halo);
+}
+
+void domain_slab(const domain_config* config, int rank, float* left, float* right) {
+	float width = (config->bounds[1] - config->bounds[0]) / (float) config->ranks;
+
+	*left = config->bounds[0] + width * (float) rank;
+	*right = rank + 1 == config->ranks ? config->bounds[1] : *left + width;
+}
+
+static void domain_append(std::vector<unsigned char>* message, const float* values, size_t count) {
+	const unsigned char* bytes = (const unsigned char*) values;
+	message->insert(message->end(), bytes, bytes + count * sizeof(float));
+}
+
+static bool domain_transfer(void) {
+	/* Sends every peer's message and receives theirs, whichever socket is ready first. */
+	for (;;) {
+		pollfd polls[DOMAIN_SIDES];
+		int polled = 0;
+		int sides[DOMAIN_SIDES];
+
+		for (int side = 0; side < DOMAIN_SIDES; side++) {
+			domain_peer* peer = &domain_peers[side];
+			short events = 0;
+
+			if (peer->fd < 0) {
+				continue;
+			}
+
+			if (peer->sent < peer->out.size()) events |= POLLOUT;
+			if (peer->received < peer->expected) events |= POLLIN;
+
+			if (events) {
+				polls[polled].fd = peer->fd;
+				polls[polled].events = events;
+				polls[polled].revents = 0;
+				sides[polled++] = side;
+			}
+		}
+
+		if (!polled) {
+			return true;
+		}
+
+		if (poll(polls, polled, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			printf("[domain_transfer] poll failed : %s\n", strerror(errno));
+			return false;
+		}
+
+		for (int i = 0; i < polled; i++) {
+			domain_peer* peer = &domain_peers[sides[i]];
+
+			if (polls[i].revents & (POLLERR | POLLNVAL)) {
+				printf("[domain_transfer] rank %d lost its %s neighbor\n", domain_settings.rank, sides[i] == DOMAIN_LEFT ? "left" : "right");
+				return false;
+			}
+
+			if (polls[i].revents & POLLOUT) {
+				ssize_t done = send(peer->fd, peer->out.data() + peer->sent, peer->out.size() - peer->sent, MSG_NOSIGNAL);
+
+				if (done < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					printf("[domain_transfer] send failed : %s\n", strerror(errno));
+					return false;
+				}
+
+				peer->sent += done > 0 ? (size_t) done : 0;
+			}
+
+			if (polls[i].revents & (POLLIN | POLLHUP)) {
+				ssize_t done = recv(peer->fd, peer->in.data() + peer->received, peer->expected - peer->received, 0);
+
+				if (done == 0 || (done < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+					printf("[domain_transfer] rank %d lost its %s neighbor\n", domain_settings.rank, sides[i] == DOMAIN_LEFT ? "left" : "right");
+					return false;
+				}
+
+				peer->received += done > 0 ? (size_t) done : 0;
+
+				if (peer->received == sizeof(domain_header) && peer->expected == sizeof(domain_header)) {
+					domain_header header;
+					memcpy(&header, peer->in.data(), sizeof header);
+
+					if (header.magic != DOMAIN_MAGIC || header.step != (uint32_t) domain_totals.steps) {
+						printf("[domain_transfer] rank %d got a bad header (step %u, expected %llu)\n", domain_settings.rank, header.step,
+							domain_totals.steps);
+						return false;
+					}
+
+					peer->expected += (size_t) header.migrants * 4 * sizeof(float) + (size_t) header.halo * 2 * sizeof(float);
+					peer->in.resize(peer->expected);
+				}
+			}
+		}
+	}
+}
+
+bool domain_exchange(float* particles, unsigned int* count, unsigned int capacity, const float** halo, unsigned int* halo_count) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	float left, right;
+	domain_slab(&domain_settings, domain_settings.rank, &left, &right);
+
+	domain_header headers[DOMAIN_SIDES];
+	std::vector<float> migrants[DOMAIN_SIDES];
+	std::vector<float> edges[DOMAIN_SIDES];
+
+	/* Particles past an edge with nobody behind it stay, they are bouncing off the bounds. */
+	unsigned int kept = 0;
+
+	for (unsigned int i = 0; i < *count; i++) {
+		const float* particle = particles + (size_t) i * 4;
+		int side = particle[0] < left ? DOMAIN_LEFT : (particle[0] >= right ? DOMAIN_RIGHT : -1);
+
+		if (side >= 0 && domain_peers[side].fd >= 0) {
+			migrants[side].insert(migrants[side].end(), particle, particle + 4);
+			continue;
+		}
+
+		if (kept != i) {
+			memcpy(particles + (size_t) kept * 4, particle, sizeof(float) * 4);
+		}
+
+		kept++;
+	}
+
+	*count = kept;
+
+	if (domain_settings.halo_width > 0.0f) {
+		for (unsigned int i = 0; i < kept; i++) {
+			float x = particles[(size_t) i * 4];
+
+			if (x < left + domain_settings.halo_width) edges[DOMAIN_LEFT].insert(edges[DOMAIN_LEFT].end(), particles + (size_t) i * 4, particles + (size_t) i * 4 + 2);
+			if (x >= right - domain_settings.halo_width) edges[DOMAIN_RIGHT].insert(edges[DOMAIN_RIGHT].end(), particles + (size_t) i * 4, particles + (size_t) i * 4 + 2);
+		}
+	}
+
+	for (int side = 0; side < DOMAIN_SIDES; side++) {
+		domain_peer* peer = &domain_peers[side];
+
+		if (peer->fd < 0) {
+			continue;
+		}
+
+		headers[side].magic = DOMAIN_MAGIC;
+		headers[side].step = (uint32_t) domain_totals.steps;
+		headers[side].migrants = (uint32_t) (migrants[side].size() / 4);
+		headers[side].halo = (uint32_t) (edges[side].size() / 2);
+
+		peer->out.clear();
+		domain_append(&peer->out, (const float*) &headers[side], sizeof(domain_header) / sizeof(float));
+		domain_append(&peer->out, migrants[side].data(), migrants[side].size());
+		domain_append(&peer->out, edges[side].data(), edges[side].size());
+		peer->sent = 0;
+
+		peer->in.resize(sizeof(domain_header));
+		peer->received = 0;
+		peer->expected = sizeof(domain_header);
+
+		domain_totals.migrated_out += headers[side].migrants;
+		domain_totals.halo_out += headers[side].halo;
+		domain_totals.bytes_out += peer->out.size();
+	}
+
+	if (!domain_transfer()) {
+		return false;
+	}
+
+	domain_halo.clear();
+
+	for (int side = 0; side < DOMAIN_SIDES; side++) {
+		domain_peer* peer = &domain_peers[side];
+
+		if (peer->fd < 0) {
+			continue;
+		}
+
+		domain_header header;
+		memcpy(&header, peer->in.data(), sizeof header);
+
+		const float* payload = (const float*) (peer->in.data() + sizeof(domain_header));
+
+		if (*count + header.migrants > capacity) {
+			printf("[domain_exchange] rank %d is over its capacity of %u particles\n", domain_settings.rank, capacity);
+			return false;
+		}
+
+		memcpy(particles + (size_t) *count * 4, payload, sizeof(float) * 4 * header.migrants);
+		*count += header.migrants;
+
+		domain_halo.insert(domain_halo.end(), payload + (size_t) header.migrants * 4, payload + (size_t) header.migrants * 4 + (size_t) header.halo * 2);
+
+		domain_totals.migrated_in += header.migrants;
+		domain_totals.halo_in += header.halo;
+		domain_totals.bytes_in += peer->in.size();
+	}
+
+	*halo = domain_halo.data();
+	*halo_count = (unsigned int) (domain_halo.size() / 2);
+
+	domain_totals.steps++;
+	domain_totals.exchange_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	return true;
+}
+
+const domain_traffic* domain_get_traffic(void) {
+	return &domain_totals;
+}
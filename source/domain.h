@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+ * Spatial domain decomposition of the CPU engine over processes, see 'particles-domains'.
+ * The bounds are cut into ranks vertical slabs of equal width, and each rank owns the particles in its slab. After every step a rank hands
+ *	the particles that left its slab to the rank they went towards, along with a halo : the positions of its particles within halo_width
+ *	of the shared edge, which the other side's neighbor stage feels but doesn't advance (see cpu_engine_set_halo()).
+ *
+ * Ranks only talk to the slabs on their left and right, over one stream socket each (a Unix socket, or TCP on loopback with a port), and
+ *	send one batched message per neighbor per step : a domain_header, the migrants as (x, y, vx, vy), then the halo as (x, y). Particles that
+ *	crossed more than one slab in a step are passed along on the following steps.
+ */
+
+#include <cstdint>
+
+#define DOMAIN_MAGIC 0x50444d31u // "PDM1"
+
+struct domain_header {
+	uint32_t magic;
+	uint32_t step;
+	uint32_t migrants;
+	uint32_t halo;
+};
+
+struct domain_config {
+	int rank;
+	int ranks;
+	float bounds[4]; // left, right, bottom, top, of the whole simulation.
+	float halo_width; // 0 sends no halo.
+	const char* name; // Unix socket paths are /tmp/<name>-<rank>.sock, one per rank that has a right neighbor.
+	int port; // TCP on 127.0.0.1, rank r listens on port + r. 0 uses Unix sockets.
+};
+
+struct domain_traffic {
+	unsigned long long steps;
+	unsigned long long migrated_out;
+	unsigned long long migrated_in;
+	unsigned long long halo_out;
+	unsigned long long halo_in;
+	unsigned long long bytes_out;
+	unsigned long long bytes_in;
+	double exchange_ms;
+};
+
+bool domain_connect(const domain_config* config); // Blocks until both neighbors are connected.
+void domain_close(void);
+
+void domain_slab(const domain_config* config, int rank, float* left, float* right);
+
+/* Sends away the particles among the first *count that are outside this rank's slab, compacting the rest, then appends the ones that
+ *	arrived (up to capacity, more is an error). The neighbors' halo is left in halo, halo_count (x, y) pairs, valid until the next exchange. */
+bool domain_exchange(float* particles, unsigned int* count, unsigned int capacity, const float** halo, unsigned int* halo_count);
+
+const domain_traffic* domain_get_traffic(void);
@@ -0,0 +1,304 @@
+/*
+ * Domain decomposed CPU engine over several processes on one box, see domain.h and 'make domains'. Builds without GL.
+ *
+ *	particles-domains [--ranks n] [--count total] [--steps k] [--threads t] [--tcp port] [--no-neighbors] [--report k] [--seed s]
+ *	particles-domains --rank r --ranks n [...]
+ *
+ * Without --rank it forks the n ranks itself, collects a summary from each over a pipe, and prints one line per rank : how many particles
+ *	it ended with, its step and exchange time, and how much crossed its edges. --rank runs a single rank, to start them by hand (every rank
+ *	needs the same options). The particle total is checked at the end, migration must neither lose nor duplicate any.
+ *
+ * Each rank starts with count / n particles spread over its slab. An attractor orbits the centre of the bounds, dragging particles across
+ *	the slab edges, and the neighbor radius shrinks with the count the way 'make bench' shrinks it.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "parallel.h"
+#include "cpu_engine.h"
+#include "forces.h"
+#include "domain.h"
+
+#define DOMAINS_REFERENCE_COUNT 175000.0f
+#define DOMAINS_REFERENCE_RADIUS 0.004f
+#define DOMAINS_STRENGTH 0.00002f
+#define DOMAINS_ORBIT_RADIUS 0.3f
+#define DOMAINS_SOFTENING 0.01f
+
+struct domains_options {
+	int rank; // -1 forks every rank.
+	int ranks;
+	unsigned int count;
+	int steps;
+	int threads;
+	int port;
+	bool neighbors;
+	int report;
+	unsigned int seed;
+};
+
+struct domains_summary {
+	int rank;
+	bool ok;
+	unsigned int particles;
+	double step_ms;
+	domain_traffic traffic;
+};
+
+static bool domains_run_rank(const domains_options* options, int rank, domains_summary* summary) {
+	memset(summary, 0, sizeof *summary);
+	summary->rank = rank;
+
+	float ratio = 1366.0f / 768.0f;
+	domain_config config;
+
+	config.rank = rank;
+	config.ranks = options->ranks;
+	config.bounds[0] = -ratio / 2.0f;
+	config.bounds[1] = ratio / 2.0f;
+	config.bounds[2] = -0.5f;
+	config.bounds[3] = 0.5f;
+	config.name = "particles-domain";
+	config.port = options->port;
+
+	float radius = DOMAINS_REFERENCE_RADIUS * sqrtf(DOMAINS_REFERENCE_COUNT / (float) options->count);
+	config.halo_width = options->neighbors ? radius : 0.0f;
+
+	if (!domain_connect(&config)) {
+		domain_close();
+		return false;
+	}
+
+	int threads = options->threads;
+
+	if (!threads) {
+		int hardware = (int) std::thread::hardware_concurrency();
+		threads = hardware > options->ranks ? hardware / options->ranks : 1;
+	}
+
+	parallel_initialize(threads);
+
+	/* Any rank may end up holding everything (the attractor can pull it all into one slab), so each one has room for all of it. */
+	unsigned int share = options->count / options->ranks + (rank + 1 == options->ranks ? options->count % options->ranks : 0);
+	unsigned int count = share;
+	float left, right;
+
+	domain_slab(&config, rank, &left, &right);
+	cpu_engine_initialize(options->count, config.bounds);
+	cpu_engine_set_neighbors(options->neighbors, radius, DOMAINS_STRENGTH);
+
+	float* particles = cpu_engine_particles();
+	srand(options->seed + (unsigned int) rank);
+
+	for (unsigned int i = 0; i < count; i++) {
+		particles[i * 4] = left + (right - left) * ((float) rand() / ((float) RAND_MAX + 1.0f));
+		particles[i * 4 + 1] = config.bounds[2] + (config.bounds[3] - config.bounds[2]) * ((float) rand() / (float) RAND_MAX);
+		particles[i * 4 + 2] = 0.0f;
+		particles[i * 4 + 3] = 0.0f;
+	}
+
+	/* One exchange up front, so the first step already has its halo. */
+	const float* halo;
+	unsigned int halo_count;
+	bool ok = domain_exchange(particles, &count, options->count, &halo, &halo_count);
+
+	for (int step = 0; ok && step < options->steps; step++) {
+		float angle = (float) step * 0.02f;
+
+		forces_clear_attractors();
+		forces_add_attractor(cosf(angle) * DOMAINS_ORBIT_RADIUS, sinf(angle) * DOMAINS_ORBIT_RADIUS, 0.5f, DOMAINS_SOFTENING);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		cpu_engine_set_halo(halo, halo_count);
+		cpu_engine_step(count);
+
+		summary->step_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		ok = domain_exchange(particles, &count, options->count, &halo, &halo_count);
+
+		if (ok && options->report && (step + 1) % options->report == 0) {
+			const domain_traffic* traffic = domain_get_traffic();
+
+			printf("[domain %d] step %d : %u particles, %u in the halo, %.2f ms stepping, %.2f ms exchanging, %llu migrated out\n", rank, step + 1,
+				count, halo_count, summary->step_ms / (step + 1), traffic->exchange_ms / traffic->steps, traffic->migrated_out);
+		}
+	}
+
+	summary->ok = ok;
+	summary->particles = count;
+	summary->step_ms /= options->steps;
+	summary->traffic = *domain_get_traffic();
+
+	cpu_engine_shutdown();
+	parallel_shutdown();
+	domain_close();
+
+	return ok;
+}
+
+static void domains_print(const domains_options* options, const domains_summary* summaries, int count) {
+	printf("[domains] %u particles over %d ranks, %d steps, neighbors %s, over %s\n", options->count, options->ranks, options->steps,
+		options->neighbors ? "on" : "off", options->port ? "TCP" : "Unix sockets");
+	printf("%4s  %10s  %9s  %11s  %12s  %11s  %10s\n", "rank", "particles", "step ms", "exchange ms", "migrated/step", "halo/step", "KB/step");
+
+	unsigned long long particles = 0;
+	double step_sum = 0.0, step_max = 0.0, slowest = 0.0;
+	bool ok = true;
+
+	for (int i = 0; i < count; i++) {
+		const domains_summary* summary = &summaries[i];
+		const domain_traffic* traffic = &summary->traffic;
+		double steps = traffic->steps ? (double) traffic->steps : 1.0;
+
+		printf("%4d  %10u  %9.3f  %11.3f  %12.1f  %11.1f  %10.1f\n", summary->rank, summary->particles, summary->step_ms,
+			traffic->exchange_ms / steps, traffic->migrated_out / steps, traffic->halo_out / steps, traffic->bytes_out / steps / 1024.0);
+
+		particles += summary->particles;
+		step_sum += summary->step_ms;
+		step_max = summary->step_ms > step_max ? summary->step_ms : step_max;
+		slowest = summary->step_ms + traffic->exchange_ms / steps > slowest ? summary->step_ms + traffic->exchange_ms / steps : slowest;
+		ok = ok && summary->ok;
+	}
+
+	/* The exchange waits on both neighbors, so every rank goes at the pace of the slowest one : that step plus exchange is the step. */
+	printf("[domains] %.3f ms per step, load imbalance %.2f (slowest over mean step)\n", slowest, count ? step_max / (step_sum / count) : 0.0);
+
+	if (count == options->ranks) {
+		printf("[domains] %llu particles at the end, %s\n", particles, !ok ? "a rank FAILED" : (particles == options->count ? "none lost" : "LOST OR DUPLICATED"));
+	}
+}
+
+static bool domains_parse(int argc, char** argv, domains_options* options) {
+	options->rank = -1;
+	options->ranks = 4;
+	options->count = 400000;
+	options->steps = 300;
+	options->threads = 0;
+	options->port = 0;
+	options->neighbors = true;
+	options->report = 0;
+	options->seed = 1;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--rank") && has_value) {
+			options->rank = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--ranks") && has_value) {
+			options->ranks = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--count") && has_value) {
+			options->count = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--steps") && has_value) {
+			options->steps = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--threads") && has_value) {
+			options->threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--tcp") && has_value) {
+			options->port = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--no-neighbors")) {
+			options->neighbors = false;
+		} else if (!strcmp(argv[i], "--report") && has_value) {
+			options->report = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && has_value) {
+			options->seed = (unsigned int) atoi(argv[++i]);
+		} else {
+			printf("[domains] unexpected argument %s\n", argv[i]);
+			return false;
+		}
+	}
+
+	if (options->ranks < 1 || options->rank >= options->ranks || !options->count || options->steps < 1) {
+		printf("[domains] nothing to run\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	domains_options options;
+
+	if (!domains_parse(argc, argv, &options)) {
+		printf("usage : %s [--rank r] [--ranks n] [--count total] [--steps k] [--threads t] [--tcp port] [--no-neighbors] [--report k]"
+			" [--seed s]\n", argv[0]);
+		return 1;
+	}
+
+	domains_summary summary;
+
+	if (options.rank >= 0) {
+		bool ok = domains_run_rank(&options, options.rank, &summary);
+		domains_print(&options, &summary, 1);
+		return ok ? 0 : 1;
+	}
+
+	/* Summaries are a lot smaller than PIPE_BUF, so the ranks' writes to the one pipe never interleave. */
+	int summaries_pipe[2];
+
+	if (pipe(summaries_pipe) < 0) {
+		printf("[domains] pipe failed\n");
+		return 1;
+	}
+
+	fflush(stdout);
+
+	for (int rank = 0; rank < options.ranks; rank++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			printf("[domains] fork failed\n");
+			return 1;
+		}
+
+		if (pid == 0) {
+			close(summaries_pipe[0]);
+
+			bool ok = domains_run_rank(&options, rank, &summary);
+			ssize_t written = write(summaries_pipe[1], &summary, sizeof summary);
+
+			fflush(stdout);
+			_exit(ok && written == (ssize_t) sizeof summary ? 0 : 1);
+		}
+	}
+
+	close(summaries_pipe[1]);
+
+	std::vector<domains_summary> summaries((size_t) options.ranks);
+	int received = 0;
+
+	while (received < options.ranks && read(summaries_pipe[0], &summary, sizeof summary) == (ssize_t) sizeof summary) {
+		summaries[summary.rank] = summary;
+		received++;
+	}
+
+	close(summaries_pipe[0]);
+
+	bool ok = received == options.ranks;
+
+	for (int rank = 0; rank < options.ranks; rank++) {
+		int status;
+
+		if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			ok = false;
+		}
+	}
+
+	if (received) {
+		domains_print(&options, summaries.data(), options.ranks);
+	}
+
+	if (received < options.ranks) {
+		printf("[domains] only %d of %d ranks reported\n", received, options.ranks);
+	}
+
+	return ok ? 0 : 1;
+}
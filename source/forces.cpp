@@ -0,0 +1,193 @@
+/*
+ * External forces implementation. See forces.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+#include "forces.h"
+
+/* Octaves of noise summed into the potential, each at twice the frequency and half the amplitude of the last. */
+#define FORCES_OCTAVES 3
+
+static forces_attractor forces_list[FORCES_MAX_ATTRACTORS];
+static unsigned int forces_count = 0;
+
+static std::vector<float> forces_field_data;
+static int forces_width = 0;
+static int forces_height = 0;
+static float forces_bounds[4] = {0.0f};
+
+void forces_clear_attractors(void) {
+	forces_count = 0;
+}
+
+bool forces_add_attractor(float x, float y, float strength, float softening) {
+	if (forces_count >= FORCES_MAX_ATTRACTORS) {
+		return false;
+	}
+
+	forces_attractor* a = forces_list + forces_count++;
+
+	a->position[0] = x;
+	a->position[1] = y;
+	a->strength = strength;
+	a->softening = softening;
+
+	return true;
+}
+
+unsigned int forces_attractor_count(void) {
+	return forces_count;
+}
+
+const forces_attractor* forces_attractors(void) {
+	return forces_list;
+}
+
+static float forces_gradient(int ix, int iy, unsigned int seed, float dx, float dy) {
+	/* Hashes the lattice point to one of 8 gradient directions and dots it with the offset. */
+	unsigned int h = (unsigned int) ix * 374761393u + (unsigned int) iy * 668265263u + seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+
+	static const float directions[8][2] = {
+		{1.0f, 0.0f}, {-1.0f, 0.0f}, {0.0f, 1.0f}, {0.0f, -1.0f},
+		{0.7071f, 0.7071f}, {-0.7071f, 0.7071f}, {0.7071f, -0.7071f}, {-0.7071f, -0.7071f},
+	};
+
+	return directions[h & 7][0] * dx + directions[h & 7][1] * dy;
+}
+
+static float forces_noise(float x, float y, unsigned int seed) {
+	/* Classic 2D gradient noise with a quintic fade. */
+	int ix = (int) floorf(x), iy = (int) floorf(y);
+	float fx = x - ix, fy = y - iy;
+
+	float u = fx * fx * fx * (fx * (fx * 6.0f - 15.0f) + 10.0f);
+	float v = fy * fy * fy * (fy * (fy * 6.0f - 15.0f) + 10.0f);
+
+	float n00 = forces_gradient(ix, iy, seed, fx, fy);
+	float n10 = forces_gradient(ix + 1, iy, seed, fx - 1.0f, fy);
+	float n01 = forces_gradient(ix, iy + 1, seed, fx, fy - 1.0f);
+	float n11 = forces_gradient(ix + 1, iy + 1, seed, fx - 1.0f, fy - 1.0f);
+
+	float nx0 = n00 + (n10 - n00) * u;
+	float nx1 = n01 + (n11 - n01) * u;
+
+	return nx0 + (nx1 - nx0) * v;
+}
+
+static float forces_potential(float x, float y, unsigned int seed) {
+	float value = 0.0f, amplitude = 1.0f;
+
+	for (int octave = 0; octave < FORCES_OCTAVES; octave++) {
+		value += forces_noise(x, y, seed + octave) * amplitude;
+
+		x *= 2.0f;
+		y *= 2.0f;
+		amplitude *= 0.5f;
+	}
+
+	return value;
+}
+
+bool forces_bake_field(int width, int height, const float* camera_bounds, float frequency, float strength, unsigned int seed) {
+	if (width <= 0 || height <= 0) {
+		return false;
+	}
+
+	forces_width = width;
+	forces_height = height;
+	memcpy(forces_bounds, camera_bounds, sizeof forces_bounds);
+
+	forces_field_data.assign((size_t) width * height * 2, 0.0f);
+
+	/* Noise space keeps the bounds' aspect ratio so features come out round. */
+	float extent_x = camera_bounds[1] - camera_bounds[0];
+	float extent_y = camera_bounds[3] - camera_bounds[2];
+	float scale = frequency / extent_x;
+	float step = 0.5f * scale * extent_x / width; // Half a texel, for central differences.
+
+	int threads = parallel_thread_count();
+	std::vector<float> peaks(threads, 0.0f);
+
+	parallel_for((unsigned int) height, [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int y = begin; y < end; y++) {
+			for (int x = 0; x < width; x++) {
+				float nx = (x + 0.5f) / width * extent_x * scale;
+				float ny = (y + 0.5f) / height * extent_y * scale;
+
+				/* The curl of a scalar potential is (d/dy, -d/dx). */
+				float dpdx = (forces_potential(nx + step, ny, seed) - forces_potential(nx - step, ny, seed)) / (2.0f * step);
+				float dpdy = (forces_potential(nx, ny + step, seed) - forces_potential(nx, ny - step, seed)) / (2.0f * step);
+
+				float* texel = forces_field_data.data() + ((size_t) y * width + x) * 2;
+
+				texel[0] = dpdy;
+				texel[1] = -dpdx;
+
+				peaks[chunk] = std::max(peaks[chunk], sqrtf(dpdy * dpdy + dpdx * dpdx));
+			}
+		}
+	});
+
+	float peak = *std::max_element(peaks.begin(), peaks.end());
+	float normalize = peak > 0.0f ? strength / peak : 0.0f;
+
+	parallel_for((unsigned int) forces_field_data.size(), [&](unsigned int begin, unsigned int end, int chunk) {
+		for (unsigned int i = begin; i < end; i++) {
+			forces_field_data[i] *= normalize;
+		}
+	});
+
+	printf("[forces_bake_field] baked %dx%d curl noise field\n", width, height);
+	return true;
+}
+
+const float* forces_field(void) {
+	return forces_field_data.empty() ? NULL : forces_field_data.data();
+}
+
+int forces_field_width(void) {
+	return forces_width;
+}
+
+int forces_field_height(void) {
+	return forces_height;
+}
+
+void forces_sample_field(float x, float y, float* force) {
+	if (forces_field_data.empty()) {
+		force[0] = force[1] = 0.0f;
+		return;
+	}
+
+	/* Texel centres sit at half-integers, same as the GL sampler. */
+	float u = (x - forces_bounds[0]) / (forces_bounds[1] - forces_bounds[0]) * forces_width - 0.5f;
+	float v = (y - forces_bounds[2]) / (forces_bounds[3] - forces_bounds[2]) * forces_height - 0.5f;
+
+	int x0 = (int) floorf(u), y0 = (int) floorf(v);
+	float fx = u - x0, fy = v - y0;
+
+	int x1 = std::min(std::max(x0 + 1, 0), forces_width - 1);
+	int y1 = std::min(std::max(y0 + 1, 0), forces_height - 1);
+	x0 = std::min(std::max(x0, 0), forces_width - 1);
+	y0 = std::min(std::max(y0, 0), forces_height - 1);
+
+	const float* t00 = forces_field_data.data() + ((size_t) y0 * forces_width + x0) * 2;
+	const float* t10 = forces_field_data.data() + ((size_t) y0 * forces_width + x1) * 2;
+	const float* t01 = forces_field_data.data() + ((size_t) y1 * forces_width + x0) * 2;
+	const float* t11 = forces_field_data.data() + ((size_t) y1 * forces_width + x1) * 2;
+
+	for (int c = 0; c < 2; c++) {
+		float bottom = t00[c] + (t10[c] - t00[c]) * fx;
+		float top = t01[c] + (t11[c] - t01[c]) * fx;
+
+		force[c] = bottom + (top - bottom) * fy;
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * External forces acting on particles : point attractors/repulsors and a baked 2D force field.
+ *
+ * Attractors are laid out as one std140 vec4 each (x, y, strength, softening) so the list can be copied straight into the advance shader's
+ *	attractor_block UBO. Strength 1 matches the original mouse pull, negative strengths repel.
+ *
+ * The force field is curl noise baked once on the worker pool. Curl noise is divergence free, so it stirs particles around without
+ *	bunching them up, and the advance shader pays a single texture fetch for it no matter how detailed it is.
+ */
+
+#define FORCES_MAX_ATTRACTORS 64 // Must match the array size of attractor_block in SHADER_ADVANCE_VS.
+
+struct forces_attractor {
+	float position[2];
+	float strength;
+	float softening; // Added to the squared distance, keeps the pull finite right at the attractor.
+};
+
+void forces_clear_attractors(void);
+bool forces_add_attractor(float x, float y, float strength, float softening);
+unsigned int forces_attractor_count(void);
+const forces_attractor* forces_attractors(void);
+
+/* Bakes a width x height field of (fx, fy) over the camera bounds. Frequency is in noise cells across the bounds, strength is the largest force. */
+bool forces_bake_field(int width, int height, const float* camera_bounds, float frequency, float strength, unsigned int seed);
+
+const float* forces_field(void); // NULL until baked.
+int forces_field_width(void);
+int forces_field_height(void);
+
+/* Bilinear lookup matching GL_LINEAR with GL_CLAMP_TO_EDGE, so the CPU engine sees exactly what the shader samples. */
+void forces_sample_field(float x, float y, float* force);
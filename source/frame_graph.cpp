@@ -0,0 +1,448 @@
+/*
+ * Frame graph implementation. See frame_graph.h.
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include <GLXW/glxw.h>
+
+#include "frame_graph.h"
+
+enum {
+	FRAME_RESOURCE_BUFFER = 0,
+	FRAME_RESOURCE_TEXTURE,
+	FRAME_RESOURCE_TARGET,
+	FRAME_RESOURCE_TRANSIENT
+};
+
+struct frame_resource {
+	const char* name;
+	int kind;
+	unsigned int flags;
+
+	frame_graph_getter buffer_getter; // Imported buffers.
+	frame_graph_getter texture_getter;
+	unsigned int texture; // Imported textures and the colour texture of targets, with its target.
+	unsigned int texture_target;
+	unsigned int framebuffer; // Targets.
+	int width, height;
+	unsigned int bytes; // Transients, and the pool entry they got.
+	unsigned int format;
+	int physical;
+
+	int first_use, last_use; // Live pass indices.
+};
+
+struct frame_version {
+	int resource;
+	int writer; // Pass that made it, -1 for what the frame starts with.
+};
+
+struct frame_access {
+	frame_handle handle;
+	int unit;
+};
+
+struct frame_pass {
+	const char* name;
+	unsigned int flags;
+	std::function<void(void)> run;
+	std::vector<frame_access> reads;
+	std::vector<frame_handle> writes;
+	bool live;
+};
+
+/* Transient buffers, kept from frame to frame. busy_until is the last pass of this frame using it. */
+struct frame_physical {
+	unsigned int bytes;
+	unsigned int format;
+	unsigned int buffer;
+	unsigned int texture;
+	int busy_until;
+};
+
+static std::vector<frame_resource> graph_resources;
+static std::vector<frame_version> graph_versions;
+static std::vector<frame_pass> graph_passes;
+static std::vector<frame_physical> graph_pool;
+
+/* What the graph last bound, ~0u when it doesn't know. Buffer textures and 2D textures are separate bindings of a unit. */
+static unsigned int graph_bound_buffers[FRAME_GRAPH_MAX_UNITS];
+static unsigned int graph_bound_2d[FRAME_GRAPH_MAX_UNITS];
+static unsigned int graph_bound_framebuffer = ~0u;
+
+static unsigned int graph_frames = 0;
+static unsigned int graph_declared = 0;
+static unsigned int graph_culled = 0;
+static unsigned int graph_binds = 0;
+static unsigned int graph_binds_skipped = 0;
+static unsigned int graph_aliased = 0; // Transients that got a pool entry another one had earlier in the frame.
+
+void frame_graph_begin(void) {
+	graph_resources.clear();
+	graph_versions.clear();
+	graph_passes.clear(); // Keeps the capacity, after the first frames nothing here allocates.
+
+	/* Whatever ran between frames (the swap, recording, other contexts) may have bound anything. */
+	for (int i = 0; i < FRAME_GRAPH_MAX_UNITS; i++) {
+		graph_bound_buffers[i] = graph_bound_2d[i] = ~0u;
+	}
+
+	graph_bound_framebuffer = ~0u;
+}
+
+static frame_handle frame_graph_add_resource(const frame_resource* resource) {
+	graph_resources.push_back(*resource);
+
+	frame_version version;
+	version.resource = (int) graph_resources.size() - 1;
+	version.writer = -1;
+
+	graph_versions.push_back(version);
+	return (frame_handle) graph_versions.size() - 1;
+}
+
+static void frame_graph_clear_resource(frame_resource* resource, const char* name, int kind, unsigned int flags) {
+	resource->name = name;
+	resource->kind = kind;
+	resource->flags = flags;
+	resource->buffer_getter = resource->texture_getter = NULL;
+	resource->texture = resource->texture_target = 0;
+	resource->framebuffer = 0;
+	resource->width = resource->height = 0;
+	resource->bytes = resource->format = 0;
+	resource->physical = -1;
+	resource->first_use = resource->last_use = -1;
+}
+
+frame_handle frame_graph_import_buffer(const char* name, frame_graph_getter buffer, frame_graph_getter texture, unsigned int flags) {
+	frame_resource resource;
+	frame_graph_clear_resource(&resource, name, FRAME_RESOURCE_BUFFER, flags);
+
+	resource.buffer_getter = buffer;
+	resource.texture_getter = texture;
+
+	return frame_graph_add_resource(&resource);
+}
+
+frame_handle frame_graph_import_texture(const char* name, unsigned int texture, unsigned int target, unsigned int flags) {
+	frame_resource resource;
+	frame_graph_clear_resource(&resource, name, FRAME_RESOURCE_TEXTURE, flags);
+
+	resource.texture = texture;
+	resource.texture_target = target;
+
+	return frame_graph_add_resource(&resource);
+}
+
+frame_handle frame_graph_import_target(const char* name, unsigned int framebuffer, unsigned int texture, int width, int height, unsigned int flags) {
+	frame_resource resource;
+	frame_graph_clear_resource(&resource, name, FRAME_RESOURCE_TARGET, flags);
+
+	resource.texture = texture;
+	resource.texture_target = GL_TEXTURE_2D;
+	resource.framebuffer = framebuffer;
+	resource.width = width;
+	resource.height = height;
+
+	return frame_graph_add_resource(&resource);
+}
+
+frame_handle frame_graph_transient_buffer(const char* name, unsigned int bytes, unsigned int format) {
+	frame_resource resource;
+	frame_graph_clear_resource(&resource, name, FRAME_RESOURCE_TRANSIENT, 0);
+
+	resource.bytes = bytes;
+	resource.format = format;
+
+	return frame_graph_add_resource(&resource);
+}
+
+int frame_graph_add_pass(const char* name, unsigned int flags, const std::function<void(void)>& run) {
+	graph_passes.push_back(frame_pass());
+
+	frame_pass* pass = &graph_passes.back();
+	pass->name = name;
+	pass->flags = flags;
+	pass->run = run;
+	pass->live = false;
+
+	return (int) graph_passes.size() - 1;
+}
+
+void frame_graph_read(int pass, frame_handle resource, int unit) {
+	if (resource < 0 || unit >= FRAME_GRAPH_MAX_UNITS) {
+		printf("[frame_graph_read] %s reads %s\n", graph_passes[pass].name, resource < 0 ? "nothing" : "past the last unit");
+		return;
+	}
+
+	frame_access access;
+	access.handle = resource;
+	access.unit = unit;
+
+	graph_passes[pass].reads.push_back(access);
+}
+
+frame_handle frame_graph_write(int pass, frame_handle resource) {
+	if (resource < 0) {
+		return -1;
+	}
+
+	frame_version version;
+	version.resource = graph_versions[resource].resource;
+	version.writer = pass;
+
+	graph_versions.push_back(version);
+
+	frame_handle written = (frame_handle) graph_versions.size() - 1;
+	graph_passes[pass].writes.push_back(written);
+
+	return written;
+}
+
+static void frame_graph_cull(void) {
+	/* Backwards : a pass is live if it has effects of its own, or a live pass after it reads something it wrote. */
+	std::vector<bool> needed(graph_passes.size(), false);
+
+	for (int i = (int) graph_passes.size() - 1; i >= 0; i--) {
+		frame_pass* pass = &graph_passes[i];
+		bool live = needed[i] || (pass->flags & FRAME_GRAPH_OUTPUT);
+
+		for (size_t w = 0; w < pass->writes.size() && !live; w++) {
+			live = (graph_resources[graph_versions[pass->writes[w]].resource].flags & FRAME_GRAPH_PERSISTENT) != 0;
+		}
+
+		pass->live = live;
+
+		if (!live) {
+			graph_culled++;
+			continue;
+		}
+
+		for (size_t r = 0; r < pass->reads.size(); r++) {
+			int writer = graph_versions[pass->reads[r].handle].writer;
+
+			if (writer >= 0) {
+				needed[writer] = true;
+			}
+		}
+	}
+}
+
+static void frame_graph_use(frame_handle handle, int pass) {
+	frame_resource* resource = &graph_resources[graph_versions[handle].resource];
+
+	if (resource->first_use < 0) {
+		resource->first_use = pass;
+	}
+
+	resource->last_use = pass;
+}
+
+static void frame_graph_allocate(void) {
+	/* Spans of the transients over the live passes. */
+	for (size_t i = 0; i < graph_passes.size(); i++) {
+		const frame_pass* pass = &graph_passes[i];
+
+		if (!pass->live) {
+			continue;
+		}
+
+		for (size_t r = 0; r < pass->reads.size(); r++) {
+			frame_graph_use(pass->reads[r].handle, (int) i);
+		}
+
+		for (size_t w = 0; w < pass->writes.size(); w++) {
+			frame_graph_use(pass->writes[w], (int) i);
+		}
+	}
+
+	for (size_t p = 0; p < graph_pool.size(); p++) {
+		graph_pool[p].busy_until = -1;
+	}
+
+	/* Resources are declared before their first use, so this goes through them in order of where their spans start. Each takes the
+	 *	smallest free pool entry big enough, or a new one. */
+	for (size_t i = 0; i < graph_resources.size(); i++) {
+		frame_resource* resource = &graph_resources[i];
+
+		if (resource->kind != FRAME_RESOURCE_TRANSIENT || resource->first_use < 0) {
+			continue;
+		}
+
+		int best = -1;
+
+		for (size_t p = 0; p < graph_pool.size(); p++) {
+			const frame_physical* physical = &graph_pool[p];
+
+			if (physical->format != resource->format || physical->bytes < resource->bytes || physical->busy_until >= resource->first_use) {
+				continue;
+			}
+
+			if (best < 0 || physical->bytes < graph_pool[best].bytes) {
+				best = (int) p;
+			}
+		}
+
+		if (best < 0) {
+			frame_physical physical;
+			physical.bytes = resource->bytes;
+			physical.format = resource->format;
+			physical.busy_until = -1;
+
+			glGenBuffers(1, &physical.buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, physical.buffer);
+			glBufferData(GL_ARRAY_BUFFER, physical.bytes, NULL, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			glGenTextures(1, &physical.texture);
+			glBindTexture(GL_TEXTURE_BUFFER, physical.texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, physical.format, physical.buffer);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+			graph_pool.push_back(physical);
+			best = (int) graph_pool.size() - 1;
+
+			printf("[frame_graph] %.1f MB transient buffer for %s\n", physical.bytes / (1024.0 * 1024.0), resource->name);
+		} else if (graph_pool[best].busy_until >= 0) {
+			graph_aliased++;
+		}
+
+		graph_pool[best].busy_until = resource->last_use;
+		resource->physical = best;
+	}
+}
+
+static void frame_graph_bind(const frame_access* access) {
+	const frame_resource* resource = &graph_resources[graph_versions[access->handle].resource];
+	bool buffer = resource->kind == FRAME_RESOURCE_BUFFER || resource->kind == FRAME_RESOURCE_TRANSIENT || resource->texture_target == GL_TEXTURE_BUFFER;
+	unsigned int* bound = buffer ? &graph_bound_buffers[access->unit] : &graph_bound_2d[access->unit];
+	unsigned int texture = frame_graph_texture(access->handle);
+
+	if (*bound == texture) {
+		graph_binds_skipped++;
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + access->unit);
+	glBindTexture(buffer ? GL_TEXTURE_BUFFER : GL_TEXTURE_2D, texture);
+
+	*bound = texture;
+	graph_binds++;
+}
+
+void frame_graph_execute(void) {
+	frame_graph_cull();
+	frame_graph_allocate();
+
+	for (size_t i = 0; i < graph_passes.size(); i++) {
+		frame_pass* pass = &graph_passes[i];
+
+		if (!pass->live) {
+			continue;
+		}
+
+		bool bound_texture = false;
+
+		for (size_t r = 0; r < pass->reads.size(); r++) {
+			if (pass->reads[r].unit >= 0) {
+				frame_graph_bind(&pass->reads[r]);
+				bound_texture = true;
+			}
+		}
+
+		if (bound_texture) {
+			glActiveTexture(GL_TEXTURE0); // What every pass expects to find.
+		}
+
+		for (size_t w = 0; w < pass->writes.size(); w++) {
+			const frame_resource* resource = &graph_resources[graph_versions[pass->writes[w]].resource];
+
+			if (resource->kind != FRAME_RESOURCE_TARGET) {
+				continue;
+			}
+
+			/* The viewport is set every time, passes drawing several views move it around. */
+			if (graph_bound_framebuffer != resource->framebuffer) {
+				glBindFramebuffer(GL_FRAMEBUFFER, resource->framebuffer);
+				graph_bound_framebuffer = resource->framebuffer;
+				graph_binds++;
+			} else {
+				graph_binds_skipped++;
+			}
+
+			glViewport(0, 0, resource->width, resource->height);
+		}
+
+		pass->run();
+	}
+
+	graph_declared += (unsigned int) graph_passes.size();
+	graph_frames++;
+}
+
+unsigned int frame_graph_buffer(frame_handle handle) {
+	const frame_resource* resource = &graph_resources[graph_versions[handle].resource];
+
+	switch (resource->kind) {
+		case FRAME_RESOURCE_BUFFER: return resource->buffer_getter ? resource->buffer_getter() : 0;
+		case FRAME_RESOURCE_TRANSIENT: return resource->physical >= 0 ? graph_pool[resource->physical].buffer : 0;
+		default: return 0;
+	}
+}
+
+unsigned int frame_graph_texture(frame_handle handle) {
+	const frame_resource* resource = &graph_resources[graph_versions[handle].resource];
+
+	switch (resource->kind) {
+		case FRAME_RESOURCE_BUFFER: return resource->texture_getter ? resource->texture_getter() : 0;
+		case FRAME_RESOURCE_TEXTURE: case FRAME_RESOURCE_TARGET: return resource->texture;
+		case FRAME_RESOURCE_TRANSIENT: return resource->physical >= 0 ? graph_pool[resource->physical].texture : 0;
+		default: return 0;
+	}
+}
+
+void frame_graph_forget_unit(int unit) {
+	if (unit >= 0 && unit < FRAME_GRAPH_MAX_UNITS) {
+		graph_bound_buffers[unit] = graph_bound_2d[unit] = ~0u;
+	}
+}
+
+void frame_graph_forget_target(void) {
+	graph_bound_framebuffer = ~0u;
+}
+
+void frame_graph_report(void) {
+	if (!graph_frames) {
+		return;
+	}
+
+	printf("[frame_graph] %.1f passes per frame, %.1f culled, %.1f binds issued and %.1f skipped, %u transients aliased, %.1f MB pooled\n",
+		(float) graph_declared / graph_frames, (float) graph_culled / graph_frames, (float) graph_binds / graph_frames,
+		(float) graph_binds_skipped / graph_frames, graph_aliased, frame_graph_transient_bytes() / (1024.0 * 1024.0));
+
+	graph_frames = graph_declared = graph_culled = graph_binds = graph_binds_skipped = graph_aliased = 0;
+}
+
+unsigned int frame_graph_transient_bytes(void) {
+	unsigned int bytes = 0;
+
+	for (size_t p = 0; p < graph_pool.size(); p++) {
+		bytes += graph_pool[p].bytes;
+	}
+
+	return bytes;
+}
+
+void frame_graph_shutdown(void) {
+	for (size_t p = 0; p < graph_pool.size(); p++) {
+		glDeleteBuffers(1, &graph_pool[p].buffer);
+		glDeleteTextures(1, &graph_pool[p].texture);
+	}
+
+	graph_pool.clear();
+	graph_resources.clear();
+	graph_versions.clear();
+	graph_passes.clear();
+}
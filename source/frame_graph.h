@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * Frame graph : the passes of a frame, each declared with the resources it reads and writes, then run by a scheduler that works out what
+ *	the hand-written sequence used to do by hand.
+ * Declared anew every frame between frame_graph_begin() and frame_graph_execute(). A pass that is off this frame simply isn't declared.
+ *
+ * Resources are versioned : writing one returns a new handle, and reading a handle means reading that version, so a pass can only ever
+ *	read what passes declared before it wrote. Declaration order is therefore always a valid order, and the scheduler keeps it. On top of
+ *	that it
+ *	- culls passes nothing live reads from. Live passes are the FRAME_GRAPH_OUTPUT ones (readbacks, the window) and those writing a
+ *		persistent resource (the particle state), then whatever they read from, back to the start of the frame.
+ *	- gives transient buffers their GL objects for the part of the frame between their first and last use. Transients whose spans don't
+ *		overlap share one buffer, kept across frames in a pool, so a frame with both the sleep partition and the cull list pays for one.
+ *	- binds each pass's texture reads on the units it asked for and each render target it writes, skipping the ones already there. The
+ *		state swapping on every advance is just a new version with a different texture, which gets bound when someone next reads it.
+ *
+ * GL 3.3 orders transform feedback writes before later texture fetches by itself, so there are no barriers to insert. Passes that bind
+ *	things the graph doesn't know about (library calls, several targets in one pass) say so with frame_graph_forget_unit() and
+ *	frame_graph_forget_target(), so the next pass that wants them gets them bound again.
+ */
+
+#include <functional>
+
+#define FRAME_GRAPH_MAX_UNITS 16
+
+/* Pass flags. */
+#define FRAME_GRAPH_OUTPUT (1u << 0) // Has effects past the frame : readbacks, drawing into the window. Never culled.
+
+/* Resource flags. */
+#define FRAME_GRAPH_PERSISTENT (1u << 0) // Outlives the frame, so writing it keeps a pass alive.
+
+typedef int frame_handle; // A version of a resource, -1 for none.
+typedef unsigned int (*frame_graph_getter)(void); // GL name of an imported resource, asked every time it is bound.
+
+void frame_graph_begin(void);
+
+/* Imported resources are owned elsewhere. Buffers come with their texture buffer, looked up through getters because owners like
+ *	particle_system swap them. Targets are bound with a viewport of their size, and read as their colour texture (0 for the window). */
+frame_handle frame_graph_import_buffer(const char* name, frame_graph_getter buffer, frame_graph_getter texture, unsigned int flags);
+frame_handle frame_graph_import_texture(const char* name, unsigned int texture, unsigned int target, unsigned int flags); // GL_TEXTURE_2D or _BUFFER.
+frame_handle frame_graph_import_target(const char* name, unsigned int framebuffer, unsigned int texture, int width, int height, unsigned int flags);
+
+/* The graph's own, bytes of format (GL_RGBA32F ...) with a texture buffer over them. Contents don't survive past the last use. */
+frame_handle frame_graph_transient_buffer(const char* name, unsigned int bytes, unsigned int format);
+
+int frame_graph_add_pass(const char* name, unsigned int flags, const std::function<void(void)>& run);
+void frame_graph_read(int pass, frame_handle resource, int unit); // unit < 0 : read some other way (copies, draws from feedback).
+frame_handle frame_graph_write(int pass, frame_handle resource); // Targets get bound before the pass runs.
+
+void frame_graph_execute(void);
+
+/* For pass bodies : the GL objects behind a handle this frame. */
+unsigned int frame_graph_buffer(frame_handle resource);
+unsigned int frame_graph_texture(frame_handle resource);
+
+void frame_graph_forget_unit(int unit);
+void frame_graph_forget_target(void);
+
+/* Culled passes, binds issued and skipped, and the transient pool, summed since the last report. */
+void frame_graph_report(void);
+unsigned int frame_graph_transient_bytes(void); // Allocated in the pool.
+void frame_graph_shutdown(void);
@@ -0,0 +1,143 @@
+/*
+ * Adaptive quality governor implementation. See governor.h.
+ */
+
+#include <cstdio>
+
+#include "governor.h"
+
+/* Hysteresis band, as fractions of the budget. Over the high mark we degrade, under the low mark we may upgrade. */
+#define GOVERNOR_HIGH_MARK 0.95f
+#define GOVERNOR_LOW_MARK 0.70f
+
+/* Consecutive frames a condition must hold before acting on it. Upgrades are deliberately much slower than degrades. */
+#define GOVERNOR_DEGRADE_FRAMES 10
+#define GOVERNOR_UPGRADE_FRAMES 180
+
+/* Frames to ignore after a change, long enough for the smoothed timers to reflect it. */
+#define GOVERNOR_SETTLE_FRAMES 45
+
+/* Particle count is changed in steps of this fraction of the maximum. */
+#define GOVERNOR_PARTICLE_STEP 0.1f
+
+static const float governor_scales[] = {1.0f, 0.85f, 0.7f, 0.5f};
+static const int governor_scale_count = sizeof governor_scales / sizeof *governor_scales;
+
+static governor_state governor_current;
+static int governor_scale_level = 0;
+
+static float governor_budget_ms = 16.6f;
+static unsigned int governor_max_particles = 0;
+static unsigned int governor_min_particles = 0;
+static int governor_max_substeps = 1;
+
+static int governor_over_frames = 0;
+static int governor_under_frames = 0;
+static int governor_settle = 0;
+
+void governor_initialize(float budget_ms, unsigned int max_particles, unsigned int min_particles, int max_substeps) {
+	governor_budget_ms = budget_ms;
+	governor_max_particles = max_particles;
+	governor_min_particles = min_particles < max_particles ? min_particles : max_particles;
+	governor_max_substeps = max_substeps < 1 ? 1 : max_substeps;
+
+	governor_current.particle_count = max_particles;
+	governor_current.substeps = governor_max_substeps;
+	governor_current.render_scale = governor_scales[0];
+	governor_scale_level = 0;
+
+	governor_over_frames = governor_under_frames = 0;
+	governor_settle = GOVERNOR_SETTLE_FRAMES;
+
+	printf("[governor] budget %.2f ms, particles %u..%u, substeps 1..%d\n", budget_ms, governor_min_particles, max_particles, governor_max_substeps);
+}
+
+static bool governor_degrade(float frame_ms) {
+	/* Cheapest loss first : substeps, then resolution, then particles. */
+	if (governor_current.substeps > 1) {
+		printf("[governor] %.2f ms over %.2f ms budget : substeps %d -> %d\n", frame_ms, governor_budget_ms, governor_current.substeps, governor_current.substeps - 1);
+		governor_current.substeps--;
+		return true;
+	}
+
+	if (governor_scale_level < governor_scale_count - 1) {
+		governor_scale_level++;
+		printf("[governor] %.2f ms over %.2f ms budget : render scale %.2f -> %.2f\n", frame_ms, governor_budget_ms, governor_current.render_scale, governor_scales[governor_scale_level]);
+		governor_current.render_scale = governor_scales[governor_scale_level];
+		return true;
+	}
+
+	if (governor_current.particle_count > governor_min_particles) {
+		unsigned int step = (unsigned int) (governor_max_particles * GOVERNOR_PARTICLE_STEP);
+		unsigned int next = governor_current.particle_count > governor_min_particles + step ? governor_current.particle_count - step : governor_min_particles;
+
+		printf("[governor] %.2f ms over %.2f ms budget : particles %u -> %u\n", frame_ms, governor_budget_ms, governor_current.particle_count, next);
+		governor_current.particle_count = next;
+		return true;
+	}
+
+	return false; // Nothing left to give.
+}
+
+static bool governor_upgrade(float frame_ms) {
+	/* Restore in the opposite order we degraded. */
+	if (governor_current.particle_count < governor_max_particles) {
+		unsigned int step = (unsigned int) (governor_max_particles * GOVERNOR_PARTICLE_STEP);
+		unsigned int next = governor_current.particle_count + step < governor_max_particles ? governor_current.particle_count + step : governor_max_particles;
+
+		printf("[governor] %.2f ms under %.2f ms budget : particles %u -> %u\n", frame_ms, governor_budget_ms, governor_current.particle_count, next);
+		governor_current.particle_count = next;
+		return true;
+	}
+
+	if (governor_scale_level > 0) {
+		governor_scale_level--;
+		printf("[governor] %.2f ms under %.2f ms budget : render scale %.2f -> %.2f\n", frame_ms, governor_budget_ms, governor_current.render_scale, governor_scales[governor_scale_level]);
+		governor_current.render_scale = governor_scales[governor_scale_level];
+		return true;
+	}
+
+	if (governor_current.substeps < governor_max_substeps) {
+		printf("[governor] %.2f ms under %.2f ms budget : substeps %d -> %d\n", frame_ms, governor_budget_ms, governor_current.substeps, governor_current.substeps + 1);
+		governor_current.substeps++;
+		return true;
+	}
+
+	return false;
+}
+
+bool governor_update(float frame_ms) {
+	if (governor_settle > 0) {
+		governor_settle--;
+		return false;
+	}
+
+	if (frame_ms > governor_budget_ms * GOVERNOR_HIGH_MARK) {
+		governor_over_frames++;
+		governor_under_frames = 0;
+	} else if (frame_ms < governor_budget_ms * GOVERNOR_LOW_MARK) {
+		governor_under_frames++;
+		governor_over_frames = 0;
+	} else {
+		governor_over_frames = governor_under_frames = 0; // Inside the band, hold still.
+	}
+
+	bool changed = false;
+
+	if (governor_over_frames >= GOVERNOR_DEGRADE_FRAMES) {
+		changed = governor_degrade(frame_ms);
+	} else if (governor_under_frames >= GOVERNOR_UPGRADE_FRAMES) {
+		changed = governor_upgrade(frame_ms);
+	}
+
+	if (changed) {
+		governor_over_frames = governor_under_frames = 0;
+		governor_settle = GOVERNOR_SETTLE_FRAMES;
+	}
+
+	return changed;
+}
+
+const governor_state* governor_get(void) {
+	return &governor_current;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+/*
+ * Adaptive quality governor.
+ * Watches the smoothed GPU frame time and trades substeps, render resolution and live particle count against a frame time budget.
+ *	Substeps only go down to 1, so with max_substeps 1 the first lever is the resolution.
+ * Degrading happens quickly, upgrading only after a long quiet period, and every change is followed by a settle period so the
+ *	(delayed) timer queries can catch up before the next decision. Every adjustment is logged.
+ */
+
+struct governor_state {
+	unsigned int particle_count; // Live prefix of the particle buffers that is advanced and drawn.
+	int substeps; // Advance passes per frame.
+	float render_scale; // Fraction of the window resolution rendered to.
+};
+
+void governor_initialize(float budget_ms, unsigned int max_particles, unsigned int min_particles, int max_substeps);
+bool governor_update(float frame_ms); // Returns true if the state changed this frame.
+const governor_state* governor_get(void);
@@ -0,0 +1,134 @@
+/*
+ * Idle usage accounting implementation. See idle.h.
+ */
+
+#include <cstdio>
+#include <ctime>
+
+#include "idle.h"
+
+#define IDLE_RAPL_ENERGY "/sys/class/powercap/intel-rapl:0/energy_uj"
+#define IDLE_RAPL_RANGE "/sys/class/powercap/intel-rapl:0/max_energy_range_uj"
+
+static bool idle_rapl = false;
+static double idle_rapl_range = 0.0; // The counter wraps around at this many joules.
+
+static idle_usage idle_start; // Readings at idle_initialize().
+static idle_usage idle_wait_start; // At the last idle_begin().
+static idle_usage idle_total; // Spent in waits.
+static unsigned int idle_waits = 0;
+
+static bool idle_read_counter(const char* path, double* value) {
+	FILE* file = fopen(path, "r");
+
+	if (!file) {
+		return false;
+	}
+
+	unsigned long long microjoules = 0;
+	bool ok = fscanf(file, "%llu", &microjoules) == 1;
+
+	fclose(file);
+
+	*value = microjoules / 1e6;
+	return ok;
+}
+
+static double idle_clock(clockid_t clock) {
+	struct timespec now;
+	clock_gettime(clock, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void idle_sample(idle_usage* usage) {
+	usage->wall_seconds = idle_clock(CLOCK_MONOTONIC);
+	usage->cpu_seconds = idle_clock(CLOCK_PROCESS_CPUTIME_ID);
+	usage->joules = -1.0;
+
+	if (idle_rapl) {
+		idle_read_counter(IDLE_RAPL_ENERGY, &usage->joules);
+	}
+}
+
+static void idle_difference(const idle_usage* from, const idle_usage* to, idle_usage* delta) {
+	delta->wall_seconds = to->wall_seconds - from->wall_seconds;
+	delta->cpu_seconds = to->cpu_seconds - from->cpu_seconds;
+	delta->joules = -1.0;
+
+	if (idle_rapl) {
+		delta->joules = to->joules - from->joules;
+
+		if (delta->joules < 0.0) {
+			delta->joules += idle_rapl_range;
+		}
+	}
+}
+
+static void idle_print(const char* label, const idle_usage* usage) {
+	double seconds = usage->wall_seconds > 0.0 ? usage->wall_seconds : 1.0;
+
+	printf("%s %.1f s, %.2f s CPU (%.1f%% of a core)", label, usage->wall_seconds, usage->cpu_seconds, usage->cpu_seconds / seconds * 100.0);
+
+	if (usage->joules >= 0.0) {
+		printf(", %.1f J (%.2f W)", usage->joules, usage->joules / seconds);
+	}
+}
+
+void idle_initialize(void) {
+	double energy;
+	idle_rapl = idle_read_counter(IDLE_RAPL_ENERGY, &energy) && idle_read_counter(IDLE_RAPL_RANGE, &idle_rapl_range);
+
+	idle_sample(&idle_start);
+
+	idle_total.wall_seconds = idle_total.cpu_seconds = 0.0;
+	idle_total.joules = idle_rapl ? 0.0 : -1.0;
+	idle_waits = 0;
+
+	printf("[idle] package energy %s\n", idle_rapl ? "from RAPL" : "not available, CPU time only");
+}
+
+void idle_begin(void) {
+	idle_sample(&idle_wait_start);
+}
+
+void idle_end(void) {
+	idle_usage now, wait;
+
+	idle_sample(&now);
+	idle_difference(&idle_wait_start, &now, &wait);
+
+	idle_total.wall_seconds += wait.wall_seconds;
+	idle_total.cpu_seconds += wait.cpu_seconds;
+
+	if (idle_rapl) {
+		idle_total.joules += wait.joules;
+	}
+
+	idle_waits++;
+
+	idle_print("[idle] woke up after", &wait);
+	printf("\n");
+}
+
+void idle_totals(idle_usage* idle, idle_usage* active) {
+	idle_usage now, all;
+
+	idle_sample(&now);
+	idle_difference(&idle_start, &now, &all);
+
+	*idle = idle_total;
+
+	active->wall_seconds = all.wall_seconds - idle_total.wall_seconds;
+	active->cpu_seconds = all.cpu_seconds - idle_total.cpu_seconds;
+	active->joules = idle_rapl ? all.joules - idle_total.joules : -1.0;
+}
+
+void idle_report(void) {
+	idle_usage idle, active;
+	idle_totals(&idle, &active);
+
+	idle_print("[idle] active", &active);
+	idle_print(", idle", &idle);
+	printf(" over %u waits\n", idle_waits);
+}
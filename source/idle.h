@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Usage accounting for render on demand (see IDLE_ENABLED in main.cpp) : wall time, process CPU time and package energy, split between
+ *	idle waits and everything else, so the savings can be read straight off the report.
+ * Energy comes from the RAPL powercap counter (/sys/class/powercap/intel-rapl:0), which covers the whole package, GPU included on
+ *	integrated parts. It is left out where that file isn't there or isn't readable (it is root only on recent kernels).
+ */
+
+struct idle_usage {
+	double wall_seconds;
+	double cpu_seconds;
+	double joules; // Negative without RAPL.
+};
+
+void idle_initialize(void);
+void idle_begin(void); // Right before blocking for events.
+void idle_end(void); // Right after, prints what the wait cost.
+
+void idle_totals(idle_usage* idle, idle_usage* active); // Since idle_initialize().
+void idle_report(void);
@@ -0,0 +1,56 @@
+/*
+ * Frame interval statistics implementation. See jitter.h.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "jitter.h"
+
+void jitter_reset(jitter_window* window) {
+	memset(window, 0, sizeof *window);
+	window->last_time = -1.0;
+}
+
+void jitter_tick(jitter_window* window, double now) {
+	if (window->last_time >= 0.0) {
+		window->samples[window->next] = (float) ((now - window->last_time) * 1000.0);
+		window->next = (window->next + 1) % JITTER_WINDOW;
+
+		if (window->count < JITTER_WINDOW) {
+			window->count++;
+		}
+	}
+
+	window->last_time = now;
+}
+
+void jitter_summary(const jitter_window* window, float* mean, float* deviation, float* p99) {
+	*mean = *deviation = *p99 = 0.0f;
+
+	if (!window->count) {
+		return;
+	}
+
+	double sum = 0.0, sum_sq = 0.0;
+
+	for (unsigned int i = 0; i < window->count; i++) {
+		sum += window->samples[i];
+		sum_sq += (double) window->samples[i] * window->samples[i];
+	}
+
+	double average = sum / window->count;
+
+	*mean = (float) average;
+	*deviation = (float) sqrt(std::max(0.0, sum_sq / window->count - average * average));
+
+	float sorted[JITTER_WINDOW];
+	memcpy(sorted, window->samples, sizeof(float) * window->count);
+
+	unsigned int rank = (unsigned int) (window->count * 0.99f);
+	rank = rank < window->count ? rank : window->count - 1;
+
+	std::nth_element(sorted, sorted + rank, sorted + window->count);
+	*p99 = sorted[rank];
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Frame interval statistics over a sliding window, for comparing how evenly frames (or simulation steps) are paced.
+ * A jitter_window is plain data owned by one thread, summarize it from that same thread.
+ */
+
+#define JITTER_WINDOW 600
+
+struct jitter_window {
+	float samples[JITTER_WINDOW]; // Intervals in ms.
+	unsigned int count;
+	unsigned int next;
+	double last_time; // Seconds, of the previous jitter_tick().
+};
+
+void jitter_reset(jitter_window* window);
+void jitter_tick(jitter_window* window, double now); // Records the interval since the previous tick.
+
+/* Mean, standard deviation and 99th percentile of the intervals in the window. */
+void jitter_summary(const jitter_window* window, float* mean, float* deviation, float* p99);
@@ -0,0 +1,73 @@
+/*
+ * Input to photon latency histogram implementation. See latency.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "latency.h"
+
+#define LATENCY_BAR_WIDTH 40
+
+void latency_reset(latency_histogram* histogram) {
+	memset(histogram, 0, sizeof *histogram);
+}
+
+void latency_add(latency_histogram* histogram, float ms) {
+	int bin = ms > 0.0f ? (int) (ms / LATENCY_BIN_MS) : 0;
+
+	histogram->bins[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1]++;
+	histogram->count++;
+	histogram->sum_ms += ms;
+	histogram->max_ms = ms > histogram->max_ms ? ms : histogram->max_ms;
+}
+
+float latency_percentile(const latency_histogram* histogram, float fraction) {
+	unsigned int rank = (unsigned int) (histogram->count * fraction);
+	unsigned int seen = 0;
+
+	for (int bin = 0; bin < LATENCY_BINS; bin++) {
+		seen += histogram->bins[bin];
+
+		if (seen > rank) {
+			return bin + 1 < LATENCY_BINS ? (bin + 1) * LATENCY_BIN_MS : histogram->max_ms;
+		}
+	}
+
+	return histogram->max_ms;
+}
+
+void latency_print(const latency_histogram* histogram, const char* label) {
+	if (!histogram->count) {
+		printf("[latency] %s : no frames completed yet\n", label);
+		return;
+	}
+
+	printf("[latency] %s : %u frames, %.2f ms mean, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.2f ms\n", label, histogram->count,
+		histogram->sum_ms / histogram->count, latency_percentile(histogram, 0.5f), latency_percentile(histogram, 0.9f),
+		latency_percentile(histogram, 0.99f), histogram->max_ms);
+
+	unsigned int peak = 0;
+
+	for (int bin = 0; bin < LATENCY_BINS; bin++) {
+		peak = histogram->bins[bin] > peak ? histogram->bins[bin] : peak;
+	}
+
+	for (int bin = 0; bin < LATENCY_BINS; bin++) {
+		if (!histogram->bins[bin]) {
+			continue;
+		}
+
+		char bar[LATENCY_BAR_WIDTH + 1];
+		int width = (int) ((unsigned long long) histogram->bins[bin] * LATENCY_BAR_WIDTH / peak);
+
+		memset(bar, '#', width > 0 ? width : 1);
+		bar[width > 0 ? width : 1] = '\0';
+
+		if (bin + 1 < LATENCY_BINS) {
+			printf("  %5.1f-%5.1f ms %6u %s\n", bin * LATENCY_BIN_MS, (bin + 1) * LATENCY_BIN_MS, histogram->bins[bin], bar);
+		} else {
+			printf("  %5.1f+     ms %6u %s\n", bin * LATENCY_BIN_MS, histogram->bins[bin], bar);
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+ * Input to photon latency histogram, see FRAMES_IN_FLIGHT in main.cpp.
+ * Samples are the time from reading the mouse to the GPU finishing the frame that used it, in ms. They go into fixed LATENCY_BIN_MS wide
+ *	bins (the last one takes everything past it), so percentiles are good to a bin. A latency_histogram is plain data owned by one thread.
+ */
+
+#define LATENCY_BINS 100
+#define LATENCY_BIN_MS 0.5f
+
+struct latency_histogram {
+	unsigned int bins[LATENCY_BINS];
+	unsigned int count;
+	float max_ms;
+	double sum_ms;
+};
+
+void latency_reset(latency_histogram* histogram);
+void latency_add(latency_histogram* histogram, float ms);
+
+float latency_percentile(const latency_histogram* histogram, float fraction); // Upper edge of the bin it falls in.
+void latency_print(const latency_histogram* histogram, const char* label); // Summary line, then a bar per occupied bin.
@@ -1,14 +1,13 @@
 /*
  * JT Stanley (github@metredigm) - OpenGL TBO particles program.
  * This program is part a of a 5-hour code rush I'm challenging myself with.
- * 
- * I would do the project in C, but there is no nice library for OpenGL matrices, and implementing this yourself takes _time_.
- * This is a single-source program (not enough time to structure the program much), and I'll try to keep it documented as much as I can.
  *
- * Absolutely requires GLSL version 330 support to run. If you don't have support, (indicated by shader error messages during launch), try upgrading to the proprietary driver set
- *	for your GPU.
+ * I would do the project in C, but there is no nice library for OpenGL matrices, and implementing this yourself takes _time_.
+ * This file is the host : window, input, the frame and its reports. The particle state and its advance are a particle_system from the
+ *	library (see particle_system.h), the passes around it (scenes, neighbors, n-body, sleeping, culling) are here. The GLSL lives in
+ *	source/shaders, and every other module has a header of its own.
  *
- * Unfortunately, Mesa does not have support for GLSL 330 yet.
+ * Requires an OpenGL 3.3 core profile context. Current Mesa drivers have one, llvmpipe included.
  */
 
 /* Library includes */
@@ -17,37 +16,266 @@
 #include <cstdio>
 #include <cstring>
 #include <cmath>
+#include <cfloat>
 #include <ctime>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <vector>
 
 #include <GLXW/glxw.h>
 #include <GLFW/glfw3.h>
 
-#include <IL/il.h>
-
 #define GLM_FORCE_RADIANS
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+/* Module includes */
+
+#include "profiler.h"
+#include "governor.h"
+#include "parallel.h"
+#include "cpu_engine.h"
+#include "bh_tree.h"
+#include "forces.h"
+#include "scenes.h"
+#include "recorder.h"
+#include "telemetry.h"
+#include "jitter.h"
+#include "latency.h"
+#include "idle.h"
+#include "publish.h"
+#include "variants.h"
+#include "startup.h"
+#include "sprites.h"
+#include "stats.h"
+#include "programs.h"
+#include "particle_system.h"
+#include "attribute_buffers.h"
+#include "frame_graph.h"
+#include "shader_reload.h"
+
 /* Shader includes */
 
-#include "shaders/render_vs.glsl"
-#include "shaders/render_gs.glsl"
-#include "shaders/render_ps.glsl"
-#include "shaders/advance_vs.glsl"
+#include "shaders/cull_vs.glsl"
+#include "shaders/cull_gs.glsl"
+#include "shaders/grid_vs.glsl"
+#include "shaders/grid_ps.glsl"
+#include "shaders/sleep_vs.glsl"
+#include "shaders/sleep_gs.glsl"
+#include "shaders/stats_vs.glsl"
+#include "shaders/stats_gs.glsl"
+#include "shaders/stats_ps.glsl"
+#include "shaders/stats_reduce_vs.glsl"
+#include "shaders/stats_reduce_ps.glsl"
 
 /* Config defines */
 
-#define PARTICLE_COUNT 175000
+#define PARTICLE_COUNT 175000 // Per scene.
+
+/* Independent particle systems hosted in one process, sharing the particle buffers, the programs and the draw calls. Each gets its own
+ *	camera bounds, mouse, gravity, damping and colour from a parameter buffer, and its own tile of the window. */
+#define SCENE_COUNT 1
+#define PARTICLE_TOTAL (PARTICLE_COUNT * SCENE_COUNT)
 
 #define WINDOW_WIDTH 1366
 #define WINDOW_HEIGHT 768
 #define WINDOW_VSYNC 0
 #define WINDOW_FULLSCREEN 1
 
-/* PARTICLE_TEXTURE has a use and is loaded, but I failed to debug the texture display in the 5-hour time frame. */
-#define PARTICLE_TEXTURE "particle.png"
+/* One simulation seen through several views, like a video wall : VIEW_COLUMNS x VIEW_ROWS of them, each with its own camera. The advance,
+ *	culling and statistics run once per frame whatever the count, a view only costs its draw. The views tile the main window, or with
+ *	VIEW_WINDOWS every view past the first gets a window of its own, on a context sharing the main one's objects. By default they split
+ *	the interactive camera's rectangle between them, --view gives one a fixed rectangle of the world instead. */
+#define VIEW_COLUMNS 1
+#define VIEW_ROWS 1
+#define VIEW_COUNT (VIEW_COLUMNS * VIEW_ROWS)
+#define VIEW_WINDOWS 0
+
+/* Advance passes per frame, each of SIMULATION_DT. The governor may drop this down to 1 under load, which slows the motion down with it.
+ *	At 1, one step per frame like the original program, there is nothing to drop and the governor starts at the render resolution. */
+#define SIMULATION_SUBSTEPS 1
+
+/* How each advance pass integrates, see SHADER_ADVANCE_VS : INTEGRATOR_EULER (semi-implicit, what the program always did), INTEGRATOR_VERLET
+ *	or INTEGRATOR_ADAPTIVE (Verlet substepped per particle). SIMULATION_DT is the length of a pass in the original program's steps, forces
+ *	and decay are still given per step, so 2.0 covers the same motion in half the passes. Adaptive takes as many substeps as keep the
+ *	acceleration's share of a substep's move under INTEGRATOR_TOLERANCE, up to INTEGRATOR_MAX_SUBSTEPS. */
+#define SIMULATION_INTEGRATOR INTEGRATOR_EULER
+#define SIMULATION_DT 1.0f
+#define INTEGRATOR_TOLERANCE 0.0002f
+#define INTEGRATOR_MAX_SUBSTEPS 8
+
+/* The governor holds the GPU frame time under GOVERNOR_BUDGET_MS by trading substeps (only above SIMULATION_SUBSTEPS 1), render resolution
+ *	and particle count. */
+#define GOVERNOR_ENABLED 1
+#define GOVERNOR_BUDGET_MS 16.6f
+#define GOVERNOR_MIN_PARTICLES (PARTICLE_COUNT / 10) // With several scenes the count is fixed, a shorter live prefix would cut off whole scenes.
+
+/* Print the smoothed GPU pass timings every this many frames, 0 to disable. PROFILER_FINISH times every pass between two glFinish() calls
+ *	instead of with timer queries, see profiler.h : slower, for measuring on drivers whose queries come back empty. */
+#define PROFILER_REPORT_FRAMES 600
+#define PROFILER_FINISH 0
+
+/* Run the advance on the CPU worker pool instead of with transform feedback, uploading the result every frame. 0 threads uses every core. */
+#define SIMULATION_ENGINE_CPU 0
+#define SIMULATION_THREADS 0
+
+/* Attractors are evaluated in the advance pass from a UBO, the mouse (while held) is one of them. ATTRACTOR_ORBITERS adds that many more
+ *	circling the centre of the screen, alternating between attracting and repelling. */
+#define ATTRACTOR_ORBITERS 0
+#define ATTRACTOR_SOFTENING 0.01f
+
+/* Curl noise force field, baked once at startup and sampled with a single texture fetch per particle. */
+#define FIELD_ENABLED 0
+#define FIELD_WIDTH 256
+#define FIELD_HEIGHT 144
+#define FIELD_FREQUENCY 3.0f
+#define FIELD_STRENGTH 0.00005f
+
+/* Short range particle-particle repulsion. The GPU splats a per-cell density grid and pushes particles down its gradient,
+ *	the CPU engine does an exact neighbor search over a counting-sorted uniform grid. Cells are NEIGHBOR_RADIUS wide in both cases, but the
+ *	two are different force models and don't give the same motion. */
+#define NEIGHBOR_ENABLED 0
+#define NEIGHBOR_RADIUS 0.004f
+#define NEIGHBOR_STRENGTH 0.00002f
+
+/* Mutual gravity through a Barnes-Hut quadtree built on the worker pool. The GPU path reads positions back asynchronously and walks a tree
+ *	that is one frame old. NBODY_GRAVITATION is shared out over all particles, NBODY_THETA is the opening angle.
+ *	Every NBODY_VALIDATE_FRAMES frames the tree is checked against a direct sum (0 to disable), NBODY_DIRECT makes the CPU engine use the
+ *	direct sum outright, which is only practical for small counts. */
+#define NBODY_ENABLED 0
+#define NBODY_THETA 0.5f
+#define NBODY_GRAVITATION 0.00001f
+#define NBODY_SOFTENING 0.01f
+#define NBODY_VALIDATE_FRAMES 600
+#define NBODY_DIRECT 0
+
+/* Particles that are slow and feel next to no force are stopped and left out of the advance. Every SLEEP_INTERVAL frames, and whenever the
+ *	attractor list changes (mouse press or release) or an attractor moved more than SLEEP_WAKE_MOVE since the last judgement (the held
+ *	mouse, the orbiters), all live particles are judged again : sleepers the moved force now reaches past SLEEP_FORCE wake up. On the GPU
+ *	that pass packs the awake ones into a prefix of the particle buffer and the advance only covers that prefix. It costs one synchronous
+ *	query readback each time it runs. The test doesn't walk the Barnes-Hut tree, so it can't be combined with GPU n-body. */
+#define SLEEP_ENABLED 0
+#define SLEEP_SPEED 0.0003f
+#define SLEEP_FORCE 0.00005f
+#define SLEEP_INTERVAL 30
+#define SLEEP_WAKE_MOVE 0.005f
+
+#if SLEEP_ENABLED && NBODY_ENABLED && !SIMULATION_ENGINE_CPU
+#error "SLEEP_ENABLED needs the CPU engine when NBODY_ENABLED is set, the GPU sleep test can't see mutual gravity."
+#endif
+
+#if SCENE_COUNT > 1 && (SIMULATION_ENGINE_CPU || NEIGHBOR_ENABLED || NBODY_ENABLED || SLEEP_ENABLED)
+#error "SCENE_COUNT > 1 is GPU only, and doesn't mix with neighbors, n-body or sleeping : those would let scenes interact or reorder them."
+#endif
+
+/* Frames in flight : before reading the input for a frame, wait for the GPU to finish the frame FRAMES_IN_FLIGHT before it, so the driver
+ *	can't queue up frames and have the mouse show up several frames late. 1 runs CPU and GPU in turns, more trades latency for throughput,
+ *	0 leaves it to the driver. --frames-in-flight overrides it, up to FRAMES_IN_FLIGHT_MAX.
+ * Input to photon latency (the mouse read to the GPU finishing the frame that used it, from GL_TIMESTAMP queries) is measured either way
+ *	and printed with the profiler report. Scanout comes on top, GL can't see that far. */
+#define FRAMES_IN_FLIGHT 2
+#define FRAMES_IN_FLIGHT_MAX 8
+
+/* Offline rendering, enabled with --record (see print_usage()). Frames are drawn into an offscreen target, read back through a ring of
+ *	RECORD_PBO_COUNT fenced pixel buffers and encoded on RECORD_THREADS writer threads (0 leaves one core for us). RECORD_SLOTS frames can
+ *	queue up for the writers before rendering waits on them. */
+#define RECORD_PBO_COUNT 3
+#define RECORD_THREADS 0
+#define RECORD_SLOTS 8
+#define RECORD_FPS 60
+#define RECORD_DEFAULT_FRAMES 600
+
+/* Run the advance on its own thread and shared GL context at a fixed SIMULATION_RATE steps per second, handing states to the render
+ *	thread through three particle buffers and fences, so a slow present doesn't hold up the simulation and the other way around.
+ *	Only the attractor, field and scene forces are available there, the other stages keep per-context GL objects or state. */
+#define SIMULATION_THREADED 0
+#define SIMULATION_RATE 60
+#define SIMULATION_REPORT_STEPS 600
+
+#if SIMULATION_THREADED && VIEW_WINDOWS
+#error "VIEW_WINDOWS draws from other contexts, which the threaded simulation's fences don't cover."
+#endif
+
+#if SIMULATION_THREADED && (SIMULATION_ENGINE_CPU || NEIGHBOR_ENABLED || NBODY_ENABLED || SLEEP_ENABLED)
+#error "SIMULATION_THREADED runs the GPU advance with attractors, the field and scenes only."
+#endif
+
+/* What happens at the edge of the camera bounds : particles bounce off (0), or wrap around to the other side (1). */
+#define BOUNDS_WRAP 0
+
+/* Half the width of a particle sprite, in world units at zoom 1. Folded into the render variants. */
+#define RENDER_PARTICLE_DIM 0.001f
+
+/* Per-particle attributes past the state (see attributes.h), ATTRIBUTE_SET is a mask of ATTRIBUTE_*_BIT and 0 disables them. They tint,
+ *	size and pick the sprite of each particle, and the age fades it in over its first ATTRIBUTE_AGE_FADE steps. ATTRIBUTE_LAYOUT is how
+ *	they are stored : attribute_layout_aos, attribute_layout_soa or attribute_layout_packed, 'make bench' compares them. The streams go on
+ *	texture units ATTRIBUTE_UNIT and up, and follow the particles by index, so nothing that reorders particles can be on. */
+#define ATTRIBUTE_SET 0
+#define ATTRIBUTE_LAYOUT attribute_layout_packed
+#define ATTRIBUTE_AGE_FADE 120.0f
+#define ATTRIBUTE_UNIT 8
+
+#if ATTRIBUTE_SET && (SLEEP_ENABLED || (SIMULATION_ENGINE_CPU && (NEIGHBOR_ENABLED || NBODY_ENABLED)))
+#error "ATTRIBUTE_SET doesn't mix with sleeping or the CPU engine's neighbor sort, both reorder the particles under the attributes."
+#endif
+
+/* Largest sprite half width a particle can have, the cull pass keeps particles that far out of view. */
+#define RENDER_PARTICLE_DIM_MAX (RENDER_PARTICLE_DIM * ((ATTRIBUTE_SET & ATTRIBUTE_SIZE_BIT) ? ATTRIBUTE_SIZE_MAX : 1.0f))
+
+/* Scroll zooms around the cursor, dragging with the right button pans and R resets the view. */
+#define CAMERA_ZOOM_MAX 64.0f
+#define CAMERA_ZOOM_STEP 1.15f // Per scroll notch.
+
+/* Once zoomed in past CULL_MIN_ZOOM, a pass compacts the particles inside the view into a render list and only those get drawn.
+ *	Needs ARB_transform_feedback2 (glDrawTransformFeedback) to draw the list without reading its length back, everything is drawn without it. */
+#define CULL_ENABLED 1
+#define CULL_MIN_ZOOM 1.5f
+
+/* Prometheus metrics endpoint on 127.0.0.1:TELEMETRY_PORT, 0 to disable. --metrics-port and --metrics-socket override it, so several
+ *	instances on a host can each get their own. */
+#define TELEMETRY_PORT 0
+
+/* Whole-population statistics (see stats.h) reduced on the GPU every frame and read back a few frames late through STATS_READBACK_COUNT
+ *	fenced pixel buffers, a few hundred bytes each. The first level spreads its blending over STATS_LANES texels per row so particles don't
+ *	all queue up on one. Printed with the profiler report and published as metrics. */
+#define STATS_ENABLED 1
+#define STATS_LANES 256
+#define STATS_READBACK_COUNT 3
+#define STATS_SPEED_MAX 0.02f // Top of the speed histogram, world units per step.
+#define STATS_MOUSE_RADIUS 0.1f
+
+/* Render on demand : once the fastest particle is slower than IDLE_SPEED (from the statistics above) and no input has come in for
+ *	IDLE_FRAMES frames, stop advancing and drawing and block in glfwWaitEvents() until some arrives, the last frame stays up. CPU time and
+ *	package energy spent idle and active are printed with the profiler report. Never while recording, with the threaded simulation or
+ *	with orbiters, which keep things moving on their own. */
+#define IDLE_ENABLED 1
+#define IDLE_SPEED 0.0003f
+#define IDLE_FRAMES 30
+
+#if IDLE_ENABLED && (!STATS_ENABLED || IDLE_FRAMES <= STATS_READBACK_COUNT)
+#error "IDLE_ENABLED needs STATS_ENABLED, and IDLE_FRAMES past the statistics readback latency."
+#endif
+
+/* Publication of the live particle state to other processes through shared memory (see publish.h), as /dev/shm/PUBLISH_NAME with
+ *	PUBLISH_SLOTS frames in the ring. NULL disables it, --publish overrides it. The GPU state is copied into PUBLISH_READBACK_COUNT fenced
+ *	buffers and published once a copy has landed : when they are all still in flight the frame isn't published, rather than waited for.
+ *	The CPU engine publishes straight from its own array. */
+#define PUBLISH_NAME NULL
+#define PUBLISH_SLOTS 4
+#define PUBLISH_READBACK_COUNT 3
+
+/* Sprite atlas baked from particle.png by 'make sprites', see sprites.h. */
+#define PARTICLE_SPRITES "particle.sprites"
+
+/* From KHR_parallel_shader_compile, which GLXW predates. */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 /* Global variable declarations */
 
@@ -55,27 +283,206 @@ static GLFWwindow* window_handle = NULL;
 static glm::mat4 projection_matrix;
 static float projection_camera_data[4] = {0.0f};
 
-static unsigned int shader_render_vs = 0;
-static unsigned int shader_render_gs = 0;
-static unsigned int shader_render_ps = 0;
+/* The render and advance programs are whichever variants are selected (see variants.h), along with their per-frame uniforms. */
 static unsigned int shader_render_program = 0;
-static int shader_render_tbo_loc = 0;
 static int shader_render_mvp_loc = 0;
-static int shader_render_tex_loc = 0;
 static int shader_render_color_loc = 0;
 
-static unsigned int shader_advance_vs = 0;
+/* The full render variant the view windows draw with, and its uniforms : picked up again only when a reload swaps the program. */
+static unsigned int shader_view_program = 0;
+static int shader_view_mvp_loc = 0;
+static int shader_view_color_loc = 0;
+
+/* View over the window bounds : its center and how far it is zoomed in. camera_scroll collects scroll notches between frames. */
+static float camera_center[2] = {0.0f};
+static float camera_zoom = 1.0f;
+static double camera_scroll = 0.0;
+static bool camera_dragging = false;
+static double camera_drag_from[2] = {0.0};
+
+/* Views, see VIEW_COLUMNS. One without a window of its own is a viewport of the main window (or of the recording). */
+struct view_state {
+	bool fixed; // Shows a rectangle given with --view, rather than its share of the camera's.
+	float rect[4]; // World rectangle it shows : left, right, bottom, top.
+	int viewport[4]; // x, y, width and height at full render scale.
+	GLFWwindow* window;
+	glm::mat4 mvp;
+};
+
+static view_state views[VIEW_COUNT];
+static int view_fixed_count = 0; // --view arguments, they go to the views in order.
+
+/* Visibility pass, its output list and the transform feedback object that remembers how long the list is. */
+static unsigned int shader_cull_program = 0;
+static int shader_cull_mvp_loc = 0;
+static int shader_cull_margin_loc = 0;
+static unsigned int cull_feedback = 0;
+static unsigned int cull_feedback_buffer = 0; // The transient the feedback object writes to, see cull_particles().
+static bool cull_supported = false;
+
 static unsigned int shader_advance_program = 0;
-static int shader_advance_tbo_loc = 0;
-static int shader_advance_cam_loc = 0;
-static int shader_advance_mouse_loc = 0;
+static int shader_advance_attractor_count_loc = 0;
+static int shader_advance_nbody_count_loc = 0;
+
+static unsigned int shader_grid_program = 0;
+static int shader_grid_cell_size_loc = 0;
 
-static unsigned int particle_buffer_first = 0;
-static unsigned int particle_buffer_second = 0;
-static unsigned int particle_buffer_first_texture = 0;
-static unsigned int particle_buffer_second_texture = 0;
+/* The particle state and its advance, see particle_system.h. Everything else here runs around it. */
+static particle_system particles;
 
 static unsigned int render_texture = 0;
+static int sprite_grid[3] = {1, 1, 1}; // Atlas columns, rows and sprites in use.
+
+/* Colour, size, age and sprite per particle, see ATTRIBUTE_SET. */
+static attribute_buffers<ATTRIBUTE_LAYOUT> attributes;
+
+/* Offscreen target for reduced resolution rendering, only used when the governor lowers the render scale. */
+static unsigned int scaled_framebuffer = 0;
+static unsigned int scaled_renderbuffer = 0;
+
+/* Attractor list for the advance pass, and the baked force field. */
+static unsigned int attractor_buffer = 0;
+static unsigned int field_texture = 0;
+
+/* Per-cell particle counts for the GPU neighbor stage. */
+static unsigned int neighbor_framebuffer = 0;
+static unsigned int neighbor_texture = 0;
+static int neighbor_grid_width = 0;
+static int neighbor_grid_height = 0;
+
+/* Barnes-Hut tree for the GPU n-body mode, plus the ring of buffers positions are read back through. */
+static unsigned int nbody_tree_buffer = 0;
+static unsigned int nbody_tree_texture = 0;
+static unsigned int nbody_points_buffer = 0;
+static unsigned int nbody_points_texture = 0;
+static unsigned int nbody_node_count = 0;
+static float* nbody_texels = NULL;
+static unsigned int nbody_texel_capacity = 0; // In nodes.
+
+static unsigned int nbody_readback_buffers[2] = {0};
+static GLsync nbody_readback_fences[2] = {0};
+static unsigned int nbody_readback_counts[2] = {0};
+static unsigned int nbody_issued = 0;
+static unsigned int nbody_collected = 0;
+static unsigned int nbody_frame = 0;
+
+/* Offline recording state. output_framebuffer is what a frame ends up in, the window or record_framebuffer. */
+static bool record_enabled = false;
+static const char* record_path = NULL;
+static int record_format = RECORDER_PNG;
+static unsigned int record_frames = RECORD_DEFAULT_FRAMES;
+
+static int telemetry_port = TELEMETRY_PORT;
+static const char* telemetry_socket = NULL;
+
+static unsigned int output_framebuffer = 0;
+static unsigned int record_framebuffer = 0;
+static unsigned int record_renderbuffer = 0;
+static unsigned int record_pbos[RECORD_PBO_COUNT] = {0};
+static GLsync record_fences[RECORD_PBO_COUNT] = {0};
+static unsigned int record_issued = 0; // Readbacks started.
+static unsigned int record_collected = 0; // Readbacks handed to the recorder.
+static unsigned int record_readback_stalls = 0;
+static float record_readback_stall_ms = 0.0f;
+
+/* Startup work that doesn't need the GL context runs on worker threads while the window and the shaders come up, and is uploaded once
+ *	the main thread gets to it. */
+static std::vector<float> startup_particles;
+
+/* Variant programs whose compile and link were issued but not checked yet, see finish_variants(). */
+struct pending_variant {
+	variant_key key;
+	unsigned int program;
+};
+
+static std::vector<pending_variant> pending_variants;
+static bool parallel_compile_supported = false;
+
+/* Threaded simulation. Three particle states : the latest one the simulation published, the one the render thread is drawing, and the
+ *	one being written. Each has a fence the simulation sets when it is written and one the render thread sets when it is done reading. */
+struct simulation_input {
+	float mouse_data[3];
+	unsigned int particle_count;
+	int substeps;
+};
+
+static GLFWwindow* simulation_window = NULL;
+static std::thread simulation_thread;
+static std::atomic<bool> simulation_exit(false);
+static std::mutex simulation_mutex;
+
+static simulation_input simulation_latest_input; // Guarded by simulation_mutex.
+static unsigned int simulation_buffers[3] = {0};
+static unsigned int simulation_textures[3] = {0};
+static GLsync simulation_written[3] = {0};
+static GLsync simulation_read[3] = {0};
+static int simulation_published = 0;
+static int simulation_rendering = 0;
+
+/* Per-scene parameters, see scenes.h. */
+static unsigned int scene_buffer = 0;
+static unsigned int scene_texture = 0;
+
+/* Sleeping particles : the partition program, a scratch buffer the sleepers are staged in, and the query that counts the awake ones. */
+static unsigned int shader_sleep_program = 0;
+static int shader_sleep_mode_loc = 0;
+static int shader_sleep_attractor_count_loc = 0;
+static unsigned int sleep_query = 0;
+static unsigned int sleep_live_count = 0;
+static unsigned int sleep_awake_count = 0;
+static unsigned int sleep_frame = 0;
+static forces_attractor sleep_attractors[FORCES_MAX_ATTRACTORS]; // As they were when the particles were last judged.
+static unsigned int sleep_attractor_count = 0;
+
+/* Statistics reduction : the per-lane target, the one texel wide target the lanes are folded into, and the ring it is read back through. */
+static unsigned int shader_stats_program = 0;
+static int shader_stats_mode_loc = 0;
+static int shader_stats_mouse_loc = 0;
+static unsigned int shader_stats_reduce_program = 0;
+static unsigned int stats_framebuffers[2] = {0};
+static unsigned int stats_textures[2] = {0};
+static unsigned int stats_pbos[STATS_READBACK_COUNT] = {0};
+static GLsync stats_fences[STATS_READBACK_COUNT] = {0};
+static unsigned int stats_issued = 0;
+static unsigned int stats_collected = 0;
+static unsigned int stats_skipped = 0; // Frames that found every buffer still in flight.
+static bool stats_valid = false;
+static particle_stats stats_latest;
+
+/* Render on demand. idle_input is set by the input callbacks and cleared every frame. */
+static bool idle_input = false;
+static bool idle_refresh = false;
+static unsigned int idle_quiet_frames = 0;
+
+/* Shared memory publication, and the ring the GPU state is read back through for it. */
+static const char* publish_name = PUBLISH_NAME;
+static unsigned int publish_buffers[PUBLISH_READBACK_COUNT] = {0};
+static GLsync publish_fences[PUBLISH_READBACK_COUNT] = {0};
+static unsigned int publish_counts[PUBLISH_READBACK_COUNT] = {0};
+static uint64_t publish_produced[PUBLISH_READBACK_COUNT] = {0};
+static unsigned int publish_issued = 0;
+static unsigned int publish_collected = 0;
+static unsigned int publish_skipped = 0; // Frames that found every buffer still in flight.
+
+/* Shader hot reload, see shader_reload.h. */
+static const char* reload_directory = NULL;
+
+/* Frames in flight, and the timestamp each one's input was read at. latency_clock_offset takes GPU timestamps to glfwGetTime(). */
+struct frame_latency {
+	GLsync fence;
+	unsigned int query;
+	double input_time;
+};
+
+static int frames_in_flight = FRAMES_IN_FLIGHT;
+static frame_latency latency_frames[FRAMES_IN_FLIGHT_MAX];
+static unsigned int latency_issued = 0;
+static unsigned int latency_collected = 0;
+static double latency_clock_offset = 0.0;
+static unsigned int latency_waits = 0;
+static float latency_wait_ms = 0.0f;
+static latency_histogram latency_recent; // Since the last profiler report.
+static latency_histogram latency_run;
 
 /* Global function declarations */
 
@@ -85,366 +492,2677 @@ void swap_window(void);
 void clear_window(void);
 
 bool initialize_shaders(void);
+bool finish_shaders(void);
+bool initialize_render_texture(void);
+bool generate_particles(void);
+bool bake_force_field(void);
+bool has_extension(const char* name);
 bool initialize_buffers(void);
+bool initialize_scaled_framebuffer(void);
+bool initialize_forces(void);
+bool initialize_neighbor_grid(void);
+bool initialize_nbody(void);
+bool initialize_sleep(void);
+bool initialize_scenes(void);
+bool initialize_recording(void);
+bool initialize_simulation_thread(void);
+bool initialize_cull(void);
+bool initialize_stats(void);
+bool initialize_latency(void);
+bool initialize_publish(void);
+bool initialize_attributes(void);
 void initialize_camera(void);
+void update_camera(double mx, double my, bool enabled);
+void camera_scroll_callback(GLFWwindow* window, double x, double y);
+void idle_cursor_callback(GLFWwindow* window, double x, double y);
+void idle_button_callback(GLFWwindow* window, int button, int action, int mods);
+void idle_key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void idle_refresh_callback(GLFWwindow* window);
+bool update_idle(bool held);
+void wait_idle(void);
+void cull_particles(unsigned int list_buffer, unsigned int count);
+bool initialize_views(void);
+void update_views(void);
+void render_particles(bool culled, bool scaled, unsigned int count, float scale, float r, float g, float b);
+void draw_view(const view_state* view, bool culled, unsigned int count, float scale);
+void draw_view_windows(unsigned int state_texture, unsigned int count, float r, float g, float b);
+void shutdown_views(void);
+
+variant_key make_variant_key(int kind, unsigned int features);
+void prepare_variant(int kind, unsigned int features);
+bool finish_variants(void);
+unsigned int get_variant(int kind, unsigned int features);
+unsigned int advance_variant_features(bool attractors, bool scene_mouse);
+unsigned int render_variant_features(bool culled);
+const char* variant_glsl(const variant_key* key);
+void setup_variant_program(const variant_key* key, unsigned int program);
+void setup_advance_program(unsigned int program);
+void setup_render_program(unsigned int program);
+void select_advance_variant(bool scene_mouse);
+void select_render_variant(bool culled);
+void set_forces_uniforms(unsigned int program);
+
+bool update_attractors(const float* mouse_data);
+bool update_scenes(const float* mouse_data);
+void update_neighbor_grid(unsigned int count);
+void update_nbody_tree(unsigned int state_buffer, unsigned int count);
+bool sleep_due(unsigned int count, bool wake);
+bool sleep_attractors_moved(void);
+void sleep_attractors_judged(void);
+void update_sleep(unsigned int scratch_buffer, unsigned int count);
+void update_stats(unsigned int count, const float* mouse_data);
+void update_publish(unsigned int state_buffer, unsigned int count);
+void calibrate_latency_clock(void);
+bool collect_latency(bool wait);
+void update_latency(double input_time);
+void print_latency(latency_histogram* histogram, const char* label);
+void shutdown_publish(void);
+float sleep_active_fraction(void);
+bool parse_arguments(int argc, char** argv);
+void print_usage(const char* program);
+bool record_collect(bool wait);
+void record_frame(void);
+void finish_recording(double seconds);
+void simulation_run(void);
+void simulation_step(unsigned int count);
+unsigned int simulation_acquire_state(void);
+void simulation_release_state(void);
+unsigned int current_state_buffer(void);
+unsigned int current_state_texture(void);
+void shutdown_simulation_thread(void);
+void advance_particles_gpu(unsigned int count, unsigned int awake);
+void advance_particles_cpu(unsigned int count);
 
 /* Entry point function definition */
 
 int main(int argc, char** argv) {
+	if (!parse_arguments(argc, argv)) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	startup_begin();
+
+	parallel_initialize(SIMULATION_THREADS); // Used by the CPU engine and the Barnes-Hut build.
+
+	initialize_camera(); // Camera bounds needed for initialize_shaders(), the particles and the field.
+
+	/* Particle generation and the field bake don't need GL, so they run while the window and context come up.
+	 *	The futures wait for their thread when destroyed, so bailing out early below is fine too. */
+	std::future<bool> particles_job = std::async(std::launch::async, generate_particles);
+	std::future<bool> field_job = std::async(std::launch::async, bake_force_field); // The only one using the worker pool.
+
 	if (!initialize_window()) {
 		printf("[main] Failed to initialize window.\n");
 		return 1;
 	}
 
-	initialize_camera(); // Camera bounds needed for initialize_shaders().
+	startup_mark("window and context");
+
+	if (!initialize_views()) {
+		printf("[main] Failed to initialize views.\n");
+		return 1;
+	}
+
+	if (!initialize_scenes()) {
+		printf("[main] Failed to initialize scenes.\n");
+		return 1;
+	}
+
+	/* Before the shaders, the render variants are built around the layout's GLSL. */
+	if (ATTRIBUTE_SET && !initialize_attributes()) {
+		printf("[main] Failed to initialize particle attributes.\n");
+		return 1;
+	}
 
+	/* Compiles are only issued here, nothing asks for their results until finish_shaders(). */
 	if (!initialize_shaders()) {
 		printf("[main] Failed to initialize shaders.\n");
 		return 1;
 	}
 
-	if (!initialize_buffers()) {
+	startup_mark("shader compiles issued");
+
+	if (!particles_job.get() || !initialize_buffers()) {
 		printf("[main] Failed to initialize buffers.\n");
 		return 1;
 	}
 
+	startup_mark("particles uploaded");
+
+	if (!field_job.get() || !initialize_forces()) {
+		printf("[main] Failed to initialize forces.\n");
+		return 1;
+	}
+
+	startup_mark("forces uploaded");
+
+	if (!initialize_render_texture()) {
+		printf("[main] Failed to initialize render texture.\n");
+		return 1;
+	}
+
+	startup_mark("texture uploaded");
+
+	if (!finish_shaders()) {
+		printf("[main] Failed to build shaders.\n");
+		return 1;
+	}
+
+	startup_mark("shaders linked");
+
+	if (CULL_ENABLED && !initialize_cull()) {
+		printf("[main] Failed to initialize cull pass.\n");
+		return 1;
+	}
+
+	if (STATS_ENABLED && !initialize_stats()) {
+		printf("[main] Failed to initialize statistics.\n");
+		return 1;
+	}
+
+	if (NEIGHBOR_ENABLED && !SIMULATION_ENGINE_CPU && !initialize_neighbor_grid()) {
+		printf("[main] Failed to initialize neighbor grid.\n");
+		return 1;
+	}
+
+	if (NBODY_ENABLED && !SIMULATION_ENGINE_CPU && !initialize_nbody()) {
+		printf("[main] Failed to initialize n-body tree.\n");
+		return 1;
+	}
+
+	if (SLEEP_ENABLED && !SIMULATION_ENGINE_CPU && !initialize_sleep()) {
+		printf("[main] Failed to initialize sleep pass.\n");
+		return 1;
+	}
+
+	if (!initialize_scaled_framebuffer()) {
+		printf("[main] Failed to initialize scaled framebuffer.\n");
+		return 1;
+	}
+
+	if (!profiler_initialize(PROFILER_FINISH)) {
+		printf("[main] Failed to initialize GPU profiler.\n");
+		return 1;
+	}
+
+	if (record_enabled && !initialize_recording()) {
+		printf("[main] Failed to initialize recording.\n");
+		return 1;
+	}
+
+	if (!telemetry_initialize(telemetry_port, telemetry_socket)) {
+		printf("[main] Failed to initialize telemetry.\n");
+		return 1;
+	}
+
+	if (!initialize_latency()) {
+		printf("[main] Failed to initialize latency queries.\n");
+		return 1;
+	}
+
+	if (publish_name && !initialize_publish()) {
+		printf("[main] Failed to initialize publishing.\n");
+		return 1;
+	}
+
+	if (SIMULATION_THREADED && !initialize_simulation_thread()) {
+		printf("[main] Failed to start the simulation thread.\n");
+		return 1;
+	}
+
+	if (reload_directory && !shader_reload_initialize(window_handle, reload_directory, variant_glsl, setup_variant_program)) {
+		printf("[main] Failed to start shader reloading.\n");
+		return 1;
+	}
+
+	startup_mark("initialized");
+
+	double record_start = glfwGetTime();
+
+	jitter_window frame_jitter;
+	jitter_reset(&frame_jitter);
+
+	if (IDLE_ENABLED) {
+		idle_initialize();
+	}
+
+	governor_initialize(GOVERNOR_BUDGET_MS, PARTICLE_TOTAL, SCENE_COUNT > 1 ? PARTICLE_TOTAL : GOVERNOR_MIN_PARTICLES, SIMULATION_SUBSTEPS);
+
 	while (update_window()) {
+		/* Between frames, so the whole frame draws with one set of programs. */
+		if (reload_directory) {
+			shader_reload_update();
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, output_framebuffer);
 		clear_window();
 
 		/* before we do anything, we update the mouse data. */
 		float mouse_data[3] = {0.0f};
 
-		if (glfwGetMouseButton(window_handle, 0) == GLFW_PRESS) {
+		if (glfwGetMouseButton(window_handle, 0) == GLFW_PRESS && !record_enabled) { // Nobody is at the mouse during a recording.
 			mouse_data[2] = 1.0f;
 		} else {
 			mouse_data[2] = 0.0f;
 		}
 
 		double mx, my;
+		double input_time = glfwGetTime();
 
 		glfwGetCursorPos(window_handle, &mx, &my); // Conv. from double to float, should be fine
-		/* we need to conv. abs mouse pos to world coordinates */
-		mouse_data[0] = (((mx / (float) WINDOW_WIDTH) - 0.5f) * 2.0f) * projection_camera_data[1];
-		mouse_data[1] = (((my / (float) WINDOW_HEIGHT) - 0.5f) * -2.0f) * projection_camera_data[3];
-		
+		update_camera(mx, my, !record_enabled);
+		update_views();
+
+		/* we need to conv. abs mouse pos to world coordinates, through the current view */
+		mouse_data[0] = camera_center[0] + (((mx / (float) WINDOW_WIDTH) - 0.5f) * 2.0f) * projection_camera_data[1] / camera_zoom;
+		mouse_data[1] = camera_center[1] + (((my / (float) WINDOW_HEIGHT) - 0.5f) * -2.0f) * projection_camera_data[3] / camera_zoom;
+
+		const governor_state* quality = governor_get();
+
+		if (SIMULATION_THREADED) {
+			/* Just hand over the input, the simulation thread picks it up on its next step. */
+			std::lock_guard<std::mutex> lock(simulation_mutex);
+
+			memcpy(simulation_latest_input.mouse_data, mouse_data, sizeof mouse_data);
+			simulation_latest_input.particle_count = quality->particle_count;
+			simulation_latest_input.substeps = quality->substeps;
+		}
+
+		bool attractors_changed = !SIMULATION_THREADED && update_attractors(mouse_data);
+		bool scene_mouse = SCENE_COUNT > 1 && !SIMULATION_THREADED && update_scenes(mouse_data);
+
+		if (!SIMULATION_THREADED && !SIMULATION_ENGINE_CPU) {
+			select_advance_variant(scene_mouse);
+		}
+
+		/* The rest of the frame is a graph of passes over the state, see frame_graph.h : what is off this frame isn't declared, what
+		 *	nothing reads is culled, and the graph binds what each pass reads. */
+		unsigned int count = quality->particle_count;
+
+		frame_graph_begin();
+
+		frame_handle state = frame_graph_import_buffer("state", current_state_buffer, current_state_texture, FRAME_GRAPH_PERSISTENT);
+		frame_handle sprites = frame_graph_import_texture("sprites", render_texture, GL_TEXTURE_2D, 0);
+		frame_handle window = frame_graph_import_target("window", output_framebuffer, 0, WINDOW_WIDTH, WINDOW_HEIGHT, FRAME_GRAPH_PERSISTENT);
+		frame_handle grid = -1, tree = -1, points = -1, aged = -1;
+
+		if (NEIGHBOR_ENABLED && !SIMULATION_ENGINE_CPU) {
+			grid = frame_graph_import_target("neighbor_grid", neighbor_framebuffer, neighbor_texture, neighbor_grid_width, neighbor_grid_height, 0);
+		}
+
+		if (NBODY_ENABLED && !SIMULATION_ENGINE_CPU) {
+			tree = frame_graph_import_texture("nbody_tree", nbody_tree_texture, GL_TEXTURE_BUFFER, 0);
+			points = frame_graph_import_texture("nbody_points", nbody_points_texture, GL_TEXTURE_BUFFER, 0);
+
+			/* Once per frame, every substep walks the same tree. It also starts the readback the next tree is built from, hence output. */
+			int pass = frame_graph_add_pass("nbody", FRAME_GRAPH_OUTPUT, [=]() {
+				update_nbody_tree(frame_graph_buffer(state), count);
+			});
+
+			frame_graph_read(pass, state, -1);
+			tree = frame_graph_write(pass, tree);
+			points = frame_graph_write(pass, points);
+		}
+
+		/* A new, removed or moved attractor can wake anything, so don't wait out the interval. */
+		bool sleep_wake = SLEEP_ENABLED && (attractors_changed || sleep_attractors_moved());
+
+		if (SLEEP_ENABLED && SIMULATION_ENGINE_CPU && sleep_wake) {
+			cpu_engine_wake();
+			sleep_attractors_judged();
+		}
+
+		if (SLEEP_ENABLED && !SIMULATION_ENGINE_CPU && sleep_due(count, sleep_wake)) {
+			frame_handle scratch = frame_graph_transient_buffer("sleep_scratch", sizeof(float) * 4 * PARTICLE_TOTAL, GL_RGBA32F);
+
+			int pass = frame_graph_add_pass("sleep", 0, [=]() {
+				update_sleep(frame_graph_buffer(scratch), count);
+			});
+
+			frame_graph_read(pass, state, 0);
+
+			if (grid >= 0) {
+				frame_graph_read(pass, grid, 2); // Splatted by the last advance, one step old.
+			}
+
+			frame_graph_write(pass, scratch);
+			state = frame_graph_write(pass, state);
+		}
+
 		/* first, we run the particle advance. */
-		glUseProgram(shader_advance_program);
-		glActiveTexture(GL_TEXTURE0);
-		glUniform3f(shader_advance_mouse_loc, mouse_data[0], mouse_data[1], mouse_data[2]); // Can't trust fv anymore.
+		for (int step = 0; step < quality->substeps && !SIMULATION_THREADED; step++) {
+			if (SIMULATION_ENGINE_CPU) {
+				int pass = frame_graph_add_pass("advance", 0, [=]() {
+					advance_particles_cpu(count);
+				});
+
+				state = frame_graph_write(pass, state);
+				continue;
+			}
+
+			if (grid >= 0) {
+				int pass = frame_graph_add_pass("grid", 0, [=]() {
+					update_neighbor_grid(count);
+				});
+
+				frame_graph_read(pass, state, 0);
+				grid = frame_graph_write(pass, grid);
+			}
+
+			/* The sleep pass above sets how many are awake, so that is looked up when the advance runs. */
+			int pass = frame_graph_add_pass("advance", 0, [=]() {
+				advance_particles_gpu(count, SLEEP_ENABLED ? sleep_awake_count : count);
+			});
+
+			frame_graph_read(pass, state, -1); // particle_system binds it itself.
+
+			if (grid >= 0) {
+				frame_graph_read(pass, grid, 2);
+			}
+
+			if (tree >= 0) {
+				frame_graph_read(pass, tree, 3);
+				frame_graph_read(pass, points, 4);
+			}
+
+			state = frame_graph_write(pass, state);
+		}
+
+		/* Aged by the steps just taken. The threaded simulation steps on its own, there they age by frames. */
+		if (ATTRIBUTE_SET) {
+			float age_step = SIMULATION_THREADED ? 1.0f : (float) quality->substeps;
+
+			int pass = frame_graph_add_pass("attributes", 0, [=]() {
+				profiler_begin(PROFILER_PASS_ATTRIBUTES);
+				attributes.update(count, age_step, ATTRIBUTE_UNIT); // On units the graph leaves alone.
+				profiler_end();
+			});
+
+			aged = frame_graph_write(pass, frame_graph_import_buffer("attributes", NULL, NULL, FRAME_GRAPH_PERSISTENT));
+		}
+
+		if (STATS_ENABLED) {
+			float mouse[3] = {mouse_data[0], mouse_data[1], mouse_data[2]};
 
-		glEnable(GL_RASTERIZER_DISCARD); // We're not drawing anything! Save performance.
-		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particle_buffer_second);
+			int pass = frame_graph_add_pass("stats", FRAME_GRAPH_OUTPUT, [=]() {
+				update_stats(count, mouse);
+			});
 
-		glBeginTransformFeedback(GL_POINTS);
-		glBindTexture(GL_TEXTURE_BUFFER, particle_buffer_first_texture);
-		glDrawArraysInstanced(GL_POINTS, 0, 1, PARTICLE_COUNT);
-		glEndTransformFeedback();
+			frame_graph_read(pass, state, 0);
+		}
 
-		glDisable(GL_RASTERIZER_DISCARD);
+		if (publish_name) {
+			int pass = frame_graph_add_pass("publish", FRAME_GRAPH_OUTPUT, [=]() {
+				update_publish(frame_graph_buffer(state), count);
+			});
 
-		/* We then swap the first and second buffer so that our changes are reflected. */
-		unsigned int temp = particle_buffer_first;
-		particle_buffer_first = particle_buffer_second;
-		particle_buffer_second = temp;
+			frame_graph_read(pass, state, -1);
+		}
 
-		temp = particle_buffer_first_texture; // Switch the textures too, for good measure.
-		particle_buffer_first_texture = particle_buffer_second_texture;
-		particle_buffer_second_texture = temp;
+		/* When zoomed in, most particles are off screen : cull them first and draw only the list. The list is cut to the camera's
+		 *	rectangle, which views with one of their own can see past. The cull pass is always there, the render pass only reads the list
+		 *	when zoomed in, and otherwise the graph drops it. */
+		bool culled = CULL_ENABLED && cull_supported && camera_zoom >= CULL_MIN_ZOOM && !view_fixed_count;
+		frame_handle list = -1;
 
-		/* Update the TBOs to match. */
-		glBindTexture(GL_TEXTURE_BUFFER, particle_buffer_first_texture);
-		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, particle_buffer_first);
+		if (CULL_ENABLED && cull_supported) {
+			frame_handle empty = frame_graph_transient_buffer("cull_list", sizeof(float) * 4 * PARTICLE_TOTAL, GL_RGBA32F);
 
-		glBindTexture(GL_TEXTURE_BUFFER, particle_buffer_second_texture);
-		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, particle_buffer_second);
+			int pass = frame_graph_add_pass("cull", 0, [=]() {
+				cull_particles(frame_graph_buffer(empty), count);
+			});
 
-		/* ^ Those steps may be unnecessary, if the TBO automatically updates with the new values. (that could mess stuff up though) */
+			frame_graph_read(pass, state, 0);
+			list = frame_graph_write(pass, empty);
+		}
 
-		/* next, bind the render shader. */
-		glUseProgram(shader_render_program);
+		/* When the governor has lowered the render scale we draw into a smaller offscreen target and stretch it over the window afterwards. */
+		bool scaled = quality->render_scale < 1.0f;
+		int render_width = (int) (WINDOW_WIDTH * quality->render_scale);
+		int render_height = (int) (WINDOW_HEIGHT * quality->render_scale);
+		float render_scale = quality->render_scale;
 
-		/* set the color uniform. */
+		frame_handle target = scaled ? frame_graph_import_target("scaled", scaled_framebuffer, 0, render_width, render_height, 0) : window;
 
 		static float dx = 0.0f; dx += 0.001f;
 		float r = sinf(dx);
 		float g = cosf(dx); // Make some cool colors.
 		float b = 1.0f;
 
-		glUniform3f(shader_render_color_loc, r, g, b);
+		int render = frame_graph_add_pass("render", 0, [=]() {
+			render_particles(culled, scaled, count, render_scale, r, g, b);
+		});
 
-		/* bind the first TBO. */
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_BUFFER, particle_buffer_first_texture);
+		frame_graph_read(render, culled ? list : state, 0); // The first TBO, or the cull list.
+		frame_graph_read(render, sprites, 1);
 
-		glActiveTexture(GL_TEXTURE0 + 1);
-		glBindTexture(GL_TEXTURE_BUFFER, render_texture);
+		if (aged >= 0) {
+			frame_graph_read(render, aged, -1);
+		}
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0); // We are using the texture buffer! No need to actually draw anything from the array buffer here.
-		glDrawArraysInstanced(GL_POINTS, 0, 1, PARTICLE_COUNT);
+		target = frame_graph_write(render, target);
 
-		swap_window();
-	}	
+		if (VIEW_WINDOWS && VIEW_COUNT > 1) {
+			int pass = frame_graph_add_pass("view_windows", FRAME_GRAPH_OUTPUT, [=]() {
+				draw_view_windows(frame_graph_texture(state), count, r, g, b);
+			});
 
-	glfwTerminate();
-	return 0;
-};
+			frame_graph_read(pass, state, -1); // Bound in the other contexts.
+			frame_graph_read(pass, sprites, -1);
 
-/* Other function definitions */
+			if (aged >= 0) {
+				frame_graph_read(pass, aged, -1);
+			}
+		}
 
-void initialize_camera(void) {
-	float ratio = (float) WINDOW_WIDTH / (float) WINDOW_HEIGHT;
+		if (scaled) {
+			int pass = frame_graph_add_pass("resolve", 0, [=]() {
+				profiler_begin(PROFILER_PASS_RESOLVE);
 
-	projection_matrix = glm::ortho(-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f);
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, scaled_framebuffer);
+				glBlitFramebuffer(0, 0, render_width, render_height, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+				telemetry_draw_call();
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, output_framebuffer); // Back to what the graph bound.
 
-	projection_camera_data[0] = -ratio / 2.0f;
-	projection_camera_data[1] = ratio / 2.0f;
-	projection_camera_data[2] = -0.5f;
-	projection_camera_data[3] = 0.5f;
-}
+				profiler_end();
+			});
 
-bool initialize_shaders(void) {
-	shader_render_vs = glCreateShader(GL_VERTEX_SHADER);
-	shader_render_gs = glCreateShader(GL_GEOMETRY_SHADER);
-	shader_render_ps = glCreateShader(GL_FRAGMENT_SHADER);
+			frame_graph_read(pass, target, -1);
+			frame_graph_write(pass, window);
+		}
+
+		/* With the threaded simulation, the passes read the latest state it published. */
+		if (SIMULATION_THREADED) {
+			simulation_acquire_state();
+		}
 
-	shader_advance_vs = glCreateShader(GL_VERTEX_SHADER);
+		frame_graph_execute();
 
-	glShaderSource(shader_render_vs, 1, &SHADER_RENDER_VS, NULL);
-	glShaderSource(shader_render_gs, 1, &SHADER_RENDER_GS, NULL);
-	glShaderSource(shader_render_ps, 1, &SHADER_RENDER_PS, NULL);
+		if (SIMULATION_THREADED) {
+			simulation_release_state();
+		}
 
-	glCompileShader(shader_render_vs);
-	glCompileShader(shader_render_gs);
-	glCompileShader(shader_render_ps);
+		profiler_frame();
 
-	int compile_status = 0;
+		static double last_frame_time = glfwGetTime();
+		double frame_time = glfwGetTime();
 
-	glGetShaderiv(shader_render_vs, GL_COMPILE_STATUS, &compile_status);
+		unsigned int active = SLEEP_ENABLED ? (unsigned int) (sleep_active_fraction() * quality->particle_count + 0.5f) : quality->particle_count;
 
-	if (!compile_status) {
-		char log[1024] = {0};
+		telemetry_set_particles(quality->particle_count, active);
+		telemetry_frame((float) (frame_time - last_frame_time));
+		last_frame_time = frame_time;
 
-		glGetShaderInfoLog(shader_render_vs, 1024, NULL, log);
-		printf("[initialize_shaders] VS error : %s\n", log);
+		jitter_tick(&frame_jitter, frame_time);
 
-		printf("[initialize_shaders] render vertex shader compile fail\n");
-		return false;
-	}
+		static unsigned int frame_index = 0;
 
-	glGetShaderiv(shader_render_gs, GL_COMPILE_STATUS, &compile_status);
+		if (PROFILER_REPORT_FRAMES && ++frame_index % PROFILER_REPORT_FRAMES == 0) {
+			profiler_report();
+			frame_graph_report();
 
-	if (!compile_status) {
-		char log[1024] = {0};
+			telemetry_set_buffer("transients", frame_graph_transient_bytes()); // The sleep scratch and the cull list, however the graph shared them.
 
-		glGetShaderInfoLog(shader_render_gs, 1024, NULL, log);
-		printf("[initialize_shaders] GS error : %s\n", log);
+			if (SLEEP_ENABLED) {
+				printf("[sleep] %.1f%% of %u particles awake\n", sleep_active_fraction() * 100.0f, quality->particle_count);
+			}
 
-		printf("[initialize_shaders] render geometry shader compile fail\n");
-		return false;
-	}
+			if (STATS_ENABLED && stats_valid) {
+				stats_print(&stats_latest, STATS_SPEED_MAX);
+				printf("[stats] %u frames skipped with every readback in flight\n", stats_skipped);
+			}
 
-	glGetShaderiv(shader_render_ps, GL_COMPILE_STATUS, &compile_status);
+			if (IDLE_ENABLED) {
+				idle_report();
+			}
 
-	if (!compile_status) {
-		char log[1024] = {0};
+			print_latency(&latency_recent, "input to GPU done");
+			latency_reset(&latency_recent);
 
-		glGetShaderInfoLog(shader_render_ps, 1024, NULL, log);
-		printf("[initialize_shaders] PS error : %s\n", log);
+			if (publish_name) {
+				printf("[publish] %llu frames published, %u skipped with every readback in flight\n", (unsigned long long) publish_frames(), publish_skipped);
+			}
 
-		printf("[initialize_shaders] render fragment shader compile fail\n");
-		return false;
-	}
+			float mean, deviation, p99;
+			jitter_summary(&frame_jitter, &mean, &deviation, &p99);
+
+			/* Single threaded, every frame is also a simulation step, so this is the simulation's pacing too. */
+			printf("[jitter] %s : %.2f ms mean, %.2f ms deviation, %.2f ms p99\n", SIMULATION_THREADED ? "render frames" : "frames and steps", mean, deviation, p99);
+		}
 
-	shader_render_program = glCreateProgram();
+		if (GOVERNOR_ENABLED && !record_enabled) { // A recording wants every frame at full quality, however long it takes.
+			governor_update(profiler_total_ms());
+		}
 
-	glAttachShader(shader_render_program, shader_render_vs);
-	glAttachShader(shader_render_program, shader_render_gs);
-	glAttachShader(shader_render_program, shader_render_ps);
+		if (record_enabled) {
+			record_frame();
 
-	glLinkProgram(shader_render_program);
+			if (record_issued == record_frames || recorder_failed()) {
+				break;
+			}
+		} else {
+			swap_window();
+		}
 
-	int link_status = 0;
+		update_latency(input_time); // Waits here, before the next frame's input is read, when too many frames are in flight.
 
-	glGetProgramiv(shader_render_program, GL_LINK_STATUS, &link_status);
+		bool idle_allowed = IDLE_ENABLED && !record_enabled && !SIMULATION_THREADED && !ATTRACTOR_ORBITERS;
 
-	if (!link_status) {
-		char log[1024] = {0};
-		
-		glGetProgramInfoLog(shader_render_program, 1024, NULL, log);
-		printf("[initialize_shaders] link error : %s\n", log);
+		if (idle_allowed && update_idle(mouse_data[2] != 0.0f)) {
+			wait_idle();
 
-		printf("[initialize_shaders] render program link fail\n");
-		return false;
-	}
+			last_frame_time = glfwGetTime(); // The wait isn't a frame.
+			frame_jitter.last_time = -1.0;
+		}
 
-	glUseProgram(shader_render_program);
+		static bool first_frame = true;
 
-	shader_render_tbo_loc = glGetUniformLocation(shader_render_program, "particle_buffer");
-	shader_render_mvp_loc = glGetUniformLocation(shader_render_program, "mat_mvp");
-	shader_render_tex_loc = glGetUniformLocation(shader_render_program, "render_texture");
-	shader_render_color_loc = glGetUniformLocation(shader_render_program, "render_color");
+		if (first_frame) {
+			first_frame = false;
 
-	if (shader_render_tbo_loc != -1) {
-		glUniform1i(shader_render_tbo_loc, 0);
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for particle_buffer\n");
-	}
+			startup_mark("first frame");
+			startup_report();
+		}
+	}	
 
-	if (shader_render_mvp_loc != -1) {
-		glUniformMatrix4fv(shader_render_mvp_loc, 1, GL_FALSE, glm::value_ptr(projection_matrix));
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for mat_mvp\n");
+	if (record_enabled) {
+		finish_recording(glfwGetTime() - record_start);
 	}
 
-	if (shader_render_tex_loc != -1) {
-		glUniform1i(shader_render_tex_loc, 1); // Use texture unit 1 for actual texture rendering.
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for render_texture (render)\n");
+	if (SIMULATION_THREADED) {
+		shutdown_simulation_thread();
 	}
 
-	if (shader_render_color_loc != -1) {
-		glUniform3f(shader_render_color_loc, 1.0f, 1.0f, 1.0f);
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for render_color\n");
+	telemetry_shutdown();
+	shutdown_views();
+
+	if (publish_name) {
+		shutdown_publish();
 	}
 
-	/* TODO : shader loading code for advance shader! */
+	if (IDLE_ENABLED) {
+		idle_report();
+	}
 
-	shader_advance_vs = glCreateShader(GL_VERTEX_SHADER);
+	while (collect_latency(true));
+	print_latency(&latency_run, "whole run");
 
-	glShaderSource(shader_advance_vs, 1, &SHADER_ADVANCE_VS, NULL);
-	glCompileShader(shader_advance_vs);
+	if (reload_directory) {
+		shader_reload_shutdown();
+	}
 
-	glGetShaderiv(shader_advance_vs, GL_COMPILE_STATUS, &compile_status);
+	frame_graph_shutdown();
+	attributes.shutdown();
+	particles.shutdown(); // While the context is still there, not at exit.
 
-	if (!compile_status) {
-		char log[1024] = {0};
+	glfwTerminate();
+	return 0;
+};
 
-		glGetShaderInfoLog(shader_advance_vs, 1024, NULL, log);
-		printf("[initialize_shaders] compilation for advance VS failed : %s\n", log);
-		return false;
-	}	
+/* Other function definitions */
 
-	shader_advance_program = glCreateProgram();
+bool update_attractors(const float* mouse_data) {
+	/* Returns true when the number of attractors changed since last frame. */
+	static unsigned int previous_count = 0;
 
-	glAttachShader(shader_advance_program, shader_advance_vs);
+	forces_clear_attractors();
 
-	/* Here we set up the transform feedback. */
-	const char* varyings[1] = {"out_particle_data"};
-	glTransformFeedbackVaryings(shader_advance_program, 1, varyings, GL_INTERLEAVED_ATTRIBS);
-	
-	glLinkProgram(shader_advance_program);
-	glGetProgramiv(shader_advance_program, GL_LINK_STATUS, &link_status);
+	static float orbit = 0.0f; orbit += 0.002f;
 
-	if (!link_status) {
-		char log[1024] = {0};
+	for (int i = 0; i < ATTRACTOR_ORBITERS; i++) {
+		float angle = orbit * (1.0f + 0.1f * i) + 6.2831853f * i / (float) ATTRACTOR_ORBITERS;
+		float radius = 0.15f + 0.25f * (float) (i % 3) / 2.0f;
 
-		glGetProgramInfoLog(shader_advance_program, 1024, NULL, log);
-		printf("[initialize_shaders] advance program link fail : %s\n", log);
+		forces_add_attractor(cosf(angle) * radius, sinf(angle) * radius, (i % 2) ? -0.5f : 0.5f, ATTRACTOR_SOFTENING);
+	}
 
-		return false;
+	if (mouse_data[2] == 1.0f && SCENE_COUNT == 1) {
+		forces_add_attractor(mouse_data[0], mouse_data[1], 1.0f, ATTRACTOR_SOFTENING);
 	}
 
-	glUseProgram(shader_advance_program);
+	unsigned int count = forces_attractor_count();
+	bool changed = count != previous_count;
 
-	shader_advance_tbo_loc = glGetUniformLocation(shader_advance_program, "particle_buffer");
-	shader_advance_cam_loc = glGetUniformLocation(shader_advance_program, "camera_bounds");
-	shader_advance_mouse_loc = glGetUniformLocation(shader_advance_program, "mouse_data");
+	previous_count = count;
 
-	if (shader_advance_tbo_loc != -1) {
-		glUniform1i(shader_advance_tbo_loc, 0);
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for advance particle_buffer\n");
+	if (SIMULATION_ENGINE_CPU) {
+		return changed; // The CPU engine reads the list straight from forces.h.
 	}
 
-	if (shader_advance_cam_loc != -1) {
-		// Uniform4fv is supposed to work, but doesn't
-		glUniform4f(shader_advance_cam_loc, projection_camera_data[0], projection_camera_data[1], projection_camera_data[2], projection_camera_data[3]);
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for advance camera_bounds\n");
+	if (count) {
+		glBindBuffer(GL_UNIFORM_BUFFER, attractor_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(forces_attractor) * count, forces_attractors());
+		telemetry_transfer_call();
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 	}
 
-	if (shader_advance_mouse_loc != -1) {
-		glUniform3f(shader_advance_mouse_loc, 0.0f, 0.0f, 0.0f);
-	} else {
-		printf("[initialize_shaders] could not locate uniform location for advance mouse_data\n");
+	/* The advance program gets the count when its variant is selected, see select_advance_variant(). */
+	if (shader_sleep_program) {
+		glUseProgram(shader_sleep_program);
+		glUniform1i(shader_sleep_attractor_count_loc, count);
 	}
 
-	/* We use this opportunity to load the particle render texture. */
+	return changed;
+}
 
-	ilInit();
+bool parse_arguments(int argc, char** argv) {
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--record") && has_value) {
+			record_enabled = true;
+			record_path = argv[++i];
+		} else if (!strcmp(argv[i], "--format") && has_value) {
+			record_format = recorder_parse_format(argv[++i]);
+
+			if (record_format < 0) {
+				printf("[parse_arguments] unknown format %s\n", argv[i]);
+				return false;
+			}
+		} else if (!strcmp(argv[i], "--frames") && has_value) {
+			record_frames = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--metrics-port") && has_value) {
+			telemetry_port = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--metrics-socket") && has_value) {
+			telemetry_socket = argv[++i];
+		} else if (!strcmp(argv[i], "--frames-in-flight") && has_value) {
+			frames_in_flight = atoi(argv[++i]);
+
+			if (frames_in_flight < 0 || frames_in_flight > FRAMES_IN_FLIGHT_MAX) {
+				printf("[parse_arguments] frames in flight go from 0 (no limit) to %d\n", FRAMES_IN_FLIGHT_MAX);
+				return false;
+			}
+		} else if (!strcmp(argv[i], "--publish") && has_value) {
+			publish_name = argv[++i];
+		} else if (!strcmp(argv[i], "--reload-shaders") && has_value) {
+			reload_directory = argv[++i];
+		} else if (!strcmp(argv[i], "--view") && has_value) {
+			if (view_fixed_count == VIEW_COUNT) {
+				printf("[parse_arguments] only %d views\n", VIEW_COUNT);
+				return false;
+			}
+
+			view_state* view = &views[view_fixed_count++];
+
+			if (sscanf(argv[++i], "%f,%f,%f,%f", &view->rect[0], &view->rect[1], &view->rect[2], &view->rect[3]) != 4 ||
+				view->rect[0] >= view->rect[1] || view->rect[2] >= view->rect[3]) {
+				printf("[parse_arguments] bad view rectangle %s\n", argv[i]);
+				return false;
+			}
+
+			view->fixed = true;
+			view->mvp = glm::ortho(view->rect[0], view->rect[1], view->rect[2], view->rect[3]);
+		} else {
+			printf("[parse_arguments] unexpected argument %s\n", argv[i]);
+			return false;
+		}
+	}
 
-	unsigned int il_image;
-	ilGenImages(1, &il_image);
-	ilBindImage(il_image);
+	if (record_enabled && !record_frames) {
+		printf("[parse_arguments] nothing to record\n");
+		return false;
+	}
 
-	if (!ilLoadImage(PARTICLE_TEXTURE)) {
-		printf("[initialize_shaders] failed to load particle render texture\n");
+	if (record_enabled && !recorder_check_path(record_path, record_format)) {
 		return false;
 	}
 
-	ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+	return true;
+}
 
-	glActiveTexture(GL_TEXTURE0 + 1);
-	glGenTextures(1, &render_texture);
-	glBindTexture(GL_TEXTURE_2D, render_texture);
+void print_usage(const char* program) {
+	printf("usage : %s [--record <path> [--format png|y4m|raw] [--frames <count>]] [--metrics-port <port>] [--metrics-socket <path>]"
+		" [--frames-in-flight <count>] [--publish <name>] [--reload-shaders <directory>] [--view <left>,<right>,<bottom>,<top> ...]\n", program);
+	printf("\tpng writes one file per frame, <path> is a printf pattern like frames/%%05d.png\n");
+	printf("\ty4m and raw write a single stream to <path>\n");
+	printf("\tmetrics are served in the Prometheus text format, on 127.0.0.1 or a Unix socket\n");
+	printf("\t--frames-in-flight caps how far the GPU may lag behind, 1 is the lowest latency and 0 leaves it to the driver\n");
+	printf("\t--publish maps the particle state into shared memory as /dev/shm/<name>, see particles-subscribe\n");
+	printf("\t--reload-shaders watches a shader directory (source/shaders from the repository root) and swaps in the advance and render programs on every save\n");
+	printf("\teach --view fixes the world rectangle of the next view, the others split the camera's between them\n");
+}
 
-	glTexImage2D(render_texture, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH), ilGetInteger(IL_IMAGE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE, ilGetData());
-	glActiveTexture(GL_TEXTURE0);
+bool record_collect(bool wait) {
+	/* Hands the oldest outstanding readback to the recorder. Without wait it only does so if the GPU is already done with it. */
+	if (record_collected == record_issued) {
+		return false;
+	}
 
-	return true;
-}
+	int slot = record_collected % RECORD_PBO_COUNT;
+	GLenum status = glClientWaitSync(record_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
 
-bool initialize_buffers(void) {
-	srand(time(NULL));
+	if (status == GL_TIMEOUT_EXPIRED) {
+		if (!wait) {
+			return false;
+		}
 
-	glGenBuffers(1, &particle_buffer_first);
-	glGenBuffers(1, &particle_buffer_second);
+		/* The whole ring is in flight, the GPU is behind by RECORD_PBO_COUNT frames. */
+		double start = glfwGetTime();
 
-	float* particle_buffer = new float[PARTICLE_COUNT * 4];
-	memset(particle_buffer, 0, sizeof(float) * PARTICLE_COUNT * 4);
+		while (status == GL_TIMEOUT_EXPIRED) {
+			status = glClientWaitSync(record_fences[slot], 0, 1000000);
+		}
 
-	for (unsigned int i = 0; i < PARTICLE_COUNT; i++) {
-		float* current_particle = particle_buffer + 4 * i;
+		record_readback_stalls++;
+		record_readback_stall_ms += (float) ((glfwGetTime() - start) * 1000.0);
+	}
 
-		current_particle[0] = ((float) rand() / ((float) INT_MAX / 2.0f) - 1.0f) / 1.02f;
-		current_particle[1] = ((float) rand() / ((float) INT_MAX / 2.0f) - 1.0f) / 1.02f;
-		current_particle[2] = current_particle[3] = 0.0f;
+	glDeleteSync(record_fences[slot]);
+	record_fences[slot] = 0;
+
+	/* A frame that can't be read still gets its index through, the stream formats write in order and would wait on it forever. */
+	if (status == GL_WAIT_FAILED) {
+		printf("[record_collect] fence wait failed, skipping frame %u\n", record_collected);
+		recorder_skip(record_collected);
+
+		record_collected++;
+		return true;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, particle_buffer_first);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * PARTICLE_COUNT * 4, particle_buffer, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, record_pbos[slot]);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, WINDOW_WIDTH * WINDOW_HEIGHT * 4, GL_MAP_READ_BIT);
+	telemetry_transfer_call();
 
-	glBindBuffer(GL_ARRAY_BUFFER, particle_buffer_second);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * PARTICLE_COUNT * 4, particle_buffer, GL_DYNAMIC_COPY);
+	if (pixels) {
+		unsigned char* frame = recorder_acquire(); // Blocks while the writers are behind.
 
-	glGenTextures(1, &particle_buffer_first_texture);
-	glGenTextures(1, &particle_buffer_second_texture);
+		memcpy(frame, pixels, WINDOW_WIDTH * WINDOW_HEIGHT * 4);
+		recorder_submit(frame, record_collected);
 
-	glBindTexture(GL_TEXTURE_BUFFER, particle_buffer_first_texture);
-	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, particle_buffer_first);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		printf("[record_collect] failed to map readback, skipping frame %u\n", record_collected);
+		recorder_skip(record_collected);
+	}
 
-	glBindTexture(GL_TEXTURE_BUFFER, particle_buffer_second_texture);
-	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, particle_buffer_second);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
+	record_collected++;
 	return true;
 }
 
-bool initialize_window(void) {
-	glfwInit();
+void record_frame(void) {
+	/* Drain whatever already landed, then make room in the ring if it is full. */
+	while (record_collect(false));
 
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	if (record_issued - record_collected == RECORD_PBO_COUNT) {
+		record_collect(true);
+	}
 
-	window_handle = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "particles", WINDOW_FULLSCREEN ? glfwGetPrimaryMonitor() : NULL, NULL);
+	int slot = record_issued % RECORD_PBO_COUNT;
 
-	if (window_handle == NULL) {
-		printf("[initialize_window] GLFW failure\n");
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, record_framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, record_pbos[slot]);
+	glReadPixels(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, 0); // Into the PBO, returns straight away.
+	telemetry_transfer_call();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, output_framebuffer);
+
+	record_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	record_issued++;
+}
+
+void finish_recording(double seconds) {
+	while (record_collect(true));
+
+	recorder_shutdown();
+
+	const recorder_stats* stats = recorder_get_stats();
+
+	printf("[record] %u frames in %.2f s : %.1f fps sustained, %.1f MB written\n", stats->frames_written, seconds,
+		seconds > 0.0 ? stats->frames_written / seconds : 0.0, stats->bytes_written / (1024.0 * 1024.0));
+	printf("[record] readback stalls %u (%.1f ms), encoder stalls %u (%.1f ms), writer time %.1f ms per frame\n",
+		record_readback_stalls, record_readback_stall_ms, stats->encoder_stalls, stats->encoder_stall_ms,
+		stats->frames_written ? stats->write_ms / stats->frames_written : 0.0f);
+
+	if (stats->frames_skipped) {
+		printf("[record] %u frames skipped, their readback failed\n", stats->frames_skipped);
+	}
+}
+
+bool initialize_simulation_thread(void) {
+	/* The simulation gets a hidden window of its own just for a context sharing buffers, textures, programs and syncs with ours. */
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	simulation_window = glfwCreateWindow(1, 1, "particles simulation", NULL, window_handle);
+	glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+
+	if (!simulation_window) {
+		printf("[initialize_simulation_thread] failed to create the shared context\n");
 		return false;
 	}
 
-	glfwMakeContextCurrent(window_handle);
+	/* Two of the three states are the usual ping-pong pair, the third starts out as a copy of the first. */
+	simulation_buffers[0] = particles.state_buffer();
+	simulation_buffers[1] = particles.next_buffer();
+	simulation_textures[0] = particles.state_texture();
+	simulation_textures[1] = particles.next_texture();
+
+	glGenBuffers(1, &simulation_buffers[2]);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, simulation_buffers[2]);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(float) * 4 * PARTICLE_TOTAL, NULL, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, particles.state_buffer());
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(float) * 4 * PARTICLE_TOTAL);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glGenTextures(1, &simulation_textures[2]);
+	glBindTexture(GL_TEXTURE_BUFFER, simulation_textures[2]);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, simulation_buffers[2]);
+
+	telemetry_set_buffer("particles", sizeof(float) * PARTICLE_TOTAL * 4 * 3);
+
+	const governor_state* quality = governor_get();
+
+	simulation_latest_input.particle_count = quality->particle_count;
+	simulation_latest_input.substeps = quality->substeps;
+
+	simulation_written[0] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); // Covers the copy above.
+	glFlush();
+
+	simulation_exit = false;
+	simulation_thread = std::thread(simulation_run);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+void simulation_run(void) {
+	glfwMakeContextCurrent(simulation_window);
+
+	/* Bindings are per context, so redo the ones the advance relies on. Everything else it needs comes from shared objects. */
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, attractor_buffer);
+
+	glActiveTexture(GL_TEXTURE0 + 5);
+	glBindTexture(GL_TEXTURE_2D, field_texture);
+	glActiveTexture(GL_TEXTURE0 + 6);
+	glBindTexture(GL_TEXTURE_BUFFER, scene_texture);
+	glActiveTexture(GL_TEXTURE0);
+
+	glEnable(GL_RASTERIZER_DISCARD); // This context never draws anything visible.
+
+	jitter_window step_jitter;
+	jitter_reset(&step_jitter);
+
+	double step_seconds = 1.0 / SIMULATION_RATE;
+	double next_step = glfwGetTime();
+	unsigned int steps = 0;
+
+	while (!simulation_exit.load()) {
+		simulation_input input;
+
+		{
+			std::lock_guard<std::mutex> lock(simulation_mutex);
+			input = simulation_latest_input;
+		}
+
+		update_attractors(input.mouse_data);
+		select_advance_variant(SCENE_COUNT > 1 && update_scenes(input.mouse_data));
+
+		for (int step = 0; step < input.substeps; step++) {
+			simulation_step(input.particle_count);
+		}
+
+		double now = glfwGetTime();
+		jitter_tick(&step_jitter, now);
+
+		if (++steps % SIMULATION_REPORT_STEPS == 0) {
+			float mean, deviation, p99;
+			jitter_summary(&step_jitter, &mean, &deviation, &p99);
+
+			printf("[jitter] simulation steps : %.2f ms mean, %.2f ms deviation, %.2f ms p99\n", mean, deviation, p99);
+		}
+
+		/* Fixed rate. If we fell more than a step behind, don't try to catch up in a burst. */
+		next_step += step_seconds;
+
+		if (next_step < now - step_seconds) {
+			next_step = now;
+		}
+
+		std::this_thread::sleep_for(std::chrono::duration<double>(next_step - now));
+	}
+
+	glFinish();
+	glfwMakeContextCurrent(NULL);
+}
+
+void simulation_step(unsigned int count) {
+	/* Write into whichever state is neither the latest nor being drawn, from the latest. */
+	int source, target;
+	GLsync reading;
+
+	{
+		std::lock_guard<std::mutex> lock(simulation_mutex);
+
+		source = simulation_published;
+		target = 0;
+
+		while (target == source || target == simulation_rendering) {
+			target++;
+		}
+
+		reading = simulation_read[target];
+		simulation_read[target] = 0;
+	}
+
+	/* The render thread may have queued draws from this buffer that haven't run yet, the GPU waits for them, we don't. */
+	if (reading) {
+		glWaitSync(reading, 0, GL_TIMEOUT_IGNORED);
+		glDeleteSync(reading);
+	}
+
+	glUseProgram(shader_advance_program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, simulation_textures[source]);
+
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, simulation_buffers[target], 0, sizeof(float) * 4 * count);
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	glEndTransformFeedback();
+
+	GLsync written = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush(); // So the render context's wait on the fence can't hang on commands still sitting in our queue.
+
+	std::lock_guard<std::mutex> lock(simulation_mutex);
+
+	if (simulation_written[target]) {
+		glDeleteSync(simulation_written[target]);
+	}
+
+	simulation_written[target] = written;
+	simulation_published = target;
+}
+
+unsigned int simulation_acquire_state(void) {
+	/* Take the latest state and make the GPU (not us) wait until it has been written. */
+	GLsync written;
+
+	{
+		std::lock_guard<std::mutex> lock(simulation_mutex);
+
+		simulation_rendering = simulation_published;
+		written = simulation_written[simulation_rendering];
+	}
+
+	if (written) {
+		glWaitSync(written, 0, GL_TIMEOUT_IGNORED);
+	}
+
+	return simulation_textures[simulation_rendering];
+}
+
+void simulation_release_state(void) {
+	/* simulation_rendering stays put until the next acquire, this fence tells the simulation when it may overwrite it after that. */
+	GLsync read = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	std::lock_guard<std::mutex> lock(simulation_mutex);
+
+	if (simulation_read[simulation_rendering]) {
+		glDeleteSync(simulation_read[simulation_rendering]);
+	}
+
+	simulation_read[simulation_rendering] = read;
+}
+
+unsigned int current_state_buffer(void) {
+	/* What the frame graph imports as the state : the threaded simulation's latest, or our own current copy. */
+	return SIMULATION_THREADED ? simulation_buffers[simulation_rendering] : particles.state_buffer();
+}
+
+unsigned int current_state_texture(void) {
+	return SIMULATION_THREADED ? simulation_textures[simulation_rendering] : particles.state_texture();
+}
+
+void shutdown_simulation_thread(void) {
+	simulation_exit = true;
+	simulation_thread.join();
+
+	glfwDestroyWindow(simulation_window);
+	simulation_window = NULL;
+}
+
+bool update_scenes(const float* mouse_data) {
+	/* The mouse only pulls on the scene whose tile it is over, in that scene's own coordinates. */
+	float scene_x = 0.0f, scene_y = 0.0f;
+	int picked = mouse_data[2] == 1.0f ? scenes_pick(projection_camera_data, mouse_data[0], mouse_data[1], &scene_x, &scene_y) : -1;
+
+	for (int i = 0; i < SCENE_COUNT; i++) {
+		scene_params* scene = scenes_get(i);
+
+		scene->mouse[0] = scene_x;
+		scene->mouse[1] = scene_y;
+		scene->mouse[2] = i == picked ? 1.0f : 0.0f;
+		scene->mouse[3] = ATTRACTOR_SOFTENING;
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, scene_buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(scene_params) * SCENE_COUNT, scenes_data());
+	telemetry_transfer_call();
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	return picked != -1; // Whether the advance needs the scene mouse at all.
+}
+
+void update_neighbor_grid(unsigned int count) {
+	/* Splat every live particle into its cell, additive blending does the counting. The graph has bound the grid and the state. */
+	profiler_begin(PROFILER_PASS_GRID);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glUseProgram(shader_grid_program);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	telemetry_draw_call();
+
+	profiler_end();
+}
+
+void update_nbody_tree(unsigned int state_buffer, unsigned int count) {
+	/* Build from the newest readback that has landed, without waiting. Older landed ones are dropped unread, and the ones still in flight
+	 *	stay for a later frame : meanwhile the advance keeps walking the tree it has. */
+	int ready = -1;
+
+	while (nbody_collected < nbody_issued) {
+		int slot = nbody_collected % 2;
+		GLenum status = glClientWaitSync(nbody_readback_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break;
+		}
+
+		glDeleteSync(nbody_readback_fences[slot]);
+		nbody_readback_fences[slot] = 0;
+
+		ready = slot;
+		nbody_collected++;
+	}
+
+	if (ready >= 0) {
+		unsigned int points = nbody_readback_counts[ready];
+
+		glBindBuffer(GL_COPY_READ_BUFFER, nbody_readback_buffers[ready]);
+		const float* positions = (const float*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(float) * 4 * points, GL_MAP_READ_BIT);
+		telemetry_transfer_call();
+
+		if (positions) {
+			if (bh_tree_build(positions, points, 4)) {
+				if (NBODY_VALIDATE_FRAMES && nbody_frame % NBODY_VALIDATE_FRAMES == 0) {
+					float mean_error = 0.0f, max_error = 0.0f;
+					bh_tree_validate(positions, points, 4, NBODY_THETA, NBODY_SOFTENING, 64, &mean_error, &max_error);
+
+					printf("[nbody] %u nodes for %u particles, theta %.2f vs direct sum : mean error %.5f, max error %.5f\n",
+						bh_tree_node_count(), points, NBODY_THETA, mean_error, max_error);
+				}
+
+				nbody_node_count = bh_tree_node_count();
+
+				if (nbody_node_count > nbody_texel_capacity) {
+					delete[] nbody_texels;
+
+					nbody_texel_capacity = nbody_node_count + nbody_node_count / 4; // Some slack, the tree size wobbles from frame to frame.
+					nbody_texels = new float[(size_t) nbody_texel_capacity * 8];
+				}
+
+				bh_tree_pack(nbody_texels);
+
+				glBindBuffer(GL_TEXTURE_BUFFER, nbody_tree_buffer);
+				glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * 8 * nbody_node_count, nbody_texels, GL_STREAM_DRAW);
+
+				glBindBuffer(GL_TEXTURE_BUFFER, nbody_points_buffer);
+				glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * 2 * points, bh_tree_points(), GL_STREAM_DRAW);
+				glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+				telemetry_transfer_call();
+				telemetry_transfer_call();
+				telemetry_set_buffer("nbody_tree", sizeof(float) * (8 * nbody_node_count + 2 * points));
+
+				glUseProgram(shader_advance_program);
+				glUniform1i(shader_advance_nbody_count_loc, nbody_node_count);
+			}
+
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+		} else {
+			printf("[update_nbody_tree] failed to map readback, keeping the old tree\n");
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	/* Kick off this frame's readback of the current state, unless both buffers are still in flight. */
+	if (nbody_issued - nbody_collected == 2) {
+		nbody_frame++;
+		return;
+	}
+
+	int slot = nbody_issued % 2;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, state_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, nbody_readback_buffers[slot]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(float) * 4 * count);
+	telemetry_transfer_call();
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	nbody_readback_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	nbody_readback_counts[slot] = count;
+	nbody_issued++;
+	nbody_frame++;
+}
+
+void update_stats(unsigned int count, const float* mouse_data) {
+	/* Take whatever readbacks have landed, oldest first, without waiting on any. */
+	while (stats_collected < stats_issued) {
+		int slot = stats_collected % STATS_READBACK_COUNT;
+		GLenum status = glClientWaitSync(stats_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break;
+		}
+
+		glDeleteSync(stats_fences[slot]);
+		stats_fences[slot] = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, stats_pbos[slot]);
+		const float* texels = (const float*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(float) * 4 * STATS_ROWS, GL_MAP_READ_BIT);
+		telemetry_transfer_call();
+
+		if (texels) {
+			stats_decode(texels, &stats_latest);
+			telemetry_set_stats(&stats_latest, STATS_SPEED_MAX);
+			stats_valid = true;
+
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		} else {
+			printf("[update_stats] failed to map readback %u\n", stats_collected);
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		stats_collected++;
+	}
+
+	if (stats_issued - stats_collected == STATS_READBACK_COUNT) {
+		stats_skipped++; // The GPU is that far behind, this frame goes without rather than stall.
+		return;
+	}
+
+	profiler_begin(PROFILER_PASS_STATS);
+
+	/* First level : every particle blends its terms into its lane of each row it contributes to. */
+	glBindFramebuffer(GL_FRAMEBUFFER, stats_framebuffers[0]);
+	glViewport(0, 0, STATS_LANES, STATS_ROWS);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	/* Except the bounds and peaks rows, which are folded with max and so start from the lowest float. */
+	float lowest[4] = {-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, STATS_ROW_BOUNDS, STATS_LANES, STATS_ROW_PEAKS - STATS_ROW_BOUNDS + 1);
+	glClearBufferfv(GL_COLOR, 0, lowest);
+	glDisable(GL_SCISSOR_TEST);
+
+	glUseProgram(shader_stats_program);
+	glUniform3f(shader_stats_mouse_loc, mouse_data[0], mouse_data[1], STATS_MOUSE_RADIUS); // The state is on unit 0, from the graph.
+
+	/* Blend equations are per draw, not per row, on 3.3. So the sums and the maxima are two draws over the particles. */
+	glBlendFunc(GL_ONE, GL_ONE); // Alpha is one of the sums here, the usual state drops it.
+	glUniform1i(shader_stats_mode_loc, 0);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	telemetry_draw_call();
+
+	glBlendEquation(GL_MAX);
+	glUniform1i(shader_stats_mode_loc, 1);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	telemetry_draw_call();
+
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ZERO);
+
+	/* Second level : one fragment per row folds its lanes, written as is. */
+	glDisable(GL_BLEND);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, stats_framebuffers[1]);
+	glViewport(0, 0, 1, STATS_ROWS);
+
+	glUseProgram(shader_stats_reduce_program);
+	glActiveTexture(GL_TEXTURE0 + 7);
+	glBindTexture(GL_TEXTURE_2D, stats_textures[0]);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	telemetry_draw_call();
+	glActiveTexture(GL_TEXTURE0);
+
+	glEnable(GL_BLEND);
+
+	/* And start its readback, collected above once the fence has passed. */
+	int slot = stats_issued % STATS_READBACK_COUNT;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, stats_pbos[slot]);
+	glReadPixels(0, 0, 1, STATS_ROWS, GL_RGBA, GL_FLOAT, 0);
+	telemetry_transfer_call();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	stats_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	stats_issued++;
+
+	frame_graph_forget_target(); // Two targets of our own, the next pass that draws gets its own bound again.
+
+	profiler_end();
+}
+
+void update_publish(unsigned int state_buffer, unsigned int count) {
+	/* The CPU engine's array is already in memory, it goes straight into the ring. */
+	if (SIMULATION_ENGINE_CPU) {
+		publish_frame(cpu_engine_particles(), count, publish_clock_ns());
+		return;
+	}
+
+	/* Publish whatever landed since last frame, oldest first so frame numbers stay in order. */
+	while (publish_collected != publish_issued) {
+		int slot = publish_collected % PUBLISH_READBACK_COUNT;
+
+		GLenum status = glClientWaitSync(publish_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+		if (status == GL_TIMEOUT_EXPIRED) {
+			break;
+		}
+
+		glDeleteSync(publish_fences[slot]);
+		publish_fences[slot] = 0;
+
+		/* Nothing says the copy landed, so that frame isn't published. Readers only ever see the frames that were. */
+		if (status == GL_WAIT_FAILED) {
+			printf("[update_publish] fence wait failed, skipping readback %u\n", publish_collected);
+
+			publish_collected++;
+			continue;
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, publish_buffers[slot]);
+		const float* state = (const float*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(float) * 4 * publish_counts[slot], GL_MAP_READ_BIT);
+		telemetry_transfer_call();
+
+		if (state) {
+			publish_frame(state, publish_counts[slot], publish_produced[slot]);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+		} else {
+			printf("[update_publish] failed to map readback %u\n", publish_collected);
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		publish_collected++;
+	}
+
+	if (publish_issued - publish_collected == PUBLISH_READBACK_COUNT) {
+		publish_skipped++;
+		return;
+	}
+
+	/* Then start copying this frame's state, a GPU side copy that returns straight away. */
+	int slot = publish_issued % PUBLISH_READBACK_COUNT;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, state_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, publish_buffers[slot]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(float) * 4 * count);
+	telemetry_transfer_call();
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	publish_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	publish_counts[slot] = count;
+	publish_produced[slot] = publish_clock_ns();
+	publish_issued++;
+}
+
+void calibrate_latency_clock(void) {
+	/* GL_TIMESTAMP is the GPU's clock, read back right away. The drift against glfwGetTime() is small, recalibrated every report anyway. */
+	GLint64 gpu_time;
+
+	double before = glfwGetTime();
+	glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+	double after = glfwGetTime();
+
+	latency_clock_offset = (before + after) / 2.0 - gpu_time * 1e-9;
+}
+
+bool collect_latency(bool wait) {
+	/* Takes the oldest frame in flight off the ring once the GPU is done with it, and records its latency. */
+	if (latency_collected == latency_issued) {
+		return false;
+	}
+
+	frame_latency* frame = &latency_frames[latency_collected % FRAMES_IN_FLIGHT_MAX];
+	GLenum status = glClientWaitSync(frame->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+	if (status == GL_TIMEOUT_EXPIRED) {
+		if (!wait) {
+			return false;
+		}
+
+		double start = glfwGetTime();
+
+		while (status == GL_TIMEOUT_EXPIRED) {
+			status = glClientWaitSync(frame->fence, 0, 1000000);
+		}
+
+		latency_waits++;
+		latency_wait_ms += (float) ((glfwGetTime() - start) * 1000.0);
+	}
+
+	glDeleteSync(frame->fence);
+	frame->fence = 0;
+
+	/* The fence went in after the timestamp, so the query has its result by now. */
+	GLuint64 done;
+	glGetQueryObjectui64v(frame->query, GL_QUERY_RESULT, &done);
+
+	float ms = (float) ((done * 1e-9 + latency_clock_offset - frame->input_time) * 1000.0);
+
+	latency_add(&latency_recent, ms);
+	latency_add(&latency_run, ms);
+
+	latency_collected++;
+	return true;
+}
+
+void update_latency(double input_time) {
+	/* Timestamp the end of this frame, then wait for the frame FRAMES_IN_FLIGHT back. */
+	if (latency_issued - latency_collected == FRAMES_IN_FLIGHT_MAX) {
+		collect_latency(true); // Only without a limit, and with the driver FRAMES_IN_FLIGHT_MAX frames behind.
+	}
+
+	frame_latency* frame = &latency_frames[latency_issued % FRAMES_IN_FLIGHT_MAX];
+
+	glQueryCounter(frame->query, GL_TIMESTAMP);
+	frame->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame->input_time = input_time;
+	latency_issued++;
+
+	while (collect_latency(false));
+
+	while (frames_in_flight && latency_issued - latency_collected >= (unsigned int) frames_in_flight) {
+		collect_latency(true);
+	}
+}
+
+void print_latency(latency_histogram* histogram, const char* label) {
+	latency_print(histogram, label);
+
+	if (frames_in_flight) {
+		printf("[latency] %d frames in flight at most, waited %u times for %.1f ms\n", frames_in_flight, latency_waits, latency_wait_ms);
+	} else {
+		printf("[latency] frames in flight left to the driver\n");
+	}
+
+	calibrate_latency_clock();
+}
+
+void shutdown_publish(void) {
+	for (int i = 0; i < PUBLISH_READBACK_COUNT; i++) {
+		if (publish_fences[i]) {
+			glDeleteSync(publish_fences[i]);
+			publish_fences[i] = 0;
+		}
+	}
+
+	glDeleteBuffers(PUBLISH_READBACK_COUNT, publish_buffers);
+	publish_shutdown();
+}
+
+bool sleep_due(unsigned int count, bool wake) {
+	/* Whether this frame repartitions. Between runs the sleepers just sit at the back of the live range. */
+	bool due = sleep_frame++ % SLEEP_INTERVAL == 0;
+
+	return due || wake || count != sleep_live_count;
+}
+
+bool sleep_attractors_moved(void) {
+	/* Against the list the sleepers were judged with. Moves below SLEEP_WAKE_MOVE wait for the interval. */
+	unsigned int count = forces_attractor_count();
+	const forces_attractor* attractors = forces_attractors();
+
+	if (count != sleep_attractor_count) {
+		return true;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		float dx = attractors[i].position[0] - sleep_attractors[i].position[0];
+		float dy = attractors[i].position[1] - sleep_attractors[i].position[1];
+
+		if (dx * dx + dy * dy > SLEEP_WAKE_MOVE * SLEEP_WAKE_MOVE || attractors[i].strength != sleep_attractors[i].strength) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void sleep_attractors_judged(void) {
+	sleep_attractor_count = forces_attractor_count();
+	memcpy(sleep_attractors, forces_attractors(), sizeof(forces_attractor) * sleep_attractor_count);
+}
+
+void update_sleep(unsigned int scratch_buffer, unsigned int count) {
+	/* Repartitions the live particles into [awake | asleep]. The graph has bound the state, and the neighbor grid when there is one. */
+	profiler_begin(PROFILER_PASS_SLEEP);
+
+	glUseProgram(shader_sleep_program);
+
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	/* Transform feedback only appends, so the split takes two passes : awake particles to the front of the second buffer... */
+	glUniform1f(shader_sleep_mode_loc, 1.0f);
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particles.next_buffer(), 0, sizeof(float) * 4 * count);
+
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, sleep_query);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	telemetry_draw_call();
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+	/* ...and sleeping ones to the scratch buffer. */
+	glUniform1f(shader_sleep_mode_loc, 0.0f);
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, scratch_buffer, 0, sizeof(float) * 4 * count);
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	telemetry_draw_call();
+	glEndTransformFeedback();
+
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	/* The one stall in the scheme, we need the split point before the sleepers can be copied behind the awake particles. */
+	unsigned int awake = 0;
+	glGetQueryObjectuiv(sleep_query, GL_QUERY_RESULT, &awake);
+
+	particles.swap_states();
+
+	/* Both buffers get the sleepers, the advance ping-pongs only the awake prefix from here on. */
+	if (awake < count) {
+		glBindBuffer(GL_COPY_READ_BUFFER, scratch_buffer);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, particles.state_buffer());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, sizeof(float) * 4 * awake, sizeof(float) * 4 * (count - awake));
+		telemetry_transfer_call();
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, particles.next_buffer());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, sizeof(float) * 4 * awake, sizeof(float) * 4 * (count - awake));
+		telemetry_transfer_call();
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	profiler_end();
+
+	sleep_live_count = count;
+	sleep_awake_count = awake;
+
+	sleep_attractors_judged();
+}
+
+float sleep_active_fraction(void) {
+	if (SIMULATION_ENGINE_CPU) {
+		return cpu_engine_active_fraction();
+	}
+
+	return sleep_live_count ? (float) sleep_awake_count / (float) sleep_live_count : 1.0f;
+}
+
+void advance_particles_gpu(unsigned int count, unsigned int awake) {
+	/* The grid and the tree are on their units already, from the graph. */
+	profiler_begin(PROFILER_PASS_ADVANCE);
+
+	/* Only the live prefix is advanced, particles past it keep their last state until the governor brings them back.
+	 *	With sleeping enabled only the awake part of it is, the sleepers behind it are already in both buffers. */
+	if (awake > count) {
+		awake = count;
+	}
+
+	particles.advance(shader_advance_program, awake);
+	frame_graph_forget_unit(0); // Left on the state it read, not the one it wrote.
+
+	if (awake) {
+		telemetry_draw_call();
+	}
+
+	profiler_end();
+}
+
+void advance_particles_cpu(unsigned int count) {
+	cpu_engine_step(count);
+
+	/* The render pass only ever reads the current state, so the CPU engine has no use for the other one. */
+	profiler_begin(PROFILER_PASS_ADVANCE);
+
+	particles.upload(cpu_engine_particles(), count);
+	telemetry_transfer_call();
+
+	profiler_end();
+}
+
+void initialize_camera(void) {
+	float ratio = (float) WINDOW_WIDTH / (float) WINDOW_HEIGHT;
+
+	projection_matrix = glm::ortho(-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f);
+
+	projection_camera_data[0] = -ratio / 2.0f;
+	projection_camera_data[1] = ratio / 2.0f;
+	projection_camera_data[2] = -0.5f;
+	projection_camera_data[3] = 0.5f;
+}
+
+void camera_scroll_callback(GLFWwindow* window, double x, double y) {
+	camera_scroll += y;
+	idle_input = true;
+}
+
+void idle_cursor_callback(GLFWwindow* window, double x, double y) {
+	idle_input = true;
+}
+
+void idle_button_callback(GLFWwindow* window, int button, int action, int mods) {
+	idle_input = true;
+}
+
+void idle_key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	idle_input = true;
+}
+
+void idle_refresh_callback(GLFWwindow* window) {
+	idle_refresh = true; // Exposed or resized, the last frame has to be drawn again.
+}
+
+bool update_idle(bool held) {
+	/* Counts quiet frames : no input, nothing held down, and the fastest particle at rest. Statistics lag a few frames behind, by
+	 *	IDLE_FRAMES they all come from after the last input. */
+	bool quiet = !idle_input && !held && stats_valid && stats_latest.max_speed < IDLE_SPEED;
+
+	idle_quiet_frames = quiet ? idle_quiet_frames + 1 : 0;
+	idle_input = false;
+
+	return idle_quiet_frames >= IDLE_FRAMES;
+}
+
+void wait_idle(void) {
+	/* Nothing left to advance or draw, so block until input arrives. A refresh only draws one frame and comes back here, since the quiet
+	 *	count stands until there is input. */
+	idle_refresh = false;
+	idle_begin();
+
+	while (!idle_input && !idle_refresh && !glfwWindowShouldClose(window_handle)) {
+		glfwWaitEvents();
+	}
+
+	idle_end();
+}
+
+void update_camera(double mx, double my, bool enabled) {
+	/* projection_camera_data stays the world (and window) bounds, only the view moves over it. */
+	float half_width = projection_camera_data[1];
+	float half_height = projection_camera_data[3];
+
+	float old_center[2] = {camera_center[0], camera_center[1]};
+	float old_zoom = camera_zoom;
+
+	float cursor_x = (float) (mx / WINDOW_WIDTH - 0.5) * 2.0f;
+	float cursor_y = (float) (my / WINDOW_HEIGHT - 0.5) * -2.0f;
+
+	if (enabled && camera_scroll != 0.0) {
+		/* Keep the world point under the cursor where it is. */
+		float world_x = camera_center[0] + cursor_x * half_width / camera_zoom;
+		float world_y = camera_center[1] + cursor_y * half_height / camera_zoom;
+
+		camera_zoom *= powf(CAMERA_ZOOM_STEP, (float) camera_scroll);
+		camera_zoom = fminf(fmaxf(camera_zoom, 1.0f), CAMERA_ZOOM_MAX);
+
+		camera_center[0] = world_x - cursor_x * half_width / camera_zoom;
+		camera_center[1] = world_y - cursor_y * half_height / camera_zoom;
+	}
+
+	camera_scroll = 0.0;
+
+	bool dragging = enabled && glfwGetMouseButton(window_handle, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+
+	if (dragging && camera_dragging) {
+		camera_center[0] -= (float) ((mx - camera_drag_from[0]) / WINDOW_WIDTH) * 2.0f * half_width / camera_zoom;
+		camera_center[1] += (float) ((my - camera_drag_from[1]) / WINDOW_HEIGHT) * 2.0f * half_height / camera_zoom;
+	}
+
+	camera_dragging = dragging;
+	camera_drag_from[0] = mx;
+	camera_drag_from[1] = my;
+
+	if (enabled && glfwGetKey(window_handle, GLFW_KEY_R) == GLFW_PRESS) {
+		camera_center[0] = camera_center[1] = 0.0f;
+		camera_zoom = 1.0f;
+	}
+
+	/* Don't let the view leave the world. */
+	float limit_x = half_width - half_width / camera_zoom;
+	float limit_y = half_height - half_height / camera_zoom;
+
+	camera_center[0] = fminf(fmaxf(camera_center[0], -limit_x), limit_x);
+	camera_center[1] = fminf(fmaxf(camera_center[1], -limit_y), limit_y);
+
+	if (camera_center[0] == old_center[0] && camera_center[1] == old_center[1] && camera_zoom == old_zoom) {
+		return;
+	}
+
+	projection_matrix = glm::ortho(camera_center[0] - half_width / camera_zoom, camera_center[0] + half_width / camera_zoom,
+		camera_center[1] - half_height / camera_zoom, camera_center[1] + half_height / camera_zoom);
+
+	/* Only the selected render variant, the others get it when they are selected. */
+	glUseProgram(shader_render_program);
+	glUniformMatrix4fv(shader_render_mvp_loc, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+
+	if (shader_cull_program) {
+		glUseProgram(shader_cull_program);
+		glUniformMatrix4fv(shader_cull_mvp_loc, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+		glUniform1f(shader_cull_margin_loc, RENDER_PARTICLE_DIM_MAX * 2.0f * camera_zoom); // The sprite half size, scaled like the y axis.
+	}
+}
+
+void cull_particles(unsigned int list_buffer, unsigned int count) {
+	/* Compacts the visible particles into list_buffer, from the state on unit 0. The list length stays on the GPU. */
+	profiler_begin(PROFILER_PASS_CULL);
+
+	glUseProgram(shader_cull_program);
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, cull_feedback);
+
+	/* The buffer binding lives in the feedback object, so it only changes when the graph hands us a different transient. */
+	if (list_buffer != cull_feedback_buffer) {
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, list_buffer);
+		cull_feedback_buffer = list_buffer;
+	}
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	telemetry_draw_call();
+	glEndTransformFeedback();
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0); // The other passes use the default object.
+
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	profiler_end();
+}
+
+bool initialize_views(void) {
+	/* Tiles go row by row from the top left, like the scene tiles. With windows every view fills its own, and view 0 the main one. */
+	for (int v = 0; v < VIEW_COUNT; v++) {
+		view_state* view = &views[v];
+		int column = v % VIEW_COLUMNS, row = v / VIEW_COLUMNS;
+
+		if (VIEW_WINDOWS) {
+			view->viewport[0] = view->viewport[1] = 0;
+			view->viewport[2] = WINDOW_WIDTH;
+			view->viewport[3] = WINDOW_HEIGHT;
+		} else {
+			view->viewport[0] = column * WINDOW_WIDTH / VIEW_COLUMNS;
+			view->viewport[1] = (VIEW_ROWS - 1 - row) * WINDOW_HEIGHT / VIEW_ROWS;
+			view->viewport[2] = (column + 1) * WINDOW_WIDTH / VIEW_COLUMNS - view->viewport[0];
+			view->viewport[3] = (VIEW_ROWS - row) * WINDOW_HEIGHT / VIEW_ROWS - view->viewport[1];
+		}
+
+		view->window = NULL;
+
+		if (!VIEW_WINDOWS || v == 0 || record_enabled) {
+			continue; // A recording only takes the main window's views.
+		}
+
+		char title[32];
+		snprintf(title, sizeof title, "particles view %d", v);
+
+		view->window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, title, NULL, window_handle);
+
+		if (!view->window) {
+			printf("[initialize_views] failed to create the window of view %d\n", v);
+			return false;
+		}
+
+		if (IDLE_ENABLED) {
+			glfwSetWindowRefreshCallback(view->window, idle_refresh_callback);
+		}
+
+		/* Objects are shared, state isn't : every context needs the blending set up again. */
+		glfwMakeContextCurrent(view->window);
+		glfwSwapInterval(0); // Only the main window waits for vsync, otherwise every view would.
+
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glEnable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ZERO);
+		glBlendEquation(GL_FUNC_ADD);
+	}
+
+	glfwMakeContextCurrent(window_handle);
+
+	update_views();
+
+	if (VIEW_COUNT > 1) {
+		printf("[initialize_views] %d views in %s, %d with fixed rectangles\n", VIEW_COUNT, VIEW_WINDOWS ? "windows" : "tiles", view_fixed_count);
+	}
+
+	return true;
+}
+
+void update_views(void) {
+	/* Views that follow the camera split its rectangle the way they tile : the whole wall shows what one window would. */
+	float half_width = projection_camera_data[1] / camera_zoom;
+	float half_height = projection_camera_data[3] / camera_zoom;
+
+	float left = camera_center[0] - half_width;
+	float top = camera_center[1] + half_height;
+
+	for (int v = 0; v < VIEW_COUNT; v++) {
+		view_state* view = &views[v];
+
+		if (view->fixed) {
+			continue;
+		}
+
+		int column = v % VIEW_COLUMNS, row = v / VIEW_COLUMNS;
+
+		view->rect[0] = left + 2.0f * half_width * column / VIEW_COLUMNS;
+		view->rect[1] = left + 2.0f * half_width * (column + 1) / VIEW_COLUMNS;
+		view->rect[2] = top - 2.0f * half_height * (row + 1) / VIEW_ROWS;
+		view->rect[3] = top - 2.0f * half_height * row / VIEW_ROWS;
+
+		view->mvp = glm::ortho(view->rect[0], view->rect[1], view->rect[2], view->rect[3]);
+	}
+}
+
+void render_particles(bool culled, bool scaled, unsigned int count, float scale, float r, float g, float b) {
+	/* The state (or the cull list), the sprites and the target are bound by the graph. */
+	profiler_begin(PROFILER_PASS_RENDER);
+
+	if (scaled) {
+		clear_window();
+	}
+
+	select_render_variant(culled);
+	glUseProgram(shader_render_program);
+	glUniform3f(shader_render_color_loc, r, g, b);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0); // We are using the texture buffer! No need to actually draw anything from the array buffer here.
+
+	/* One draw per view in this window, of the same state. */
+	for (int v = 0; v < VIEW_COUNT; v++) {
+		if (!views[v].window) {
+			draw_view(&views[v], culled, count, scale);
+		}
+	}
+
+	profiler_end();
+}
+
+void draw_view(const view_state* view, bool culled, unsigned int count, float scale) {
+	/* The render program, its textures and the target are already bound, a view only brings its viewport and camera. */
+	glViewport((int) (view->viewport[0] * scale), (int) (view->viewport[1] * scale), (int) (view->viewport[2] * scale), (int) (view->viewport[3] * scale));
+	glUniformMatrix4fv(shader_render_mvp_loc, 1, GL_FALSE, glm::value_ptr(view->mvp));
+
+	if (culled) {
+		glDrawTransformFeedback(GL_POINTS, cull_feedback); // One vertex per listed particle, the GPU knows how many.
+	} else {
+		glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	}
+
+	telemetry_draw_call();
+}
+
+void draw_view_windows(unsigned int state_texture, unsigned int count, float r, float g, float b) {
+	/* The views with windows of their own, drawn from the full state : transform feedback objects aren't shared, so the cull list
+	 *	length can't be either. The other contexts wait on a fence for the advance, without stalling us. */
+	GLsync advanced = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	unsigned int program = get_variant(VARIANT_RENDER, render_variant_features(false));
+
+	if (program != shader_view_program) {
+		shader_view_program = program;
+		shader_view_mvp_loc = glGetUniformLocation(program, "mat_mvp");
+		shader_view_color_loc = glGetUniformLocation(program, "render_color");
+	}
+
+	for (int v = 1; v < VIEW_COUNT; v++) {
+		view_state* view = &views[v];
+
+		if (!view->window) {
+			continue;
+		}
+
+		glfwMakeContextCurrent(view->window);
+		glWaitSync(advanced, 0, GL_TIMEOUT_IGNORED);
+
+		glViewport(0, 0, view->viewport[2], view->viewport[3]);
+		clear_window();
+
+		glUseProgram(program);
+		glUniformMatrix4fv(shader_view_mvp_loc, 1, GL_FALSE, glm::value_ptr(view->mvp));
+		glUniform3f(shader_view_color_loc, r, g, b);
+
+		/* Texture bindings are per context too. */
+		glActiveTexture(GL_TEXTURE0 + 6);
+		glBindTexture(GL_TEXTURE_BUFFER, scene_texture);
+		glActiveTexture(GL_TEXTURE0 + 1);
+		glBindTexture(GL_TEXTURE_2D, render_texture);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_BUFFER, state_texture);
+
+		if (ATTRIBUTE_SET) {
+			attributes.bind(ATTRIBUTE_UNIT);
+		}
+
+		glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+		telemetry_draw_call();
+
+		glfwSwapBuffers(view->window);
+	}
+
+	glfwMakeContextCurrent(window_handle);
+	glDeleteSync(advanced); // The waits already issued hold on to it.
+}
+
+void shutdown_views(void) {
+	for (int v = 0; v < VIEW_COUNT; v++) {
+		if (views[v].window) {
+			glfwDestroyWindow(views[v].window);
+			views[v].window = NULL;
+		}
+	}
+}
+
+bool initialize_shaders(void) {
+	/* With KHR_parallel_shader_compile the driver compiles on threads of its own, as long as nobody asks for the results too early. */
+	parallel_compile_supported = has_extension("GL_KHR_parallel_shader_compile") || has_extension("GL_ARB_parallel_shader_compile");
+
+	if (parallel_compile_supported) {
+		typedef void (*max_threads_proc)(unsigned int count);
+		max_threads_proc max_threads = (max_threads_proc) glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+
+		if (max_threads) {
+			max_threads(0xFFFFFFFF); // As many as the driver likes.
+		}
+	}
+
+	/* Every variant a click or a zoom can switch to, so that switching never compiles anything. */
+	for (int attractors = 0; attractors < 2; attractors++) {
+		for (int scene_mouse = 0; scene_mouse < (SCENE_COUNT > 1 ? 2 : 1); scene_mouse++) {
+			prepare_variant(VARIANT_ADVANCE, advance_variant_features(attractors, scene_mouse));
+		}
+	}
+
+	prepare_variant(VARIANT_RENDER, render_variant_features(false));
+	prepare_variant(VARIANT_RENDER, render_variant_features(true));
+
+	return true;
+}
+
+bool finish_shaders(void) {
+	if (!finish_variants()) {
+		return false;
+	}
+
+	select_render_variant(false);
+	select_advance_variant(false);
+
+	printf("[finish_shaders] %d shader variants built%s\n", variants_count(), parallel_compile_supported ? ", compiled in parallel" : "");
+	return shader_render_program && shader_advance_program;
+}
+
+bool initialize_render_texture(void) {
+	/* The atlas is already in the layout GL wants, level by level, so this is a map and one upload per level. */
+	if (!sprites_open(PARTICLE_SPRITES)) {
+		printf("[initialize_render_texture] run 'make sprites' to bake %s\n", PARTICLE_SPRITES);
+		return false;
+	}
+
+	const sprites_header* header = sprites_get_header();
+
+	sprite_grid[0] = (int) header->columns;
+	sprite_grid[1] = (int) header->rows;
+	sprite_grid[2] = (int) header->count;
+
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glGenTextures(1, &render_texture);
+	glBindTexture(GL_TEXTURE_2D, render_texture);
+
+	/* Immutable storage needs ARB_texture_storage on a 3.3 context (it is core in 4.2), otherwise each level is specified on its own. */
+	bool storage = has_extension("GL_ARB_texture_storage");
+
+	if (storage) {
+		glTexStorage2D(GL_TEXTURE_2D, header->levels, GL_RGBA8, header->width, header->height);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (unsigned int level = 0; level < header->levels; level++) {
+		unsigned int width, height;
+		const unsigned char* pixels = sprites_level(level, &width, &height);
+
+		if (storage) {
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+
+		telemetry_transfer_call();
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	/* Particles are a pixel or two across, so they sample the small levels most of the time. */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+	glActiveTexture(GL_TEXTURE0);
+
+	telemetry_set_buffer("sprites", sprites_bytes());
+
+	sprites_close(); // GL has its own copy now.
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool generate_particles(void) {
+	/* Worker thread, so rand_r() : the scenes seed and use rand() on the main thread meanwhile. */
+	unsigned int seed = (unsigned int) time(NULL);
+
+	startup_particles.assign((size_t) PARTICLE_TOTAL * 4, 0.0f);
+
+	for (unsigned int i = 0; i < PARTICLE_TOTAL; i++) {
+		float* current_particle = startup_particles.data() + 4 * i;
+
+		current_particle[0] = ((float) rand_r(&seed) / ((float) INT_MAX / 2.0f) - 1.0f) / 1.02f;
+		current_particle[1] = ((float) rand_r(&seed) / ((float) INT_MAX / 2.0f) - 1.0f) / 1.02f;
+		current_particle[2] = current_particle[3] = 0.0f;
+	}
+
+	startup_mark("particles generated");
+	return true;
+}
+
+bool bake_force_field(void) {
+	if (!FIELD_ENABLED) {
+		return true;
+	}
+
+	if (!forces_bake_field(FIELD_WIDTH, FIELD_HEIGHT, projection_camera_data, FIELD_FREQUENCY, FIELD_STRENGTH, (unsigned int) time(NULL))) {
+		return false;
+	}
+
+	startup_mark("field baked");
+	return true;
+}
+
+bool has_extension(const char* name) {
+	int extension_count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+
+	for (int i = 0; i < extension_count; i++) {
+		if (!strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), name)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+unsigned int advance_variant_features(bool attractors, bool scene_mouse) {
+	/* Stages that are off for the whole run are compiled out for good, only attractors and the scene mouse come and go. */
+	unsigned int features = 0;
+
+	if (attractors) features |= VARIANT_ATTRACTORS;
+	if (scene_mouse) features |= VARIANT_SCENE_MOUSE;
+	if (FIELD_ENABLED && !SIMULATION_ENGINE_CPU) features |= VARIANT_FIELD;
+	if (NEIGHBOR_ENABLED && !SIMULATION_ENGINE_CPU) features |= VARIANT_NEIGHBORS;
+	if (NBODY_ENABLED && !SIMULATION_ENGINE_CPU) features |= VARIANT_NBODY;
+	if (BOUNDS_WRAP) features |= VARIANT_BOUNDS_WRAP;
+	if (SCENE_COUNT == 1) features |= VARIANT_SCENE_FOLDED;
+
+	features |= variants_integrator_features(SIMULATION_INTEGRATOR);
+
+	return features;
+}
+
+unsigned int render_variant_features(bool culled) {
+	unsigned int features = culled ? VARIANT_CULLED : 0;
+
+	if (ATTRIBUTE_SET) features |= VARIANT_ATTRIBUTES;
+
+	return features;
+}
+
+const char* variant_glsl(const variant_key* key) {
+	/* Render variants with attributes read them through the layout's load_attributes(). */
+	return (key->kind == VARIANT_RENDER && (key->features & VARIANT_ATTRIBUTES)) ? attributes.plan()->load_glsl.c_str() : NULL;
+}
+
+void setup_variant_program(const variant_key* key, unsigned int program) {
+	if (key->kind == VARIANT_ADVANCE) {
+		setup_advance_program(program);
+	} else {
+		setup_render_program(program);
+	}
+}
+
+variant_key make_variant_key(int kind, unsigned int features) {
+	variant_key key;
+	variants_key(&key, kind, features);
+
+	if (kind == VARIANT_ADVANCE && (features & VARIANT_SCENE_FOLDED)) {
+		const scene_params* scene = scenes_get(0);
+
+		memcpy(key.constants, scene->camera_bounds, sizeof(float) * 4);
+		key.constants[4] = scene->gravity;
+		key.constants[5] = scene->speed_decay;
+		key.constants[6] = scene->bounce_decay;
+	} else if (kind == VARIANT_RENDER) {
+		key.constants[0] = RENDER_PARTICLE_DIM;
+	}
+
+	return key;
+}
+
+void prepare_variant(int kind, unsigned int features) {
+	/* Issues the build without waiting on it, finish_variants() collects it. */
+	variant_key key = make_variant_key(kind, features);
+
+	if (variants_find(&key)) {
+		return;
+	}
+
+	/* From the last reloaded sources, if shaders were reloaded. */
+	pending_variant pending;
+	pending.key = key;
+	pending.program = particle_system_start_variant(&key, variant_glsl(&key), shader_reload_sources(kind));
+
+	pending_variants.push_back(pending);
+}
+
+bool finish_variants(void) {
+	/* With parallel compiles, take programs in whatever order the driver gets them done, otherwise just in order. */
+	bool ok = true;
+
+	while (!pending_variants.empty()) {
+		for (size_t i = 0; i < pending_variants.size(); i++) {
+			int done = 1;
+
+			if (parallel_compile_supported) {
+				glGetProgramiv(pending_variants[i].program, GL_COMPLETION_STATUS_KHR, &done);
+			}
+
+			if (!done) {
+				continue;
+			}
+
+			pending_variant pending = pending_variants[i];
+			pending_variants.erase(pending_variants.begin() + i--);
+
+			if (!finish_program(pending.key.kind == VARIANT_ADVANCE ? "advance" : "render", pending.program)) {
+				ok = false;
+				continue;
+			}
+
+			setup_variant_program(&pending.key, pending.program);
+			variants_insert(&pending.key, pending.program);
+		}
+
+		if (!pending_variants.empty()) {
+			std::this_thread::yield();
+		}
+	}
+
+	return ok;
+}
+
+unsigned int get_variant(int kind, unsigned int features) {
+	/* Returns the cached program for this variant, building and setting it up the first time. 0 if it fails to build. */
+	variant_key key = make_variant_key(kind, features);
+	unsigned int program = variants_find(&key);
+
+	if (program) {
+		return program;
+	}
+
+	program = particle_system_start_variant(&key, variant_glsl(&key), shader_reload_sources(kind));
+
+	if (!finish_program(kind == VARIANT_ADVANCE ? "advance" : "render", program)) {
+		return 0;
+	}
+
+	setup_variant_program(&key, program);
+
+	variants_insert(&key, program);
+	return program;
+}
+
+void setup_advance_program(unsigned int program) {
+	/* Uniforms a variant compiled out are simply not found, glUniform ignores location -1. */
+	glUseProgram(program);
+
+	set_forces_uniforms(program);
+
+	glUniform1i(glGetUniformLocation(program, "particle_buffer"), 0);
+	glUniform4f(glGetUniformLocation(program, "field_data"), (FIELD_ENABLED && !SIMULATION_ENGINE_CPU) ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f);
+
+	/* The CPU engine runs its own neighbor search, so the shader only splats when it is the one advancing. */
+	glUniform4f(glGetUniformLocation(program, "neighbor_data"), NEIGHBOR_RADIUS, NEIGHBOR_STRENGTH, (NEIGHBOR_ENABLED && !SIMULATION_ENGINE_CPU) ? 1.0f : 0.0f, 0.0f);
+
+	glUniform1i(glGetUniformLocation(program, "nbody_tree"), 3);
+	glUniform1i(glGetUniformLocation(program, "nbody_points"), 4);
+	glUniform4f(glGetUniformLocation(program, "nbody_data"), NBODY_THETA * NBODY_THETA, NBODY_GRAVITATION / PARTICLE_COUNT, NBODY_SOFTENING * NBODY_SOFTENING,
+		(NBODY_ENABLED && !SIMULATION_ENGINE_CPU) ? 1.0f : 0.0f);
+
+	glUniform4f(glGetUniformLocation(program, "integrator_data"), SIMULATION_DT, INTEGRATOR_TOLERANCE, (float) INTEGRATOR_MAX_SUBSTEPS, 0.0f);
+
+	/* Every scene program finds its scene from gl_InstanceID. */
+	glUniform1i(glGetUniformLocation(program, "scene_buffer"), 6);
+	glUniform1i(glGetUniformLocation(program, "scene_particles"), PARTICLE_COUNT);
+}
+
+void setup_render_program(unsigned int program) {
+	glUseProgram(program);
+
+	glUniform1i(glGetUniformLocation(program, "particle_buffer"), 0);
+	glUniform1i(glGetUniformLocation(program, "render_texture"), 1); // Use texture unit 1 for actual texture rendering.
+	glUniform3i(glGetUniformLocation(program, "sprite_grid"), sprite_grid[0], sprite_grid[1], sprite_grid[2]);
+	glUniform3f(glGetUniformLocation(program, "render_color"), 1.0f, 1.0f, 1.0f);
+
+	glUniform1i(glGetUniformLocation(program, "scene_buffer"), 6);
+	glUniform1i(glGetUniformLocation(program, "scene_particles"), PARTICLE_COUNT);
+	glUniform2i(glGetUniformLocation(program, "scene_grid"), scenes_columns(), scenes_rows());
+	glUniform4f(glGetUniformLocation(program, "camera_bounds"), projection_camera_data[0], projection_camera_data[1], projection_camera_data[2], projection_camera_data[3]);
+
+	glUniform1f(glGetUniformLocation(program, "attribute_age_fade"), ATTRIBUTE_AGE_FADE);
+	attributes.set_uniforms(program, ATTRIBUTE_UNIT);
+}
+
+void select_advance_variant(bool scene_mouse) {
+	/* Called once per frame (or simulation step) once the attractors and scenes are updated. Both dynamic uniforms are set every time,
+	 *	the program may have just been switched and they change most frames anyway. */
+	unsigned int program = get_variant(VARIANT_ADVANCE, advance_variant_features(forces_attractor_count() > 0, scene_mouse));
+
+	if (!program) {
+		return; // Keep the previous one, build_program() said what went wrong.
+	}
+
+	if (program != shader_advance_program) {
+		shader_advance_program = program;
+		shader_advance_attractor_count_loc = glGetUniformLocation(program, "attractor_count");
+		shader_advance_nbody_count_loc = glGetUniformLocation(program, "nbody_node_count");
+	}
+
+	glUseProgram(shader_advance_program);
+	glUniform1i(shader_advance_attractor_count_loc, forces_attractor_count());
+	glUniform1i(shader_advance_nbody_count_loc, nbody_node_count);
+}
+
+void select_render_variant(bool culled) {
+	unsigned int program = get_variant(VARIANT_RENDER, render_variant_features(culled));
+
+	if (!program || program == shader_render_program) {
+		return;
+	}
+
+	shader_render_program = program;
+	shader_render_mvp_loc = glGetUniformLocation(program, "mat_mvp");
+	shader_render_color_loc = glGetUniformLocation(program, "render_color");
+
+	/* The view may have moved since this variant was last used. */
+	glUseProgram(program);
+	glUniformMatrix4fv(shader_render_mvp_loc, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+}
+
+bool initialize_buffers(void) {
+	/* The positions were generated by generate_particles() on a worker. */
+	float* particle_buffer = startup_particles.data();
+
+	if (SIMULATION_ENGINE_CPU) {
+		cpu_engine_initialize(PARTICLE_COUNT, projection_camera_data);
+		cpu_engine_set_neighbors(NEIGHBOR_ENABLED, NEIGHBOR_RADIUS, NEIGHBOR_STRENGTH);
+		cpu_engine_set_nbody(NBODY_ENABLED, NBODY_THETA, NBODY_GRAVITATION / PARTICLE_COUNT, NBODY_SOFTENING, NBODY_DIRECT);
+		cpu_engine_set_sleep(SLEEP_ENABLED, SLEEP_SPEED, SLEEP_FORCE, SLEEP_INTERVAL);
+		cpu_engine_set_bounds(BOUNDS_WRAP);
+		cpu_engine_set_integrator(SIMULATION_INTEGRATOR, SIMULATION_DT, INTEGRATOR_TOLERANCE, INTEGRATOR_MAX_SUBSTEPS);
+		memcpy(cpu_engine_particles(), particle_buffer, sizeof(float) * PARTICLE_COUNT * 4);
+	}
+
+	/* Only the state buffers are used out of the particle system, the parameters and forces come from the scenes and from here. */
+	particle_system_config config;
+	particle_system_defaults(&config, PARTICLE_TOTAL, projection_camera_data);
+
+	config.wrap = BOUNDS_WRAP;
+	config.particle_size = RENDER_PARTICLE_DIM;
+	config.integrator = SIMULATION_INTEGRATOR;
+	config.dt = SIMULATION_DT;
+	config.tolerance = INTEGRATOR_TOLERANCE;
+	config.max_substeps = INTEGRATOR_MAX_SUBSTEPS;
+
+	if (!particles.initialize(&config, particle_buffer)) {
+		return false;
+	}
+
+	telemetry_set_buffer("particles", sizeof(float) * PARTICLE_TOTAL * 4 * 2);
+
+	std::vector<float>().swap(startup_particles);
+	return true;
+}
+
+bool initialize_forces(void) {
+	glGenBuffers(1, &attractor_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, attractor_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(forces_attractor) * FORCES_MAX_ATTRACTORS, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	telemetry_set_buffer("attractors", sizeof(forces_attractor) * FORCES_MAX_ATTRACTORS);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, attractor_buffer);
+
+	if (!FIELD_ENABLED) {
+		return true;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + 5); // Baked by bake_force_field() on a worker.
+	glGenTextures(1, &field_texture);
+	glBindTexture(GL_TEXTURE_2D, field_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, FIELD_WIDTH, FIELD_HEIGHT, 0, GL_RG, GL_FLOAT, forces_field());
+	telemetry_set_buffer("force_field", sizeof(float) * 2 * FIELD_WIDTH * FIELD_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_neighbor_grid(void) {
+	neighbor_grid_width = (int) ceilf((projection_camera_data[1] - projection_camera_data[0]) / NEIGHBOR_RADIUS);
+	neighbor_grid_height = (int) ceilf((projection_camera_data[3] - projection_camera_data[2]) / NEIGHBOR_RADIUS);
+
+	shader_grid_program = build_program("grid", NULL, SHADER_GRID_VS, NULL, SHADER_GRID_PS, NULL, NULL);
+
+	if (!shader_grid_program) {
+		return false;
+	}
+
+	glUseProgram(shader_grid_program);
+
+	glUniform1i(glGetUniformLocation(shader_grid_program, "particle_buffer"), 0);
+	glUniform4f(glGetUniformLocation(shader_grid_program, "camera_bounds"), projection_camera_data[0], projection_camera_data[1], projection_camera_data[2], projection_camera_data[3]);
+
+	shader_grid_cell_size_loc = glGetUniformLocation(shader_grid_program, "cell_size");
+	glUniform1f(shader_grid_cell_size_loc, NEIGHBOR_RADIUS);
+
+	glActiveTexture(GL_TEXTURE0 + 2);
+	glGenTextures(1, &neighbor_texture);
+	glBindTexture(GL_TEXTURE_2D, neighbor_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, neighbor_grid_width, neighbor_grid_height, 0, GL_RED, GL_FLOAT, NULL);
+	telemetry_set_buffer("neighbor_grid", sizeof(float) * neighbor_grid_width * neighbor_grid_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glActiveTexture(GL_TEXTURE0);
+
+	glGenFramebuffers(1, &neighbor_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, neighbor_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, neighbor_texture, 0);
+
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!complete) {
+		printf("[initialize_neighbor_grid] framebuffer incomplete\n");
+		return false;
+	}
+
+	printf("[initialize_neighbor_grid] %dx%d cells\n", neighbor_grid_width, neighbor_grid_height);
+	return true;
+}
+
+bool initialize_nbody(void) {
+	glGenBuffers(2, nbody_readback_buffers);
+
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, nbody_readback_buffers[i]);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(float) * 4 * PARTICLE_COUNT, NULL, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	telemetry_set_buffer("nbody_readback", sizeof(float) * 4 * PARTICLE_COUNT * 2);
+
+	glGenBuffers(1, &nbody_tree_buffer);
+	glGenBuffers(1, &nbody_points_buffer);
+	glGenTextures(1, &nbody_tree_texture);
+	glGenTextures(1, &nbody_points_texture);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, nbody_tree_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * 8, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, nbody_points_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * 2, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glBindTexture(GL_TEXTURE_BUFFER, nbody_tree_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, nbody_tree_buffer);
+
+	glBindTexture(GL_TEXTURE_BUFFER, nbody_points_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, nbody_points_buffer);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_sleep(void) {
+	shader_sleep_program = build_program("sleep", SHADER_FORCES_COMMON, SHADER_SLEEP_VS, SHADER_SLEEP_GS, NULL, "out_particle_data", NULL);
+
+	if (!shader_sleep_program) {
+		return false;
+	}
+
+	glUseProgram(shader_sleep_program);
+
+	set_forces_uniforms(shader_sleep_program);
+	glUniform1i(glGetUniformLocation(shader_sleep_program, "particle_buffer"), 0);
+	glUniform2f(glGetUniformLocation(shader_sleep_program, "sleep_data"), SLEEP_SPEED * SLEEP_SPEED, SLEEP_FORCE * SLEEP_FORCE);
+
+	shader_sleep_mode_loc = glGetUniformLocation(shader_sleep_program, "sleep_mode");
+	shader_sleep_attractor_count_loc = glGetUniformLocation(shader_sleep_program, "attractor_count");
+
+	/* The scratch buffer the sleepers go to is a frame graph transient, shared with the cull list. */
+	glGenQueries(1, &sleep_query);
+
+	sleep_awake_count = PARTICLE_TOTAL; // Everything is awake until the first partition.
+	return glGetError() == GL_NO_ERROR;
+}
+
+void set_forces_uniforms(unsigned int program) {
+	/* The SHADER_FORCES_COMMON uniforms, for programs other than the advance (which sets them up along with its own). Program must be bound. */
+	glUniform4f(glGetUniformLocation(program, "camera_bounds"), projection_camera_data[0], projection_camera_data[1], projection_camera_data[2], projection_camera_data[3]);
+	glUniform1i(glGetUniformLocation(program, "attractor_count"), 0);
+
+	unsigned int attractor_block = glGetUniformBlockIndex(program, "attractor_block");
+
+	if (attractor_block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, attractor_block, 0);
+	}
+
+	glUniform1i(glGetUniformLocation(program, "force_field"), 5);
+	glUniform4f(glGetUniformLocation(program, "field_data"), FIELD_ENABLED ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f);
+
+	glUniform1i(glGetUniformLocation(program, "neighbor_grid"), 2);
+	glUniform4f(glGetUniformLocation(program, "neighbor_data"), NEIGHBOR_RADIUS, NEIGHBOR_STRENGTH, NEIGHBOR_ENABLED ? 1.0f : 0.0f, 0.0f);
+}
+
+bool initialize_scenes(void) {
+	if (!scenes_initialize(SCENE_COUNT, projection_camera_data, (unsigned int) time(NULL))) {
+		return false;
+	}
+
+	glGenBuffers(1, &scene_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, scene_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(scene_params) * SCENE_COUNT, scenes_data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	telemetry_set_buffer("scenes", sizeof(scene_params) * SCENE_COUNT);
+
+	glActiveTexture(GL_TEXTURE0 + 6); // Texture unit 6 holds the scene parameters for good.
+	glGenTextures(1, &scene_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, scene_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, scene_buffer);
+	glActiveTexture(GL_TEXTURE0);
+
+	/* The advance and render programs pick the scene uniforms up in setup_advance_program() and setup_render_program(). */
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_recording(void) {
+	glGenFramebuffers(1, &record_framebuffer);
+	glGenRenderbuffers(1, &record_renderbuffer);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, record_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, record_framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, record_renderbuffer);
+
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!complete) {
+		printf("[initialize_recording] framebuffer incomplete\n");
+		return false;
+	}
+
+	glGenBuffers(RECORD_PBO_COUNT, record_pbos);
+
+	for (int i = 0; i < RECORD_PBO_COUNT; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, record_pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, WINDOW_WIDTH * WINDOW_HEIGHT * 4, NULL, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	telemetry_set_buffer("record", WINDOW_WIDTH * WINDOW_HEIGHT * 4 * (RECORD_PBO_COUNT + 1)); // Readback ring plus the target.
+
+	if (!recorder_initialize(record_path, record_format, WINDOW_WIDTH, WINDOW_HEIGHT, RECORD_FPS, RECORD_THREADS, RECORD_SLOTS)) {
+		return false;
+	}
+
+	output_framebuffer = record_framebuffer;
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_cull(void) {
+	/* glDrawTransformFeedback is core in 4.0, on a 3.3 context it comes with ARB_transform_feedback2. */
+	cull_supported = has_extension("GL_ARB_transform_feedback2");
+
+	if (!cull_supported) {
+		printf("[initialize_cull] no ARB_transform_feedback2, drawing every particle\n");
+		return true;
+	}
+
+	shader_cull_program = build_program("cull", SHADER_SCENE_TILES, SHADER_CULL_VS, SHADER_CULL_GS, NULL, "out_render_data", NULL);
+
+	if (!shader_cull_program) {
+		return false;
+	}
+
+	glUseProgram(shader_cull_program);
+
+	glUniform1i(glGetUniformLocation(shader_cull_program, "particle_buffer"), 0);
+	glUniform1i(glGetUniformLocation(shader_cull_program, "scene_buffer"), 6);
+	glUniform1i(glGetUniformLocation(shader_cull_program, "scene_particles"), PARTICLE_COUNT);
+	glUniform2i(glGetUniformLocation(shader_cull_program, "scene_grid"), scenes_columns(), scenes_rows());
+	glUniform4f(glGetUniformLocation(shader_cull_program, "camera_bounds"), projection_camera_data[0], projection_camera_data[1], projection_camera_data[2], projection_camera_data[3]);
+
+	shader_cull_mvp_loc = glGetUniformLocation(shader_cull_program, "mat_mvp");
+	shader_cull_margin_loc = glGetUniformLocation(shader_cull_program, "cull_margin");
+
+	glUniformMatrix4fv(shader_cull_mvp_loc, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+	glUniform1f(shader_cull_margin_loc, RENDER_PARTICLE_DIM_MAX * 2.0f);
+
+	/* The list itself is a frame graph transient, attached to the feedback object when the cull pass runs. The object keeps the count
+	 *	of what was last written through it. */
+	glGenTransformFeedbacks(1, &cull_feedback);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_stats(void) {
+	shader_stats_program = build_program("stats", NULL, SHADER_STATS_VS, SHADER_STATS_GS, SHADER_STATS_PS, NULL, NULL);
+	shader_stats_reduce_program = build_program("stats_reduce", NULL, SHADER_STATS_REDUCE_VS, NULL, SHADER_STATS_REDUCE_PS, NULL, NULL);
+
+	if (!shader_stats_program || !shader_stats_reduce_program) {
+		return false;
+	}
+
+	glUseProgram(shader_stats_program);
+
+	glUniform1i(glGetUniformLocation(shader_stats_program, "particle_buffer"), 0);
+	glUniform1i(glGetUniformLocation(shader_stats_program, "stats_lanes"), STATS_LANES);
+	glUniform1i(glGetUniformLocation(shader_stats_program, "stats_rows"), STATS_ROWS);
+	glUniform1i(glGetUniformLocation(shader_stats_program, "stats_bins"), STATS_HISTOGRAM_BINS);
+	glUniform1f(glGetUniformLocation(shader_stats_program, "stats_speed_max"), STATS_SPEED_MAX);
+
+	shader_stats_mode_loc = glGetUniformLocation(shader_stats_program, "stats_mode");
+	shader_stats_mouse_loc = glGetUniformLocation(shader_stats_program, "stats_mouse");
+
+	glUseProgram(shader_stats_reduce_program);
+
+	glUniform1i(glGetUniformLocation(shader_stats_reduce_program, "stats_lanes_texture"), 7);
+	glUniform1i(glGetUniformLocation(shader_stats_reduce_program, "stats_lanes"), STATS_LANES);
+	glUniform2i(glGetUniformLocation(shader_stats_reduce_program, "stats_max_rows"), STATS_ROW_BOUNDS, STATS_ROW_PEAKS);
+
+	/* Lanes by rows, then one by rows. Both are only ever fetched from, so no filtering (and no incomplete mip chain). */
+	glGenTextures(2, stats_textures);
+	glGenFramebuffers(2, stats_framebuffers);
+
+	for (int i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, stats_textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, i ? 1 : STATS_LANES, STATS_ROWS, 0, GL_RGBA, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, stats_framebuffers[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, stats_textures[i], 0);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			printf("[initialize_stats] framebuffer %d incomplete\n", i);
+			return false;
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(STATS_READBACK_COUNT, stats_pbos);
+
+	for (int i = 0; i < STATS_READBACK_COUNT; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, stats_pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float) * 4 * STATS_ROWS, NULL, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	telemetry_set_buffer("stats", sizeof(float) * 4 * STATS_ROWS * (STATS_LANES + 1 + STATS_READBACK_COUNT));
+
+	printf("[initialize_stats] %d lanes, %d bytes read back per frame\n", STATS_LANES, (int) sizeof(float) * 4 * STATS_ROWS);
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_latency(void) {
+	for (int i = 0; i < FRAMES_IN_FLIGHT_MAX; i++) {
+		glGenQueries(1, &latency_frames[i].query);
+		latency_frames[i].fence = 0;
+	}
+
+	latency_reset(&latency_recent);
+	latency_reset(&latency_run);
+	calibrate_latency_clock();
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_publish(void) {
+	if (!publish_initialize(publish_name, PARTICLE_TOTAL, PUBLISH_SLOTS)) {
+		return false;
+	}
+
+	if (SIMULATION_ENGINE_CPU) {
+		return true;
+	}
+
+	glGenBuffers(PUBLISH_READBACK_COUNT, publish_buffers);
+
+	for (int i = 0; i < PUBLISH_READBACK_COUNT; i++) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, publish_buffers[i]);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(float) * 4 * PARTICLE_TOTAL, NULL, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	telemetry_set_buffer("publish", sizeof(float) * 4 * PARTICLE_TOTAL * PUBLISH_READBACK_COUNT);
+	return glGetError() == GL_NO_ERROR;
+}
+
+bool initialize_attributes(void) {
+	/* A spread of colours, sizes and sprites. Sprites go up to what the packed layout keeps, the render pass wraps them to the atlas. */
+	std::vector<particle_attributes> initial(PARTICLE_TOTAL);
+	attributes_generate(initial.data(), PARTICLE_TOTAL, 1, 256);
+
+	if (!attributes.initialize(ATTRIBUTE_SET, PARTICLE_TOTAL, initial.data())) {
+		return false;
+	}
+
+	const attribute_plan* plan = attributes.plan();
+	unsigned int copies = 0;
+
+	for (int s = 0; s < plan->stream_count; s++) {
+		copies += plan->streams[s].bytes * (plan->streams[s].written ? 2 : 1);
+	}
+
+	telemetry_set_buffer("attributes", copies * PARTICLE_TOTAL);
+	return true;
+}
+
+bool initialize_scaled_framebuffer(void) {
+	/* Allocated at full window size, the governor only ever renders into a corner of it. */
+	glGenFramebuffers(1, &scaled_framebuffer);
+	glGenRenderbuffers(1, &scaled_renderbuffer);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, scaled_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WINDOW_WIDTH, WINDOW_HEIGHT);
+	telemetry_set_buffer("scaled_target", WINDOW_WIDTH * WINDOW_HEIGHT * 4);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, scaled_framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, scaled_renderbuffer);
+
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!complete) {
+		printf("[initialize_scaled_framebuffer] framebuffer incomplete\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool initialize_window(void) {
+	glfwInit();
+
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+
+	if (record_enabled) {
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE); // Only here for the context, frames go to record_framebuffer.
+	}
+
+	bool fullscreen = WINDOW_FULLSCREEN && !record_enabled;
+	window_handle = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "particles", fullscreen ? glfwGetPrimaryMonitor() : NULL, NULL);
+
+	if (window_handle == NULL) {
+		printf("[initialize_window] GLFW failure\n");
+		return false;
+	}
+
+	glfwMakeContextCurrent(window_handle);
+	glfwSetScrollCallback(window_handle, camera_scroll_callback);
+
+	if (IDLE_ENABLED) {
+		glfwSetCursorPosCallback(window_handle, idle_cursor_callback);
+		glfwSetMouseButtonCallback(window_handle, idle_button_callback);
+		glfwSetKeyCallback(window_handle, idle_key_callback);
+		glfwSetWindowRefreshCallback(window_handle, idle_refresh_callback);
+	}
 
 	if (glxwInit() != 0) {
 		printf("[initialize_window] GLXW failure\n");
@@ -0,0 +1,120 @@
+/*
+ * Worker pool implementation. See parallel.h.
+ */
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "parallel.h"
+
+static std::vector<std::thread> parallel_workers;
+static std::mutex parallel_mutex;
+static std::condition_variable parallel_wake;
+static std::condition_variable parallel_done;
+
+static const parallel_body* parallel_job = NULL;
+static unsigned int parallel_job_count = 0;
+static unsigned long parallel_generation = 0;
+static int parallel_remaining = 0;
+static bool parallel_exit = false;
+
+static void parallel_chunk(unsigned int count, int chunk, int chunks, const parallel_body& body) {
+	unsigned int begin = (unsigned int) ((unsigned long long) count * chunk / chunks);
+	unsigned int end = (unsigned int) ((unsigned long long) count * (chunk + 1) / chunks);
+
+	if (begin < end) {
+		body(begin, end, chunk);
+	}
+}
+
+static void parallel_worker(int chunk) {
+	unsigned long seen = 0;
+
+	for (;;) {
+		std::unique_lock<std::mutex> lock(parallel_mutex);
+		parallel_wake.wait(lock, [&] { return parallel_exit || parallel_generation != seen; });
+
+		if (parallel_exit) {
+			return;
+		}
+
+		seen = parallel_generation;
+		const parallel_body* body = parallel_job;
+		unsigned int count = parallel_job_count;
+		lock.unlock();
+
+		parallel_chunk(count, chunk, (int) parallel_workers.size() + 1, *body);
+
+		lock.lock();
+
+		if (!--parallel_remaining) {
+			parallel_done.notify_one();
+		}
+	}
+}
+
+bool parallel_initialize(int threads) {
+	if (threads <= 0) {
+		threads = (int) std::thread::hardware_concurrency();
+	}
+
+	if (threads <= 0) {
+		threads = 1;
+	}
+
+	parallel_shutdown();
+
+	/* The calling thread always works too, so we only spawn threads - 1 workers. */
+	for (int i = 1; i < threads; i++) {
+		parallel_workers.push_back(std::thread(parallel_worker, i));
+	}
+
+	printf("[parallel_initialize] using %d threads\n", threads);
+	return true;
+}
+
+void parallel_shutdown(void) {
+	{
+		std::lock_guard<std::mutex> lock(parallel_mutex);
+		parallel_exit = true;
+	}
+
+	parallel_wake.notify_all();
+
+	for (size_t i = 0; i < parallel_workers.size(); i++) {
+		parallel_workers[i].join();
+	}
+
+	parallel_workers.clear();
+	parallel_exit = false;
+}
+
+int parallel_thread_count(void) {
+	return (int) parallel_workers.size() + 1;
+}
+
+void parallel_for(unsigned int count, const parallel_body& body) {
+	int chunks = parallel_thread_count();
+
+	if (chunks == 1 || count < (unsigned int) chunks) {
+		body(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(parallel_mutex);
+		parallel_job = &body;
+		parallel_job_count = count;
+		parallel_remaining = chunks - 1;
+		parallel_generation++;
+	}
+
+	parallel_wake.notify_all();
+	parallel_chunk(count, 0, chunks, body);
+
+	std::unique_lock<std::mutex> lock(parallel_mutex);
+	parallel_done.wait(lock, [] { return parallel_remaining == 0; });
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * Minimal persistent worker pool for the CPU side of the simulation.
+ * parallel_for() splits [0, count) into one contiguous chunk per thread (the calling thread takes chunk 0) and returns once every chunk is done.
+ * The chunk index is passed along so callers can keep per-thread scratch data without locking.
+ */
+
+#include <functional>
+
+typedef std::function<void(unsigned int begin, unsigned int end, int chunk)> parallel_body;
+
+bool parallel_initialize(int threads); // 0 uses every hardware thread.
+void parallel_shutdown(void);
+int parallel_thread_count(void);
+
+void parallel_for(unsigned int count, const parallel_body& body);
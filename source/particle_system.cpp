@@ -0,0 +1,464 @@
+/*
+ * Embeddable particle system implementation. See particle_system.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <GLXW/glxw.h>
+
+#include "particle_system.h"
+#include "programs.h"
+
+#include "shaders/advance_vs.glsl"
+#include "shaders/render_vs.glsl"
+#include "shaders/render_gs.glsl"
+#include "shaders/render_ps.glsl"
+
+void particle_system_defaults(particle_system_config* config, unsigned int capacity, const float* bounds) {
+	config->capacity = capacity;
+	memcpy(config->bounds, bounds, sizeof(float) * 4);
+
+	config->gravity = 0.0001f;
+	config->speed_decay = 1.01f;
+	config->bounce_decay = 1.5f;
+	config->wrap = false;
+	config->particle_size = 0.001f;
+	config->integrator = INTEGRATOR_EULER;
+	config->dt = 1.0f;
+	config->tolerance = 0.0002f;
+	config->max_substeps = 8;
+}
+
+void particle_system_variant_sources(int kind, variant_sources* sources) {
+	if (kind == VARIANT_ADVANCE) {
+		sources->common = SHADER_FORCES_COMMON;
+		sources->vs = SHADER_ADVANCE_VS;
+		sources->gs = sources->ps = NULL;
+		sources->varying = "out_particle_data";
+	} else {
+		sources->common = SHADER_SCENE_TILES;
+		sources->vs = SHADER_RENDER_VS;
+		sources->gs = SHADER_RENDER_GS;
+		sources->ps = SHADER_RENDER_PS;
+		sources->varying = NULL;
+	}
+}
+
+unsigned int particle_system_start_variant(const variant_key* key, const char* glsl, const variant_sources* sources) {
+	char defines[VARIANT_DEFINES_SIZE];
+	variants_defines(key, defines, sizeof defines);
+
+	std::string source = defines;
+
+	if (glsl) {
+		source += glsl;
+	}
+
+	variant_sources carried;
+
+	if (!sources) {
+		particle_system_variant_sources(key->kind, &carried);
+		sources = &carried;
+	}
+
+	return start_program(sources->common, sources->vs, sources->gs, sources->ps, sources->varying, source.c_str());
+}
+
+particle_system::particle_system(void) {
+	initialized = false;
+
+	particle_capacity = particle_live = 0;
+	buffers[0] = buffers[1] = 0;
+	textures[0] = textures[1] = 0;
+	current = 0;
+	mapped = false;
+
+	memset(&params, 0, sizeof params);
+	params_buffer = params_texture = 0;
+	params_dirty = false;
+
+	attractor_count = 0;
+	attractor_buffer = 0;
+	attractors_dirty = false;
+
+	wrap = false;
+	integrator = INTEGRATOR_EULER;
+	integrator_data[0] = 1.0f;
+	integrator_data[1] = integrator_data[2] = integrator_data[3] = 0.0f;
+	particle_size = 0.0f;
+	sprite_texture = white_texture = 0;
+	sprite_grid[0] = sprite_grid[1] = sprite_grid[2] = 1;
+}
+
+particle_system::~particle_system(void) {
+	shutdown();
+}
+
+bool particle_system::initialize(const particle_system_config* config, const float* particles) {
+	particle_capacity = particle_live = config->capacity;
+	wrap = config->wrap;
+	particle_size = config->particle_size;
+	set_integrator(config->integrator, config->dt, config->tolerance, config->max_substeps);
+
+	/* Both states start out the same, so particles outside the live count look the same whichever one is current. */
+	glGenBuffers(2, buffers);
+	glGenTextures(2, textures);
+
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 4 * particle_capacity, NULL, GL_DYNAMIC_COPY);
+
+		if (particles) {
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * 4 * particle_capacity, particles);
+		} else {
+			float* zero = (float*) glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(float) * 4 * particle_capacity, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+			if (zero) {
+				memset(zero, 0, sizeof(float) * 4 * particle_capacity);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[i]);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	current = 0;
+
+	memcpy(params.camera_bounds, config->bounds, sizeof(float) * 4);
+	params.gravity = config->gravity;
+	params.speed_decay = config->speed_decay;
+	params.bounce_decay = config->bounce_decay;
+	params.color[0] = params.color[1] = params.color[2] = params.color[3] = 1.0f;
+
+	glGenBuffers(1, &params_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, params_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof params, &params, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &params_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, params_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, params_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	glGenBuffers(1, &attractor_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, attractor_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(forces_attractor) * FORCES_MAX_ATTRACTORS, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	/* Plain squares until the host hands over a sprite atlas. */
+	const unsigned char white[4] = {255, 255, 255, 255};
+
+	glGenTextures(1, &white_texture);
+	glBindTexture(GL_TEXTURE_2D, white_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	sprite_texture = white_texture;
+	initialized = true;
+
+	if (glGetError() != GL_NO_ERROR) {
+		printf("[particle_system] GL error while creating %u particles\n", particle_capacity);
+		return false;
+	}
+
+	/* Built now, so a broken advance shader shows up here instead of as particles that never move. */
+	if (!get_program(VARIANT_ADVANCE, advance_features())) {
+		printf("[particle_system] no advance program for the %s integrator\n", variants_integrator_name(integrator));
+		return false;
+	}
+
+	return true;
+}
+
+void particle_system::shutdown(void) {
+	if (!initialized) {
+		return;
+	}
+
+	if (mapped) {
+		unmap_state();
+	}
+
+	glDeleteBuffers(2, buffers);
+	glDeleteTextures(2, textures);
+	glDeleteBuffers(1, &params_buffer);
+	glDeleteTextures(1, &params_texture);
+	glDeleteBuffers(1, &attractor_buffer);
+	glDeleteTextures(1, &white_texture);
+
+	/* Programs belong to the variant cache, other instances may still be using them. */
+	initialized = false;
+}
+
+unsigned int particle_system::get_program(int kind, unsigned int features) {
+	variant_key key;
+	variants_key(&key, kind, features);
+
+	if (kind == VARIANT_RENDER) {
+		key.constants[0] = particle_size;
+	}
+
+	unsigned int program = variants_find(&key);
+
+	if (program) {
+		return program;
+	}
+
+	program = particle_system_start_variant(&key);
+
+	if (!finish_program(kind == VARIANT_ADVANCE ? "advance" : "render", program)) {
+		return 0;
+	}
+
+	unsigned int attractor_block = glGetUniformBlockIndex(program, "attractor_block");
+
+	if (attractor_block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, attractor_block, 0);
+	}
+
+	variants_insert(&key, program);
+	return program;
+}
+
+void particle_system::bind_params(unsigned int program) {
+	/* Everything that differs between instances, set on every use. Our particles are all scene 0 of a one scene grid. */
+	glUniform1i(glGetUniformLocation(program, "particle_buffer"), 0);
+	glUniform1i(glGetUniformLocation(program, "scene_buffer"), 6);
+	glUniform1i(glGetUniformLocation(program, "scene_particles"), particle_capacity);
+
+	glActiveTexture(GL_TEXTURE0 + 6);
+	glBindTexture(GL_TEXTURE_BUFFER, params_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void particle_system::flush(void) {
+	/* Parameter changes are batched up until the next pass that needs them. */
+	if (params_dirty) {
+		glBindBuffer(GL_TEXTURE_BUFFER, params_buffer);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof params, &params);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		params_dirty = false;
+	}
+
+	if (attractors_dirty && attractor_count) {
+		glBindBuffer(GL_UNIFORM_BUFFER, attractor_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(forces_attractor) * attractor_count, attractors);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	attractors_dirty = false;
+}
+
+unsigned int particle_system::advance_features(void) {
+	unsigned int features = 0;
+
+	if (attractor_count) features |= VARIANT_ATTRACTORS;
+	if (wrap) features |= VARIANT_BOUNDS_WRAP;
+
+	return features | variants_integrator_features(integrator);
+}
+
+bool particle_system::step(unsigned int substeps) {
+	flush();
+
+	unsigned int program = get_program(VARIANT_ADVANCE, advance_features());
+
+	if (!program) {
+		return false; // finish_program() printed the log.
+	}
+
+	glUseProgram(program);
+	bind_params(program);
+
+	glUniform1i(glGetUniformLocation(program, "attractor_count"), attractor_count);
+	glUniform4fv(glGetUniformLocation(program, "integrator_data"), 1, integrator_data);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, attractor_buffer);
+
+	for (unsigned int i = 0; i < substeps; i++) {
+		advance(program, particle_live);
+	}
+
+	return true;
+}
+
+void particle_system::render(const float* mvp) {
+	flush();
+
+	unsigned int program = get_program(VARIANT_RENDER, 0);
+
+	if (!program) {
+		return;
+	}
+
+	glUseProgram(program);
+	bind_params(program);
+
+	/* The window is this instance's bounds, so the scene tile mapping comes out as the identity. */
+	glUniform1i(glGetUniformLocation(program, "render_texture"), 1);
+	glUniform3i(glGetUniformLocation(program, "sprite_grid"), sprite_grid[0], sprite_grid[1], sprite_grid[2]);
+	glUniform3f(glGetUniformLocation(program, "render_color"), 1.0f, 1.0f, 1.0f); // The colour is the scene tint.
+	glUniform2i(glGetUniformLocation(program, "scene_grid"), 1, 1);
+	glUniform4fv(glGetUniformLocation(program, "camera_bounds"), 1, params.camera_bounds);
+	glUniformMatrix4fv(glGetUniformLocation(program, "mat_mvp"), 1, GL_FALSE, mvp);
+
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glBindTexture(GL_TEXTURE_2D, sprite_texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, textures[current]);
+
+	glDrawArraysInstanced(GL_POINTS, 0, 1, particle_live);
+}
+
+void particle_system::advance(unsigned int program, unsigned int count) {
+	if (count > particle_capacity) {
+		count = particle_capacity;
+	}
+
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+
+	glEnable(GL_RASTERIZER_DISCARD); // Nothing is drawn, the output is captured.
+
+	if (count) {
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[1 - current], 0, sizeof(float) * 4 * count);
+
+		glBeginTransformFeedback(GL_POINTS);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[current]);
+		glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+		glEndTransformFeedback();
+	}
+
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	swap_states();
+}
+
+void particle_system::swap_states(void) {
+	/* Each texture stays attached to its own buffer, only which pair is current changes. */
+	current = 1 - current;
+}
+
+void particle_system::set_live_count(unsigned int count) {
+	particle_live = count < particle_capacity ? count : particle_capacity;
+}
+
+void particle_system::set_bounds(const float* bounds) {
+	memcpy(params.camera_bounds, bounds, sizeof(float) * 4);
+	params_dirty = true;
+}
+
+void particle_system::set_motion(float gravity, float speed_decay, float bounce_decay) {
+	params.gravity = gravity;
+	params.speed_decay = speed_decay;
+	params.bounce_decay = bounce_decay;
+	params_dirty = true;
+}
+
+void particle_system::set_wrap(bool enabled) {
+	wrap = enabled;
+}
+
+void particle_system::set_integrator(int method, float dt, float tolerance, int max_substeps) {
+	integrator = method;
+
+	integrator_data[0] = dt;
+	integrator_data[1] = tolerance;
+	integrator_data[2] = (float) (max_substeps < 1 ? 1 : max_substeps);
+}
+
+void particle_system::set_color(float r, float g, float b) {
+	params.color[0] = r;
+	params.color[1] = g;
+	params.color[2] = b;
+	params_dirty = true;
+}
+
+void particle_system::set_particle_size(float size) {
+	particle_size = size;
+}
+
+void particle_system::set_sprites(unsigned int texture, int columns, int rows, int count) {
+	sprite_texture = texture ? texture : white_texture;
+
+	sprite_grid[0] = texture ? columns : 1;
+	sprite_grid[1] = texture ? rows : 1;
+	sprite_grid[2] = texture ? count : 1;
+}
+
+void particle_system::clear_attractors(void) {
+	attractor_count = 0;
+	attractors_dirty = true;
+}
+
+bool particle_system::add_attractor(float x, float y, float strength, float softening) {
+	if (attractor_count == FORCES_MAX_ATTRACTORS) {
+		return false;
+	}
+
+	forces_attractor* attractor = &attractors[attractor_count++];
+
+	attractor->position[0] = x;
+	attractor->position[1] = y;
+	attractor->strength = strength;
+	attractor->softening = softening;
+
+	attractors_dirty = true;
+	return true;
+}
+
+unsigned int particle_system::capacity(void) const {
+	return particle_capacity;
+}
+
+unsigned int particle_system::live_count(void) const {
+	return particle_live;
+}
+
+unsigned int particle_system::state_buffer(void) const {
+	return buffers[current];
+}
+
+unsigned int particle_system::state_texture(void) const {
+	return textures[current];
+}
+
+unsigned int particle_system::next_buffer(void) const {
+	return buffers[1 - current];
+}
+
+unsigned int particle_system::next_texture(void) const {
+	return textures[1 - current];
+}
+
+float* particle_system::map_state(bool write) {
+	/* Mapping waits for the GPU to finish writing the state, fence the last step first if that matters. */
+	glBindBuffer(GL_COPY_READ_BUFFER, buffers[current]);
+	float* state = (float*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(float) * 4 * particle_live, GL_MAP_READ_BIT | (write ? GL_MAP_WRITE_BIT : 0));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	mapped = state != NULL;
+	return state;
+}
+
+void particle_system::unmap_state(void) {
+	glBindBuffer(GL_COPY_READ_BUFFER, buffers[current]);
+	glUnmapBuffer(GL_COPY_READ_BUFFER);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	mapped = false;
+}
+
+void particle_system::upload(const float* particles, unsigned int count) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[current]);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * 4 * (count < particle_capacity ? count : particle_capacity), particles);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
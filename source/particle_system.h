@@ -0,0 +1,139 @@
+#pragma once
+
+/*
+ * Embeddable particle system, for hosts with a renderer of their own (built as libparticles.a).
+ * One particle_system is one set of particles : its two state buffers, its parameters and attractors, and the passes that advance and draw
+ *	it. Everything past the constructor needs the host's GL 3.3 context current, with GLXW loaded.
+ *
+ * Any number of instances can share a context. Programs are shared between them through the variant cache (see variants.h), and every call
+ *	sets its instance's uniforms again, so instances can't leak state into each other. step() and render() use texture units 0, 1 and 6 and
+ *	uniform buffer binding 0, and leave their own objects bound there.
+ *
+ * State is (x, y, vx, vy) per particle in RGBA32F, double buffered. state_buffer() and state_texture() name the current state and swap on
+ *	every advance, so ask for them after stepping rather than holding on to them. Hosts can bind, draw or copy them directly, or map_state()
+ *	for a host pointer into the current state. Nothing is copied out either way.
+ *
+ * The particles binary is built on this too : it owns one instance, and runs its own passes (scenes, neighbors, n-body, sleeping, culling)
+ *	around advance() and the accessors instead of calling step() and render().
+ */
+
+#include "forces.h"
+#include "scenes.h"
+#include "variants.h"
+
+struct particle_system_config {
+	unsigned int capacity;
+	float bounds[4]; // left, right, bottom, top
+	float gravity; // Pull down per step.
+	float speed_decay; // Velocity is divided by this every step.
+	float bounce_decay; // And by this on hitting a wall.
+	bool wrap; // Wrap around the bounds instead of bouncing off them.
+	float particle_size; // Half the width of a sprite, in world units.
+	int integrator; // INTEGRATOR_* from variants.h.
+	float dt; // Length of one step, in the steps the motion constants are given for.
+	float tolerance; // Adaptive only : largest move due to acceleration per substep, in world units.
+	int max_substeps; // Adaptive only.
+};
+
+/* The original program's constants over the given bounds. */
+void particle_system_defaults(particle_system_config* config, unsigned int capacity, const float* bounds);
+
+/* The stages a variant kind is built from, as start_program() takes them. NULL stages are left out. */
+struct variant_sources {
+	const char* common;
+	const char* vs;
+	const char* gs;
+	const char* ps;
+	const char* varying;
+};
+
+void particle_system_variant_sources(int kind, variant_sources* sources); // The ones the library carries.
+
+/* Starts building the advance or render program of a variant from the sources the library carries, see start_program(). For hosts that
+ *	pick their own variants, step() and render() build theirs as they need them. glsl, when given, goes in after the defines : a render
+ *	variant with VARIANT_ATTRIBUTES needs the layout's load_attributes() there (see attribute_plan). The cache key doesn't cover it, so
+ *	a host only ever passes one. sources, when given, replace the library's (reloaded from disk, say). */
+unsigned int particle_system_start_variant(const variant_key* key, const char* glsl = NULL, const variant_sources* sources = NULL);
+
+class particle_system {
+public:
+	particle_system(void);
+	~particle_system(void); // Calls shutdown(), the context must still be current if it was initialized.
+
+	particle_system(const particle_system&) = delete; // Owns GL objects.
+	particle_system& operator=(const particle_system&) = delete;
+
+	/* particles is capacity * 4 floats, NULL starts them all at rest at the origin. Every particle starts out live. The advance program for
+	 *	config is built here, false when it doesn't. */
+	bool initialize(const particle_system_config* config, const float* particles);
+	void shutdown(void);
+
+	/* The built-in passes : bounds, gravity, damping and the attractors, over the live particles. render() draws into the bound framebuffer
+	 *	with the host's blending (the binary uses additive), mvp is a column major world to clip matrix. step() is false, and does nothing,
+	 *	when the advance program for the current settings didn't build. */
+	bool step(unsigned int substeps);
+	void render(const float* mvp);
+
+	/* Runs program over the first count particles, from the current state into the other one, then swaps them. The current state is on
+	 *	texture unit 0, anything else the program reads is up to the caller : this is for hosts with advance passes of their own. */
+	void advance(unsigned int program, unsigned int count);
+	void swap_states(void); // For hosts that wrote next_buffer() some other way.
+
+	void set_live_count(unsigned int count); // Particles past it are neither advanced nor drawn, and keep their state.
+	void set_bounds(const float* bounds);
+	void set_motion(float gravity, float speed_decay, float bounce_decay);
+	void set_wrap(bool enabled);
+	void set_integrator(int method, float dt, float tolerance, int max_substeps); // See particle_system_config.
+	void set_color(float r, float g, float b);
+	void set_particle_size(float size); // A new size builds a render variant the first time it is drawn.
+	void set_sprites(unsigned int texture, int columns, int rows, int count); // A sprite atlas (see sprites.h), 0 for plain squares.
+
+	void clear_attractors(void);
+	bool add_attractor(float x, float y, float strength, float softening); // Same units as forces.h, false once the list is full.
+
+	unsigned int capacity(void) const;
+	unsigned int live_count(void) const;
+	unsigned int state_buffer(void) const;
+	unsigned int state_texture(void) const; // GL_TEXTURE_BUFFER over state_buffer().
+	unsigned int next_buffer(void) const;
+	unsigned int next_texture(void) const;
+
+	/* Maps the live part of the current state, live_count() * 4 floats. Unmap before the next advance or draw touches it. */
+	float* map_state(bool write);
+	void unmap_state(void);
+	void upload(const float* particles, unsigned int count); // Replaces the first count particles of the current state.
+
+private:
+	unsigned int get_program(int kind, unsigned int features);
+	unsigned int advance_features(void);
+	void bind_params(unsigned int program);
+	void flush(void);
+
+	bool initialized;
+
+	unsigned int particle_capacity;
+	unsigned int particle_live;
+	unsigned int buffers[2];
+	unsigned int textures[2];
+	int current;
+	bool mapped;
+
+	/* The instance's parameters, laid out as one scene so the advance and render shaders read them the way they read scenes. */
+	scene_params params;
+	unsigned int params_buffer;
+	unsigned int params_texture;
+	bool params_dirty;
+
+	forces_attractor attractors[FORCES_MAX_ATTRACTORS];
+	unsigned int attractor_count;
+	unsigned int attractor_buffer;
+	bool attractors_dirty;
+
+	bool wrap;
+	int integrator;
+	float integrator_data[4]; // dt, tolerance, max substeps, as SHADER_ADVANCE_VS takes them.
+	float particle_size;
+	unsigned int sprite_texture; // The host's, or white_texture.
+	unsigned int white_texture;
+	int sprite_grid[3];
+};
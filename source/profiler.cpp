@@ -0,0 +1,165 @@
+/*
+ * GPU pass timer implementation. See profiler.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+#include <GLXW/glxw.h>
+
+#include "profiler.h"
+
+/* Frames of latency between issuing a query and reading it back. */
+#define PROFILER_FRAMES 4
+
+/* Spans per frame. Substeps issue one advance span each, so leave some room. */
+#define PROFILER_MAX_SPANS 32
+
+/* Weight of the newest frame in the smoothed timings. */
+#define PROFILER_SMOOTHING 0.1f
+
+struct profiler_frame_slot {
+	unsigned int queries[PROFILER_MAX_SPANS];
+	float finished_ms[PROFILER_MAX_SPANS]; // Spans timed with glFinish(), in place of the queries.
+	int passes[PROFILER_MAX_SPANS];
+	int span_count;
+};
+
+static profiler_frame_slot profiler_frames[PROFILER_FRAMES];
+static int profiler_current = 0;
+static bool profiler_active = false;
+static bool profiler_primed = false;
+
+static bool profiler_finish = false;
+static std::chrono::steady_clock::time_point profiler_start;
+
+static float profiler_smoothed[PROFILER_PASS_COUNT] = {0.0f};
+static float profiler_smoothed_total = 0.0f;
+
+static const char* profiler_names[PROFILER_PASS_COUNT] = {
+	"advance",
+	"grid",
+	"render",
+	"resolve",
+	"sleep",
+	"cull",
+	"stats",
+	"attributes",
+};
+
+bool profiler_initialize(bool finish) {
+	profiler_finish = finish;
+
+	for (int i = 0; i < PROFILER_FRAMES; i++) {
+		glGenQueries(PROFILER_MAX_SPANS, profiler_frames[i].queries);
+		profiler_frames[i].span_count = 0;
+	}
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+void profiler_begin(int pass) {
+	profiler_frame_slot* slot = profiler_frames + profiler_current;
+
+	if (profiler_active || slot->span_count >= PROFILER_MAX_SPANS) {
+		return; // Out of queries this frame, the span just goes untimed.
+	}
+
+	slot->passes[slot->span_count] = pass;
+
+	if (profiler_finish) {
+		glFinish(); // Whatever came before isn't this pass's.
+		profiler_start = std::chrono::steady_clock::now();
+	} else {
+		glBeginQuery(GL_TIME_ELAPSED, slot->queries[slot->span_count]);
+	}
+
+	profiler_active = true;
+}
+
+void profiler_end(void) {
+	if (!profiler_active) {
+		return;
+	}
+
+	profiler_frame_slot* slot = profiler_frames + profiler_current;
+
+	if (profiler_finish) {
+		glFinish();
+		slot->finished_ms[slot->span_count] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - profiler_start).count();
+	} else {
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	slot->span_count++;
+	profiler_active = false;
+}
+
+void profiler_frame(void) {
+	profiler_current = (profiler_current + 1) % PROFILER_FRAMES;
+
+	/* The slot we are about to reuse holds the oldest frame, read it back before the queries are overwritten. */
+	profiler_frame_slot* slot = profiler_frames + profiler_current;
+
+	if (!slot->span_count) {
+		return;
+	}
+
+	float pass_ms[PROFILER_PASS_COUNT] = {0.0f};
+	float total_ms = 0.0f;
+
+	for (int i = 0; i < slot->span_count; i++) {
+		float ms = slot->finished_ms[i];
+
+		if (!profiler_finish) {
+			/* This only blocks if the GPU is more than PROFILER_FRAMES behind, in which case we are throttled anyway. */
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(slot->queries[i], GL_QUERY_RESULT, &elapsed);
+
+			ms = (float) elapsed / 1000000.0f;
+		}
+
+		pass_ms[slot->passes[i]] += ms;
+		total_ms += ms;
+	}
+
+	slot->span_count = 0;
+
+	if (!profiler_primed) {
+		memcpy(profiler_smoothed, pass_ms, sizeof pass_ms);
+		profiler_smoothed_total = total_ms;
+		profiler_primed = true;
+		return;
+	}
+
+	for (int i = 0; i < PROFILER_PASS_COUNT; i++) {
+		profiler_smoothed[i] += (pass_ms[i] - profiler_smoothed[i]) * PROFILER_SMOOTHING;
+	}
+
+	profiler_smoothed_total += (total_ms - profiler_smoothed_total) * PROFILER_SMOOTHING;
+}
+
+float profiler_pass_ms(int pass) {
+	return profiler_smoothed[pass];
+}
+
+float profiler_total_ms(void) {
+	return profiler_smoothed_total;
+}
+
+const char* profiler_pass_name(int pass) {
+	return profiler_names[pass];
+}
+
+void profiler_report(void) {
+	printf("[profiler] frame %.3f ms", profiler_smoothed_total);
+
+	for (int i = 0; i < PROFILER_PASS_COUNT; i++) {
+		if (profiler_smoothed[i] > 0.0f) {
+			printf(" | %s %.3f ms", profiler_names[i], profiler_smoothed[i]);
+		}
+	}
+
+	printf("\n");
+}
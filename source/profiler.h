@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+ * GPU pass timer.
+ * Every pass is wrapped in a GL_TIME_ELAPSED query. Queries are kept in a small ring of frames and only read back once that frame comes around again,
+ *	so collecting timings never stalls the pipeline in the common case.
+ *
+ * With finish set, every pass is instead bracketed by glFinish() and timed on the CPU clock. That stalls the pipeline twice per pass, so it
+ *	is for measuring only, on drivers whose queries miss work : llvmpipe runs transform feedback outside of them, the advance reads zero.
+ */
+
+enum {
+	PROFILER_PASS_ADVANCE = 0,
+	PROFILER_PASS_GRID,
+	PROFILER_PASS_RENDER,
+	PROFILER_PASS_RESOLVE,
+	PROFILER_PASS_SLEEP,
+	PROFILER_PASS_CULL,
+	PROFILER_PASS_STATS,
+	PROFILER_PASS_ATTRIBUTES,
+	PROFILER_PASS_COUNT
+};
+
+bool profiler_initialize(bool finish);
+void profiler_begin(int pass);
+void profiler_end(void);
+void profiler_frame(void);
+
+float profiler_pass_ms(int pass); // Smoothed GPU time of a pass, summed over all of its spans in a frame.
+float profiler_total_ms(void); // Smoothed GPU time of a whole frame.
+const char* profiler_pass_name(int pass);
+void profiler_report(void); // Prints the smoothed timings of every pass that ran.
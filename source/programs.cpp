@@ -0,0 +1,95 @@
+/*
+ * Program building implementation. See programs.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <GLXW/glxw.h>
+
+#include "programs.h"
+
+unsigned int build_program(const char* name, const char* vs_common, const char* vs_source, const char* gs_source, const char* ps_source, const char* varying,
+	const char* defines) {
+	unsigned int program = start_program(vs_common, vs_source, gs_source, ps_source, varying, defines);
+	return finish_program(name, program) ? program : 0;
+}
+
+unsigned int start_program(const char* vs_common, const char* vs_source, const char* gs_source, const char* ps_source, const char* varying, const char* defines) {
+	return start_program_feedback(vs_common, vs_source, gs_source, ps_source, varying ? &varying : NULL, varying ? 1 : 0, false, defines);
+}
+
+unsigned int start_program_feedback(const char* vs_common, const char* vs_source, const char* gs_source, const char* ps_source, const char* const* varyings,
+	int varying_count, bool separate, const char* defines) {
+	/* vs_common, when given, is compiled in front of the vertex shader (see SHADER_FORCES_COMMON). defines, when given, go into every
+	 *	stage right after its #version line. Compiles and the link are only issued here, asking for their status would wait on them. */
+	const char* sources[3] = {vs_source, gs_source, ps_source};
+	const unsigned int types[3] = {GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER};
+
+	unsigned int program = glCreateProgram();
+
+	for (int i = 0; i < 3; i++) {
+		if (!sources[i]) {
+			continue;
+		}
+
+		unsigned int shader = glCreateShader(types[i]);
+
+		/* The first source carries the #version line, split it off so the defines can follow it. */
+		const char* first = (i == 0 && vs_common) ? vs_common : sources[i];
+		const char* line_end = strchr(first, '\n');
+		int version_length = (!strncmp(first, "#version", 8) && line_end) ? (int) (line_end - first + 1) : 0;
+
+		const char* parts[4] = {first, defines ? defines : "", first + version_length, first == vs_common ? vs_source : ""};
+		int lengths[4] = {version_length, -1, -1, -1};
+
+		glShaderSource(shader, 4, parts, lengths);
+		glCompileShader(shader);
+
+		glAttachShader(program, shader);
+		glDeleteShader(shader); // Only flagged, the program keeps it alive.
+	}
+
+	if (varying_count) {
+		glTransformFeedbackVaryings(program, varying_count, varyings, separate ? GL_SEPARATE_ATTRIBS : GL_INTERLEAVED_ATTRIBS);
+	}
+
+	glLinkProgram(program);
+	return program;
+}
+
+bool finish_program(const char* name, unsigned int program) {
+	/* Blocks until the link is done (unless the driver already said it is), then reports whatever failed. Deletes the program on failure. */
+	int link_status = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+
+	if (link_status) {
+		return true;
+	}
+
+	unsigned int shaders[3] = {0};
+	int shader_count = 0;
+	glGetAttachedShaders(program, 3, &shader_count, shaders);
+
+	for (int i = 0; i < shader_count; i++) {
+		int compile_status = 0, type = 0;
+
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compile_status);
+		glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+
+		if (!compile_status) {
+			char log[1024] = {0};
+
+			glGetShaderInfoLog(shaders[i], 1024, NULL, log);
+			printf("[finish_program] %s %s error : %s\n", name, type == GL_VERTEX_SHADER ? "VS" : type == GL_GEOMETRY_SHADER ? "GS" : "PS", log);
+		}
+	}
+
+	char log[1024] = {0};
+
+	glGetProgramInfoLog(program, 1024, NULL, log);
+	printf("[finish_program] %s link error : %s\n", name, log);
+
+	glDeleteProgram(program);
+	return false;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * GL program building, shared by the particle system library and the programs built on it.
+ * start_program() only issues the compiles and the link, finish_program() is the first thing that asks for their status, so a caller can
+ *	get other work done in between (or let KHR_parallel_shader_compile do its thing). build_program() is both back to back.
+ *
+ * vs_common, when given, is compiled in front of the vertex shader and carries the #version line (see SHADER_FORCES_COMMON). defines, when
+ *	given, go into every stage right after its #version line. varying, when given, is captured with transform feedback.
+ * start_program_feedback() captures several varyings, interleaved into one buffer or one buffer each (separate).
+ */
+
+unsigned int build_program(const char* name, const char* vs_common, const char* vs_source, const char* gs_source, const char* ps_source, const char* varying,
+	const char* defines);
+unsigned int start_program(const char* vs_common, const char* vs_source, const char* gs_source, const char* ps_source, const char* varying, const char* defines);
+unsigned int start_program_feedback(const char* vs_common, const char* vs_source, const char* gs_source, const char* ps_source, const char* const* varyings,
+	int varying_count, bool separate, const char* defines);
+bool finish_program(const char* name, unsigned int program); // Prints the logs and deletes the program on failure.
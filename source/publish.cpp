@@ -0,0 +1,234 @@
+#include "publish.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PUBLISH_READ_ATTEMPTS 64
+
+static char publish_name[256];
+static unsigned char* publish_memory = NULL;
+static size_t publish_size = 0;
+static publish_header* publish_head = NULL;
+static uint64_t publish_count = 0;
+
+uint64_t publish_clock_ns(void) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+static publish_slot* publish_slot_at(const publish_header* header, uint64_t frame) {
+	unsigned char* base = (unsigned char*) header + sizeof(publish_header);
+	return (publish_slot*) (base + (frame % header->slots) * header->slot_bytes);
+}
+
+bool publish_initialize(const char* name, unsigned int capacity, unsigned int slots) {
+	if (slots < 2) {
+		printf("[publish_initialize] need at least 2 slots, the writer would always be in the only one\n");
+		return false;
+	}
+
+	snprintf(publish_name, sizeof publish_name, "%s%s", name[0] == '/' ? "" : "/", name);
+
+	/* Slots are kept to whole cache lines, so the writer filling one never shares a line with a reader on the one before. */
+	uint64_t slot_bytes = (sizeof(publish_slot) + (uint64_t) capacity * 4 * sizeof(float) + 63) & ~63ull;
+	publish_size = sizeof(publish_header) + slot_bytes * slots;
+
+	int fd = shm_open(publish_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		printf("[publish_initialize] shm_open %s failed : %s\n", publish_name, strerror(errno));
+		return false;
+	}
+
+	if (ftruncate(fd, (off_t) publish_size) < 0) {
+		printf("[publish_initialize] can't size %s to %zu bytes : %s\n", publish_name, publish_size, strerror(errno));
+		close(fd);
+		shm_unlink(publish_name);
+		return false;
+	}
+
+	void* memory = mmap(NULL, publish_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping keeps the segment.
+
+	if (memory == MAP_FAILED) {
+		printf("[publish_initialize] mmap failed : %s\n", strerror(errno));
+		shm_unlink(publish_name);
+		return false;
+	}
+
+	/* Fresh pages are zero, so every sequence and latest start out at 0. The magic goes in last, readers check it. */
+	publish_memory = (unsigned char*) memory;
+	publish_head = (publish_header*) memory;
+	publish_head->version = PUBLISH_VERSION;
+	publish_head->slots = slots;
+	publish_head->capacity = capacity;
+	publish_head->slot_bytes = slot_bytes;
+	publish_count = 0;
+
+	std::atomic_thread_fence(std::memory_order_release);
+	publish_head->magic = PUBLISH_MAGIC;
+
+	printf("[publish_initialize] %s : %u slots of %u particles, %.1f MB\n", publish_name, slots, capacity, publish_size / (1024.0 * 1024.0));
+	return true;
+}
+
+void publish_shutdown(void) {
+	if (!publish_memory) {
+		return;
+	}
+
+	munmap(publish_memory, publish_size);
+	shm_unlink(publish_name);
+
+	publish_memory = NULL;
+	publish_head = NULL;
+}
+
+bool publish_frame(const float* particles, unsigned int count, uint64_t produced_ns) {
+	if (!publish_head) {
+		return false;
+	}
+
+	if (count > publish_head->capacity) {
+		count = publish_head->capacity;
+	}
+
+	publish_slot* slot = publish_slot_at(publish_head, publish_count);
+	uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+
+	/* Odd first, and fenced so none of the copy below can be seen before it. */
+	slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->frame = publish_count;
+	slot->produced_ns = produced_ns;
+	slot->count = count;
+	memcpy((unsigned char*) slot + sizeof(publish_slot), particles, (size_t) count * 4 * sizeof(float));
+	slot->published_ns = publish_clock_ns();
+
+	slot->sequence.store(sequence + 2, std::memory_order_release);
+	publish_head->latest.store(++publish_count, std::memory_order_release);
+
+	return true;
+}
+
+uint64_t publish_frames(void) {
+	return publish_count;
+}
+
+bool publish_open(const char* name, publish_reader* reader) {
+	char path[256];
+	snprintf(path, sizeof path, "%s%s", name[0] == '/' ? "" : "/", name);
+
+	reader->fd = shm_open(path, O_RDONLY, 0);
+	reader->header = NULL;
+
+	if (reader->fd < 0) {
+		printf("[publish_open] shm_open %s failed : %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat info;
+
+	if (fstat(reader->fd, &info) < 0 || (size_t) info.st_size < sizeof(publish_header)) {
+		printf("[publish_open] %s isn't a particle ring\n", path);
+		close(reader->fd);
+		return false;
+	}
+
+	reader->size = (size_t) info.st_size;
+	void* memory = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+
+	if (memory == MAP_FAILED) {
+		printf("[publish_open] mmap failed : %s\n", strerror(errno));
+		close(reader->fd);
+		return false;
+	}
+
+	const publish_header* header = (const publish_header*) memory;
+	bool valid = header->magic == PUBLISH_MAGIC;
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if (!valid || header->version != PUBLISH_VERSION || sizeof(publish_header) + header->slot_bytes * header->slots > reader->size) {
+		printf("[publish_open] %s has an unknown layout\n", path);
+		munmap(memory, reader->size);
+		close(reader->fd);
+		return false;
+	}
+
+	reader->header = header;
+	return true;
+}
+
+void publish_close(publish_reader* reader) {
+	if (reader->header) {
+		munmap((void*) reader->header, reader->size);
+		close(reader->fd);
+		reader->header = NULL;
+	}
+}
+
+const publish_slot* publish_peek(const publish_reader* reader, uint64_t* sequence) {
+	uint64_t latest = reader->header->latest.load(std::memory_order_acquire);
+
+	if (!latest) {
+		return NULL;
+	}
+
+	const publish_slot* slot = publish_slot_at(reader->header, latest - 1);
+	*sequence = slot->sequence.load(std::memory_order_acquire);
+
+	return *sequence & 1 ? NULL : slot;
+}
+
+const float* publish_particles(const publish_slot* slot) {
+	return (const float*) ((const unsigned char*) slot + sizeof(publish_slot));
+}
+
+bool publish_valid(const publish_slot* slot, uint64_t sequence) {
+	/* Orders the reads of the slot before the second look at the sequence. */
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+bool publish_read(const publish_reader* reader, float* particles, unsigned int capacity, publish_slot* info, unsigned int* retries) {
+	for (unsigned int attempt = 0; attempt < PUBLISH_READ_ATTEMPTS; attempt++) {
+		uint64_t sequence;
+		const publish_slot* slot = publish_peek(reader, &sequence);
+
+		if (!slot) {
+			if (!reader->header->latest.load(std::memory_order_relaxed)) {
+				return false; // Nothing published yet.
+			}
+
+			if (retries) (*retries)++;
+			continue;
+		}
+
+		info->frame = slot->frame;
+		info->produced_ns = slot->produced_ns;
+		info->published_ns = slot->published_ns;
+		info->count = slot->count < capacity ? slot->count : capacity;
+		info->count = info->count < reader->header->capacity ? info->count : reader->header->capacity; // A torn count could be anything.
+
+		memcpy(particles, publish_particles(slot), (size_t) info->count * 4 * sizeof(float));
+
+		if (publish_valid(slot, sequence)) {
+			return true;
+		}
+
+		if (retries) (*retries)++;
+	}
+
+	return false; // The writer lapped us every time, the copy is slower than a whole ring of frames.
+}
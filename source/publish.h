@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+ * Publication of the particle state to other processes through POSIX shared memory (shm_open(), so /dev/shm/<name> on Linux).
+ * The segment is a publish_header followed by a ring of slots, each a publish_slot header and room for capacity particles as (x, y, vx, vy).
+ *	The writer fills the slot after the last one it completed, bumping the slot's sequence to odd before and back to even after, then
+ *	points latest at it. It never waits on anything : a reader that was still looking at a slot the writer came round to finds the sequence
+ *	changed and tries again with the newer frame. Readers only ever read the segment, any number of them.
+ *
+ * Readers can copy a frame out (publish_read()), or work on it in place and check afterwards that it didn't change under them
+ *	(publish_peek() then publish_valid()). The layout is plain enough for other languages to map, see the README.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#define PUBLISH_MAGIC 0x31425550u // "PUB1"
+#define PUBLISH_VERSION 1u
+
+struct publish_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t capacity; // Particles per slot.
+	uint64_t slot_bytes; // Stride of the ring, slot header included.
+	std::atomic<uint64_t> latest; // Frame number + 1 of the newest complete slot, 0 before the first.
+	uint64_t padding[4]; // To a cache line, the slots start on their own.
+};
+
+struct publish_slot {
+	std::atomic<uint64_t> sequence; // Odd while the writer is in the slot.
+	uint64_t frame;
+	uint64_t produced_ns; // CLOCK_MONOTONIC when the state was computed.
+	uint64_t published_ns; // And when it was done being copied in.
+	uint32_t count; // Particles that follow.
+	uint32_t padding[7];
+};
+
+static_assert(sizeof(publish_header) == 64 && sizeof(publish_slot) == 64, "publish_header and publish_slot are one cache line each");
+
+uint64_t publish_clock_ns(void); // CLOCK_MONOTONIC, what the timestamps use.
+
+/* Writer side. slots is how many frames a reader has to get through one before the writer can come round to it again. */
+bool publish_initialize(const char* name, unsigned int capacity, unsigned int slots);
+void publish_shutdown(void); // Unlinks the segment, mapped readers keep theirs.
+bool publish_frame(const float* particles, unsigned int count, uint64_t produced_ns);
+uint64_t publish_frames(void);
+
+/* Reader side. */
+struct publish_reader {
+	int fd;
+	size_t size;
+	const publish_header* header;
+};
+
+bool publish_open(const char* name, publish_reader* reader);
+void publish_close(publish_reader* reader);
+
+/* The newest complete slot and the sequence it had, NULL before the first frame or while the writer is in it. */
+const publish_slot* publish_peek(const publish_reader* reader, uint64_t* sequence);
+const float* publish_particles(const publish_slot* slot);
+bool publish_valid(const publish_slot* slot, uint64_t sequence); // After reading a peeked slot : false if the writer got to it meanwhile.
+
+/* Copies the newest frame into particles (capacity particles at most), retrying through torn reads. info gets the slot header. */
+bool publish_read(const publish_reader* reader, float* particles, unsigned int capacity, publish_slot* info, unsigned int* retries);
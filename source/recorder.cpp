@@ -0,0 +1,403 @@
+/*
+ * Frame sequence writer implementation. See recorder.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include <png.h>
+
+#include "recorder.h"
+
+/* PNG compression is a trade between disk and writer CPU, level 3 keeps a few writers ahead of the GPU at 1080p. */
+#define RECORDER_PNG_LEVEL 3
+
+struct recorder_job {
+	unsigned char* frame;
+	unsigned int index;
+};
+
+static std::vector<std::thread> recorder_workers;
+static std::mutex recorder_mutex;
+static std::condition_variable recorder_queued; // Work arrived, or we are shutting down.
+static std::condition_variable recorder_freed; // A slot went back on the free list.
+static std::condition_variable recorder_turn; // The stream moved on to the next frame.
+
+static std::vector<unsigned char*> recorder_slots;
+static std::vector<unsigned char*> recorder_free;
+static std::deque<recorder_job> recorder_queue;
+static bool recorder_exit = false;
+static bool recorder_error = false;
+
+static char recorder_path[512] = {0};
+static int recorder_format = RECORDER_PNG;
+static int recorder_width = 0;
+static int recorder_height = 0;
+
+static FILE* recorder_stream = NULL;
+static unsigned int recorder_next_write = 0; // Next frame the stream is waiting for.
+
+static recorder_stats recorder_counters;
+
+static float recorder_elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool recorder_write_png(const unsigned char* frame, unsigned int index, unsigned long long* bytes) {
+	char filename[600];
+	snprintf(filename, sizeof filename, recorder_path, index);
+
+	FILE* file = fopen(filename, "wb");
+
+	if (!file) {
+		printf("[recorder] failed to open %s\n", filename);
+		return false;
+	}
+
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png ? png_create_info_struct(png) : NULL;
+
+	if (!info || setjmp(png_jmpbuf(png))) {
+		printf("[recorder] libpng failed on %s\n", filename);
+
+		png_destroy_write_struct(&png, &info);
+		fclose(file);
+		return false;
+	}
+
+	png_init_io(png, file);
+	png_set_compression_level(png, RECORDER_PNG_LEVEL);
+	png_set_IHDR(png, info, recorder_width, recorder_height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+		PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	/* GL hands us the bottom row first. */
+	for (int y = recorder_height - 1; y >= 0; y--) {
+		png_write_row(png, (png_const_bytep) (frame + (size_t) y * recorder_width * 4));
+	}
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+
+	*bytes += (unsigned long long) ftell(file);
+	return fclose(file) == 0;
+}
+
+static void recorder_convert_y4m(const unsigned char* frame, std::vector<unsigned char>& out) {
+	/* Full range BT.601 (C420jpeg), chroma averaged over each 2x2 block. Rows are flipped on the way. */
+	int w = recorder_width, h = recorder_height;
+
+	out.resize((size_t) w * h * 3 / 2);
+
+	unsigned char* luma = out.data();
+	unsigned char* cb = luma + (size_t) w * h;
+	unsigned char* cr = cb + (size_t) (w / 2) * (h / 2);
+
+	for (int y = 0; y < h; y++) {
+		const unsigned char* row = frame + (size_t) (h - 1 - y) * w * 4;
+
+		for (int x = 0; x < w; x++) {
+			const unsigned char* p = row + x * 4;
+			luma[(size_t) y * w + x] = (unsigned char) (0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+		}
+	}
+
+	for (int y = 0; y < h / 2; y++) {
+		const unsigned char* top = frame + (size_t) (h - 1 - y * 2) * w * 4;
+		const unsigned char* bottom = frame + (size_t) (h - 2 - y * 2) * w * 4;
+
+		for (int x = 0; x < w / 2; x++) {
+			float r = (top[x * 8] + top[x * 8 + 4] + bottom[x * 8] + bottom[x * 8 + 4]) * 0.25f;
+			float g = (top[x * 8 + 1] + top[x * 8 + 5] + bottom[x * 8 + 1] + bottom[x * 8 + 5]) * 0.25f;
+			float b = (top[x * 8 + 2] + top[x * 8 + 6] + bottom[x * 8 + 2] + bottom[x * 8 + 6]) * 0.25f;
+
+			cb[(size_t) y * (w / 2) + x] = (unsigned char) (128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f);
+			cr[(size_t) y * (w / 2) + x] = (unsigned char) (128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f);
+		}
+	}
+}
+
+static void recorder_convert_raw(const unsigned char* frame, std::vector<unsigned char>& out) {
+	size_t row_bytes = (size_t) recorder_width * 4;
+	out.resize(row_bytes * recorder_height);
+
+	for (int y = 0; y < recorder_height; y++) {
+		memcpy(out.data() + (size_t) y * row_bytes, frame + (size_t) (recorder_height - 1 - y) * row_bytes, row_bytes);
+	}
+}
+
+static bool recorder_write_stream(const std::vector<unsigned char>& data, unsigned int index, unsigned long long* bytes) {
+	/* Conversion ran in parallel, appending has to happen in frame order. */
+	std::unique_lock<std::mutex> lock(recorder_mutex);
+	recorder_turn.wait(lock, [&] { return recorder_next_write == index; });
+	lock.unlock();
+
+	bool ok = true;
+
+	/* Empty for a skipped frame, which only passes the turn on. */
+	if (!data.empty()) {
+		if (recorder_format == RECORDER_Y4M) {
+			ok = fputs("FRAME\n", recorder_stream) >= 0;
+			*bytes += 6;
+		}
+
+		ok = ok && fwrite(data.data(), 1, data.size(), recorder_stream) == data.size();
+		*bytes += data.size();
+	}
+
+	lock.lock();
+	recorder_next_write++;
+	lock.unlock();
+
+	recorder_turn.notify_all();
+	return ok;
+}
+
+static void recorder_worker(void) {
+	std::vector<unsigned char> converted;
+
+	for (;;) {
+		std::unique_lock<std::mutex> lock(recorder_mutex);
+		recorder_queued.wait(lock, [] { return recorder_exit || !recorder_queue.empty(); });
+
+		if (recorder_queue.empty()) {
+			return; // Only reached on exit, once the queue is drained.
+		}
+
+		recorder_job job = recorder_queue.front();
+		recorder_queue.pop_front();
+
+		bool skip = recorder_error || !job.frame;
+		lock.unlock();
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		unsigned long long bytes = 0;
+		bool ok = true;
+
+		if (recorder_format == RECORDER_PNG) {
+			ok = skip || recorder_write_png(job.frame, job.index, &bytes);
+		} else {
+			/* Stream frames still take their turn when skipped, or the frames after them would wait forever. */
+			if (!skip) {
+				if (recorder_format == RECORDER_Y4M) {
+					recorder_convert_y4m(job.frame, converted);
+				} else {
+					recorder_convert_raw(job.frame, converted);
+				}
+			} else {
+				converted.clear();
+			}
+
+			ok = recorder_write_stream(converted, job.index, &bytes) || skip;
+		}
+
+		float write_ms = recorder_elapsed_ms(start);
+
+		lock.lock();
+
+		if (!ok && !recorder_error) {
+			printf("[recorder] write failed at frame %u, dropping the rest\n", job.index);
+			recorder_error = true;
+		}
+
+		if (!skip && ok) {
+			recorder_counters.frames_written++;
+		}
+
+		recorder_counters.write_ms += write_ms;
+		recorder_counters.bytes_written += bytes;
+
+		if (!job.frame) {
+			recorder_counters.frames_skipped++;
+			lock.unlock();
+			continue; // Held no slot.
+		}
+
+		recorder_free.push_back(job.frame);
+		lock.unlock();
+
+		recorder_freed.notify_one();
+	}
+}
+
+bool recorder_initialize(const char* path, int format, int width, int height, int fps, int threads, int slots) {
+	if (!recorder_check_path(path, format)) {
+		return false;
+	}
+
+	if (format == RECORDER_Y4M && (width % 2 || height % 2)) {
+		printf("[recorder_initialize] Y4M needs an even frame size, got %dx%d\n", width, height);
+		return false;
+	}
+
+	snprintf(recorder_path, sizeof recorder_path, "%s", path);
+	recorder_format = format;
+	recorder_width = width;
+	recorder_height = height;
+
+	memset(&recorder_counters, 0, sizeof recorder_counters);
+	recorder_exit = false;
+	recorder_error = false;
+	recorder_next_write = 0;
+
+	if (format != RECORDER_PNG) {
+		recorder_stream = fopen(path, "wb");
+
+		if (!recorder_stream) {
+			printf("[recorder_initialize] failed to open %s\n", path);
+			return false;
+		}
+
+		if (format == RECORDER_Y4M) {
+			recorder_counters.bytes_written += fprintf(recorder_stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		}
+	}
+
+	if (threads <= 0) {
+		threads = (int) std::thread::hardware_concurrency();
+		threads = threads > 1 ? threads - 1 : 1; // Leave a core for the render thread.
+	}
+
+	if (slots < threads + 1) {
+		slots = threads + 1; // Otherwise the writers can never all be busy while a frame is being filled.
+	}
+
+	for (int i = 0; i < slots; i++) {
+		recorder_slots.push_back(new unsigned char[(size_t) width * height * 4]);
+	}
+
+	recorder_free = recorder_slots;
+
+	for (int i = 0; i < threads; i++) {
+		recorder_workers.push_back(std::thread(recorder_worker));
+	}
+
+	printf("[recorder_initialize] %dx%d to %s, %d writer threads, %d frame slots\n", width, height, path, threads, slots);
+	return true;
+}
+
+void recorder_shutdown(void) {
+	{
+		std::lock_guard<std::mutex> lock(recorder_mutex);
+		recorder_exit = true;
+	}
+
+	recorder_queued.notify_all();
+
+	for (size_t i = 0; i < recorder_workers.size(); i++) {
+		recorder_workers[i].join();
+	}
+
+	recorder_workers.clear();
+
+	if (recorder_stream) {
+		fclose(recorder_stream);
+		recorder_stream = NULL;
+	}
+
+	for (size_t i = 0; i < recorder_slots.size(); i++) {
+		delete[] recorder_slots[i];
+	}
+
+	recorder_slots.clear();
+	recorder_free.clear();
+}
+
+unsigned char* recorder_acquire(void) {
+	std::unique_lock<std::mutex> lock(recorder_mutex);
+
+	if (recorder_free.empty()) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		recorder_freed.wait(lock, [] { return !recorder_free.empty(); });
+
+		recorder_counters.encoder_stalls++;
+		recorder_counters.encoder_stall_ms += recorder_elapsed_ms(start);
+	}
+
+	unsigned char* frame = recorder_free.back();
+	recorder_free.pop_back();
+
+	return frame;
+}
+
+void recorder_submit(unsigned char* frame, unsigned int index) {
+	{
+		std::lock_guard<std::mutex> lock(recorder_mutex);
+
+		recorder_job job = {frame, index};
+		recorder_queue.push_back(job);
+	}
+
+	recorder_queued.notify_one();
+}
+
+void recorder_skip(unsigned int index) {
+	recorder_submit(NULL, index);
+}
+
+bool recorder_failed(void) {
+	std::lock_guard<std::mutex> lock(recorder_mutex);
+	return recorder_error;
+}
+
+const recorder_stats* recorder_get_stats(void) {
+	return &recorder_counters;
+}
+
+int recorder_parse_format(const char* name) {
+	if (!strcmp(name, "png")) return RECORDER_PNG;
+	if (!strcmp(name, "y4m")) return RECORDER_Y4M;
+	if (!strcmp(name, "raw")) return RECORDER_RAW;
+
+	return -1;
+}
+
+bool recorder_check_path(const char* path, int format) {
+	if (format != RECORDER_PNG) {
+		return true; // Opened as it is.
+	}
+
+	int conversions = 0;
+
+	for (const char* c = path; *c; c++) {
+		if (*c != '%') {
+			continue;
+		}
+
+		if (c[1] == '%') {
+			c++;
+			continue;
+		}
+
+		/* Flags, width and precision, then the conversion itself. The frame number is an unsigned int, so no length modifiers. */
+		c++;
+		c += strspn(c, "-+ #0");
+		c += strspn(c, "0123456789");
+
+		if (*c == '.') {
+			c++;
+			c += strspn(c, "0123456789");
+		}
+
+		if (!*c || !strchr("diouxX", *c)) {
+			printf("[recorder] %s : only integer conversions and %%%% can appear in a PNG path\n", path);
+			return false;
+		}
+
+		conversions++;
+	}
+
+	if (conversions != 1) {
+		printf("[recorder] %s : a PNG path takes exactly one integer conversion for the frame number, like frames/%%05d.png\n", path);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * Frame sequence writer for offline rendering.
+ * Frames are handed over as bottom-up RGBA8 images (what glReadPixels gives) and encoded on a pool of writer threads. The recorder owns a
+ *	fixed number of frame slots : recorder_acquire() hands out a free one and blocks when they are all queued up, which is the back-pressure
+ *	that keeps a slow disk from eating all memory. Time spent blocked there is counted as encoder stalls.
+ *
+ * PNG writes one file per frame (path is a printf pattern taking the frame number), in whatever order the writers finish. Y4M and raw
+ *	write a single stream, so writers convert in parallel but take turns appending, in frame order.
+ */
+
+enum {
+	RECORDER_PNG = 0,
+	RECORDER_Y4M, // 4:2:0, what ffmpeg and most players take straight away.
+	RECORDER_RAW, // Top-down RGBA8, no header.
+};
+
+struct recorder_stats {
+	unsigned int frames_written;
+	unsigned int frames_skipped;
+	unsigned int encoder_stalls; // recorder_acquire() calls that had to wait for a free slot.
+	float encoder_stall_ms;
+	float write_ms; // Summed over writer threads.
+	unsigned long long bytes_written;
+};
+
+bool recorder_initialize(const char* path, int format, int width, int height, int fps, int threads, int slots);
+void recorder_shutdown(void); // Writes out everything still queued.
+
+unsigned char* recorder_acquire(void); // Space for one width * height * 4 frame.
+void recorder_submit(unsigned char* frame, unsigned int index);
+void recorder_skip(unsigned int index); // For a frame that never made it, so the stream doesn't wait on it.
+
+bool recorder_failed(void); // Set once any write fails, later frames are dropped.
+const recorder_stats* recorder_get_stats(void);
+
+int recorder_parse_format(const char* name); // "png", "y4m" or "raw", -1 otherwise.
+
+/* PNG paths are a printf pattern : exactly one integer conversion for the frame number, and no % other than %% besides it. */
+bool recorder_check_path(const char* path, int format);
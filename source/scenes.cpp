@@ -0,0 +1,106 @@
+/*
+ * Scene parameter implementation. See scenes.h.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "scenes.h"
+
+static scene_params scenes_list[SCENES_MAX];
+static int scenes_total = 0;
+static int scenes_cols = 1;
+static int scenes_rows_count = 1;
+
+static float scenes_random(float low, float high) {
+	return low + (high - low) * ((float) rand() / (float) RAND_MAX);
+}
+
+bool scenes_initialize(int count, const float* camera_bounds, unsigned int seed) {
+	if (count < 1 || count > SCENES_MAX) {
+		printf("[scenes_initialize] %d scenes requested, between 1 and %d supported\n", count, SCENES_MAX);
+		return false;
+	}
+
+	scenes_total = count;
+
+	/* Near-square grid of tiles, wider than tall like the window. */
+	scenes_cols = (int) ceilf(sqrtf((float) count));
+	scenes_rows_count = (count + scenes_cols - 1) / scenes_cols;
+
+	srand(seed);
+
+	for (int i = 0; i < count; i++) {
+		scene_params* scene = scenes_list + i;
+		memset(scene, 0, sizeof *scene);
+
+		memcpy(scene->camera_bounds, camera_bounds, sizeof scene->camera_bounds);
+
+		scene->gravity = 0.0001f;
+		scene->speed_decay = 1.01f;
+		scene->bounce_decay = 1.5f;
+		scene->color[0] = scene->color[1] = scene->color[2] = scene->color[3] = 1.0f;
+
+		if (i == 0) {
+			continue;
+		}
+
+		scene->gravity *= scenes_random(0.25f, 2.0f);
+		scene->speed_decay = 1.0f + 0.01f * scenes_random(0.5f, 2.0f);
+		scene->bounce_decay = scenes_random(1.1f, 3.0f);
+
+		for (int c = 0; c < 3; c++) {
+			scene->color[c] = scenes_random(0.3f, 1.0f);
+		}
+	}
+
+	printf("[scenes_initialize] %d scenes in a %dx%d grid\n", count, scenes_cols, scenes_rows_count);
+	return true;
+}
+
+int scenes_count(void) {
+	return scenes_total;
+}
+
+int scenes_columns(void) {
+	return scenes_cols;
+}
+
+int scenes_rows(void) {
+	return scenes_rows_count;
+}
+
+scene_params* scenes_get(int scene) {
+	return scenes_list + scene;
+}
+
+const float* scenes_data(void) {
+	return (const float*) scenes_list;
+}
+
+int scenes_pick(const float* window_bounds, float x, float y, float* scene_x, float* scene_y) {
+	/* Tiles fill the window row by row from the top left, same as SHADER_RENDER_VS places them. */
+	float u = (x - window_bounds[0]) / (window_bounds[1] - window_bounds[0]) * scenes_cols;
+	float v = (window_bounds[3] - y) / (window_bounds[3] - window_bounds[2]) * scenes_rows_count;
+
+	int column = (int) floorf(u), row = (int) floorf(v);
+
+	if (column < 0 || column >= scenes_cols || row < 0 || row >= scenes_rows_count) {
+		return -1;
+	}
+
+	int scene = row * scenes_cols + column;
+
+	if (scene >= scenes_total) {
+		return -1;
+	}
+
+	const float* bounds = scenes_list[scene].camera_bounds;
+
+	*scene_x = bounds[0] + (u - column) * (bounds[1] - bounds[0]);
+	*scene_y = bounds[3] - (v - row) * (bounds[3] - bounds[2]);
+
+	return scene;
+}
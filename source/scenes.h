@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * Independent particle systems sharing one set of particle buffers.
+ * Scene i owns particles [i * per_scene, (i + 1) * per_scene), and its parameters live in a texture buffer the advance and render shaders
+ *	index with gl_InstanceID / per_scene, so every scene is still advanced by a single transform feedback draw and drawn by a single call.
+ *	On screen the scenes are tiled over the window, each tile showing that scene's own camera bounds.
+ *
+ * Parameters are SCENES_TEXELS RGBA32F texels per scene, laid out exactly like scene_params.
+ */
+
+#define SCENES_MAX 256
+#define SCENES_TEXELS 4
+
+struct scene_params {
+	float camera_bounds[4]; // left, right, bottom, top
+	float mouse[4]; // x, y, strength, softening, same layout as forces_attractor. Strength 0 while the button is up.
+	float gravity; // Pull per step, 0.0001 in the original program.
+	float speed_decay; // Velocity is divided by this every step.
+	float bounce_decay; // And by this on hitting a wall.
+	float padding;
+	float color[4]; // Multiplied into the render color.
+};
+
+/* Scene 0 always gets the original program's constants, the rest get their own gravity, damping and colour. */
+bool scenes_initialize(int count, const float* camera_bounds, unsigned int seed);
+
+int scenes_count(void);
+int scenes_columns(void);
+int scenes_rows(void);
+
+scene_params* scenes_get(int scene);
+const float* scenes_data(void); // scenes_count() * SCENES_TEXELS texels.
+
+/* Finds the scene tile under a point in window camera coordinates, and where that point lands in the scene's own camera bounds. -1 if none. */
+int scenes_pick(const float* window_bounds, float x, float y, float* scene_x, float* scene_y);
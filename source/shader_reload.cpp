@@ -0,0 +1,633 @@
+/*
+ * Shader hot reload implementation. See shader_reload.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <GLXW/glxw.h>
+#include <GLFW/glfw3.h>
+
+#include "shader_reload.h"
+#include "particle_system.h"
+#include "programs.h"
+
+#define RELOAD_MAX_VARIANTS 64 // Of one kind, more than the feature bits in use ever make.
+
+enum {
+	RELOAD_COMMON = 0,
+	RELOAD_VS,
+	RELOAD_GS,
+	RELOAD_PS,
+	RELOAD_STAGES
+};
+
+struct reload_file {
+	int kind;
+	int stage;
+	const char* file;
+	const char* name;
+};
+
+/* What each kind is built from, see particle_system_variant_sources(). */
+static const reload_file reload_files[] = {
+	{VARIANT_ADVANCE, RELOAD_COMMON, "forces_common.glsl", "SHADER_FORCES_COMMON"},
+	{VARIANT_ADVANCE, RELOAD_VS, "advance_vs.glsl", "SHADER_ADVANCE_VS"},
+	{VARIANT_RENDER, RELOAD_COMMON, "scene_tiles.glsl", "SHADER_SCENE_TILES"},
+	{VARIANT_RENDER, RELOAD_VS, "render_vs.glsl", "SHADER_RENDER_VS"},
+	{VARIANT_RENDER, RELOAD_GS, "render_gs.glsl", "SHADER_RENDER_GS"},
+	{VARIANT_RENDER, RELOAD_PS, "render_ps.glsl", "SHADER_RENDER_PS"},
+};
+
+#define RELOAD_FILES ((int) (sizeof reload_files / sizeof reload_files[0]))
+
+/* One kind's stages as read from disk, and the variant_sources into them. Kept until shutdown : queued jobs and other threads building a
+ *	cache miss may still be reading an older set. */
+struct reload_set {
+	std::string stages[RELOAD_STAGES];
+	variant_sources sources;
+};
+
+struct reload_job {
+	unsigned int generation;
+	variant_key key;
+	std::string glsl;
+	const reload_set* set;
+};
+
+struct reload_result {
+	unsigned int generation;
+	variant_key key;
+	unsigned int program; // 0 if it failed, finish_program() printed why.
+	GLsync built;
+};
+
+/* A reload of one kind, swapped in once all of its variants are back. */
+struct reload_generation {
+	unsigned int id;
+	int kind;
+	const reload_set* set;
+	int expected;
+	std::vector<reload_result> results;
+	double started;
+};
+
+struct reload_retired {
+	unsigned int program;
+	unsigned int update; // When it was replaced.
+};
+
+static std::string reload_directory;
+static int reload_fd = -1;
+static shader_reload_glsl reload_glsl = NULL;
+static shader_reload_setup reload_setup = NULL;
+
+static GLFWwindow* reload_window = NULL;
+static std::thread reload_thread;
+static std::mutex reload_mutex;
+static std::condition_variable reload_queued; // A job arrived, or we are shutting down.
+static std::vector<reload_job> reload_queue; // Guarded by reload_mutex, like the two below.
+static std::vector<reload_result> reload_done;
+static bool reload_exit = false;
+
+/* Main thread only, except the current sources which cache misses on other threads read. */
+static std::vector<std::unique_ptr<reload_set>> reload_sets;
+static std::atomic<const variant_sources*> reload_current[VARIANT_KINDS];
+static std::vector<reload_generation> reload_generations;
+static std::vector<reload_retired> reload_retirees;
+static unsigned int reload_next_generation = 0;
+static unsigned int reload_updates = 0;
+
+static const char* reload_kind_name(int kind) {
+	return kind == VARIANT_ADVANCE ? "advance" : "render";
+}
+
+static void reload_worker(void) {
+	/* Compiles and links with nothing else to do, so finish_program() blocking on the driver only holds up this thread. */
+	glfwMakeContextCurrent(reload_window);
+
+	while (true) {
+		reload_job job;
+
+		{
+			std::unique_lock<std::mutex> lock(reload_mutex);
+			reload_queued.wait(lock, [] { return reload_exit || !reload_queue.empty(); });
+
+			if (reload_exit) {
+				break;
+			}
+
+			job = reload_queue.front();
+			reload_queue.erase(reload_queue.begin());
+		}
+
+		reload_result result;
+		result.generation = job.generation;
+		result.key = job.key;
+		result.program = particle_system_start_variant(&job.key, job.glsl.empty() ? NULL : job.glsl.c_str(), &job.set->sources);
+
+		if (!finish_program(reload_kind_name(job.key.kind), result.program)) {
+			result.program = 0;
+		}
+
+		/* Our commands have to be done before the main context can use the program. */
+		result.built = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+
+		std::lock_guard<std::mutex> lock(reload_mutex);
+		reload_done.push_back(result);
+	}
+
+	glfwMakeContextCurrent(NULL);
+}
+
+static void reload_discard(reload_result* result) {
+	if (result->program) {
+		glDeleteProgram(result->program);
+	}
+
+	if (result->built) {
+		glDeleteSync(result->built);
+	}
+}
+
+static void reload_supersede(int kind) {
+	/* A newer save of the same kind : whatever the older one still has queued is dropped, and what it got back discarded. */
+	{
+		std::lock_guard<std::mutex> lock(reload_mutex);
+
+		for (size_t i = 0; i < reload_queue.size(); i++) {
+			if (reload_queue[i].key.kind == kind) {
+				reload_queue.erase(reload_queue.begin() + i--);
+			}
+		}
+	}
+
+	for (size_t g = 0; g < reload_generations.size(); g++) {
+		if (reload_generations[g].kind != kind) {
+			continue;
+		}
+
+		for (size_t r = 0; r < reload_generations[g].results.size(); r++) {
+			reload_discard(&reload_generations[g].results[r]);
+		}
+
+		reload_generations.erase(reload_generations.begin() + g--);
+	}
+}
+
+static void reload_start(int kind) {
+	/* Every stage of the kind is read back, not just the saved one, so a set always comes from one state of the files. */
+	std::unique_ptr<reload_set> set(new reload_set);
+	particle_system_variant_sources(kind, &set->sources); // The varying, and the stages the kind doesn't have.
+
+	for (int i = 0; i < RELOAD_FILES; i++) {
+		const reload_file* file = &reload_files[i];
+
+		if (file->kind != kind) {
+			continue;
+		}
+
+		std::string path = reload_directory + "/" + file->file;
+
+		if (!shader_reload_load(path.c_str(), file->name, &set->stages[file->stage])) {
+			printf("[shader_reload] couldn't read %s from %s, the running %s programs stay\n", file->name, path.c_str(), reload_kind_name(kind));
+			return;
+		}
+	}
+
+	for (int i = 0; i < RELOAD_FILES; i++) {
+		const reload_file* file = &reload_files[i];
+
+		if (file->kind != kind) {
+			continue;
+		}
+
+		const char* stage = set->stages[file->stage].c_str();
+
+		switch (file->stage) {
+			case RELOAD_COMMON: set->sources.common = stage; break;
+			case RELOAD_VS: set->sources.vs = stage; break;
+			case RELOAD_GS: set->sources.gs = stage; break;
+			case RELOAD_PS: set->sources.ps = stage; break;
+		}
+	}
+
+	reload_supersede(kind);
+
+	variant_key keys[RELOAD_MAX_VARIANTS];
+
+	reload_generation generation;
+	generation.id = ++reload_next_generation;
+	generation.kind = kind;
+	generation.set = set.get();
+	generation.expected = variants_keys(kind, keys, RELOAD_MAX_VARIANTS);
+	generation.started = glfwGetTime();
+
+	{
+		std::lock_guard<std::mutex> lock(reload_mutex);
+
+		for (int i = 0; i < generation.expected; i++) {
+			reload_job job;
+			job.generation = generation.id;
+			job.key = keys[i];
+			job.set = set.get();
+
+			const char* glsl = reload_glsl ? reload_glsl(&keys[i]) : NULL;
+
+			if (glsl) {
+				job.glsl = glsl;
+			}
+
+			reload_queue.push_back(job);
+		}
+	}
+
+	reload_queued.notify_one();
+
+	printf("[shader_reload] rebuilding %d %s variants\n", generation.expected, reload_kind_name(kind));
+
+	reload_sets.push_back(std::move(set));
+	reload_generations.push_back(generation);
+}
+
+static unsigned int reload_changed_kinds(void) {
+	/* Drains the inotify queue, returns a mask of the kinds that had a file saved. */
+	alignas(inotify_event) char buffer[4096];
+	unsigned int kinds = 0;
+
+	while (true) {
+		ssize_t length = read(reload_fd, buffer, sizeof buffer);
+
+		if (length <= 0) {
+			break; // EAGAIN, nothing more for now.
+		}
+
+		for (ssize_t offset = 0; offset < length; ) {
+			const inotify_event* event = (const inotify_event*) (buffer + offset);
+
+			for (int i = 0; i < RELOAD_FILES && event->len; i++) {
+				if (!strcmp(event->name, reload_files[i].file)) {
+					kinds |= 1u << reload_files[i].kind;
+				}
+			}
+
+			offset += sizeof(inotify_event) + event->len;
+		}
+	}
+
+	return kinds;
+}
+
+static bool reload_finish(reload_generation* generation) {
+	/* Swaps a generation in when all of it is back, built and linked. False while it is still waiting on anything. */
+	if ((int) generation->results.size() < generation->expected) {
+		return false;
+	}
+
+	for (size_t r = 0; r < generation->results.size(); r++) {
+		GLsync built = generation->results[r].built;
+
+		if (built && glClientWaitSync(built, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+	}
+
+	int failed = 0;
+
+	for (size_t r = 0; r < generation->results.size(); r++) {
+		failed += generation->results[r].program ? 0 : 1;
+	}
+
+	if (failed) {
+		printf("[shader_reload] %d of %d %s variants failed, the running ones stay\n", failed, generation->expected, reload_kind_name(generation->kind));
+
+		for (size_t r = 0; r < generation->results.size(); r++) {
+			reload_discard(&generation->results[r]);
+		}
+
+		return true;
+	}
+
+	for (size_t r = 0; r < generation->results.size(); r++) {
+		reload_result* result = &generation->results[r];
+
+		glDeleteSync(result->built);
+
+		if (reload_setup) {
+			reload_setup(&result->key, result->program);
+		}
+
+		unsigned int replaced = variants_replace(&result->key, result->program);
+
+		if (replaced) {
+			reload_retired retired;
+			retired.program = replaced;
+			retired.update = reload_updates;
+
+			reload_retirees.push_back(retired);
+		}
+	}
+
+	reload_current[generation->kind] = &generation->set->sources;
+
+	printf("[shader_reload] %d %s variants swapped in, %.0f ms after the save\n", generation->expected, reload_kind_name(generation->kind),
+		(glfwGetTime() - generation->started) * 1000.0);
+
+	return true;
+}
+
+bool shader_reload_update(void) {
+	reload_updates++;
+
+	for (size_t i = 0; i < reload_retirees.size(); i++) {
+		if (reload_updates - reload_retirees[i].update >= SHADER_RELOAD_RETIRE_UPDATES) {
+			glDeleteProgram(reload_retirees[i].program);
+			reload_retirees.erase(reload_retirees.begin() + i--);
+		}
+	}
+
+	unsigned int kinds = reload_changed_kinds();
+
+	for (int kind = 0; kind < VARIANT_KINDS; kind++) {
+		if (kinds & (1u << kind)) {
+			reload_start(kind);
+		}
+	}
+
+	std::vector<reload_result> arrived;
+
+	{
+		std::lock_guard<std::mutex> lock(reload_mutex);
+		arrived.swap(reload_done);
+	}
+
+	for (size_t a = 0; a < arrived.size(); a++) {
+		reload_generation* owner = NULL;
+
+		for (size_t g = 0; g < reload_generations.size() && !owner; g++) {
+			if (reload_generations[g].id == arrived[a].generation) {
+				owner = &reload_generations[g];
+			}
+		}
+
+		if (owner) {
+			owner->results.push_back(arrived[a]);
+		} else {
+			reload_discard(&arrived[a]); // Superseded while it was building.
+		}
+	}
+
+	bool swapped = false;
+
+	for (size_t g = 0; g < reload_generations.size(); g++) {
+		reload_generation* generation = &reload_generations[g];
+		bool failed = false;
+
+		for (size_t r = 0; r < generation->results.size(); r++) {
+			failed |= !generation->results[r].program;
+		}
+
+		if (reload_finish(generation)) {
+			swapped |= !failed;
+			reload_generations.erase(reload_generations.begin() + g--);
+		}
+	}
+
+	return swapped;
+}
+
+const variant_sources* shader_reload_sources(int kind) {
+	return reload_current[kind];
+}
+
+bool shader_reload_initialize(GLFWwindow* share, const char* directory, shader_reload_glsl glsl, shader_reload_setup setup) {
+	reload_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (reload_fd < 0) {
+		printf("[shader_reload_initialize] inotify_init1 failed : %s\n", strerror(errno));
+		return false;
+	}
+
+	/* Editors either write the file in place or write another one and rename it over, both are a save. */
+	if (inotify_add_watch(reload_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("[shader_reload_initialize] can't watch %s : %s\n", directory, strerror(errno));
+
+		close(reload_fd);
+		reload_fd = -1;
+		return false;
+	}
+
+	/* The worker gets a hidden window of its own just for a context sharing programs with ours, like the threaded simulation. */
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	reload_window = glfwCreateWindow(1, 1, "particles shader reload", NULL, share);
+	glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+
+	if (!reload_window) {
+		printf("[shader_reload_initialize] failed to create the shared context\n");
+
+		close(reload_fd);
+		reload_fd = -1;
+		return false;
+	}
+
+	reload_directory = directory;
+	reload_glsl = glsl;
+	reload_setup = setup;
+
+	for (int kind = 0; kind < VARIANT_KINDS; kind++) {
+		reload_current[kind] = NULL;
+	}
+
+	reload_exit = false;
+	reload_thread = std::thread(reload_worker);
+
+	printf("[shader_reload_initialize] watching %s\n", directory);
+	return true;
+}
+
+void shader_reload_shutdown(void) {
+	{
+		std::lock_guard<std::mutex> lock(reload_mutex);
+		reload_exit = true;
+	}
+
+	reload_queued.notify_all();
+	reload_thread.join();
+
+	glfwDestroyWindow(reload_window);
+	reload_window = NULL;
+
+	for (size_t g = 0; g < reload_generations.size(); g++) {
+		for (size_t r = 0; r < reload_generations[g].results.size(); r++) {
+			reload_discard(&reload_generations[g].results[r]);
+		}
+	}
+
+	for (size_t d = 0; d < reload_done.size(); d++) {
+		reload_discard(&reload_done[d]);
+	}
+
+	for (size_t i = 0; i < reload_retirees.size(); i++) {
+		glDeleteProgram(reload_retirees[i].program);
+	}
+
+	reload_generations.clear();
+	reload_done.clear();
+	reload_queue.clear();
+	reload_retirees.clear();
+
+	/* The cache may hold programs built from these, but nothing is built from them anymore. */
+	for (int kind = 0; kind < VARIANT_KINDS; kind++) {
+		reload_current[kind] = NULL;
+	}
+
+	reload_sets.clear();
+
+	close(reload_fd);
+	reload_fd = -1;
+}
+
+static bool reload_read_file(const char* path, std::string* text) {
+	FILE* file = fopen(path, "rb");
+
+	if (!file) {
+		return false;
+	}
+
+	char chunk[4096];
+	size_t length;
+
+	text->clear();
+
+	while ((length = fread(chunk, 1, sizeof chunk, file)) > 0) {
+		text->append(chunk, length);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static bool reload_identifier(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static size_t reload_skip_space(const std::string& text, size_t at) {
+	while (at < text.size() && (text[at] == ' ' || text[at] == '\t' || text[at] == '\r' || text[at] == '\n')) {
+		at++;
+	}
+
+	return at;
+}
+
+static bool reload_stringify(const std::string& text, size_t at, std::string* source) {
+	/* What #src makes of a macro argument : comments are gone, every run of whitespace is one space, none at either end. The argument
+	 *	runs to the parenthesis that closes the one at at - 1. */
+	int depth = 1;
+	bool space = false;
+
+	while (at < text.size()) {
+		char c = text[at];
+
+		if (c == '/' && at + 1 < text.size() && text[at + 1] == '/') {
+			at = text.find('\n', at);
+			space = true;
+			continue;
+		}
+
+		if (c == '/' && at + 1 < text.size() && text[at + 1] == '*') {
+			at = text.find("*/", at + 2);
+
+			if (at == std::string::npos) {
+				return false;
+			}
+
+			at += 2;
+			space = true;
+			continue;
+		}
+
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			at++;
+			space = true;
+			continue;
+		}
+
+		if (c == '(') {
+			depth++;
+		} else if (c == ')' && --depth == 0) {
+			return true;
+		}
+
+		if (space && !source->empty() && source->back() != '\n') {
+			*source += ' ';
+		}
+
+		*source += c;
+		space = false;
+		at++;
+	}
+
+	return false; // Never closed.
+}
+
+bool shader_reload_load(const char* path, const char* name, std::string* source) {
+	std::string text;
+
+	if (!reload_read_file(path, &text)) {
+		return false;
+	}
+
+	/* The definition : name, then =, then one of the three forms the shader headers use. */
+	size_t name_length = strlen(name);
+
+	for (size_t at = text.find(name); at != std::string::npos; at = text.find(name, at + name_length)) {
+		if ((at > 0 && reload_identifier(text[at - 1])) || reload_identifier(text[at + name_length])) {
+			continue;
+		}
+
+		size_t value = reload_skip_space(text, at + name_length);
+
+		if (value >= text.size() || text[value] != '=') {
+			continue; // Only mentioned, in a comment say.
+		}
+
+		value = reload_skip_space(text, value + 1);
+
+		if (!text.compare(value, 3, "R\"(")) {
+			size_t end = text.find(")\"", value + 3);
+
+			if (end == std::string::npos) {
+				return false;
+			}
+
+			*source = text.substr(value + 3, end - value - 3);
+			return true;
+		}
+
+		if (!text.compare(value, 5, "GLSL(")) {
+			*source = "#version 330\n";
+			return reload_stringify(text, value + 5, source);
+		}
+
+		if (!text.compare(value, 10, "GLSL_PART(")) {
+			source->clear();
+			return reload_stringify(text, value + 10, source);
+		}
+
+		return false;
+	}
+
+	return false;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * Shader hot reload for the advance and render variants.
+ * The GLSL is compiled into the binary, from the string constants in source/shaders. With reloading on, those files are watched with
+ *	inotify, and a save of any file a variant kind is built from reads that kind's stages back out of the files : raw strings as they are,
+ *	GLSL() and GLSL_PART() bodies the way the preprocessor would stringify them.
+ *
+ * Every variant of the kind built so far is then rebuilt on a worker thread, which has a hidden window of its own for a context sharing
+ *	programs with ours. The running programs keep drawing meanwhile. Once the whole set has linked and the worker's fences have passed, they
+ *	replace the old ones in the variant cache between two frames, all at once : selection picks them up from there. If any of them fails to
+ *	compile or link, the logs are printed and the running set stays. The sources of the last set that made it are what later cache misses
+ *	are built from.
+ *
+ * Replaced programs are only deleted SHADER_RELOAD_RETIRE_UPDATES frames later, other contexts (the threaded simulation) may still be
+ *	about to use them. The other programs (cull, grid, sleep, stats) aren't reloaded.
+ */
+
+#include <string>
+
+#include "variants.h"
+
+struct GLFWwindow;
+struct variant_sources;
+
+#define SHADER_RELOAD_RETIRE_UPDATES 16
+
+/* What goes in after the defines of a variant, as particle_system_start_variant() takes it. NULL for nothing. */
+typedef const char* (*shader_reload_glsl)(const variant_key* key);
+
+/* Sets up the uniforms of a fresh program, on the main context before it is swapped in. */
+typedef void (*shader_reload_setup)(const variant_key* key, unsigned int program);
+
+bool shader_reload_initialize(GLFWwindow* share, const char* directory, shader_reload_glsl glsl, shader_reload_setup setup);
+void shader_reload_shutdown(void);
+
+/* Once per frame on the main thread, at the frame boundary. True when a set of programs was swapped in. */
+bool shader_reload_update(void);
+
+/* The sources new variants of kind are built from, NULL until a reload of it went through (then build from the library's). */
+const variant_sources* shader_reload_sources(int kind);
+
+/* Pulls the string constant name out of the shader file at path, as the compiler would see it. */
+bool shader_reload_load(const char* path, const char* name, std::string* source);
@@ -1,57 +1,180 @@
 #pragma once
 
-#define GLSL(src) "#version 330\n" #src
+#include "forces_common.glsl"
 
-const char* SHADER_ADVANCE_VS = GLSL(
+/* Compiled after SHADER_FORCES_COMMON and the variant defines (see variants.h), so it is a raw string : the #ifs have to survive. */
+const char* SHADER_ADVANCE_VS = R"(
 	uniform samplerBuffer particle_buffer;
 
 	out vec4 out_particle_data;
-	uniform vec4 camera_bounds;
-	uniform vec3 mouse_data;
+
+	uniform samplerBuffer scene_buffer; // SCENES_TEXELS texels per scene, see scene_params.
+	uniform int scene_particles;
+
+	uniform samplerBuffer nbody_tree;
+	uniform samplerBuffer nbody_points;
+	uniform vec4 nbody_data; // x = opening angle squared, y = gravitation, z = softening squared, w = 1 when enabled
+	uniform int nbody_node_count;
+
+	uniform vec4 integrator_data; // x = step length, y = adaptive position tolerance, z = adaptive substep limit
+
+#if defined(VARIANT_VERLET) || defined(VARIANT_ADAPTIVE)
+#define INTEGRATOR_VERLET
+#endif
+
+	/* The forces that depend on where the particle is right now, which Verlet evaluates again at the end of every (sub)step. */
+	vec2 position_force(vec2 position, vec4 scene_mouse) {
+		vec2 force = vec2(0.0f);
+
+#ifdef VARIANT_SCENE_MOUSE
+		/* Only with several scenes, otherwise the mouse is in attractor_block. The pressed flag still varies per scene. */
+		if (scene_mouse.z != 0.0f) {
+			force += point_force(position, scene_mouse);
+		}
+#endif
+#ifdef VARIANT_ATTRACTORS
+		force += attractor_force(position);
+#endif
+#ifdef VARIANT_FIELD
+		force += field_force(position);
+#endif
+
+		return force;
+	}
 
 	void main(void) {
 		vec4 particle_data = texelFetch(particle_buffer, gl_InstanceID);
 
-		float bounce_decay = 1.5f;
-		float gravitation = 0.0001f;
-		float speed_decay = 1.01;
+#ifdef VARIANT_SCENE_FOLDED
+		/* Only one scene, whose constants were folded in. Its mouse texel is still read from the scene buffer. */
+		const int scene = 0;
+		const vec4 bounds = SCENE_BOUNDS;
+		const vec3 scene_motion = SCENE_MOTION;
+#else
+		/* Every particle in a scene reads the same few texels, so these stay in cache. */
+		int scene = gl_InstanceID / scene_particles;
+
+		vec4 bounds = texelFetch(scene_buffer, scene * 4);
+		vec3 scene_motion = texelFetch(scene_buffer, scene * 4 + 2).xyz; // gravity, speed decay, bounce decay
+#endif
+
+		float bounce_decay = scene_motion.z;
+		float speed_decay = scene_motion.y;
 
-		particle_data.w -= 0.0001f;
+		/* Decay is per original step, so a step of dt decays by its dt-th power. */
+		float dt = integrator_data.x;
+		float step_decay = pow(speed_decay, dt);
 
-		if (particle_data.x <= camera_bounds.x) {
-			particle_data.x = camera_bounds.x;
+#ifndef INTEGRATOR_VERLET
+		particle_data.w -= scene_motion.x * dt;
+#endif
+
+#ifdef VARIANT_BOUNDS_WRAP
+		/* Leave on one side, come back in on the other with the same velocity. */
+		particle_data.xy = bounds.xz + mod(particle_data.xy - bounds.xz, bounds.yw - bounds.xz);
+#else
+		if (particle_data.x <= bounds.x) {
+			particle_data.x = bounds.x;
 			particle_data.z = -particle_data.z / bounce_decay;
 		}
 
-		if (particle_data.x >= camera_bounds.y) {
-			particle_data.x = camera_bounds.y;
+		if (particle_data.x >= bounds.y) {
+			particle_data.x = bounds.y;
 			particle_data.z = -particle_data.z / bounce_decay;
 		}
 
-		if (particle_data.y <= camera_bounds.z) {
-			particle_data.y = camera_bounds.z;
+		if (particle_data.y <= bounds.z) {
+			particle_data.y = bounds.z;
 			particle_data.w = -particle_data.w / bounce_decay;
 		}
 
-		if (particle_data.y >= camera_bounds.w) {
-			particle_data.y = camera_bounds.w;
+		if (particle_data.y >= bounds.w) {
+			particle_data.y = bounds.w;
 			particle_data.w = -particle_data.w / bounce_decay;
 		}
+#endif
+
+#ifdef VARIANT_SCENE_MOUSE
+		vec4 scene_mouse = texelFetch(scene_buffer, scene * 4 + 1);
+#else
+		vec4 scene_mouse = vec4(0.0f);
+#endif
+
+		/* The neighbor grid and the tree were built from the positions at the start of the step, so their forces are held over it. */
+		vec2 held_force = vec2(0.0f);
+
+#ifdef VARIANT_NEIGHBORS
+		held_force += neighbor_force(particle_data.xy);
+#endif
+
+#ifdef VARIANT_NBODY
+		{
+			/* Stackless walk of the Barnes-Hut tree : far nodes count as one mass and are skipped, near leaves are summed directly. */
+			vec2 acceleration = vec2(0.0f);
+			int node = 0;
+
+			while (node < nbody_node_count) {
+				vec4 mass_data = texelFetch(nbody_tree, node * 2); // com.x, com.y, mass, size
+				vec4 link_data = texelFetch(nbody_tree, node * 2 + 1); // next, leaf_first, leaf_count
+
+				vec2 delta = mass_data.xy - particle_data.xy;
+				float dist_sq = dot(delta, delta) + nbody_data.z;
+
+				if (mass_data.w * mass_data.w < nbody_data.x * dist_sq) {
+					acceleration += delta * (mass_data.z * inversesqrt(dist_sq) / dist_sq);
+				} else if (link_data.z > 0.0f) {
+					int leaf_last = int(link_data.y + link_data.z);
+
+					for (int point = int(link_data.y); point < leaf_last; point++) {
+						vec2 point_delta = texelFetch(nbody_points, point).xy - particle_data.xy;
+						float point_dist_sq = dot(point_delta, point_delta) + nbody_data.z;
+
+						acceleration += point_delta * (inversesqrt(point_dist_sq) / point_dist_sq);
+					}
+				} else {
+					node++; // Too close, open it up.
+					continue;
+				}
+
+				node = int(link_data.x);
+			}
+
+			held_force += acceleration * nbody_data.y;
+		}
+#endif
+
+#ifdef INTEGRATOR_VERLET
+		/* Velocity Verlet : drift with the acceleration at the start, then kick with the mean of the accelerations at both ends. Gravity
+		 *	is just another constant acceleration here. Decay is applied once per step, like Euler does. */
+		vec2 constant_force = held_force - vec2(0.0f, scene_motion.x);
+		vec2 acceleration = position_force(particle_data.xy, scene_mouse) + constant_force;
 
-		if (mouse_data[2] == 1.0f) {
-			float dist = sqrt(pow(mouse_data[0] - particle_data.x, 2) + pow(mouse_data[1] - particle_data.y, 2));
+#ifdef VARIANT_ADAPTIVE
+		/* Enough substeps that the acceleration term of each moves the particle less than the tolerance : h^2 |a| / 2 < tolerance. */
+		float substeps = clamp(ceil(dt * sqrt(length(acceleration) / (2.0f * integrator_data.y))), 1.0f, integrator_data.z);
+#else
+		float substeps = 1.0f;
+#endif
 
-			float angle = atan(mouse_data[1] - particle_data.y, mouse_data[0] - particle_data.x);
+		float h = dt / substeps;
 
-			particle_data.z += (1.0f / (pow(dist, 2) + 0.01f)) * cos(angle) * gravitation;
-			particle_data.w += (1.0f / (pow(dist, 2) + 0.01f)) * sin(angle) * gravitation;
+		for (float substep = 0.0f; substep < substeps; substep += 1.0f) {
+			particle_data.xy += particle_data.zw * h + acceleration * (0.5f * h * h);
+
+			vec2 next_acceleration = position_force(particle_data.xy, scene_mouse) + constant_force;
+
+			particle_data.zw += (acceleration + next_acceleration) * (0.5f * h);
+			acceleration = next_acceleration;
 		}
 
-		particle_data.z /= speed_decay;
-		particle_data.w /= speed_decay;
+		particle_data.zw /= step_decay;
+#else
+		particle_data.zw += (position_force(particle_data.xy, scene_mouse) + held_force) * dt;
+		particle_data.zw /= step_decay;
+
+		particle_data.xy += particle_data.zw * dt;
+#endif
 
-		particle_data.x += particle_data.z;
-		particle_data.y += particle_data.w;
 		out_particle_data = particle_data;
 	}
-);
+)";
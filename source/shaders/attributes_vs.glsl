@@ -0,0 +1,16 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* Ages every particle's attributes by a step, through the layout's load_attributes() and store_attributes() (see attributes.h), which
+ *	come in with the defines. Only the streams holding the age are captured. */
+const char* SHADER_ATTRIBUTES_VS = GLSL(
+	uniform float attribute_age_step;
+
+	void main(void) {
+		particle_attributes attributes = load_attributes(gl_InstanceID);
+		attributes.age += attribute_age_step;
+
+		store_attributes(attributes);
+	}
+);
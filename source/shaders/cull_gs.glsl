@@ -0,0 +1,23 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* Keeps the particles whose sprite touches the view, compacted into the render list. */
+const char* SHADER_CULL_GS = GLSL(
+	layout (points) in;
+	layout (points, max_vertices = 1) out;
+
+	in vec4 cull_particle[];
+	in float cull_visible[];
+
+	out vec4 out_render_data;
+
+	void main(void) {
+		if (cull_visible[0] != 0.0f) {
+			out_render_data = cull_particle[0];
+
+			EmitVertex();
+			EndPrimitive();
+		}
+	}
+);
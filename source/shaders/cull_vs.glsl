@@ -0,0 +1,24 @@
+#pragma once
+
+#include "scene_tiles.glsl"
+
+/* Compiled after SHADER_SCENE_TILES. */
+const char* SHADER_CULL_VS = GLSL_PART(
+	uniform samplerBuffer particle_buffer;
+	uniform mat4 mat_mvp;
+	uniform float cull_margin; // Half a sprite, in clip space.
+
+	out vec4 cull_particle;
+	out float cull_visible;
+
+	void main(void) {
+		vec4 particle_data = texelFetch(particle_buffer, gl_InstanceID);
+
+		int scene = gl_InstanceID / scene_particles;
+		vec2 position = scene_tile_position(particle_data.xy, scene);
+		vec4 clip = mat_mvp * vec4(position, 0.0f, 1.0f);
+
+		cull_particle = vec4(position, float(scene), float(gl_InstanceID)); // The render pass finds the sprite and attributes from the index.
+		cull_visible = all(lessThanEqual(abs(clip.xy), vec2(1.0f + cull_margin))) ? 1.0f : 0.0f;
+	}
+);
@@ -0,0 +1,68 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* For shader sources that get compiled after SHADER_FORCES_COMMON, which already carries the version line. */
+#define GLSL_PART(src) #src
+
+/* Uniforms and force terms shared by every pass that needs to know what a particle feels (advance and sleep).
+ *	Static, it is compiled into the particle system library and into the binary. */
+static const char* SHADER_FORCES_COMMON = GLSL(
+	uniform vec4 camera_bounds;
+
+	layout (std140) uniform attractor_block {
+		vec4 attractors[64]; // x, y, strength, softening. Size must match FORCES_MAX_ATTRACTORS.
+	};
+
+	uniform int attractor_count;
+
+	uniform sampler2D force_field;
+	uniform vec4 field_data; // x = 1 when enabled
+
+	uniform sampler2D neighbor_grid;
+	uniform vec4 neighbor_data; // x = cell size, y = repulsion strength, z = 1 when enabled
+
+	vec2 point_force(vec2 position, vec4 attractor) {
+		/* Same pull as the old mouse attractor, (1 / (dist^2 + softening)) * gravitation along the direction, without the trig. */
+		vec2 delta = attractor.xy - position;
+		float dist_sq = dot(delta, delta);
+
+		return delta * (inversesqrt(max(dist_sq, 1e-12f)) * attractor.z * 0.0001f / (dist_sq + attractor.w));
+	}
+
+	vec2 attractor_force(vec2 position) {
+		vec2 force = vec2(0.0f);
+
+		for (int i = 0; i < attractor_count; i++) {
+			force += point_force(position, attractors[i]);
+		}
+
+		return force;
+	}
+
+	vec2 field_force(vec2 position) {
+		/* Baked curl noise over the camera bounds, one fetch regardless of how it was made. */
+		if (field_data.x != 1.0f) {
+			return vec2(0.0f);
+		}
+
+		return texture(force_field, (position - camera_bounds.xz) / (camera_bounds.yw - camera_bounds.xz)).xy;
+	}
+
+	vec2 neighbor_force(vec2 position) {
+		/* Particle counts per cell were splatted by SHADER_GRID_VS, the repulsion pushes down the density gradient. */
+		if (neighbor_data.z != 1.0f) {
+			return vec2(0.0f);
+		}
+
+		ivec2 grid_size = textureSize(neighbor_grid, 0);
+		ivec2 cell = clamp(ivec2(floor((position - camera_bounds.xz) / neighbor_data.x)), ivec2(0), grid_size - 1);
+
+		float left = texelFetch(neighbor_grid, max(cell - ivec2(1, 0), ivec2(0)), 0).r;
+		float right = texelFetch(neighbor_grid, min(cell + ivec2(1, 0), grid_size - 1), 0).r;
+		float down = texelFetch(neighbor_grid, max(cell - ivec2(0, 1), ivec2(0)), 0).r;
+		float up = texelFetch(neighbor_grid, min(cell + ivec2(0, 1), grid_size - 1), 0).r;
+
+		return -vec2(right - left, up - down) * 0.5f * neighbor_data.y;
+	}
+);
@@ -0,0 +1,11 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+const char* SHADER_GRID_PS = GLSL(
+	out vec4 cell_count;
+
+	void main(void) {
+		cell_count = vec4(1.0f, 0.0f, 0.0f, 0.0f); // Accumulated by additive blending.
+	}
+);
@@ -0,0 +1,21 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* The histogram half of a counting sort : every particle adds one to its cell, by additive blending. The scatter half would need atomics,
+ *	which GL 3.3 doesn't have, and the density force in SHADER_ADVANCE_VS only needs the counts. */
+const char* SHADER_GRID_VS = GLSL(
+	uniform samplerBuffer particle_buffer;
+	uniform vec4 camera_bounds;
+	uniform float cell_size;
+
+	void main(void) {
+		vec4 particle_data = texelFetch(particle_buffer, gl_InstanceID);
+
+		/* Same cell mapping as the advance shader, so each point lands on the centre of its cell's texel. */
+		ivec2 grid_size = ivec2(ceil((camera_bounds.yw - camera_bounds.xz) / cell_size));
+		ivec2 cell = clamp(ivec2(floor((particle_data.xy - camera_bounds.xz) / cell_size)), ivec2(0), grid_size - 1);
+
+		gl_Position = vec4((vec2(cell) + 0.5f) / vec2(grid_size) * 2.0f - 1.0f, 0.0f, 1.0f);
+	}
+);
@@ -1,36 +1,53 @@
 #pragma once
 
-#define GLSL(src) "#version 330\n" #src
-
-const char* SHADER_RENDER_GS = GLSL(
+/* Raw string, the sprite size comes in as a variant constant (see variants.h). */
+const char* SHADER_RENDER_GS = R"(#version 330
 	layout (points) in;
 	layout (triangle_strip, max_vertices = 4) out;
 
+	in vec3 scene_tint[];
+	in float particle_sprite[];
+	in float particle_scale[];
+
 	out vec2 pixel_texcoord;
+	out vec3 pixel_tint;
 	uniform mat4 mat_mvp;
+	uniform ivec3 sprite_grid;
+
+	/* Corner of the quad to texture coordinates inside the particle's atlas cell. */
+	vec2 sprite_texcoord(vec2 corner) {
+		float sprite = particle_sprite[0];
+		vec2 cell = vec2(mod(sprite, float(sprite_grid.x)), floor(sprite / float(sprite_grid.x)));
+
+		return (cell + corner) / vec2(sprite_grid.xy);
+	}
 
 	void main(void) {
-		float particle_dim = 0.001f;
+		float particle_dim = PARTICLE_DIM * particle_scale[0];
 
-		pixel_texcoord = vec2(0.0f, 0.0f);
+		pixel_tint = scene_tint[0];
+		pixel_texcoord = sprite_texcoord(vec2(0.0f, 0.0f));
 		gl_Position = mat_mvp * (gl_in[0].gl_Position + vec4(-particle_dim, -particle_dim, 0.0f, 0.0f));
 
 		EmitVertex();
 
-		pixel_texcoord = vec2(0.0f, 1.0f);
+		pixel_tint = scene_tint[0];
+		pixel_texcoord = sprite_texcoord(vec2(0.0f, 1.0f));
 		gl_Position = mat_mvp * (gl_in[0].gl_Position + vec4(-particle_dim, particle_dim, 0.0f, 0.0f));
 
 		EmitVertex();
 
-		pixel_texcoord = vec2(1.0f, 0.0f);
+		pixel_tint = scene_tint[0];
+		pixel_texcoord = sprite_texcoord(vec2(1.0f, 0.0f));
 		gl_Position = mat_mvp * (gl_in[0].gl_Position + vec4(particle_dim, -particle_dim, 0.0f, 0.0f));
 
 		EmitVertex();
 
-		pixel_texcoord = vec2(1.0f, 1.0f);
+		pixel_tint = scene_tint[0];
+		pixel_texcoord = sprite_texcoord(vec2(1.0f, 1.0f));
 		gl_Position = mat_mvp * (gl_in[0].gl_Position + vec4(particle_dim, particle_dim, 0.0f, 0.0f));
 
 		EmitVertex();
 		EndPrimitive();
 	}
-);
+)";
@@ -6,11 +6,12 @@ const char* SHADER_RENDER_PS = GLSL(
 	uniform sampler2D render_texture;
 	uniform vec3 render_color;
 	in vec2 pixel_texcoord;
+	in vec3 pixel_tint;
 	out vec4 pixel_color;
 
 	void main(void) {
 		vec4 offset = vec4(0.1f, 0.1f, 0.1f, 0.0f);
 
-		pixel_color = texture2D(render_texture, pixel_texcoord) * (vec4(render_color, 1.0f) / 10.0f); 
+		pixel_color = texture(render_texture, pixel_texcoord) * (vec4(render_color * pixel_tint, 1.0f) / 10.0f); 
 	}
 );
@@ -1,14 +1,51 @@
 #pragma once
 
-#define GLSL(src) "#version 330\n" #src
+#include "scene_tiles.glsl"
 
-const char* SHADER_RENDER_VS = GLSL(
+/* Compiled after SHADER_SCENE_TILES and the variant defines (see variants.h), and with VARIANT_ATTRIBUTES after the layout's
+ *	load_attributes() (see attributes.h). */
+const char* SHADER_RENDER_VS = R"(
 	uniform samplerBuffer particle_buffer;
 	uniform mat4 mat_mvp;
+	uniform ivec3 sprite_grid; // Atlas columns, rows, sprites in use.
+	uniform float attribute_age_fade; // Steps a particle takes to fade in, 0 for none.
+
+	out vec3 scene_tint;
+	out float particle_sprite;
+	out float particle_scale;
 
 	void main(void) {
-		vec4 particle_data;
-		particle_data=texelFetch(particle_buffer, gl_InstanceID);
-		gl_Position=vec4(particle_data.x, particle_data.y, 0.0f, 1.0f);
+#ifdef VARIANT_CULLED
+		/* One instance of many vertices, drawn straight from the cull list : already in window space, with the scene in z and the
+		 *	particle's index in w. */
+		vec4 particle_data = texelFetch(particle_buffer, gl_VertexID);
+
+		int index = int(particle_data.w);
+		int scene = int(particle_data.z);
+		vec2 position = particle_data.xy;
+#else
+		vec4 particle_data = texelFetch(particle_buffer, gl_InstanceID);
+
+		int index = gl_InstanceID;
+		int scene = gl_InstanceID / scene_particles;
+		vec2 position = scene_tile_position(particle_data.xy, scene);
+#endif
+
+		gl_Position = vec4(position.x, position.y, 0.0f, 1.0f);
+		scene_tint = scene_tile_tint(scene);
+		particle_sprite = float(index % sprite_grid.z); // The particle layout has no room for it, so it follows the index.
+		particle_scale = 1.0f;
+
+#ifdef VARIANT_ATTRIBUTES
+		particle_attributes attributes = load_attributes(index);
+		float fade = attribute_age_fade > 0.0f ? min(attributes.age / attribute_age_fade, 1.0f) : 1.0f;
+
+		scene_tint *= attributes.color.rgb * (attributes.color.a * fade);
+		particle_scale = clamp(attributes.size, 0.0f, attribute_size_max); // The cull margin assumes no larger.
+
+		if (attributes.sprite >= 0.0f) {
+			particle_sprite = mod(attributes.sprite, float(sprite_grid.z));
+		}
+#endif
 	}
-);
+)";
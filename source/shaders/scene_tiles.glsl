@@ -0,0 +1,27 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+#define GLSL_PART(src) #src
+
+/* Where a particle lands in the window, shared by the render and cull passes. With one scene this is the identity.
+ *	Static, like SHADER_FORCES_COMMON, both the library and the binary compile it in. */
+static const char* SHADER_SCENE_TILES = GLSL(
+	uniform samplerBuffer scene_buffer;
+	uniform int scene_particles;
+	uniform ivec2 scene_grid; // columns, rows
+	uniform vec4 camera_bounds; // Of the whole window.
+
+	/* Map the particle from its scene's bounds into that scene's tile, tiles go row by row from the top left. */
+	vec2 scene_tile_position(vec2 particle, int scene) {
+		vec4 bounds = texelFetch(scene_buffer, scene * 4);
+
+		vec2 tile_size = (camera_bounds.yw - camera_bounds.xz) / vec2(scene_grid);
+		vec2 tile_origin = vec2(camera_bounds.x + float(scene % scene_grid.x) * tile_size.x, camera_bounds.w - float(scene / scene_grid.x + 1) * tile_size.y);
+
+		return tile_origin + (particle - bounds.xz) / (bounds.yw - bounds.xz) * tile_size;
+	}
+
+	vec3 scene_tile_tint(int scene) {
+		return texelFetch(scene_buffer, scene * 4 + 3).rgb;
+	}
+);
@@ -0,0 +1,24 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* Transform feedback can't scatter, so the awake/asleep split is done by running the pass twice and dropping the other half here. */
+const char* SHADER_SLEEP_GS = GLSL(
+	layout (points) in;
+	layout (points, max_vertices = 1) out;
+
+	in vec4 sleep_particle[];
+	in float sleep_awake[];
+
+	out vec4 out_particle_data;
+	uniform float sleep_mode; // 1 keeps awake particles, 0 keeps sleeping ones.
+
+	void main(void) {
+		if (sleep_awake[0] == sleep_mode) {
+			out_particle_data = sleep_particle[0];
+
+			EmitVertex();
+			EndPrimitive();
+		}
+	}
+);
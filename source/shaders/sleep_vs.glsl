@@ -0,0 +1,32 @@
+#pragma once
+
+#include "forces_common.glsl"
+
+/* Compiled after SHADER_FORCES_COMMON. Decides for each live particle whether it is awake, SHADER_SLEEP_GS then keeps one side of the split. */
+const char* SHADER_SLEEP_VS = GLSL_PART(
+	uniform samplerBuffer particle_buffer;
+	uniform vec2 sleep_data; // x = speed threshold squared, y = force threshold squared
+
+	out vec4 sleep_particle;
+	out float sleep_awake;
+
+	void main(void) {
+		vec4 particle_data = texelFetch(particle_buffer, gl_InstanceID);
+
+		vec2 force = attractor_force(particle_data.xy) + field_force(particle_data.xy) + neighbor_force(particle_data.xy);
+
+		/* Gravity counts unless the floor is holding the particle up. Must match CPU_FLOOR_CONTACT. */
+		if (particle_data.y > camera_bounds.z + 0.001f) {
+			force.y -= 0.0001f;
+		}
+
+		bool awake = dot(particle_data.zw, particle_data.zw) > sleep_data.x || dot(force, force) > sleep_data.y;
+
+		if (!awake) {
+			particle_data.zw = vec2(0.0f); // Falling asleep, come to a full stop.
+		}
+
+		sleep_particle = particle_data;
+		sleep_awake = awake ? 1.0f : 0.0f;
+	}
+);
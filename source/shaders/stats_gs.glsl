@@ -0,0 +1,49 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* First reduction level : every particle adds its terms to the texels of its lane, one point per row it contributes to (see stats.h).
+ *	stats_mode 0 is the additive rows, 1 the bounds and peaks rows, which are drawn on their own with GL_MAX blending. */
+const char* SHADER_STATS_GS = GLSL(
+	layout (points) in;
+	layout (points, max_vertices = 3) out;
+
+	in vec4 stats_particle[];
+	flat in int stats_lane[];
+
+	out vec4 stats_value;
+
+	uniform int stats_mode;
+	uniform int stats_lanes;
+	uniform int stats_rows;
+	uniform int stats_bins;
+	uniform float stats_speed_max;
+	uniform vec3 stats_mouse; // x, y and the radius that counts as near.
+
+	void emit(int row, vec4 value) {
+		stats_value = value;
+		gl_Position = vec4((vec2(stats_lane[0], row) + 0.5f) / vec2(stats_lanes, stats_rows) * 2.0f - 1.0f, 0.0f, 1.0f);
+
+		EmitVertex();
+		EndPrimitive();
+	}
+
+	void main(void) {
+		vec2 position = stats_particle[0].xy;
+		vec2 velocity = stats_particle[0].zw;
+		float speed = length(velocity);
+
+		if (stats_mode == 1) {
+			emit(2, vec4(position, -position));
+			emit(3, vec4(speed, abs(velocity), 0.0f));
+			return;
+		}
+
+		float near = distance(position, stats_mouse.xy) < stats_mouse.z ? 1.0f : 0.0f;
+		int bin = min(int(speed / stats_speed_max * float(stats_bins)), stats_bins - 1);
+
+		emit(0, vec4(1.0f, position, 0.5f * dot(velocity, velocity)));
+		emit(1, vec4(near, speed, velocity));
+		emit(4 + bin, vec4(1.0f, 0.0f, 0.0f, 0.0f));
+	}
+);
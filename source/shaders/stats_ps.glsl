@@ -0,0 +1,12 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+const char* SHADER_STATS_PS = GLSL(
+	in vec4 stats_value;
+	out vec4 stats_sum;
+
+	void main(void) {
+		stats_sum = stats_value; // Accumulated by blending, added or maxed depending on the pass.
+	}
+);
@@ -0,0 +1,26 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* Second reduction level : a one texel wide target, each fragment folds the lanes of its row. */
+const char* SHADER_STATS_REDUCE_PS = GLSL(
+	uniform sampler2D stats_lanes_texture;
+	uniform int stats_lanes;
+	uniform ivec2 stats_max_rows; // First and last row folded with max.
+
+	out vec4 stats_total;
+
+	void main(void) {
+		int row = int(gl_FragCoord.y);
+		bool maxima = row >= stats_max_rows.x && row <= stats_max_rows.y;
+
+		vec4 total = texelFetch(stats_lanes_texture, ivec2(0, row), 0);
+
+		for (int lane = 1; lane < stats_lanes; lane++) {
+			vec4 value = texelFetch(stats_lanes_texture, ivec2(lane, row), 0);
+			total = maxima ? max(total, value) : total + value;
+		}
+
+		stats_total = total;
+	}
+);
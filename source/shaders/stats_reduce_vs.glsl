@@ -0,0 +1,11 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+/* One triangle covering the whole target, from the vertex index alone. */
+const char* SHADER_STATS_REDUCE_VS = GLSL(
+	void main(void) {
+		vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+		gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+	}
+);
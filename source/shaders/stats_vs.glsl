@@ -0,0 +1,16 @@
+#pragma once
+
+#define GLSL(src) "#version 330\n" #src
+
+const char* SHADER_STATS_VS = GLSL(
+	uniform samplerBuffer particle_buffer;
+	uniform int stats_lanes;
+
+	out vec4 stats_particle;
+	flat out int stats_lane;
+
+	void main(void) {
+		stats_particle = texelFetch(particle_buffer, gl_InstanceID);
+		stats_lane = gl_InstanceID % stats_lanes; // Spreads the blending over many texels, instead of every particle hitting one.
+	}
+);
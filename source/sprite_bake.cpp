@@ -0,0 +1,210 @@
+/*
+ * Sprite atlas baker, see sprites.h for the format. Builds without GL, see 'make sprites'.
+ *
+ *	particles-sprite-bake [--size 64] [--columns n] -o particle.sprites a.png [b.png ...]
+ *
+ * Every input is scaled to one --size square cell (a power of two) and the cells are laid out in a grid, then each mip level is made by
+ *	averaging 2x2 blocks of the one above. Levels stop at one pixel per cell, so no level ever mixes two sprites.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <png.h>
+
+#include "sprites.h"
+
+static bool bake_read_png(const char* path, std::vector<unsigned char>& pixels, unsigned int* width, unsigned int* height) {
+	png_image image;
+	memset(&image, 0, sizeof image);
+	image.version = PNG_IMAGE_VERSION;
+
+	if (!png_image_begin_read_from_file(&image, path)) {
+		printf("[sprite_bake] failed to read %s : %s\n", path, image.message);
+		return false;
+	}
+
+	image.format = PNG_FORMAT_RGBA;
+	pixels.resize(PNG_IMAGE_SIZE(image));
+
+	/* Negative stride gives us the rows bottom-up, which is how GL and the atlas want them. */
+	if (!png_image_finish_read(&image, NULL, pixels.data(), -(png_int_32) PNG_IMAGE_ROW_STRIDE(image), NULL)) {
+		printf("[sprite_bake] failed to decode %s : %s\n", path, image.message);
+		return false;
+	}
+
+	*width = image.width;
+	*height = image.height;
+	return true;
+}
+
+static void bake_scale_into(const std::vector<unsigned char>& source, unsigned int source_width, unsigned int source_height, unsigned char* cell,
+	unsigned int cell_size, unsigned int atlas_width) {
+	/* Box filter : every cell pixel averages the source pixels whose centers fall inside its footprint (or the nearest one, upscaling). */
+	for (unsigned int y = 0; y < cell_size; y++) {
+		unsigned int y0 = y * source_height / cell_size;
+		unsigned int y1 = (y + 1) * source_height / cell_size;
+
+		if (y1 <= y0) y1 = y0 + 1;
+
+		for (unsigned int x = 0; x < cell_size; x++) {
+			unsigned int x0 = x * source_width / cell_size;
+			unsigned int x1 = (x + 1) * source_width / cell_size;
+
+			if (x1 <= x0) x1 = x0 + 1;
+
+			unsigned int sum[4] = {0};
+
+			for (unsigned int sy = y0; sy < y1; sy++) {
+				for (unsigned int sx = x0; sx < x1; sx++) {
+					const unsigned char* p = source.data() + ((size_t) sy * source_width + sx) * 4;
+
+					for (int c = 0; c < 4; c++) sum[c] += p[c];
+				}
+			}
+
+			unsigned int area = (y1 - y0) * (x1 - x0);
+			unsigned char* out = cell + ((size_t) y * atlas_width + x) * 4;
+
+			for (int c = 0; c < 4; c++) out[c] = (unsigned char) ((sum[c] + area / 2) / area);
+		}
+	}
+}
+
+static void bake_downsample(const std::vector<unsigned char>& level, unsigned int width, unsigned int height, std::vector<unsigned char>& next) {
+	unsigned int next_width = width > 1 ? width / 2 : 1;
+	unsigned int next_height = height > 1 ? height / 2 : 1;
+
+	next.resize((size_t) next_width * next_height * 4);
+
+	for (unsigned int y = 0; y < next_height; y++) {
+		for (unsigned int x = 0; x < next_width; x++) {
+			for (int c = 0; c < 4; c++) {
+				unsigned int sum = 0;
+
+				for (unsigned int dy = 0; dy < 2; dy++) {
+					for (unsigned int dx = 0; dx < 2; dx++) {
+						unsigned int sx = x * 2 + dx < width ? x * 2 + dx : width - 1;
+						unsigned int sy = y * 2 + dy < height ? y * 2 + dy : height - 1;
+
+						sum += level[((size_t) sy * width + sx) * 4 + c];
+					}
+				}
+
+				next[((size_t) y * next_width + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+static void bake_usage(const char* program) {
+	printf("usage : %s [--size 64] [--columns n] -o out.sprites a.png [b.png ...]\n", program);
+}
+
+int main(int argc, char** argv) {
+	unsigned int cell_size = 64;
+	unsigned int columns = 0;
+	const char* output = NULL;
+	std::vector<const char*> inputs;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--size") && has_value) {
+			cell_size = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--columns") && has_value) {
+			columns = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-o") && has_value) {
+			output = argv[++i];
+		} else if (argv[i][0] == '-') {
+			bake_usage(argv[0]);
+			return 1;
+		} else {
+			inputs.push_back(argv[i]);
+		}
+	}
+
+	if (!output || inputs.empty() || !cell_size || (cell_size & (cell_size - 1))) {
+		bake_usage(argv[0]);
+		printf("[sprite_bake] --size must be a power of two\n");
+		return 1;
+	}
+
+	unsigned int count = (unsigned int) inputs.size();
+
+	if (!columns) {
+		for (columns = 1; columns * columns < count; columns++);
+	}
+
+	unsigned int rows = (count + columns - 1) / columns;
+
+	sprites_header header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, SPRITES_MAGIC, 4);
+
+	header.version = SPRITES_VERSION;
+	header.width = columns * cell_size;
+	header.height = rows * cell_size;
+	header.columns = columns;
+	header.rows = rows;
+	header.count = count;
+
+	for (unsigned int size = cell_size; size && header.levels < SPRITES_MAX_LEVELS; size /= 2) {
+		header.levels++;
+	}
+
+	/* Level 0, cells are filled bottom row first like the texture. Unused cells stay transparent. */
+	std::vector<unsigned char> level((size_t) header.width * header.height * 4, 0);
+
+	for (unsigned int i = 0; i < count; i++) {
+		std::vector<unsigned char> source;
+		unsigned int source_width, source_height;
+
+		if (!bake_read_png(inputs[i], source, &source_width, &source_height)) {
+			return 1;
+		}
+
+		unsigned char* cell = level.data() + ((size_t) (i / columns) * cell_size * header.width + (i % columns) * cell_size) * 4;
+		bake_scale_into(source, source_width, source_height, cell, cell_size, header.width);
+	}
+
+	FILE* file = fopen(output, "wb");
+
+	if (!file) {
+		printf("[sprite_bake] failed to open %s\n", output);
+		return 1;
+	}
+
+	/* Header first with the offsets filled in as we go, then rewritten at the end. */
+	fwrite(&header, sizeof header, 1, file);
+
+	unsigned int width = header.width, height = header.height;
+	unsigned long long bytes = 0;
+
+	for (unsigned int l = 0; l < header.levels; l++) {
+		header.level_offsets[l] = (unsigned int) ftell(file);
+		fwrite(level.data(), 1, level.size(), file);
+		bytes += level.size();
+
+		std::vector<unsigned char> next;
+		bake_downsample(level, width, height, next);
+
+		level.swap(next);
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	fseek(file, 0, SEEK_SET);
+	fwrite(&header, sizeof header, 1, file);
+
+	if (fclose(file) != 0) {
+		printf("[sprite_bake] failed to write %s\n", output);
+		return 1;
+	}
+
+	printf("[sprite_bake] %u sprites in a %ux%u grid of %u px cells, %u levels, %llu bytes to %s\n", count, columns, rows, cell_size, header.levels,
+		bytes, output);
+	return 0;
+}
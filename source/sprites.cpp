@@ -0,0 +1,108 @@
+/*
+ * Baked sprite atlas loader. See sprites.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sprites.h"
+
+static const unsigned char* sprites_data = NULL;
+static size_t sprites_size = 0;
+
+static unsigned int sprites_level_size(unsigned int size, unsigned int level) {
+	size >>= level;
+	return size ? size : 1;
+}
+
+bool sprites_open(const char* path) {
+	int file = open(path, O_RDONLY);
+
+	if (file < 0) {
+		printf("[sprites_open] failed to open %s\n", path);
+		return false;
+	}
+
+	struct stat info;
+
+	if (fstat(file, &info) != 0 || (size_t) info.st_size < sizeof(sprites_header)) {
+		printf("[sprites_open] %s is too small for a sprite atlas\n", path);
+		close(file);
+		return false;
+	}
+
+	void* mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file); // The mapping stays valid.
+
+	if (mapping == MAP_FAILED) {
+		printf("[sprites_open] failed to map %s\n", path);
+		return false;
+	}
+
+	sprites_data = (const unsigned char*) mapping;
+	sprites_size = (size_t) info.st_size;
+
+	const sprites_header* header = sprites_get_header();
+
+	if (memcmp(header->magic, SPRITES_MAGIC, 4) || header->version != SPRITES_VERSION) {
+		printf("[sprites_open] %s is not a version %d sprite atlas, bake it again\n", path, SPRITES_VERSION);
+		sprites_close();
+		return false;
+	}
+
+	if (!header->levels || header->levels > SPRITES_MAX_LEVELS || !header->count || header->count > header->columns * header->rows) {
+		printf("[sprites_open] %s has a broken header\n", path);
+		sprites_close();
+		return false;
+	}
+
+	for (unsigned int level = 0; level < header->levels; level++) {
+		size_t bytes = (size_t) sprites_level_size(header->width, level) * sprites_level_size(header->height, level) * 4;
+
+		if (header->level_offsets[level] < sizeof(sprites_header) || header->level_offsets[level] + bytes > sprites_size) {
+			printf("[sprites_open] %s is truncated at level %u\n", path, level);
+			sprites_close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void sprites_close(void) {
+	if (sprites_data) {
+		munmap((void*) sprites_data, sprites_size);
+	}
+
+	sprites_data = NULL;
+	sprites_size = 0;
+}
+
+const sprites_header* sprites_get_header(void) {
+	return (const sprites_header*) sprites_data;
+}
+
+const unsigned char* sprites_level(unsigned int level, unsigned int* width, unsigned int* height) {
+	const sprites_header* header = sprites_get_header();
+
+	*width = sprites_level_size(header->width, level);
+	*height = sprites_level_size(header->height, level);
+
+	return sprites_data + header->level_offsets[level];
+}
+
+unsigned long long sprites_bytes(void) {
+	const sprites_header* header = sprites_get_header();
+	unsigned long long bytes = 0;
+
+	for (unsigned int level = 0; level < header->levels; level++) {
+		bytes += (unsigned long long) sprites_level_size(header->width, level) * sprites_level_size(header->height, level) * 4;
+	}
+
+	return bytes;
+}
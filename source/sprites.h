@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * Baked sprite atlas.
+ * particles-sprite-bake (sprite_bake.cpp) packs one or more sprites into a grid of equal power-of-two cells and writes the whole mip chain
+ *	as raw RGBA8, so at runtime the file is just mapped and each level handed to GL as it is. No decoding, no conversion.
+ *
+ * Layout : a sprites_header, then every level at the offset the header gives, rows bottom-up (GL order) and tightly packed. Sprite i is in
+ *	cell (i % columns, i / columns) counting from the bottom left. Cells are at least 2^(levels - 1) pixels wide, so even the smallest level
+ *	never blends two sprites together. Integers are stored little-endian, like the machines this runs on.
+ */
+
+#define SPRITES_MAGIC "SPRT"
+#define SPRITES_VERSION 1
+#define SPRITES_MAX_LEVELS 16
+
+struct sprites_header {
+	char magic[4];
+	unsigned int version;
+	unsigned int width; // Of level 0, the whole atlas.
+	unsigned int height;
+	unsigned int levels;
+	unsigned int columns; // Atlas grid.
+	unsigned int rows;
+	unsigned int count; // Sprites in use, at most columns * rows.
+	unsigned int level_offsets[SPRITES_MAX_LEVELS]; // From the start of the file.
+};
+
+bool sprites_open(const char* path); // Maps the file and checks that every level is inside it.
+void sprites_close(void);
+
+const sprites_header* sprites_get_header(void);
+const unsigned char* sprites_level(unsigned int level, unsigned int* width, unsigned int* height);
+unsigned long long sprites_bytes(void); // All levels together.
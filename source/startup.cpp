@@ -0,0 +1,60 @@
+/*
+ * Startup timeline implementation. See startup.h.
+ */
+
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "startup.h"
+
+struct startup_entry {
+	const char* label;
+	float ms;
+	bool main_thread;
+};
+
+static std::chrono::steady_clock::time_point startup_start;
+static std::thread::id startup_main_thread;
+
+static std::mutex startup_mutex;
+static startup_entry startup_entries[STARTUP_MAX_MARKS];
+static int startup_count = 0;
+
+void startup_begin(void) {
+	startup_start = std::chrono::steady_clock::now();
+	startup_main_thread = std::this_thread::get_id();
+	startup_count = 0;
+}
+
+float startup_elapsed_ms(void) {
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startup_start).count();
+}
+
+void startup_mark(const char* label) {
+	float ms = startup_elapsed_ms();
+
+	std::lock_guard<std::mutex> lock(startup_mutex);
+
+	if (startup_count == STARTUP_MAX_MARKS) {
+		return;
+	}
+
+	startup_entry entry = {label, ms, std::this_thread::get_id() == startup_main_thread};
+	startup_entries[startup_count++] = entry;
+}
+
+void startup_report(void) {
+	std::lock_guard<std::mutex> lock(startup_mutex);
+
+	/* Worker marks land whenever the workers finish, put everything back in time order. */
+	std::stable_sort(startup_entries, startup_entries + startup_count, [](const startup_entry& a, const startup_entry& b) { return a.ms < b.ms; });
+
+	printf("[startup] timeline :\n");
+
+	for (int i = 0; i < startup_count; i++) {
+		printf("[startup] %8.1f ms  %-6s  %s\n", startup_entries[i].ms, startup_entries[i].main_thread ? "main" : "worker", startup_entries[i].label);
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+ * Startup timeline.
+ * Startup runs on the main thread and a few workers at once, so instead of timing steps one after another every step marks when it
+ *	finished, on whichever thread it ran. startup_report() prints the marks in order with the thread each came from.
+ */
+
+#define STARTUP_MAX_MARKS 64
+
+void startup_begin(void); // On the main thread, as early as possible. Marks are relative to this.
+void startup_mark(const char* label); // Any thread. label must outlive the report (a literal).
+float startup_elapsed_ms(void);
+void startup_report(void);
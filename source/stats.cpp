@@ -0,0 +1,59 @@
+/*
+ * Particle statistics decoding. See stats.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "stats.h"
+
+void stats_decode(const float* texels, particle_stats* stats) {
+	const float* sums = texels + 4 * STATS_ROW_SUMS;
+	const float* motion = texels + 4 * STATS_ROW_MOTION;
+	const float* maxima = texels + 4 * STATS_ROW_BOUNDS;
+	const float* peaks = texels + 4 * STATS_ROW_PEAKS;
+
+	memset(stats, 0, sizeof *stats);
+
+	/* Counts were summed as floats, which is exact up to 2^24 : plenty for the particle counts we run. */
+	stats->count = (unsigned int) (sums[0] + 0.5f);
+	stats->near_mouse = (unsigned int) (motion[0] + 0.5f);
+
+	for (int i = 0; i < STATS_HISTOGRAM_BINS; i++) {
+		stats->histogram[i] = (unsigned int) (texels[4 * (STATS_ROW_HISTOGRAM + i)] + 0.5f);
+	}
+
+	if (!stats->count) {
+		return;
+	}
+
+	float inverse = 1.0f / sums[0];
+
+	stats->bounds[0] = -maxima[2];
+	stats->bounds[1] = maxima[0];
+	stats->bounds[2] = -maxima[3];
+	stats->bounds[3] = maxima[1];
+
+	stats->centroid[0] = sums[1] * inverse;
+	stats->centroid[1] = sums[2] * inverse;
+	stats->kinetic_energy = sums[3];
+
+	stats->mean_speed = motion[1] * inverse;
+	stats->max_speed = peaks[0];
+	stats->mean_velocity[0] = motion[2] * inverse;
+	stats->mean_velocity[1] = motion[3] * inverse;
+}
+
+void stats_print(const particle_stats* stats, float speed_max) {
+	printf("[stats] %u particles in [%.3f, %.3f] x [%.3f, %.3f], centroid (%.3f, %.3f), kinetic energy %.4g, mean speed %.3g, max speed %.3g, %u near the mouse\n",
+		stats->count, stats->bounds[0], stats->bounds[1], stats->bounds[2], stats->bounds[3], stats->centroid[0], stats->centroid[1],
+		stats->kinetic_energy, stats->mean_speed, stats->max_speed, stats->near_mouse);
+
+	printf("[stats] speed histogram (bins of %.3g) :", speed_max / STATS_HISTOGRAM_BINS);
+
+	for (int i = 0; i < STATS_HISTOGRAM_BINS; i++) {
+		printf(" %u", stats->histogram[i]);
+	}
+
+	printf("\n");
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Whole-population particle statistics, reduced on the GPU so only a few hundred bytes per frame come back (see update_stats() in main.cpp).
+ * The reduction ends in STATS_ROWS RGBA32F texels, one per row :
+ *	STATS_ROW_SUMS      count, sum of x, sum of y, sum of v^2 / 2
+ *	STATS_ROW_MOTION    particles near the mouse, sum of speed, sum of vx, sum of vy
+ *	STATS_ROW_BOUNDS    maxima of x, y, -x and -y
+ *	STATS_ROW_PEAKS     maxima of speed, |vx| and |vy|
+ *	STATS_ROW_HISTOGRAM and on, one particle count per speed bin in .x
+ * The bounds and peaks rows are folded with max, the others summed. This file only decodes them, it doesn't touch GL.
+ */
+
+#define STATS_HISTOGRAM_BINS 16
+
+enum {
+	STATS_ROW_SUMS = 0,
+	STATS_ROW_MOTION,
+	STATS_ROW_BOUNDS,
+	STATS_ROW_PEAKS,
+	STATS_ROW_HISTOGRAM,
+	STATS_ROWS = STATS_ROW_HISTOGRAM + STATS_HISTOGRAM_BINS
+};
+
+struct particle_stats {
+	unsigned int count;
+	float bounds[4]; // min x, max x, min y, max y : the same order as the camera bounds.
+	float centroid[2];
+	float kinetic_energy; // Unit mass, in world units per step.
+	float mean_speed;
+	float max_speed;
+	float mean_velocity[2];
+	unsigned int near_mouse;
+	unsigned int histogram[STATS_HISTOGRAM_BINS]; // Even bins up to the speed_max given to the reduction, the last one takes the rest.
+};
+
+void stats_decode(const float* texels, particle_stats* stats); // texels is STATS_ROWS * 4 floats.
+void stats_print(const particle_stats* stats, float speed_max);
@@ -0,0 +1,252 @@
+/*
+ * Sample reader of the shared memory particle ring, see publish.h and 'make subscribe'. Builds without GL.
+ *
+ *	particles-subscribe [--name n] [--frames k] [--copy] [--poll-us p]
+ *	particles-subscribe --produce [--name n] [--count c] [--rate hz] [--frames k]
+ *
+ * Waits for each new frame and works out the centroid and mean speed of the particles in it, in place in the ring (or on a copy with
+ *	--copy), then prints how far behind it saw each frame : from when the state was computed (simulation to reader) and from when its copy
+ *	into the ring was done (ring to reader). Frames the writer got through faster than we polled are counted as missed, reads the writer
+ *	came round to in the middle as torn.
+ *
+ * --produce publishes the CPU engine's state at a fixed rate instead, the same way the particles binary does with SIMULATION_ENGINE_CPU,
+ *	for trying readers out on a machine without GL.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+#include "cpu_engine.h"
+#include "forces.h"
+#include "publish.h"
+
+struct subscribe_options {
+	const char* name;
+	unsigned int frames;
+	bool copy;
+	int poll_us;
+	bool produce;
+	unsigned int count;
+	int rate;
+};
+
+static double subscribe_percentile(std::vector<double>* values, double fraction) {
+	if (values->empty()) {
+		return 0.0;
+	}
+
+	size_t index = (size_t) (fraction * (values->size() - 1) + 0.5);
+	std::nth_element(values->begin(), values->begin() + index, values->end());
+
+	return (*values)[index];
+}
+
+static int subscribe_produce(const subscribe_options* options) {
+	float ratio = 1366.0f / 768.0f;
+	float bounds[4] = {-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f};
+
+	parallel_initialize(0);
+	cpu_engine_initialize(options->count, bounds);
+
+	float* particles = cpu_engine_particles();
+	srand(1);
+
+	for (unsigned int i = 0; i < options->count * 4; i += 4) {
+		particles[i] = bounds[0] + (bounds[1] - bounds[0]) * ((float) rand() / (float) RAND_MAX);
+		particles[i + 1] = bounds[2] + (bounds[3] - bounds[2]) * ((float) rand() / (float) RAND_MAX);
+		particles[i + 2] = particles[i + 3] = 0.0f;
+	}
+
+	if (!publish_initialize(options->name, options->count, 4)) {
+		return 1;
+	}
+
+	std::chrono::steady_clock::duration period = std::chrono::microseconds(1000000 / options->rate);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	double publish_ms = 0.0;
+
+	for (unsigned int frame = 0; frame < options->frames; frame++) {
+		float angle = (float) frame * 0.02f;
+
+		forces_clear_attractors();
+		forces_add_attractor(cosf(angle) * 0.3f, sinf(angle) * 0.3f, 0.5f, 0.01f);
+
+		cpu_engine_step(options->count);
+
+		uint64_t produced = publish_clock_ns();
+		publish_frame(cpu_engine_particles(), options->count, produced);
+		publish_ms += (publish_clock_ns() - produced) / 1e6;
+
+		next += period;
+		std::this_thread::sleep_until(next);
+	}
+
+	printf("[subscribe] published %u frames of %u particles, %.3f ms per copy into the ring\n", options->frames, options->count,
+		publish_ms / options->frames);
+
+	publish_shutdown();
+	cpu_engine_shutdown();
+	parallel_shutdown();
+
+	return 0;
+}
+
+static int subscribe_read(const subscribe_options* options) {
+	publish_reader reader;
+
+	while (!publish_open(options->name, &reader)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(500)); // Started before the writer.
+	}
+
+	printf("[subscribe] %s : %u slots of %u particles, reading %s\n", options->name, reader.header->slots, reader.header->capacity,
+		options->copy ? "copies" : "in place");
+
+	std::vector<float> copy(options->copy ? (size_t) reader.header->capacity * 4 : 0);
+	std::vector<double> simulation_latency, ring_latency;
+	uint64_t last_frame = 0;
+	bool first = true;
+	unsigned int seen = 0, missed = 0, torn = 0;
+	double centroid[2] = {0.0}, mean_speed = 0.0;
+
+	while (seen < options->frames) {
+		uint64_t latest = reader.header->latest.load(std::memory_order_acquire);
+
+		if (!latest || (!first && latest - 1 == last_frame)) {
+			std::this_thread::sleep_for(std::chrono::microseconds(options->poll_us));
+			continue;
+		}
+
+		publish_slot info;
+		const float* particles;
+		uint64_t sequence = 0;
+		const publish_slot* slot = NULL;
+
+		if (options->copy) {
+			unsigned int retries = 0;
+
+			if (!publish_read(&reader, copy.data(), reader.header->capacity, &info, &retries)) {
+				torn += retries;
+				continue;
+			}
+
+			torn += retries;
+			particles = copy.data();
+		} else {
+			slot = publish_peek(&reader, &sequence);
+
+			if (!slot) {
+				torn++;
+				continue;
+			}
+
+			info.frame = slot->frame;
+			info.produced_ns = slot->produced_ns;
+			info.published_ns = slot->published_ns;
+			info.count = slot->count < reader.header->capacity ? slot->count : reader.header->capacity;
+			particles = publish_particles(slot);
+		}
+
+		double sum[3] = {0.0};
+
+		for (unsigned int i = 0; i < info.count; i++) {
+			sum[0] += particles[i * 4];
+			sum[1] += particles[i * 4 + 1];
+			sum[2] += sqrt((double) particles[i * 4 + 2] * particles[i * 4 + 2] + (double) particles[i * 4 + 3] * particles[i * 4 + 3]);
+		}
+
+		/* In place, the numbers only count if the writer didn't come round to the slot while we were adding them up. */
+		if (slot && !publish_valid(slot, sequence)) {
+			torn++;
+			continue;
+		}
+
+		uint64_t now = publish_clock_ns();
+
+		if (!first && info.frame > last_frame + 1) {
+			missed += (unsigned int) (info.frame - last_frame - 1);
+		}
+
+		simulation_latency.push_back((now - info.produced_ns) / 1e3);
+		ring_latency.push_back((now - info.published_ns) / 1e3);
+
+		if (info.count) {
+			centroid[0] = sum[0] / info.count;
+			centroid[1] = sum[1] / info.count;
+			mean_speed = sum[2] / info.count;
+		}
+
+		last_frame = info.frame;
+		first = false;
+		seen++;
+	}
+
+	printf("[subscribe] %u frames seen, %u missed, %u torn reads retried, last centroid (%.4f, %.4f), mean speed %.6f\n", seen, missed, torn,
+		centroid[0], centroid[1], mean_speed);
+	printf("%-22s  %10s  %10s  %10s\n", "latency (us)", "p50", "p99", "max");
+	printf("%-22s  %10.1f  %10.1f  %10.1f\n", "simulation to reader", subscribe_percentile(&simulation_latency, 0.5),
+		subscribe_percentile(&simulation_latency, 0.99), subscribe_percentile(&simulation_latency, 1.0));
+	printf("%-22s  %10.1f  %10.1f  %10.1f\n", "ring to reader", subscribe_percentile(&ring_latency, 0.5), subscribe_percentile(&ring_latency, 0.99),
+		subscribe_percentile(&ring_latency, 1.0));
+
+	publish_close(&reader);
+	return 0;
+}
+
+static bool subscribe_parse(int argc, char** argv, subscribe_options* options) {
+	options->name = "particles";
+	options->frames = 600;
+	options->copy = false;
+	options->poll_us = 100;
+	options->produce = false;
+	options->count = 175000;
+	options->rate = 60;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--name") && has_value) {
+			options->name = argv[++i];
+		} else if (!strcmp(argv[i], "--frames") && has_value) {
+			options->frames = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--copy")) {
+			options->copy = true;
+		} else if (!strcmp(argv[i], "--poll-us") && has_value) {
+			options->poll_us = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--produce")) {
+			options->produce = true;
+		} else if (!strcmp(argv[i], "--count") && has_value) {
+			options->count = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--rate") && has_value) {
+			options->rate = atoi(argv[++i]);
+		} else {
+			printf("[subscribe] unexpected argument %s\n", argv[i]);
+			return false;
+		}
+	}
+
+	if (!options->frames || !options->count || options->rate < 1) {
+		printf("[subscribe] nothing to do\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	subscribe_options options;
+
+	if (!subscribe_parse(argc, argv, &options)) {
+		printf("usage : %s [--name n] [--frames k] [--copy] [--poll-us p]\n", argv[0]);
+		printf("        %s --produce [--name n] [--count c] [--rate hz] [--frames k]\n", argv[0]);
+		return 1;
+	}
+
+	return options.produce ? subscribe_produce(&options) : subscribe_read(&options);
+}
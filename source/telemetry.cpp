@@ -0,0 +1,434 @@
+/*
+ * Metrics endpoint implementation. See telemetry.h.
+ */
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "profiler.h"
+#include "telemetry.h"
+
+/* Frame time histogram bucket bounds in seconds, 60 and 30 fps sit on bucket edges. */
+static const double telemetry_bounds[] = {0.001, 0.002, 0.004, 0.008, 0.0167, 0.0334, 0.05, 0.1, 0.25};
+#define TELEMETRY_BUCKETS (sizeof telemetry_bounds / sizeof *telemetry_bounds)
+
+/* How often the server checks whether it should exit while idle. */
+#define TELEMETRY_POLL_MS 250
+
+static std::thread telemetry_thread;
+static std::atomic<bool> telemetry_exit(false);
+static bool telemetry_enabled = false;
+static int telemetry_listeners[2] = {-1, -1};
+static char telemetry_unix_path[108] = {0};
+
+/* Written by the render thread only, read by the server. */
+static std::atomic<unsigned long long> telemetry_buckets[TELEMETRY_BUCKETS + 1]; // Last one is +Inf.
+static std::atomic<unsigned long long> telemetry_frame_micros(0); // Sum of frame times, in microseconds so it can stay an integer.
+
+static std::atomic<float> telemetry_pass_ms[PROFILER_PASS_COUNT];
+static std::atomic<float> telemetry_total_ms(0.0f);
+
+static std::atomic<unsigned int> telemetry_live(0);
+static std::atomic<unsigned int> telemetry_active(0);
+
+/* Reduced particle statistics, see stats.h. */
+static std::atomic<bool> telemetry_stats_valid(false);
+static std::atomic<float> telemetry_stats_bounds[4];
+static std::atomic<float> telemetry_stats_centroid[2];
+static std::atomic<float> telemetry_stats_energy(0.0f);
+static std::atomic<float> telemetry_stats_speed_sum(0.0f);
+static std::atomic<float> telemetry_stats_speed_max(0.0f);
+static std::atomic<float> telemetry_stats_fastest(0.0f);
+static std::atomic<unsigned int> telemetry_stats_near_mouse(0);
+static std::atomic<unsigned int> telemetry_stats_histogram[STATS_HISTOGRAM_BINS];
+
+static const char* telemetry_buffer_names[TELEMETRY_MAX_BUFFERS];
+static std::atomic<unsigned long long> telemetry_buffer_bytes[TELEMETRY_MAX_BUFFERS];
+static std::atomic<int> telemetry_buffer_count(0);
+
+/* Counted by whichever thread issues the call (the threaded simulation uploads attractors and scenes too), published by telemetry_frame(). */
+static std::atomic<unsigned int> telemetry_frame_draws(0);
+static std::atomic<unsigned int> telemetry_frame_transfers(0);
+static std::atomic<unsigned int> telemetry_draws(0);
+static std::atomic<unsigned int> telemetry_transfers(0);
+static std::atomic<unsigned long long> telemetry_draws_total(0);
+static std::atomic<unsigned long long> telemetry_transfers_total(0);
+
+static void telemetry_append(std::string& page, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void telemetry_append(std::string& page, const char* format, ...) {
+	char line[256];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof line, format, args);
+	va_end(args);
+
+	page += line;
+}
+
+static std::string telemetry_page(void) {
+	std::string page;
+	page.reserve(4096);
+
+	page += "# HELP particles_frame_seconds Wall time between frames.\n# TYPE particles_frame_seconds histogram\n";
+
+	unsigned long long cumulative = 0;
+
+	for (size_t i = 0; i < TELEMETRY_BUCKETS; i++) {
+		cumulative += telemetry_buckets[i].load(std::memory_order_relaxed);
+		telemetry_append(page, "particles_frame_seconds_bucket{le=\"%g\"} %llu\n", telemetry_bounds[i], cumulative);
+	}
+
+	cumulative += telemetry_buckets[TELEMETRY_BUCKETS].load(std::memory_order_relaxed);
+
+	telemetry_append(page, "particles_frame_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+	telemetry_append(page, "particles_frame_seconds_sum %.6f\n", telemetry_frame_micros.load(std::memory_order_relaxed) / 1e6);
+	telemetry_append(page, "particles_frame_seconds_count %llu\n", cumulative);
+
+	page += "# HELP particles_gpu_pass_seconds Smoothed GPU time per pass, from the profiler's timer queries.\n# TYPE particles_gpu_pass_seconds gauge\n";
+
+	for (int i = 0; i < PROFILER_PASS_COUNT; i++) {
+		telemetry_append(page, "particles_gpu_pass_seconds{pass=\"%s\"} %.6f\n", profiler_pass_name(i), telemetry_pass_ms[i].load(std::memory_order_relaxed) / 1000.0);
+	}
+
+	telemetry_append(page, "particles_gpu_frame_seconds %.6f\n", telemetry_total_ms.load(std::memory_order_relaxed) / 1000.0);
+
+	page += "# HELP particles_live Particles advanced and drawn.\n# TYPE particles_live gauge\n";
+	telemetry_append(page, "particles_live %u\n", telemetry_live.load(std::memory_order_relaxed));
+
+	page += "# HELP particles_active Live particles that are awake.\n# TYPE particles_active gauge\n";
+	telemetry_append(page, "particles_active %u\n", telemetry_active.load(std::memory_order_relaxed));
+
+	if (telemetry_stats_valid.load(std::memory_order_relaxed)) {
+		static const char* edges[4] = {"min_x", "max_x", "min_y", "max_y"};
+
+		page += "# HELP particles_bounds Bounding box of the live particles, in world units.\n# TYPE particles_bounds gauge\n";
+
+		for (int i = 0; i < 4; i++) {
+			telemetry_append(page, "particles_bounds{edge=\"%s\"} %g\n", edges[i], telemetry_stats_bounds[i].load(std::memory_order_relaxed));
+		}
+
+		page += "# HELP particles_centroid Mean position of the live particles.\n# TYPE particles_centroid gauge\n";
+		telemetry_append(page, "particles_centroid{axis=\"x\"} %g\n", telemetry_stats_centroid[0].load(std::memory_order_relaxed));
+		telemetry_append(page, "particles_centroid{axis=\"y\"} %g\n", telemetry_stats_centroid[1].load(std::memory_order_relaxed));
+
+		page += "# HELP particles_kinetic_energy Sum of v^2 / 2 over the live particles, unit mass.\n# TYPE particles_kinetic_energy gauge\n";
+		telemetry_append(page, "particles_kinetic_energy %g\n", telemetry_stats_energy.load(std::memory_order_relaxed));
+
+		page += "# HELP particles_max_speed Speed of the fastest live particle, world units per step.\n# TYPE particles_max_speed gauge\n";
+		telemetry_append(page, "particles_max_speed %g\n", telemetry_stats_fastest.load(std::memory_order_relaxed));
+
+		page += "# HELP particles_near_mouse Live particles within reach of the mouse.\n# TYPE particles_near_mouse gauge\n";
+		telemetry_append(page, "particles_near_mouse %u\n", telemetry_stats_near_mouse.load(std::memory_order_relaxed));
+
+		/* A snapshot of the last frame rather than a running count, but the histogram type still fits it best. */
+		page += "# HELP particles_speed Particle speeds in the last reduced frame, world units per step.\n# TYPE particles_speed histogram\n";
+
+		float speed_max = telemetry_stats_speed_max.load(std::memory_order_relaxed);
+		unsigned long long particles = 0;
+
+		for (int i = 0; i < STATS_HISTOGRAM_BINS - 1; i++) {
+			particles += telemetry_stats_histogram[i].load(std::memory_order_relaxed);
+			telemetry_append(page, "particles_speed_bucket{le=\"%g\"} %llu\n", speed_max * (i + 1) / STATS_HISTOGRAM_BINS, particles);
+		}
+
+		particles += telemetry_stats_histogram[STATS_HISTOGRAM_BINS - 1].load(std::memory_order_relaxed);
+
+		telemetry_append(page, "particles_speed_bucket{le=\"+Inf\"} %llu\n", particles);
+		telemetry_append(page, "particles_speed_sum %g\n", telemetry_stats_speed_sum.load(std::memory_order_relaxed));
+		telemetry_append(page, "particles_speed_count %llu\n", particles);
+	}
+
+	page += "# HELP particles_gpu_buffer_bytes GPU memory allocated, by buffer.\n# TYPE particles_gpu_buffer_bytes gauge\n";
+
+	int buffers = telemetry_buffer_count.load(std::memory_order_acquire);
+
+	for (int i = 0; i < buffers; i++) {
+		telemetry_append(page, "particles_gpu_buffer_bytes{buffer=\"%s\"} %llu\n", telemetry_buffer_names[i], telemetry_buffer_bytes[i].load(std::memory_order_relaxed));
+	}
+
+	page += "# HELP particles_gl_calls GL draw and transfer calls in the last frame.\n# TYPE particles_gl_calls gauge\n";
+	telemetry_append(page, "particles_gl_calls{kind=\"draw\"} %u\n", telemetry_draws.load(std::memory_order_relaxed));
+	telemetry_append(page, "particles_gl_calls{kind=\"transfer\"} %u\n", telemetry_transfers.load(std::memory_order_relaxed));
+
+	page += "# HELP particles_gl_calls_total GL draw and transfer calls since startup.\n# TYPE particles_gl_calls_total counter\n";
+	telemetry_append(page, "particles_gl_calls_total{kind=\"draw\"} %llu\n", telemetry_draws_total.load(std::memory_order_relaxed));
+	telemetry_append(page, "particles_gl_calls_total{kind=\"transfer\"} %llu\n", telemetry_transfers_total.load(std::memory_order_relaxed));
+
+	return page;
+}
+
+static void telemetry_serve(int client) {
+	/* Whatever was asked for gets the metrics page, but wait (briefly) for the request so the client doesn't see a reset. */
+	struct pollfd readable = {client, POLLIN, 0};
+
+	if (poll(&readable, 1, 1000) > 0) {
+		char request[1024];
+		ssize_t got = recv(client, request, sizeof request, 0);
+		(void) got;
+	}
+
+	std::string body = telemetry_page();
+
+	char header[160];
+	int header_length = snprintf(header, sizeof header,
+		"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+
+	std::string response = std::string(header, header_length) + body;
+	size_t sent = 0;
+
+	while (sent < response.size()) {
+		ssize_t wrote = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+
+		if (wrote <= 0) {
+			break;
+		}
+
+		sent += wrote;
+	}
+
+	close(client);
+}
+
+static void telemetry_run(void) {
+	struct pollfd listeners[2];
+	int count = 0;
+
+	for (int i = 0; i < 2; i++) {
+		if (telemetry_listeners[i] >= 0) {
+			listeners[count].fd = telemetry_listeners[i];
+			listeners[count].events = POLLIN;
+			count++;
+		}
+	}
+
+	while (!telemetry_exit.load()) {
+		if (poll(listeners, count, TELEMETRY_POLL_MS) <= 0) {
+			continue;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (listeners[i].revents & POLLIN) {
+				int client = accept(listeners[i].fd, NULL, NULL);
+
+				if (client >= 0) {
+					telemetry_serve(client);
+				}
+			}
+		}
+	}
+}
+
+static int telemetry_listen_tcp(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof address);
+
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local scrapers only.
+
+	if (bind(fd, (struct sockaddr*) &address, sizeof address) < 0 || listen(fd, 4) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int telemetry_listen_unix(const char* path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof address);
+
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof address.sun_path, "%s", path);
+
+	unlink(path); // Left over from a crashed run.
+
+	if (bind(fd, (struct sockaddr*) &address, sizeof address) < 0 || listen(fd, 4) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+bool telemetry_initialize(int port, const char* unix_path) {
+	for (size_t i = 0; i <= TELEMETRY_BUCKETS; i++) {
+		telemetry_buckets[i] = 0;
+	}
+
+	for (int i = 0; i < PROFILER_PASS_COUNT; i++) {
+		telemetry_pass_ms[i] = 0.0f;
+	}
+
+	if (!port && !unix_path) {
+		return true;
+	}
+
+	if (port) {
+		telemetry_listeners[0] = telemetry_listen_tcp(port);
+
+		if (telemetry_listeners[0] < 0) {
+			printf("[telemetry_initialize] failed to listen on 127.0.0.1:%d\n", port);
+			return false;
+		}
+
+		printf("[telemetry_initialize] serving metrics on http://127.0.0.1:%d/metrics\n", port);
+	}
+
+	if (unix_path) {
+		telemetry_listeners[1] = telemetry_listen_unix(unix_path);
+
+		if (telemetry_listeners[1] < 0) {
+			printf("[telemetry_initialize] failed to listen on %s\n", unix_path);
+			telemetry_shutdown();
+			return false;
+		}
+
+		snprintf(telemetry_unix_path, sizeof telemetry_unix_path, "%s", unix_path);
+		printf("[telemetry_initialize] serving metrics on %s\n", unix_path);
+	}
+
+	telemetry_enabled = true;
+	telemetry_exit = false;
+	telemetry_thread = std::thread(telemetry_run);
+
+	return true;
+}
+
+void telemetry_shutdown(void) {
+	if (telemetry_thread.joinable()) {
+		telemetry_exit = true;
+		telemetry_thread.join();
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (telemetry_listeners[i] >= 0) {
+			close(telemetry_listeners[i]);
+			telemetry_listeners[i] = -1;
+		}
+	}
+
+	if (telemetry_unix_path[0]) {
+		unlink(telemetry_unix_path);
+		telemetry_unix_path[0] = 0;
+	}
+
+	telemetry_enabled = false;
+}
+
+void telemetry_frame(float frame_seconds) {
+	/* Taken with an exchange, so calls from the simulation thread in between land in this frame or the next one, never in neither. */
+	unsigned int draws = telemetry_frame_draws.exchange(0, std::memory_order_relaxed);
+	unsigned int transfers = telemetry_frame_transfers.exchange(0, std::memory_order_relaxed);
+
+	if (!telemetry_enabled) {
+		return;
+	}
+
+	size_t bucket = 0;
+
+	while (bucket < TELEMETRY_BUCKETS && frame_seconds > telemetry_bounds[bucket]) {
+		bucket++;
+	}
+
+	/* Only this thread writes, relaxed increments are all the server needs. */
+	telemetry_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	telemetry_frame_micros.fetch_add((unsigned long long) (frame_seconds * 1e6f), std::memory_order_relaxed);
+
+	for (int i = 0; i < PROFILER_PASS_COUNT; i++) {
+		telemetry_pass_ms[i].store(profiler_pass_ms(i), std::memory_order_relaxed);
+	}
+
+	telemetry_total_ms.store(profiler_total_ms(), std::memory_order_relaxed);
+
+	telemetry_draws.store(draws, std::memory_order_relaxed);
+	telemetry_transfers.store(transfers, std::memory_order_relaxed);
+	telemetry_draws_total.fetch_add(draws, std::memory_order_relaxed);
+	telemetry_transfers_total.fetch_add(transfers, std::memory_order_relaxed);
+}
+
+void telemetry_set_particles(unsigned int live, unsigned int active) {
+	telemetry_live.store(live, std::memory_order_relaxed);
+	telemetry_active.store(active, std::memory_order_relaxed);
+}
+
+void telemetry_set_stats(const particle_stats* stats, float speed_max) {
+	if (!telemetry_enabled) {
+		return;
+	}
+
+	/* The fields can be read mid-update, which is no worse than a scrape landing a frame earlier or later. */
+	for (int i = 0; i < 4; i++) {
+		telemetry_stats_bounds[i].store(stats->bounds[i], std::memory_order_relaxed);
+	}
+
+	telemetry_stats_centroid[0].store(stats->centroid[0], std::memory_order_relaxed);
+	telemetry_stats_centroid[1].store(stats->centroid[1], std::memory_order_relaxed);
+	telemetry_stats_energy.store(stats->kinetic_energy, std::memory_order_relaxed);
+	telemetry_stats_speed_sum.store(stats->mean_speed * stats->count, std::memory_order_relaxed);
+	telemetry_stats_speed_max.store(speed_max, std::memory_order_relaxed);
+	telemetry_stats_fastest.store(stats->max_speed, std::memory_order_relaxed);
+	telemetry_stats_near_mouse.store(stats->near_mouse, std::memory_order_relaxed);
+
+	for (int i = 0; i < STATS_HISTOGRAM_BINS; i++) {
+		telemetry_stats_histogram[i].store(stats->histogram[i], std::memory_order_relaxed);
+	}
+
+	telemetry_stats_valid.store(true, std::memory_order_relaxed);
+}
+
+void telemetry_set_buffer(const char* name, unsigned long long bytes) {
+	int count = telemetry_buffer_count.load(std::memory_order_relaxed);
+
+	for (int i = 0; i < count; i++) {
+		if (telemetry_buffer_names[i] == name || !strcmp(telemetry_buffer_names[i], name)) {
+			telemetry_buffer_bytes[i].store(bytes, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	if (count == TELEMETRY_MAX_BUFFERS) {
+		return;
+	}
+
+	/* Fill the slot in before publishing the new count, the server never sees half a registration. */
+	telemetry_buffer_names[count] = name;
+	telemetry_buffer_bytes[count].store(bytes, std::memory_order_relaxed);
+	telemetry_buffer_count.store(count + 1, std::memory_order_release);
+}
+
+void telemetry_draw_call(void) {
+	telemetry_frame_draws.fetch_add(1, std::memory_order_relaxed);
+}
+
+void telemetry_transfer_call(void) {
+	telemetry_frame_transfers.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+ * Live metrics in the Prometheus text format, served over HTTP on a localhost TCP port or a Unix domain socket.
+ *
+ * Everything the render thread reports goes into atomics (or plain per-frame counters it alone touches, published with telemetry_frame()),
+ *	and the server thread formats a page from them whenever it is scraped. Nothing on the render side ever takes a lock or waits on a
+ *	scrape, so a slow or stuck client can't cause a frame hitch.
+ */
+
+#include "stats.h"
+
+#define TELEMETRY_MAX_BUFFERS 32
+
+/* Port 0 and a NULL path disables the endpoint, all the other calls are then cheap no-ops. Both may be given. */
+bool telemetry_initialize(int port, const char* unix_path);
+void telemetry_shutdown(void);
+
+/* Once per frame, after profiler_frame(). Publishes the per-frame counters and reads the smoothed pass timings from the profiler. */
+void telemetry_frame(float frame_seconds);
+
+void telemetry_set_particles(unsigned int live, unsigned int active);
+
+/* The latest reduced statistics, speed_max being the top of the histogram. Nothing about them is exported until the first call. */
+void telemetry_set_stats(const particle_stats* stats, float speed_max);
+
+/* GPU memory, by buffer. name must outlive the program (a literal), the first call with a new name registers it. */
+void telemetry_set_buffer(const char* name, unsigned long long bytes);
+
+/* GL calls worth counting : draws (and blits), and transfers (uploads, copies, maps, readbacks). State changes aren't counted. Any thread. */
+void telemetry_draw_call(void);
+void telemetry_transfer_call(void);
@@ -0,0 +1,299 @@
+/*
+ * Differential check of the GPU advance against the CPU engine, see 'make validate'. Built on libparticles.a like any other host.
+ *
+ *	particles-validate [--count n] [--steps k] [--seed s] [--integrator euler|verlet|adaptive] [--dt t] [--wrap] [--lockstep]
+ *		[--max-abs e] [--max-ulp u]
+ *
+ * Both sides start from the same seeded particles and replay the same attractor script (an orbiter, and a mouse that is held down for the
+ *	middle half of the run), then every component of every particle is compared : largest and mean absolute error, and the same in ULPs.
+ *	The exit status is 1 when a maximum is over its threshold (0 disables one), or when anything came out NaN on one side only, and 2 when
+ *	there was no GPU side to compare : no context, or an advance program that didn't build.
+ *
+ * Errors compound over free running steps, and near an attractor a few ULPs become visible drift quickly. --lockstep copies the CPU state
+ *	over the GPU one after every step and keeps the worst step instead, which isolates what a single advance pass does.
+ *
+ * It needs a GL 3.3 context but draws nothing, so a hidden window on a software rasterizer is enough (LIBGL_ALWAYS_SOFTWARE=1 for llvmpipe).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+#include <GLXW/glxw.h>
+#include <GLFW/glfw3.h>
+
+#include "parallel.h"
+#include "cpu_engine.h"
+#include "forces.h"
+#include "particle_system.h"
+
+#define VALIDATE_ORBIT_RADIUS 0.3f
+#define VALIDATE_SOFTENING 0.01f
+
+static const char* validate_components[4] = {"x", "y", "vx", "vy"};
+
+struct validate_options {
+	unsigned int count;
+	int steps;
+	unsigned int seed;
+	int integrator;
+	float dt;
+	bool wrap;
+	bool lockstep;
+	double max_abs;
+	double max_ulp;
+};
+
+struct validate_error {
+	double max_abs[4];
+	double sum_abs[4];
+	double max_ulp[4];
+	double sum_ulp[4];
+	unsigned long long samples;
+	unsigned int nan_mismatches;
+};
+
+static int64_t validate_ordered(float value) {
+	/* Float bits as an integer that counts up with the value, so the difference of two is their distance in ULPs. */
+	int32_t bits;
+	memcpy(&bits, &value, sizeof bits);
+
+	return bits < 0 ? (int64_t) INT32_MIN - bits : bits;
+}
+
+static void validate_compare(const float* gpu, const float* cpu, unsigned int count, validate_error* error) {
+	for (unsigned int i = 0; i < count; i++) {
+		for (int c = 0; c < 4; c++) {
+			float a = gpu[i * 4 + c], b = cpu[i * 4 + c];
+
+			if (std::isnan(a) || std::isnan(b)) {
+				error->nan_mismatches += std::isnan(a) != std::isnan(b);
+				continue;
+			}
+
+			double abs_error = fabs((double) a - (double) b);
+			double ulp_error = (double) llabs(validate_ordered(a) - validate_ordered(b));
+
+			error->max_abs[c] = abs_error > error->max_abs[c] ? abs_error : error->max_abs[c];
+			error->max_ulp[c] = ulp_error > error->max_ulp[c] ? ulp_error : error->max_ulp[c];
+			error->sum_abs[c] += abs_error;
+			error->sum_ulp[c] += ulp_error;
+		}
+	}
+
+	error->samples += count;
+}
+
+static void validate_script(int step, int steps, particle_system* particles) {
+	/* Same attractors on both sides. The orbiter circles the centre, the mouse sits off to one side while held. */
+	float angle = (float) step * 0.02f;
+
+	forces_clear_attractors();
+	particles->clear_attractors();
+
+	forces_add_attractor(cosf(angle) * VALIDATE_ORBIT_RADIUS, sinf(angle) * VALIDATE_ORBIT_RADIUS, 0.5f, VALIDATE_SOFTENING);
+	particles->add_attractor(cosf(angle) * VALIDATE_ORBIT_RADIUS, sinf(angle) * VALIDATE_ORBIT_RADIUS, 0.5f, VALIDATE_SOFTENING);
+
+	if (step >= steps / 4 && step < steps * 3 / 4) {
+		forces_add_attractor(0.2f, -0.1f, 1.0f, VALIDATE_SOFTENING);
+		particles->add_attractor(0.2f, -0.1f, 1.0f, VALIDATE_SOFTENING);
+	}
+}
+
+static bool validate_parse(int argc, char** argv, validate_options* options) {
+	options->count = 10000;
+	options->steps = 120;
+	options->seed = 1;
+	options->integrator = INTEGRATOR_EULER;
+	options->dt = 1.0f;
+	options->wrap = false;
+	options->lockstep = false;
+	options->max_abs = 1e-4;
+	options->max_ulp = 0.0;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--count") && has_value) {
+			options->count = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--steps") && has_value) {
+			options->steps = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && has_value) {
+			options->seed = (unsigned int) atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--integrator") && has_value) {
+			i++;
+			options->integrator = -1;
+
+			for (int integrator = 0; integrator < INTEGRATORS; integrator++) {
+				if (!strcmp(argv[i], variants_integrator_name(integrator))) {
+					options->integrator = integrator;
+				}
+			}
+
+			if (options->integrator < 0) {
+				printf("[validate] unknown integrator %s\n", argv[i]);
+				return false;
+			}
+		} else if (!strcmp(argv[i], "--dt") && has_value) {
+			options->dt = (float) atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--wrap")) {
+			options->wrap = true;
+		} else if (!strcmp(argv[i], "--lockstep")) {
+			options->lockstep = true;
+		} else if (!strcmp(argv[i], "--max-abs") && has_value) {
+			options->max_abs = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--max-ulp") && has_value) {
+			options->max_ulp = atof(argv[++i]);
+		} else {
+			printf("[validate] unexpected argument %s\n", argv[i]);
+			return false;
+		}
+	}
+
+	if (!options->count || options->steps < 1 || options->dt <= 0.0f) {
+		printf("[validate] nothing to run\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	validate_options options;
+
+	if (!validate_parse(argc, argv, &options)) {
+		printf("usage : %s [--count n] [--steps k] [--seed s] [--integrator euler|verlet|adaptive] [--dt t] [--wrap] [--lockstep]"
+			" [--max-abs e] [--max-ulp u]\n", argv[0]);
+		return 1;
+	}
+
+	glfwInit();
+
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "particles-validate", NULL, NULL);
+
+	if (window == NULL) {
+		printf("[validate] GLFW failure\n");
+		return 2;
+	}
+
+	glfwMakeContextCurrent(window);
+
+	if (glxwInit() != 0) {
+		printf("[validate] GLXW failure\n");
+		return 2;
+	}
+
+	/* The advance draws have no attributes, but a core profile still wants a vertex array bound for them (Mesa enforces it). */
+	unsigned int vertex_array;
+	glGenVertexArrays(1, &vertex_array);
+	glBindVertexArray(vertex_array);
+
+	printf("[validate] %s, %s\n", (const char*) glGetString(GL_RENDERER), (const char*) glGetString(GL_VERSION));
+
+	/* Same seeded start for both : spread over the bounds, with a little velocity so the first steps aren't all alike. */
+	float ratio = 1366.0f / 768.0f;
+	float bounds[4] = {-ratio / 2.0f, ratio / 2.0f, -0.5f, 0.5f};
+	std::vector<float> start((size_t) options.count * 4);
+
+	srand(options.seed);
+
+	for (unsigned int i = 0; i < options.count; i++) {
+		start[i * 4] = bounds[0] + (bounds[1] - bounds[0]) * ((float) rand() / (float) RAND_MAX);
+		start[i * 4 + 1] = bounds[2] + (bounds[3] - bounds[2]) * ((float) rand() / (float) RAND_MAX);
+		start[i * 4 + 2] = 0.001f * ((float) rand() / (float) RAND_MAX - 0.5f);
+		start[i * 4 + 3] = 0.001f * ((float) rand() / (float) RAND_MAX - 0.5f);
+	}
+
+	parallel_initialize(0);
+
+	/* Neighbors and sleeping stay off : the neighbor sort reorders the particles, and the two are compared index by index. */
+	cpu_engine_initialize(options.count, bounds);
+	cpu_engine_set_neighbors(false, 0.004f, 0.0f);
+	cpu_engine_set_bounds(options.wrap);
+	cpu_engine_set_integrator(options.integrator, options.dt, 0.0002f, 8);
+	memcpy(cpu_engine_particles(), start.data(), sizeof(float) * start.size());
+
+	particle_system_config config;
+	particle_system_defaults(&config, options.count, bounds);
+
+	config.wrap = options.wrap;
+	config.integrator = options.integrator;
+	config.dt = options.dt;
+	config.tolerance = 0.0002f;
+	config.max_substeps = 8;
+
+	particle_system particles;
+
+	if (!particles.initialize(&config, start.data())) {
+		printf("[validate] no GPU advance program, nothing was compared\n");
+		return 2;
+	}
+
+	validate_error error;
+	memset(&error, 0, sizeof error);
+
+	for (int step = 0; step < options.steps; step++) {
+		validate_script(step, options.steps, &particles);
+
+		if (!particles.step(1)) {
+			printf("[validate] no GPU advance program at step %d, nothing was compared\n", step);
+			return 2;
+		}
+
+		cpu_engine_step(options.count);
+
+		if (!options.lockstep && step + 1 < options.steps) {
+			continue;
+		}
+
+		const float* gpu = particles.map_state(false);
+
+		if (!gpu) {
+			printf("[validate] failed to map the GPU state\n");
+			return 1;
+		}
+
+		validate_compare(gpu, cpu_engine_particles(), options.count, &error);
+		particles.unmap_state();
+
+		if (options.lockstep) {
+			particles.upload(cpu_engine_particles(), options.count);
+		}
+	}
+
+	printf("[validate] %u particles, %d steps of %.3f with %s%s%s\n", options.count, options.steps, options.dt,
+		variants_integrator_name(options.integrator), options.wrap ? ", wrapping" : "", options.lockstep ? ", lockstep" : "");
+	printf("%-9s  %12s  %12s  %10s  %10s\n", "component", "max abs", "mean abs", "max ulp", "mean ulp");
+
+	bool pass = error.nan_mismatches == 0;
+
+	for (int c = 0; c < 4; c++) {
+		printf("%-9s  %12.4e  %12.4e  %10.0f  %10.2f\n", validate_components[c], error.max_abs[c], error.sum_abs[c] / error.samples,
+			error.max_ulp[c], error.sum_ulp[c] / error.samples);
+
+		if (options.max_abs > 0.0 && error.max_abs[c] > options.max_abs) pass = false;
+		if (options.max_ulp > 0.0 && error.max_ulp[c] > options.max_ulp) pass = false;
+	}
+
+	if (error.nan_mismatches) {
+		printf("[validate] %u components are NaN on one side only\n", error.nan_mismatches);
+	}
+
+	printf("[validate] %s (max abs %g, max ulp %g)\n", pass ? "pass" : "FAIL", options.max_abs, options.max_ulp);
+
+	particles.shutdown();
+	glDeleteVertexArrays(1, &vertex_array);
+	cpu_engine_shutdown();
+	parallel_shutdown();
+
+	glfwTerminate();
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+/*
+ * Shader variant keys and program cache. See variants.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <mutex>
+
+#include "variants.h"
+
+struct variant_entry {
+	variant_key key;
+	unsigned int program;
+};
+
+struct variant_constant {
+	int kind;
+	const char* name;
+	const char* type;
+	int first;
+	int size;
+};
+
+static const char* variant_feature_names[] = {
+	"VARIANT_ATTRACTORS",
+	"VARIANT_FIELD",
+	"VARIANT_NEIGHBORS",
+	"VARIANT_BOUNDS_WRAP",
+	"VARIANT_NBODY",
+	"VARIANT_SCENE_MOUSE",
+	"VARIANT_SCENE_FOLDED",
+	"VARIANT_CULLED",
+	"VARIANT_VERLET",
+	"VARIANT_ADAPTIVE",
+	"VARIANT_ATTRIBUTES",
+};
+
+static const char* variant_integrator_names[INTEGRATORS] = {"euler", "verlet", "adaptive"};
+
+static const variant_constant variant_constants[] = {
+	{VARIANT_ADVANCE, "SCENE_BOUNDS", "vec4", 0, 4},
+	{VARIANT_ADVANCE, "SCENE_MOTION", "vec3", 4, 3},
+	{VARIANT_RENDER, "PARTICLE_DIM", "float", 0, 1},
+};
+
+static std::vector<variant_entry> variant_cache;
+static std::mutex variant_mutex;
+
+static bool variant_equal(const variant_key* a, const variant_key* b) {
+	if (a->kind != b->kind || a->features != b->features) {
+		return false;
+	}
+
+	for (int i = 0; i < VARIANT_MAX_CONSTANTS; i++) {
+		if (a->constants[i] != b->constants[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void variants_key(variant_key* key, int kind, unsigned int features) {
+	memset(key, 0, sizeof *key);
+
+	key->kind = kind;
+	key->features = features;
+}
+
+unsigned int variants_integrator_features(int integrator) {
+	switch (integrator) {
+		case INTEGRATOR_VERLET: return VARIANT_VERLET;
+		case INTEGRATOR_ADAPTIVE: return VARIANT_ADAPTIVE;
+		default: return 0;
+	}
+}
+
+const char* variants_integrator_name(int integrator) {
+	return integrator >= 0 && integrator < INTEGRATORS ? variant_integrator_names[integrator] : "unknown";
+}
+
+void variants_defines(const variant_key* key, char* out, int size) {
+	int length = 0;
+	out[0] = 0;
+
+	for (unsigned int bit = 0; bit < sizeof variant_feature_names / sizeof variant_feature_names[0]; bit++) {
+		if (key->features & (1u << bit) && length < size) {
+			length += snprintf(out + length, size - length, "#define %s 1\n", variant_feature_names[bit]);
+		}
+	}
+
+	/* Exponent notation always reads back as the exact float, and is a float literal to GLSL. */
+	for (unsigned int c = 0; c < sizeof variant_constants / sizeof variant_constants[0]; c++) {
+		const variant_constant* constant = &variant_constants[c];
+
+		if (constant->kind != key->kind || length >= size) {
+			continue;
+		}
+
+		length += snprintf(out + length, size - length, "#define %s %s(", constant->name, constant->type);
+
+		for (int i = 0; i < constant->size && length < size; i++) {
+			length += snprintf(out + length, size - length, i ? ", %.9e" : "%.9e", key->constants[constant->first + i]);
+		}
+
+		if (length < size) {
+			length += snprintf(out + length, size - length, ")\n");
+		}
+	}
+
+	if (length >= size) {
+		printf("[variants_defines] defines truncated at %d bytes\n", size);
+	}
+}
+
+unsigned int variants_find(const variant_key* key) {
+	std::lock_guard<std::mutex> lock(variant_mutex);
+
+	for (size_t i = 0; i < variant_cache.size(); i++) {
+		if (variant_equal(&variant_cache[i].key, key)) {
+			return variant_cache[i].program;
+		}
+	}
+
+	return 0;
+}
+
+void variants_insert(const variant_key* key, unsigned int program) {
+	std::lock_guard<std::mutex> lock(variant_mutex);
+
+	variant_entry entry;
+	entry.key = *key;
+	entry.program = program;
+
+	variant_cache.push_back(entry);
+}
+
+unsigned int variants_replace(const variant_key* key, unsigned int program) {
+	std::lock_guard<std::mutex> lock(variant_mutex);
+
+	for (size_t i = 0; i < variant_cache.size(); i++) {
+		if (variant_equal(&variant_cache[i].key, key)) {
+			unsigned int old = variant_cache[i].program;
+			variant_cache[i].program = program;
+
+			return old;
+		}
+	}
+
+	variant_entry entry;
+	entry.key = *key;
+	entry.program = program;
+
+	variant_cache.push_back(entry);
+	return 0;
+}
+
+int variants_keys(int kind, variant_key* keys, int capacity) {
+	std::lock_guard<std::mutex> lock(variant_mutex);
+
+	int count = 0;
+
+	for (size_t i = 0; i < variant_cache.size() && count < capacity; i++) {
+		if (variant_cache[i].key.kind == kind) {
+			keys[count++] = variant_cache[i].key;
+		}
+	}
+
+	return count;
+}
+
+int variants_count(void) {
+	std::lock_guard<std::mutex> lock(variant_mutex);
+	return (int) variant_cache.size();
+}
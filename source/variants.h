@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * Specialized shader variants.
+ * A variant is a program kind, a set of feature bits and a few constants. Its defines go in right after the #version line, so shader
+ *	sources can #if whole stages out and use the constants as literals instead of uniforms. Every program built is kept in a cache keyed on
+ *	all of that, so switching variants at runtime (say, the first attractor appearing) is a lookup and only the first switch compiles.
+ *
+ * The same feature bits pick the CPU engine's kernel instantiation (see cpu_engine.cpp), VARIANT_CPU_FEATURES are the ones it looks at.
+ */
+
+enum {
+	VARIANT_ADVANCE = 0,
+	VARIANT_RENDER,
+	VARIANT_KINDS
+};
+
+#define VARIANT_ATTRACTORS (1u << 0) // The attractor list isn't empty.
+#define VARIANT_FIELD (1u << 1)
+#define VARIANT_NEIGHBORS (1u << 2)
+#define VARIANT_BOUNDS_WRAP (1u << 3) // Particles leaving one side come back in on the other, instead of bouncing off.
+#define VARIANT_NBODY (1u << 4)
+#define VARIANT_SCENE_MOUSE (1u << 5) // The mouse is down over some scene.
+#define VARIANT_SCENE_FOLDED (1u << 6) // A single scene, its bounds and motion constants are literals.
+#define VARIANT_CULLED (1u << 7) // Render from the cull list.
+#define VARIANT_VERLET (1u << 8) // Velocity Verlet instead of semi-implicit Euler.
+#define VARIANT_ADAPTIVE (1u << 9) // Verlet, split into as many substeps as each particle's acceleration calls for.
+#define VARIANT_ATTRIBUTES (1u << 10) // Render tinted, sized and sprited by the particle attributes, see attributes.h.
+
+#define VARIANT_CPU_FEATURES (VARIANT_ATTRACTORS | VARIANT_FIELD | VARIANT_NEIGHBORS | VARIANT_BOUNDS_WRAP)
+
+/* Integrators, see SHADER_ADVANCE_VS. Euler is what the advance always did, the others pick a variant. The CPU engine instantiates its
+ *	kernels per integrator rather than per bit. */
+enum {
+	INTEGRATOR_EULER = 0,
+	INTEGRATOR_VERLET,
+	INTEGRATOR_ADAPTIVE,
+	INTEGRATORS
+};
+
+unsigned int variants_integrator_features(int integrator);
+const char* variants_integrator_name(int integrator);
+
+#define VARIANT_MAX_CONSTANTS 8
+#define VARIANT_DEFINES_SIZE 1024
+
+/* Advance constants : SCENE_BOUNDS (vec4) in 0-3 and SCENE_MOTION (gravity, speed decay, bounce decay) in 4-6.
+ *	Render constants : PARTICLE_DIM in 0. */
+struct variant_key {
+	int kind;
+	unsigned int features;
+	float constants[VARIANT_MAX_CONSTANTS];
+};
+
+void variants_key(variant_key* key, int kind, unsigned int features); // Constants start out zero.
+void variants_defines(const variant_key* key, char* out, int size); // One #define per feature bit set, plus the kind's constants.
+
+/* The cache is shared between threads (the threaded simulation selects advance variants on its own). */
+unsigned int variants_find(const variant_key* key); // 0 if it hasn't been built.
+void variants_insert(const variant_key* key, unsigned int program);
+unsigned int variants_replace(const variant_key* key, unsigned int program); // Returns the program it had, 0 if it was inserted instead.
+int variants_keys(int kind, variant_key* keys, int capacity); // Every variant of kind built so far, up to capacity of them.
+int variants_count(void);